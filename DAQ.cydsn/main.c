@@ -1,2272 +1,3360 @@
-/* ========================================
- *
- * Robert P. Johnson
- * Copyright U.C. Santa Cruz, 2020
- * All Rights Reserved
- * UNPUBLISHED, LICENSED SOFTWARE.
- *
- * CONFIDENTIAL AND PROPRIETARY INFORMATION
- * WHICH IS THE PROPERTY OF U.C. Santa Cruz.
- *
- * Code to run in the Event PSOC on the AESOP-Lite DAQ board.
- *
- * ========================================
-*/
-#include "project.h"
-#include <stdlib.h>
-#include <stdio.h>
-#include <string.h>
-#include <stdbool.h>
-
-#define VERSION 1
-
-/*=========================================================================
- *
- * Calibration/PMT input connections, from left to right looking down at the end of the DAQ board:
- *              T3        G        T4        T1        T2
- * Connector  J10/12    J2/11    J17/18    J15/16    J25/26
- * Peak det.   p4[3]    p4[7]     p3[0]     p0[7]     p3[4]
- * Schem pin   11         17       13         7        20
- * ADC          2          2        1         2         1
- * ADC Chan     2          1        1         0         0
- * Preamp      p4[6]    p3[2]     p3[3]     p4[5]      p2[0]
- * Schem pin    9         16       15        14        19
- * Channel      2          1        4         3         5 
- * TOF                              2         1   
- * Trig bit     1         N/A       0         3         2
- *
- * The 4 PSOC DACs are labeled by channel number.
- * Note that T2 is the channel with the external 12-bit DAC for setting its threshold. The digital signal goes to p2[0].
- * T1 and T4 are connected to the two channels that go to the TOF chip.
- * The guard signal, G, does not participate in the trigger logic but is discriminated and registered in the data.
- *
- *  Event output format:
- *  Header "ZERO" in ASCII (5A, 45, 52, 4F)
- *  Event Header:
- *      - Run number 2 bytes
- *      - Event number 4 bytes (counts accepted triggers)
- *      - Trigger time stamp 4 bytes
- *      - Trigger count (including deadtime) 4 bytes
- *      - real time and date 4 bytes
- *      - Trigger status word 1 byte               
- *  PHA Data:
- *      - T1 2 bytes
- *      - T2 2 bytes
- *      - T3 2 bytes
- *      - T4 2 bytes
- *      - Guard 2 bytes
- *      - extra channel 2 bytes (can be removed once not needed)
- *  TOF Data:
- *      Time difference in units of 10 ps, 2 bytes, signed integer
- *  Tracker trigger count 2 bytes
- *  Tracker command count 1 byte
- *  Tracker trigger pattern 1 byte
- *  TOF debugging data 10 bytes (can be removed once not needed)
- *  Number of tracker boards 1 byte
- *  Tracker Data
- *  Trailer "FINI" in ASCII (46, 49, 4e, 49)
- *
- *  The Event PSOC can take commands from the USB-UART or main PSOC UART.    
- *    Each command is formatted as "S1234<sp>xyW" repeated 3 times, followed by <cr><lf>
- *    where 1234 are 4 ASCII characters, each representing a nibble 
- *    12 gives us the data byte and 34 the address byte             
- *    data byte: {7:0} gives the command code                 
- *    address byte: {7:6} and {1:0] give the number of data-byte "commands" to follow, 0 to 15
- *                  {5:2} = 0x8 indicate the event PSOC        
- *    All data arrive in up to 15 subsequent data-byte "commands" For those,
- *    bits {7:0} of the command byte are the data for the command in progress
- *    bits {7:6} and {1:0} give the data-byte number, 1 through 15
- *    Subsequent commands must wait until after the correct number of data bytes has arrived
- *
- *    The following commands are defined:
- *    Byte Code    Number Data Bytes            Data Byte Definition
- */
-/* I2C mode */
-#define ACK  (1u)
-#define NACK (0u)
-#define I2C_READ (1u)
-#define I2C_WRITE (0u)
-
-/* Default DAC threshold setting */
-#define THRDEF (5u)
-
-/* Timeout in 5 millisecond units when waiting for command completion */
-#define TIMEOUT 200u 
-
-/* Packet IDs */
-#define FIX_HEAD ('\xDB')
-#define VAR_HEAD ('\xDC')
-
-#if defined (__GNUC__)
-    /* Add an explicit reference to the floating point printf library */
-    /* to allow the usage of floating point conversion specifiers. */
-    /* This is not linked in by default with the newlib-nano library. */
-    asm (".global _printf_float");
-#endif
-
-#define FIFO_LEN 100
-#define MXERR 64
-#define MAX_CMD_DATA 16
-#define TOFSIZE 17
-#define TKRHOUSE_LEN 70
-#define TOFMAX_EVT 64
-#define MAX_TKR_BOARDS 8
-#define MAX_TKR_BOARD_BYTES 203     // Two leading bytes, 12 bit header, 12 chips * (12-bit header and up to 10 12-bit cluster words) + CRC byte
-#define USBFS_DEVICE (0u)
-#define BUFFER_LEN  64u 
-#define MAX_DATA_OUT 256
-#define MXERR 64
-#define SPI_OUTPUT 0u
-#define USBUART_OUTPUT 1u
-#define CALMASK 1u
-#define DATAMASK 2u
-#define TRIGMASK 3u
-
-#define ERR_DAC_LOAD 1u
-#define ERR_DAC_READ 2u 
-#define ERR_TOF_DAC_LOAD 3u
-#define ERR_TOF_DAC_READ 4u
-#define ERR_CMD_IGNORE 5u
-#define ERR_TKR_READ_TIMEOUT 6u
-#define ERR_TKR_BAD_ID 7u
-#define ERR_TKR_BAD_LENGTH 8u
-#define ERR_TKR_BAD_ECHO 9u
-#define ERR_GET_TKR_DATA 10u
-#define ERR_TKR_BAD_FPGA 11u
-#define ERR_TKR_BAD_TRAILER 12u
-#define ERR_TKR_BAD_NDATA 13u
-#define ERR_PMT_DAQ_TIMEOUT 14u
-#define ERR_TKR_NUM_BOARDS 15u
-#define ERR_TKR_BAD_BOARD_ID 16u
-#define ERR_TKR_BOARD_SHORT 17u
-#define ERR_TKR_NO_MEMORY 18u
-#define ERR_TX_FAILED 19u
-#define ERR_BAD_CMD 20u
-#define ERR_EVT_TOO_BIG 21u
-#define ERR_BAD_BYTE 22u
-#define ERR_TKR_BAD_STATUS 23u
-#define ERR_TKR_TRG_ENABLE 24u
-#define ERR_TKR_BAD_TRGHEAD 25u
-
-#define TKR_READ_TIMEOUT 31u    // Length of time to wait before giving a time-out error
-
-//added for new cmd buffer parsing -Brian Lucas
-#define WRAPINC(a,b) ((a + 1) % (b)) //Macro to increment an index a around a circular buffer of size b  
-#define WRAP(a,b) ((a) % (b)) //Macro to bring new calculated index a into the bounds of a circular buffer of size b
-
-uint8 bufferRead = 0; //index of byte to read circular raw ASCII buffer of commands -Brian
-uint8 bufferWrite = 0; //index of byte to write circular raw ASCII buffer of commands, if read = write then empty
-
-uint8 nDataReady;
-uint8 dataOut[MAX_DATA_OUT];      // Buffer for output data
-uint16 tkrCmdCount;               // Command count returned from the Tracker
-uint8 tkrCmdCode;                 // Command code echoed from the Tracker
-
-// Register pointers for the power monitoring chips
-const uint8 INA226_Config_Reg = 0x00;
-const uint8 INA226_ShuntV_Reg = 0x01;
-const uint8 INA226_BusV_Reg = 0x02;
-const uint8 INA226_Power_Reg = 0x03;
-const uint8 INA226_Current_Reg = 0x04;
-const uint8 INA226_Calib_Reg = 0x05;
-const uint8 INA226_Mask_Reg = 0x06;
-const uint8 INA226_Alert_Reg = 0x07;
-
-const uint8 I2C_Address_TMP100 = '\x48';
-const uint8 TMP100_Temp_Reg = '\x00';
-const uint8 I2C_Address_Barometer = '\x70';
-const uint8 I2C_Address_RTC = '\x6F';
-
-// Masks for DC control register
-const uint8 LED1 = '\x08';
-const uint8 LED2 = '\x10';
-const uint8 RSTPEAK = '\x10';
-const uint8 TKRLED = '\x20'; 
-const uint8 DATLED = '\x40';
-
-#define trgBit_T4 = 0x01;
-#define trgBit_T3 = 0x02;
-#define trgBit_T2 = 0x04;
-#define trgBit_T1 = 0x08;
-
-/* Bit definitions for the pulse control register */
-#define PULSE_TOF_RESET 0x01
-#define PULSE_TKR_TRIG 0x02
-#define PULSE_LOGIC_RST 0x04
-#define PULSE_CNTR_RST 0x08
-
-// Slave addresses for the SPI interface
-const uint8 SSN_TOF = 2;
-const uint8 SSN_Main = 1;
-
-const uint8 triggerEnable_Mask = '\x04';
-const uint8 SSN_Mask = '\xFC';
-
-// Command codes for the TOF chip
-const uint8 TOF_enable = 0x18;
-const uint8 powerOnRESET = 0x30;
-const uint8 writeConfig = 0x80;
-const uint8 readConfig = 0x40;
-const uint8 readResults =  0x60;
-
-RTC_1_TIME_DATE* timeDate;
-
-// TOF circular data buffers
-struct TOF {
-    uint32 shiftReg[TOFMAX_EVT];
-    uint16 clkCnt[TOFMAX_EVT];
-    bool filled[TOFMAX_EVT];
-    uint8 ptr;
-} tofA, tofB;
-bool outputTOF;
-uint32 tofA_sampleArray[3] = {0};
-uint32 tofB_sampleArray[3] = {0};
-
-// Temporary storage of Tracker housekeeping data
-uint8 nTkrHouseKeeping;
-uint8 tkrHouseKeepingFPGA;
-uint8 tkrHouseKeepingCMD;
-uint8 tkrHouseKeeping[TKRHOUSE_LEN];
-
-uint32 timeStamp;
-uint8 trgStatus;
-bool triggered;
-
-struct TkrData {
-    uint16 triggerCount;
-    uint8 cmdCount;
-    uint8 trgPattern;              // bit 7 = non-bending; bit 6 = bending
-    uint8 nTkrBoards;              // number of boards read out
-    struct BoardHits {
-        uint8 nBytes;              // number of bytes in the hit list
-        uint8* hitList;            // pointer to the variable length hit list
-    } boardHits[MAX_TKR_BOARDS];
-} tkrData;
-
-struct Error {
-    uint8 errorCode;
-    uint8 value0;
-    uint8 value1;
-} errors[MXERR];
-uint8 nErrors = 0;
-
-uint32 clkCnt;
-uint32 time() {
-    //uint8 cnt200val = Counter_1_ReadCounter();
-    uint8 cnt200val = Cntr8_Timer_ReadCount();
-    return clkCnt + cnt200val;
-}
-
-char8 *parity[] = { "None", "Odd", "Even", "Mark", "Space" };
-char8 *stop[] = { "1", "1.5", "2" };
-
-uint16 ch1Count, ch1CountSave;
-uint16 ch2Count, ch2CountSave;
-uint16 ch3Count, ch3CountSave;
-uint16 ch4Count, ch4CountSave;
-uint16 ch5Count, ch5CountSave;
-uint8 ch1CtrSave, ch2CtrSave, ch3CtrSave, ch4CtrSave, ch5CtrSave;
-uint32 cntGO;
-uint32 cntGO1;
-uint16 runNumber;
-
-/* Defines for DMA_1 and DMA_2 */
-#define DMA_BYTES_PER_BURST 2
-#define DMA_REQUEST_PER_BURST 1
-#define DMA_NO_OF_SAMPLES 3
-#define DMA_SRC_BASE (CYDEV_PERIPH_BASE)
-#define DMA_DST_BASE (CYDEV_SRAM_BASE)
-
-void LED2_OnOff(bool on) {
-    uint8 status = Control_Reg_SSN_Read() & ~LED2;
-    if (on) {
-        Control_Reg_SSN_Write(status | LED2);
-    } else {
-        Control_Reg_SSN_Write(status);
-    }
-}
-
-void addError(uint8 code, uint8 val1, uint8 val2) {
-    if (nErrors < MXERR) {
-        errors[nErrors].errorCode = code;
-        errors[nErrors].value0 = val1;
-        errors[nErrors].value1 = val2;
-        nErrors++;
-    }
-}
-
-// Load a single I2C byte register
-uint8 loadI2Creg(uint8 I2C_Address, uint8 regAddress, uint8 regValue) {
-
-    // Send the start byte, with address
-    uint8 rc = I2C_2_MasterSendStart(I2C_Address,I2C_WRITE);
-    if (rc != I2C_2_MSTR_NO_ERROR) return rc;
-    
-    // Send the register address
-    rc = I2C_2_MasterWriteByte(regAddress);
-    if (rc != I2C_2_MSTR_NO_ERROR) return rc;
-    
-    // Send the register value
-    rc = I2C_2_MasterWriteByte(regValue);
-    if (rc != I2C_2_MSTR_NO_ERROR) return rc;
-    
-    // Send the stop condition
-    rc = I2C_2_MasterSendStop();
-    if(rc != I2C_2_MSTR_NO_ERROR) return rc;
-    
-    /* Wait for the data transfer to complete */
-    rc = I2C_2_MasterStatus();
-    if (rc != I2C_2_MSTAT_CLEAR) {
-        while(I2C_2_MasterStatus() == I2C_2_MSTAT_XFER_INP) CyDelay(100);
-    }  
-    
-    return 0;    
-}
-
-// Read bytes from an I2C chip register
-uint8 readI2Creg(int nBytes, uint8 I2C_Address, uint8 regAddress, uint8 regValue[]) {
-   
-    // Send the start byte, with address and control set to write
-    uint8 rc = I2C_2_MasterSendStart(I2C_Address,I2C_WRITE);
-    if (rc != I2C_2_MSTR_NO_ERROR) return rc;
-    
-    // Send the register address
-    rc = I2C_2_MasterWriteByte(regAddress);
-    if (rc != I2C_2_MSTR_NO_ERROR) return rc;
-
-    // Send the stop condition
-    rc = I2C_2_MasterSendStop();
-    if(rc != I2C_2_MSTR_NO_ERROR) return rc;    
-
-    // Wait for the data transfer to complete 
-    rc = I2C_2_MasterStatus();
-    if (rc != I2C_2_MSTAT_CLEAR) {
-        while(I2C_2_MasterStatus() == I2C_2_MSTAT_XFER_INP) CyDelay(100);
-    }      
-    
-    // Send the start byte, with address and control set to read
-    rc = I2C_2_MasterSendStart(I2C_Address,I2C_READ);
-    if (rc != I2C_2_MSTR_NO_ERROR) return rc;
-    
-    for (int i=0; i<nBytes-1; ++i) {
-        regValue[i] = I2C_2_MasterReadByte(ACK);
-    }
-    regValue[nBytes-1] = I2C_2_MasterReadByte(NACK);
-        
-    // Send the stop condition
-    rc = I2C_2_MasterSendStop();
-    if(rc != I2C_2_MSTR_NO_ERROR) return rc;
-    
-    /* Wait for the data transfer to complete */
-    rc = I2C_2_MasterStatus();
-    if (rc != I2C_2_MSTAT_CLEAR) {
-        while(I2C_2_MasterStatus() == I2C_2_MSTAT_XFER_INP) CyDelay(100);
-    }  
-    
-    return 0;    
-}
-
-// Load the AD5622 DAC
-uint8 loadDAC(uint8 I2C_Address, uint16 voltage) {
-    
-    uint8 nib0 = (voltage & 0x00FF);
-    uint8 nib1 = (voltage & 0x0F00)>>8;
-    
-    uint8 rc;
-    
-    rc = I2C_2_MasterSendStart(I2C_Address,I2C_WRITE);
-    if (rc != I2C_2_MSTR_NO_ERROR) return rc;
-    
-    rc = I2C_2_MasterWriteByte(nib1);
-    if (rc != I2C_2_MSTR_NO_ERROR) return rc;
-    
-    rc = I2C_2_MasterWriteByte(nib0);
-    if(rc != I2C_2_MSTR_NO_ERROR) return rc;
-    
-    rc = I2C_2_MasterSendStop();
-    if(rc != I2C_2_MSTR_NO_ERROR) return rc;
-    
-    /* Wait for the data transfer to complete */
-    rc = I2C_2_MasterStatus();
-    if (rc != I2C_2_MSTAT_CLEAR) {
-        while(I2C_2_MasterStatus() == I2C_2_MSTAT_XFER_INP) CyDelay(100);
-    }  
-    
-    return 0;
-} // end of loadDAC
-
-// Read back the setting from the AD5622 DAC and return it
-uint8 readDAC(uint8 I2C_Address, uint16* rvalue) {
-           
-    uint8 bytes[2];
-    //I2C_2_MasterClearReadBuf();
-    //uint8 rc = I2C_2_MasterReadBuf(I2C_Address, bytes, 2, I2C_2_MODE_COMPLETE_XFER);
-    uint8 rc = I2C_2_MasterSendStart(I2C_Address,I2C_READ);
-    if (rc != I2C_2_MSTR_NO_ERROR) return rc;    
-
-    bytes[0] = I2C_2_MasterReadByte(ACK);
-    bytes[1] = I2C_2_MasterReadByte(NACK);
-
-    rc = I2C_2_MasterSendStop();
-    if (rc != I2C_2_MSTR_NO_ERROR) return rc;
-
-    *rvalue = ((uint16)(bytes[0] & '\x3F'))<<6;
-    *rvalue = *rvalue | ((uint16)(bytes[1] & '\xFC')>>2);
-    
-    rc = I2C_2_MasterStatus();    
-    if (rc != I2C_2_MSTAT_CLEAR) {
-        while(I2C_2_MasterStatus() == I2C_2_MSTAT_XFER_INP) CyDelay(100);
-    } 
-    return 0;
-}
-
-bool isTriggerEnabled() {
-    uint8 regValue = Control_Reg_SSN_Read();
-    return (regValue & triggerEnable_Mask);
-}
-
-void setPeakDetResetWait(uint8 waitTime) {
-    Count7_3_WritePeriod(waitTime);
-}
-
-void setTriggerMask(char trigger, uint8 mask) {
-    mask = mask & 0x0F;
-    if (trigger == 'e') {
-        Control_Reg_Trg1_Write(mask);
-    } else if (trigger == 'p') {
-        Control_Reg_Trg2_Write(mask);
-    }
-}
-
-uint8 getTriggerMask(char trigger) {
-    if (trigger == 'e') return Control_Reg_Trg1_Read();
-    else if (trigger == 'p') return Control_Reg_Trg2_Read();
-    return 0;
-}
-
-// Control of the SPI slave address. The slave select is active low.
-// Note that the TOF chip needs to go high, for reset, before each SPI transaction.
-void set_SPI_SSN(uint8 SSN, bool clearBuffer) {
-    // SSN = SSN_Main = 1 for main PSOC
-    // SSN = SSN_TOF  = 2 for TOF chip
-    // SSN = 0 (or anything else) to deselect all slaves
-    while (!(SPIM_ReadTxStatus() & SPIM_STS_SPI_IDLE));
-    uint8 regValue = Control_Reg_SSN_Read() & SSN_Mask;
-    Control_Reg_SSN_Write(regValue | (SSN_Main | SSN_TOF));
-    if (SSN == SSN_TOF) {
-        Control_Reg_SSN_Write(regValue | SSN_Main);
-    } else if (SSN == SSN_Main) {
-        Control_Reg_SSN_Write(regValue | SSN_TOF);
-    }
-    if (clearBuffer) SPIM_ClearTxBuffer();
-}
-
-// Control of the trigger enable bit
-void triggerEnable(bool enable) {
-    uint8 regValue = Control_Reg_SSN_Read() & ~triggerEnable_Mask;
-    if (enable) {
-        // Reset the TOF chip time reference. It also gets reset every 5 ms by interrupt.
-        //Control_Reg_Pls_Write(PULSE_TOF_RESET);
-        
-        // Enable both TOF chip channels
-        //set_SPI_SSN(SSN_TOF, true);
-        //SPIM_WriteTxData(writeConfig+1);
-        //SPIM_WriteTxData(0x05);
-        
-        // Enable the master trigger
-        Control_Reg_SSN_Write(regValue | triggerEnable_Mask);  
-    } else {
-        //LED2_OnOff(false);
-        // Disable the master trigger
-        Control_Reg_SSN_Write(regValue);
-        
-        // Stop the TOF chip acquisition by disabling both channels
-        //set_SPI_SSN(SSN_TOF, true);
-        //SPIM_WriteTxData(writeConfig+1);
-        //SPIM_WriteTxData(0x00);
-    }
-}
-
-uint8 byte32(uint32 word, int byte) {
-    const uint32 mask[4] = {0xFF000000, 0x00FF0000, 0x0000FF00, 0x000000FF};
-    return (uint8)((word & mask[byte]) >> (3-byte)*8);
-}
-uint8 byte16(uint16 word, int byte) {
-    const uint16 mask[2] = {0xFF00, 0x00FF};
-    return (uint8)((word & mask[byte]) >> (1-byte)*8);
-}
-
-void logicReset() {
-    //LED2_OnOff(true);
-    int state = isr_clk200_GetState();
-    isr_clk200_Disable();
-    int stateTrg = isr_GO1_GetState();
-    isr_GO1_Disable();
-    clkCnt = 0;             
-    ch1Count = 0;
-    ch2Count = 0;
-    ch3Count = 0;
-    ch4Count = 0;
-    ch5Count = 0;
-    cntGO = 0;
-    cntGO1 = 0;
-    Control_Reg_Pls_Write(PULSE_LOGIC_RST);
-    Control_Reg_Pls_Write(PULSE_CNTR_RST);
-    CyDelay(20);
-    if (stateTrg) isr_GO1_Enable();
-    if (state) isr_clk200_Enable();
-    //LED2_OnOff(false);
-    for (int brd=0; brd<MAX_TKR_BOARDS; ++brd) {
-        if (tkrData.boardHits[brd].nBytes > 0) {
-            tkrData.boardHits[brd].nBytes = 0;
-            free(tkrData.boardHits[brd].hitList);
-        }
-    }
-}
-
-// Get a byte of data from the Tracker UART, with a time-out in case nothing is coming.
-// The second argument (flag) helps to identify where a timeout error originated.
-uint8 tkr_getByte(uint32 startTime, uint8 flag) {
-    while (!(UART_TKR_ReadRxStatus() & UART_TKR_RX_STS_FIFO_NOTEMPTY)) {
-        uint32 timeElapsed = time() - startTime;
-        if (timeElapsed > TKR_READ_TIMEOUT) {
-            uint8 temp = (uint8)(timeElapsed & 0x000000ff);
-            addError(ERR_TKR_READ_TIMEOUT, temp, flag);
-            return 0x00;
-        }
-    }
-    return UART_TKR_ReadRxData();
-}
-
-// Function to receive ASIC register data from the Tracker
-void getASICdata() {
-    uint32 startTime = time();
-    nDataReady = tkr_getByte(startTime, 69);
-    dataOut[0] = nDataReady;
-    nDataReady++;
-    for (int i=1; i<nDataReady; ++i) {
-        startTime = time();
-        dataOut[i] = tkr_getByte(startTime, 70+i);
-    }
-}
-
-// Function to receive i2c register data from the Tracker
-void getTKRi2cData() {
-    uint32 startTime = time();
-    nDataReady = 4;
-    dataOut[0] = tkr_getByte(startTime, 0x89);
-    dataOut[1] = tkr_getByte(startTime, 0x90);
-    dataOut[2] = tkr_getByte(startTime, 0x91);
-    dataOut[3] = tkr_getByte(startTime, 0x92);
-}
-
-// Receive trigger-primitive and TOT data from the tracker, for calibration-pulse events only
-int getTrackerBoardTriggerData(uint8 FPGA) {
-    int rc = 0;
-    uint32 startTime = time();
-    // Ignore the first byte, which is rubbish (not sure why. . .)
-    uint8 theByte = tkr_getByte(startTime, 0x44);
-    // The first good byte received encodes the FPGA address, so we check it here:
-    theByte = tkr_getByte(startTime, 0x45);
-    uint8 fpgaRet = (theByte & 0x38)>>3;
-    if (fpgaRet != FPGA) {
-        addError(ERR_TKR_BAD_TRGHEAD, FPGA, fpgaRet);
-        rc = 1;
-    }
-    nDataReady = 9;   
-    dataOut[0] = theByte;
-    // Read in the other 8 bytes
-    for (int i=1; i<nDataReady; ++i) {
-        dataOut[i] = tkr_getByte(startTime, 0x46);
-    }
-    return rc;
-}
-
-// Function to get a full data packet from the Tracker.
-int getTrackerData() {
-    int rc = 0;
-    uint32 startTime = time();
-    uint8 len = tkr_getByte(startTime, 1);
-    uint8 IDcode = tkr_getByte(startTime, 2);
-    if (IDcode == 0xD3) {         // Event data
-        if (len != 5) {           // Formal check
-            addError(ERR_TKR_BAD_LENGTH, IDcode, len);
-            return 55;
-        }
-        tkrData.triggerCount = ((uint16)tkr_getByte(startTime, 3) & 0x00FF) << 8;
-        tkrData.triggerCount = tkrData.triggerCount | ((uint16)tkr_getByte(startTime, 4) & 0x00FF);
-        tkrData.cmdCount = tkr_getByte(startTime, 5);
-        uint8 nBoards = tkr_getByte(startTime, 6);
-        tkrData.trgPattern = nBoards & 0xC0;
-        nBoards = nBoards & 0x3F;
-        if (nBoards > MAX_TKR_BOARDS) {
-            addError(ERR_TKR_NUM_BOARDS, nBoards, tkrData.trgPattern);
-            nBoards = 0;
-        }
-        tkrData.nTkrBoards = nBoards;
-        for (int brd=0; brd < nBoards; ++brd) {
-            uint8 nBrdBytes = tkr_getByte(startTime, 7);  // Length of the hit list, in bytes
-            if (nBrdBytes < 4) {
-                addError(ERR_TKR_BOARD_SHORT, nBrdBytes, brd);
-                return 56;
-            }
-            uint8 IDbyte = tkr_getByte(startTime, 8);     // Hit list identifier, should always be 11100111
-            if (IDbyte != 0xE7) {
-                addError(ERR_TKR_BAD_BOARD_ID, IDbyte, brd);
-                return 58;
-            }
-            uint8 byte2 = tkr_getByte(startTime, 9);        // Byte containing the board address
-            if (byte2 > 8) {   // Formal check. Note that 8 denotes the master board, which really is layer 0
-                addError(ERR_TKR_BAD_FPGA, byte2, brd);
-            }
-            uint8 lyr = 0x7 & byte2;  // Get rid of the master bit, leaving just the layer number
-            if (nBrdBytes > MAX_TKR_BOARD_BYTES) {    // This really should never happen, due to ASIC 10-hit limit
-                tkrData.boardHits[lyr].nBytes = MAX_TKR_BOARD_BYTES;
-            } else {
-                tkrData.boardHits[lyr].nBytes = nBrdBytes;
-            }
-            tkrData.boardHits[lyr].hitList = (uint8*) malloc(nBrdBytes);
-            if (tkrData.boardHits[lyr].hitList == NULL) {
-                addError(ERR_TKR_NO_MEMORY, nBrdBytes-2, brd);
-                return 60;
-            }
-            tkrData.boardHits[lyr].hitList[0] = IDbyte;
-            tkrData.boardHits[lyr].hitList[1] = byte2;
-            for (int i=2; i<nBrdBytes; ++i) {
-                uint8 theByte = tkr_getByte(startTime, 10);
-                if (i<MAX_TKR_BOARD_BYTES) {       
-                    tkrData.boardHits[lyr].hitList[i] = theByte;
-                }
-            }
-        }
-    } else if (IDcode == 0xC7) {  // Housekeeping data
-        uint8 nData = tkr_getByte(startTime, 11);
-        if (len != nData+6) {   // Formal check
-            addError(ERR_TKR_BAD_NDATA, len, nData);
-        }
-        tkrCmdCount = (uint16)(tkr_getByte(startTime, 12)) << 8;
-        tkrCmdCount = (tkrCmdCount & 0xFF00) | (uint16)tkr_getByte(startTime, 13);
-        tkrHouseKeepingFPGA = tkr_getByte(startTime, 14);
-        if (tkrHouseKeepingFPGA > 8) {   // Formal check
-            addError(ERR_TKR_BAD_FPGA, tkrCmdCode, tkrHouseKeepingFPGA);
-        }
-        uint8 tkrHouseKeepingCMD = tkr_getByte(startTime, 15);
-        if (tkrHouseKeepingCMD != tkrCmdCode) {   // Formal check
-            addError(ERR_TKR_BAD_ECHO, tkrHouseKeepingCMD, tkrCmdCode);
-        }
-        nTkrHouseKeeping = 0;      // Overwrite any old data, even if it was never sent out.
-        for (int i=0; i<nData; ++i) {
-            uint8 tmpData = tkr_getByte(startTime, 16);
-            if (i < TKRHOUSE_LEN) {
-                tkrHouseKeeping[i] = tmpData;
-                nTkrHouseKeeping++;
-            }
-        }
-        if (tkrHouseKeeping[nTkrHouseKeeping-1] != 0x0F) {    // Formal check
-            addError(ERR_TKR_BAD_TRAILER, tkrCmdCode, tkrHouseKeeping[nTkrHouseKeeping-1]);           
-        }
-    } else if (IDcode == 0xF1) {  // Command Echo
-        if (len != 4) {           // Formal check
-            addError(ERR_TKR_BAD_LENGTH, IDcode, len);
-        }
-        nDataReady = 3;
-        dataOut[0] = tkr_getByte(startTime, 17);
-        tkrCmdCount = (uint16)dataOut[0] << 8;
-        dataOut[1] = tkr_getByte(startTime, 18);
-        tkrCmdCount = (tkrCmdCount & 0xFF00) | dataOut[1];
-        uint8 tkrCmdCodeEcho = tkr_getByte(startTime, 19);
-        dataOut[2] = tkrCmdCodeEcho;
-        if (tkrCmdCode != tkrCmdCodeEcho) {
-            addError(ERR_TKR_BAD_ECHO, tkrCmdCodeEcho, tkrCmdCode);
-            rc = 1;
-        }
-    } else {    // WTF?!?   Not sure what to do with this situation, besides flag it.
-        if (nErrors < MXERR) {
-            addError(ERR_TKR_BAD_ID, IDcode, len);
-        }
-        nDataReady = len;
-        if (len > 15) len = 15;
-        for (int i=0; i<nDataReady; ++i) {
-            dataOut[i] = tkr_getByte(startTime,20+i);
-        }       
-    }
-    return rc;
-}
-
-CY_ISR(Store_A)
-{
-    if (ShiftReg_A_GetIntStatus() == ShiftReg_A_STORE) {
-        while (ShiftReg_A_GetFIFOStatus(ShiftReg_A_OUT_FIFO) != ShiftReg_A_RET_FIFO_EMPTY) {
-            uint32 AT = ShiftReg_A_ReadData();
-            tofA.shiftReg[tofA.ptr] = AT;
-            tofA.clkCnt[tofA.ptr] = (uint16)time();
-            tofA.filled[tofA.ptr] = true;
-            tofA.ptr++;
-            if (tofA.ptr >= TOFMAX_EVT) tofA.ptr = 0;
-            if (outputTOF) {    
-                //LED2_OnOff(true);
-                //trgLEDoff = true;
-                uint8 oReg[7];
-                oReg[0] = 0xAA;
-                oReg[1] = (AT & 0x0000FF00)>>8;
-                oReg[2] =  AT & 0x000000FF;
-                oReg[3] = (AT & 0xFF000000)>>24;
-                oReg[4] = (AT & 0x00FF0000)>>16;            
-                uint16 clk16 = (uint16)time();
-                oReg[5] = (uint8)((clk16 & 0xFF00)>>8);
-                oReg[6] = (uint8)(clk16 & 0x00FF);             
-                //while(USBUART_CDCIsReady() == 0u);
-                USBUART_PutData(oReg,7);
-            }
-        }
-    }
-}
-
-CY_ISR(Store_B)
-{
-    if (ShiftReg_B_GetIntStatus() == ShiftReg_B_STORE) { 
-        while (ShiftReg_B_GetFIFOStatus(ShiftReg_B_OUT_FIFO) != ShiftReg_B_RET_FIFO_EMPTY) {
-            uint32 BT = ShiftReg_B_ReadData();
-            tofB.shiftReg[tofB.ptr] = BT;
-//            tofB.stop[tofB.ptr] = (uint16)(BT & 0x0000FFFF);
-//            tofB.ref[tofB.ptr] = (uint16)((BT & 0xFFFF0000)>>16);
-            tofB.clkCnt[tofB.ptr] = (uint16)time();
-            tofB.filled[tofB.ptr] = true;
-            tofB.ptr++;
-            if (tofB.ptr >= TOFMAX_EVT) tofB.ptr = 0;
-            if (outputTOF) {  
-                //LED2_OnOff(true);
-                Timer_1_Start();
-                uint8 oReg[7];
-                oReg[0] = 0xBB;
-                oReg[1] = (BT & 0x0000FF00)>>8;
-                oReg[2] =  BT & 0x000000FF;
-                oReg[3] = (BT & 0xFF000000)>>24;
-                oReg[4] = (BT & 0x00FF0000)>>16;
-                uint16 clk16 = (uint16)time();
-                oReg[5] = (uint8)((clk16 & 0xFF00)>>8);
-                oReg[6] = (uint8)(clk16 & 0x00FF);                  
-                //while(USBUART_CDCIsReady() == 0u);
-                USBUART_PutData(oReg,7);
-            }
-        }
-    }
-}
-
-CY_ISR(intTimer) {
-    uint8 status = Control_Reg_SSN_Read();
-    status = status & ~DATLED;
-    status = status & ~TKRLED;
-    //status = status & ~LED2;
-    Control_Reg_SSN_Write(status);
-    Timer_1_Stop();
-}
-
-CY_ISR(clk200) {  // Interrupt every second
-    clkCnt += 200;     // Increment the clock counter used for time stamps
-    uint8 status = Control_Reg_SSN_Read();
-    uint8 blink = status & LED1;
-    if (blink == 0x00) blink = LED1;
-    else blink = 0x00;
-    status = (status & ~LED1) | blink;
-    Control_Reg_SSN_Write(status);
-}
-
-CY_ISR(isrCh1)
-{
-    ch1Count++;
-}
-
-CY_ISR(isrCh2)
-{
-    ch2Count++;
-}
-
-CY_ISR(isrCh3)
-{
-    ch3Count++;
-}
-
-CY_ISR(isrCh4)
-{
-    ch4Count++;
-}
-
-CY_ISR(isrCh5)
-{
-    ch5Count++;
-}
-
-CY_ISR(isrGO1)    // GO signal (system trigger). Start the full event readout if trigger is enabled.
-{
-    if (isTriggerEnabled()) {
-        // Disable the trigger until the event readout has been completed
-        triggerEnable(false);
-        trgStatus = Status_Reg_Trg_Read();
-        cntGO++;
-        triggered = true;
-        timeStamp = time();
-        timeDate = RTC_1_ReadTime();
-        //LED2_OnOff(true);
-        Timer_1_Start();
-    }
-    cntGO1++;     // Count all GO signals during a run, even if the trigger is not enabled.
-    
-    // At this point execution returns to its normal flow, allowing other interrupts. The remainder of the
-    // event readout process is done in main(), in the infinite for loop.
-}
-
-void tkrLED(bool on) {
-    if (on) {
-        uint8 status = Control_Reg_SSN_Read() & ~TKRLED;
-        Control_Reg_SSN_Write(status | TKRLED);
-    } else {
-        Timer_1_Start();
-    }
-}
-
-void dataLED(bool on) {
-    uint8 status;
-    if (on) {
-        status = Control_Reg_SSN_Read() & ~DATLED;
-        Control_Reg_SSN_Write(status | DATLED);
-    } else {
-        Timer_1_Start();
-    }
-}
-
-void setCoincidenceWindow(uint8 dt) {
-    TrigWindow_V1_1_Count7_1_WritePeriod(dt);
-    TrigWindow_V1_2_Count7_1_WritePeriod(dt);
-    TrigWindow_V1_3_Count7_1_WritePeriod(dt);
-    TrigWindow_V1_4_Count7_1_WritePeriod(dt);
-    TrigWindow_V1_5_Count7_1_WritePeriod(dt);
-}
-
-int main(void)
-{     
-    triggered = false;
-    tkrData.nTkrBoards = 0;
-    tofA.ptr = 0;
-    tofB.ptr = 0;
-    outputTOF = false;
-    for (int i=0; i<TOFMAX_EVT; ++i) {
-        tofA.filled[i] = false;
-        tofB.filled[i] = false;
-    }
-    
-    nDataReady = 0;
-    clkCnt = 0;
-    nTkrHouseKeeping = 0;
-    
-    runNumber = 0;
-    timeStamp = time();
-    
-    uint8 buffer[BUFFER_LEN];  // Circular Buffer for incoming UART commands
-    uint8 code[256];  // ASCII code translation to hex nibbles
-    for (int i=0; i<256; ++i) code[i] = 0;
-    code[49] = 1;
-    code[50] = 2;
-    code[51] = 3;
-    code[52] = 4;
-    code[53] = 5;
-    code[54] = 6;
-    code[55] = 7;
-    code[56] = 8;
-    code[57] = 9;
-    code[65] = 10;
-    code[97] = 10;   // not case sensitive for ABCDEF
-    code[66] = 11;
-    code[98] = 11;
-    code[67] = 12;
-    code[99] = 12;
-    code[68] = 13;
-    code[100] = 13;
-    code[69] = 14;
-    code[101] = 14;
-    code[70] = 15;
-    code[102] = 15;
-    
-    // Buffer for output of a 3-byte data packet. Set the invariant parts of the header and trailer bytes.
-    uint8 dataPacket[9];
-    dataPacket[1] = '\x00';
-    dataPacket[2] = '\xFF';
-    dataPacket[6] = '\xFF';
-    dataPacket[7] = '\x00';
-    dataPacket[8] = '\xFF';
-    
-    // General hardware logic reset (not including the tracker), and reset of counters
-    logicReset();
-    
-    CyGlobalIntEnable; /* Enable global interrupts. */
-
-    /* Initialize interrupts */
-    isr_timer_StartEx(intTimer);
-    isr_clk200_StartEx(clk200);
-    isr_Store_A_StartEx(Store_A);
-    isr_Store_B_StartEx(Store_B);
-    isr_Ch1_StartEx(isrCh1);
-    isr_Ch2_StartEx(isrCh2);
-    isr_Ch3_StartEx(isrCh3);
-    isr_Ch4_StartEx(isrCh4);
-    isr_Ch5_StartEx(isrCh5);
-    isr_GO1_StartEx(isrGO1);   
-    
-    /* Start up the various hardware components */
-    I2C_2_Start();
-    
-    // Counters for loading TOF shift registers. The periods are set in the schematic and should never change!
-    Count7_1_Start();
-    Count7_2_Start();
-    
-    // Set up the counter used for timing. It counts a 200 Hz clock derived from the watch crystal, and every 200 counts
-    // i.e. once each second, it interrupts the CPU, which then increments a 1 Hz count. The time() function adds the two
-    // counts together to get a time tag that increments every 5 ms. Note that the main purpose of the 200 Hz clock is to
-    // send a hardware reset to the time-of-flight chip every 5 ms, so that we know exactly when its counting starts.
-    //Counter_1_Start();
-    //Counter_1_WritePeriod(199);  // Should count from 0 to 199, for a period of 200
-    //Counter_1_SetCaptureMode(Counter_1__B_COUNTER__SOFTWARE_CONTROL);
-    Cntr8_Timer_WritePeriod(199);
-    
-    // Counter for the delay time to wait before resetting the peak detectors.
-    Count7_3_Start();
-    // The peak detector output takes about 4us to settle down after its upward swing, so at 12MHz this should be at least 48 ticks to set
-    // the time to start digitizing. This also affects wait times to sent peak detector resets and start looking for new triggers.
-    setPeakDetResetWait(72);
-
-    // TOF shift registers
-    ShiftReg_A_Start();
-    ShiftReg_B_Start();
-    
-    SPIM_Start();
-    
-    uint8 outputMode = SPI_OUTPUT; //USBUART_OUTPUT;    
-    USBUART_Start(USBFS_DEVICE, USBUART_3V_OPERATION);
-    
-    Comp_Ch1_Start();
-    Comp_Ch2_Start();
-    Comp_Ch3_Start();
-    Comp_Ch4_Start();
-    
-    // Internal and external voltage DACs
-    uint8 thrDACsettings[] = {THRDEF, THRDEF, THRDEF, THRDEF};
-    VDAC8_Ch1_Start();
-    VDAC8_Ch1_SetValue(THRDEF);   // This is in DAC counts, 4 mV/bit
-    VDAC8_Ch2_Start();
-    VDAC8_Ch2_SetValue(THRDEF);
-    VDAC8_Ch3_Start();
-    VDAC8_Ch3_SetValue(THRDEF);
-    VDAC8_Ch4_Start();
-    VDAC8_Ch4_SetValue(THRDEF);
-    const uint8 I2C_Address_DAC_Ch5 = '\x0E';
-    loadDAC(I2C_Address_DAC_Ch5, 0x000F);
-    const uint8 I2C_Address_TOF_DAC1 = '\x0C';
-    loadDAC(I2C_Address_TOF_DAC1, 0x00FF);
-    const uint8 I2C_Address_TOF_DAC2 = '\x0F';
-    loadDAC(I2C_Address_TOF_DAC2, 0x00FF);
-    
-    ADC_SAR_1_Start();
-    ADC_SAR_2_Start();
-    ADC_DelSig_1_Start();
- 
-    UART_TKR_Start();
-    UART_CMD_Start();
-    int command = 0;
-    int dCnt = 0;
-
-    // Start counters buried inside of the edge detectors for the trigger inputs
-    TrigWindow_V1_1_Count7_1_Start();
-    TrigWindow_V1_2_Count7_1_Start();
-    TrigWindow_V1_3_Count7_1_Start();
-    TrigWindow_V1_4_Count7_1_Start();
-    TrigWindow_V1_5_Count7_1_Start();
-    setCoincidenceWindow(12);
-    
-    // Start the internal real-time-clock component
-    RTC_1_Start();
-    
-    // Configure the i2c Real-Time-Clock if that bus extends to the event PSOC (normally not)
-    //loadI2Creg(I2C_Address_RTC, 0x00, 0x59);
-    //loadI2Creg(I2C_Address_RTC, 0x07, 0x80);     
-    
-    /* Variable declarations for DMA_1 */
-    uint8 DMA_1_Chan;
-    uint8 DMA_1_TD[1];  
-    uint16 adc1_sampleArray[3] = {0};
-
-    /* Variable declarations for DMA_2 */
-    uint8 DMA_2_Chan;
-    uint8 DMA_2_TD[1];   
-    uint16 adc2_sampleArray[3] = {0};
-            
-    /* DMA Configuration for DMA_1 SAR ADC */
-    DMA_1_Chan = DMA_1_DmaInitialize(DMA_BYTES_PER_BURST, DMA_REQUEST_PER_BURST, 
-                 HI16(DMA_SRC_BASE), HI16(DMA_DST_BASE));
-    DMA_1_TD[0] = CyDmaTdAllocate();
-    CyDmaTdSetConfiguration(DMA_1_TD[0], DMA_BYTES_PER_BURST*DMA_NO_OF_SAMPLES, DMA_1_TD[0], 
-                                 DMA_1__TD_TERMOUT_EN | CY_DMA_TD_INC_DST_ADR);
-    CyDmaTdSetAddress(DMA_1_TD[0], LO16((uint32)ADC_SAR_1_SAR_WRK0_PTR), LO16((uint32)adc1_sampleArray));
-    CyDmaChSetInitialTd(DMA_1_Chan, DMA_1_TD[0]);
-    CyDmaChEnable(DMA_1_Chan, 1);             /* Enable the DMA channel for the ADC */
-    
-    /* DMA Configuration for DMA_2 SAR ADC */
-    DMA_2_Chan = DMA_2_DmaInitialize(DMA_BYTES_PER_BURST, DMA_REQUEST_PER_BURST, 
-                 HI16(DMA_SRC_BASE), HI16(DMA_DST_BASE));
-    DMA_2_TD[0] = CyDmaTdAllocate();
-    CyDmaTdSetConfiguration(DMA_2_TD[0], DMA_BYTES_PER_BURST*DMA_NO_OF_SAMPLES, DMA_2_TD[0], 
-                                 DMA_1__TD_TERMOUT_EN | CY_DMA_TD_INC_DST_ADR);
-    CyDmaTdSetAddress(DMA_2_TD[0], LO16((uint32)ADC_SAR_2_SAR_WRK0_PTR), LO16((uint32)adc2_sampleArray));
-    CyDmaChSetInitialTd(DMA_2_Chan, DMA_2_TD[0]);
-    CyDmaChEnable(DMA_2_Chan, 1);             /* Enable the DMA channel for the ADC */
-    
-    // Variable declarations for DMA_3,4 
-    /*
-    #define TOF_DMA_BYTES_PER_BURST 4
-    #define TOF_DMA_REQUEST_PER_BURST 1
-    #define TOF_DMA_NO_OF_SAMPLES 1
-    uint8 DMA_3_Chan;
-    uint8 DMA_3_TD[1];   
-    uint8 DMA_4_Chan;
-    uint8 DMA_4_TD[1];   
-
-    // DMA Configuration for TOF shift register A 
-    DMA_3_Chan = DMA_3_DmaInitialize(TOF_DMA_BYTES_PER_BURST, TOF_DMA_REQUEST_PER_BURST, 
-                 HI16(DMA_SRC_BASE), HI16(DMA_DST_BASE));
-    DMA_3_TD[0] = CyDmaTdAllocate();
-    CyDmaTdSetConfiguration(DMA_3_TD[0], TOF_DMA_BYTES_PER_BURST*TOF_DMA_NO_OF_SAMPLES, DMA_3_TD[0], 
-                                 DMA_3__TD_TERMOUT_EN | CY_DMA_TD_INC_DST_ADR);
-    CyDmaTdSetAddress(DMA_3_TD[0], LO16((uint32)ShiftReg_A_OUT_FIFO_VAL_LSB_PTR), LO16((uint32)tofA_sampleArray));
-    CyDmaChSetInitialTd(DMA_3_Chan, DMA_3_TD[0]);
-    CyDmaChEnable(DMA_3_Chan, 1);        
-    
-    // DMA Configuration for TOF shift register B 
-    DMA_4_Chan = DMA_4_DmaInitialize(TOF_DMA_BYTES_PER_BURST, TOF_DMA_REQUEST_PER_BURST, 
-                 HI16(DMA_SRC_BASE), HI16(DMA_DST_BASE));
-    DMA_4_TD[0] = CyDmaTdAllocate();
-    CyDmaTdSetConfiguration(DMA_4_TD[0], TOF_DMA_BYTES_PER_BURST*TOF_DMA_NO_OF_SAMPLES, DMA_4_TD[0], 
-                                 DMA_4__TD_TERMOUT_EN | CY_DMA_TD_INC_DST_ADR);
-    CyDmaTdSetAddress(DMA_4_TD[0], LO16((uint32)ShiftReg_B_OUT_FIFO_VAL_LSB_PTR), LO16((uint32)tofB_sampleArray));
-    CyDmaChSetInitialTd(DMA_4_Chan, DMA_4_TD[0]);
-    CyDmaChEnable(DMA_4_Chan, 1);        
-    */
-    // Default configuration of the TOF chip. The second byte should be 0x05 for stop events to be accepted.
-    // That is not normally turned on here by default, but rather is turned on when the master trigger is enabled.
-    // The reference clock is 12 MHz, which has a period of 83333 picoseconds. With 16 bits it will count up to
-    // about 5.46 milliseconds. We reset it every 5 milliseconds, so it should only get up to a count of 60,000
-    // which is EA60 in hex. We set the LSB by dividing the reference clock period by 8333, which is ~10ps.
-    // Only 14 bit are needed, then, for the stop clocks, but 16 bits are read out. The maximum stop-clock count
-    // should be 8333, or hex 208D.
-    // Addr0: B5  Make active STOPA, STOPB, REFCLK, LVDS LCLK & LCLKOUT, Ref clk reset
-    // Addr1: 05  Activate A and B top inputs; no channel combine; standard resolution
-    // Addr2: 0C  Ref and Stop both set to 16 bits; single data rate, no common read, std FIFO
-    // Addr3: 8D  Ref Clk divisions = 00208D = 8333 which sets the LSB to be 10 picoseconds with a 12 MHz reference clock
-    // Addr4: 20  Ref Clk divisions
-    // Addr5: 00  Ref Clk divisions
-    // Addr6: 00  Normal LVDS operation; no test pattern
-    // Addr7: 08  0ps LVDS adjustment
-    // Addr8 through 15 are defaults
-    // Addr16 00  Differential LVDS input
-    uint8 tofConfig[TOFSIZE] = {0xB5, 0x05, 0x0C, 0x8D, 0x20, 0x00, 0x00, 0x08, 0xA1, 0x13, 0x00,
-                         0x0A, 0xCC, 0xCC, 0xF1, 0x7D, 0x00};
-    
-    // Set up the configuration of the TOF chip AS6501:
-    SPIM_ClearTxBuffer();
-    SPIM_ClearRxBuffer();
-
-    set_SPI_SSN(SSN_TOF, true);
-    SPIM_WriteTxData(powerOnRESET);
-    CyDelay(1);
-
-    // Set up the default AS6501 TOF configuration
-    set_SPI_SSN(SSN_TOF, true);
-    SPIM_WriteTxData(writeConfig);
-    for (int i=0; i<TOFSIZE; ++i) {
-        SPIM_WriteTxData(tofConfig[i]);
-    }
-    CyDelay(1);
-    
-    // Enable the TOF
-    set_SPI_SSN(SSN_TOF, true);
-    SPIM_WriteTxData(TOF_enable); 
-    
-    int cmdCountGLB = 0;               // Count of all command packets received
-    int cmdCount = 0;                  // Count of all event PSOC commands received
-    uint8 cmdData[MAX_CMD_DATA];       // Data sent with commands
-    int nCmdTimeOut = 0;
-    const uint8 eventPSOCaddress = '\x08';
-    
-    // Set up the default trigger configuration
-    Cntr8_V1_TKR_WritePeriod(255);    // Tracker trigger prescale
-    Cntr8_V1_PMT_WritePeriod(255);    // PMT hadron trigger prescale
-    setTriggerMask('e',0x01);
-    setTriggerMask('p',0x05);
-
-    // Enable interrupts and configure TOF shift register interrupt signals
-    isr_timer_Enable();
-    isr_clk200_Enable();
-    isr_Store_A_Enable();
-    ShiftReg_A_EnableInt();
-    ShiftReg_A_SetIntMode(ShiftReg_A_STORE_INT_EN);
-    isr_Store_B_Enable();
-    ShiftReg_B_EnableInt();
-    ShiftReg_B_SetIntMode(ShiftReg_B_STORE_INT_EN);    
-    isr_Ch1_Enable();
-    isr_Ch2_Enable();
-    isr_Ch3_Enable();
-    isr_Ch4_Enable();
-    isr_Ch5_Enable();
-    isr_GO1_Enable();
-    
-    bool eventDataReady = false;
-    bool awaitingCommand = true;
-    time_t cmdStartTime;
-    uint8 nDataBytes = 0;
-    uint8 rc;
-    bool cmdDone = false;
-    set_SPI_SSN(0, false);   // Deselect all SPI slaves
-    //uint32 cmdTime = time();
-    triggerEnable(false);
-    for(;;)
-    {
-        if (USBUART_IsConfigurationChanged() != 0u) {
-            /* Wait for USB-UART Device to enumerate */
-            if (USBUART_GetConfiguration() != 0u) {
-                /* Enumeration is done, enable OUT endpoint to receive data from Host */
-                USBUART_CDC_Init();
-            }
-        }
-
-//        if ((Status_Reg_2_Read() & 0x01) != 0) {
-//            uint8 status = Control_Reg_1_Read() & ~RSTPEAK;
-//            Control_Reg_1_Write(status | RSTPEAK);     // Reset the peak detector
-//            phSAR = ADC_SAR_1_GetResult16();
-//        }
-
-        // Build an event and send it out each time a GO is received
-        if (triggered) {
-            uint32 timeStampSave = timeStamp;  // Store current count so it cannot change via interrupt
-            triggered = false;
-            //LED2_OnOff(true);
-            // Read the digitized PMT data after waiting for the digitizers to finish
-            uint t0 = time();
-            while (!(Status_Reg_M_Read() & 0x08)) {   // Wait here for the done signal
-                if (time() - t0 > 20) {
-                    addError(ERR_PMT_DAQ_TIMEOUT, (uint8)cntGO, (uint8)(cntGO >> 8));
-                    break;
-                }
-            }
-            // By this point the ADC sample arrays should have been filled by DMA
-            // Check that a tracker trigger was received and whether data are ready
-            // This check generally works the first try and can maybe be removed in the long run.
-            uint8 tkrDataReady = 0;
-            uint8 nTry =0;
-            while (tkrDataReady != 0x59) {
-                tkrCmdCode = 0x57;
-                while (UART_TKR_ReadTxStatus() & UART_TKR_TX_STS_FIFO_FULL);
-                UART_TKR_WriteTxData(0x00);    // Address byte
-                while (UART_TKR_ReadTxStatus() & UART_TKR_TX_STS_FIFO_FULL);
-                UART_TKR_WriteTxData(tkrCmdCode);    // Check status
-                while (UART_TKR_ReadTxStatus() & UART_TKR_TX_STS_FIFO_FULL);
-                UART_TKR_WriteTxData(0x00);    // Number of data bytes
-                getTrackerData();
-                if (nTkrHouseKeeping > 0) {
-                    nTkrHouseKeeping = 0;
-                    if (tkrHouseKeeping[0] == 0x59) {
-                        tkrDataReady = 0x59;
-                        break;
-                    } else if (tkrHouseKeeping[0] == 0x4E) {
-                        tkrDataReady = 0x4E;
-                    } else {
-                        addError(ERR_TKR_BAD_STATUS, tkrHouseKeeping[0], nTry);
-                    }
-                }
-                nTry++;
-                if (nTry > 9) {
-                    addError(ERR_TKR_BAD_STATUS, tkrHouseKeeping[0], nTry+1);
-                    break;
-                }
-            }           
-            
-            // Start the read of the Tracker data by sending a read-event command
-            tkrLED(true);
-            tkrCmdCode = 0x01;
-            while (UART_TKR_ReadTxStatus() & UART_TKR_TX_STS_FIFO_FULL);
-            UART_TKR_WriteTxData(0x00);    // Address byte
-            while (UART_TKR_ReadTxStatus() & UART_TKR_TX_STS_FIFO_FULL);
-            UART_TKR_WriteTxData(tkrCmdCode);    // Read event command
-            while (UART_TKR_ReadTxStatus() & UART_TKR_TX_STS_FIFO_FULL);
-            UART_TKR_WriteTxData(0x01);    // Number of data bytes
-            while (UART_TKR_ReadTxStatus() & UART_TKR_TX_STS_FIFO_FULL);
-            UART_TKR_WriteTxData(0x00);    // Use internally generated trigger tags
-            // Read the Tracker data in from the UART and into internal arrays
-            rc = getTrackerData();        
-            if (rc != 0) {
-                addError(ERR_GET_TKR_DATA, rc, 0x77);
-            }
-            tkrLED(false);
-            
-            // Search for nearly coincident TOF data. Note that each TOF chip channel operates asynchronously w.r.t. the
-            // instrument trigger, so we have to correlate the two channels with each other and with the event
-            // by looking at the course timing information.
-            uint16 timeStamp16 = (uint16)(timeStampSave & 0x0000FFFF);
-            int nI=0;
-            uint8 idx[TOFMAX_EVT];
-            for (int i=0; i<TOFMAX_EVT; ++i) {           // Make a list of TOF hits in channel A
-                int iptr = tofA.ptr - i - 1;             // Work backwards in time, starting with the most recent measurement
-                if (iptr < 0) iptr = iptr + TOFMAX_EVT;  // Wrap around the circular buffer
-                if (!tofA.filled[iptr]) continue;        // Use only entries filled since the previous readout
-                if (timeStamp16 == tofA.clkCnt[iptr] || timeStamp16 == tofA.clkCnt[iptr]+1) {
-                    idx[nI] = iptr;                      // Only look at entries within two 5ms clock periods of the event time stamp
-                    ++nI;
-                }
-            }
-            uint16 aCLK = 65535;
-            uint16 bCLK = 65535;
-            uint16 aTOF = 65535;
-            uint16 bTOF = 65535;
-            int16 dtmin = 32767;
-            int nJ=0;
-            for (int j=0; j<TOFMAX_EVT; ++j) {           // Loop over the TOF hits in channel B
-                int jptr = tofB.ptr - j - 1;             // Work backwards in time, starting with the most recent measurement
-                if (jptr < 0) jptr = jptr + TOFMAX_EVT;  // Wrap around the circular buffer
-                if (!tofB.filled[jptr]) continue;        // Use only entries filled since the previous readout
-                // Look only at entries filled within two 5 ms clock periods of the event time stamp
-                if (!(tofB.clkCnt[jptr] == timeStamp16 || tofB.clkCnt[jptr] == timeStamp16-1)) continue;
-                uint32 BT = tofB.shiftReg[jptr];
-                uint16 stopB = (uint16)(BT & 0x0000FFFF);       // Stop time for channel B
-                uint16 refB = (uint16)((BT & 0xFFFF0000)>>16);  // Reference clock for channel B
-                int timej = refB*8333 + stopB;                  // Full time for channel B in 10 picosecond units
-                ++nJ;
-                for (int i=0; i<nI; ++i) {                          // Loop over the channel A hits
-                    int iptr = idx[i];
-                    if (abs(tofA.clkCnt[iptr] - tofB.clkCnt[jptr]) > 1) continue; // Two channels must be within +- 1 clock period
-                    uint32 AT = tofA.shiftReg[iptr];
-                    uint16 stopA = (uint16)(AT & 0x0000FFFF);       // Stop time for channel A
-                    uint16 refA = (uint16)((AT & 0xFFFF0000)>>16);  // Reference clock for channel A
-                    int timei = refA*8333 + stopA;                  // Full time for channel A in 10 picosecond units
-                    // Here we try to handle cases in which a reference clock rolled over
-                    int dt;
-                    if (refA > 49152 && refB < 16384) {
-                        dt = timej - (timei - 500000000);
-                    } else if (refB > 49152 && refA < 16384) {
-                        dt = (timej - 500000000) - timei; 
-                    } else {
-                        dt = timej - timei;
-                    }
-                    if (abs(dt) < abs(dtmin)) { // Keep the smallest time difference of all combinations
-                        dtmin = dt;
-                        aCLK = tofA.clkCnt[iptr];  // Save the clock and reference counts for debugging
-                        bCLK = tofB.clkCnt[jptr];
-                        aTOF = refA;
-                        bTOF = refB;
-                    }
-                }
-            }
-
-            // Build the event by filling the output buffer according to the output format.
-            // Pack the time and date information into a 4-byte unsigned integer
-            uint32 timeWord = ((uint32)timeDate->Year - 2000) << 26;
-            timeWord = timeWord | ((uint32)timeDate->Month << 22);
-            timeWord = timeWord | ((uint32)timeDate->DayOfMonth << 17);
-            timeWord = timeWord | ((uint32)timeDate->Hour << 12);
-            timeWord = timeWord | ((uint32)timeDate->Min << 6);
-            timeWord = timeWord | ((uint32)timeDate->Sec); 
-            //
-            // Start the event with a 4-byte header
-            dataOut[0] = 0x5A;
-            dataOut[1] = 0x45;
-            dataOut[2] = 0x52;
-            dataOut[3] = 0x4F;
-            dataOut[4] = byte16(runNumber, 0);
-            dataOut[5] = byte16(runNumber, 1);
-            dataOut[6] = byte32(cntGO, 0);     // Event number
-            dataOut[7] = byte32(cntGO, 1);
-            dataOut[8] = byte32(cntGO, 2);
-            dataOut[9] = byte32(cntGO, 3);
-            dataOut[10] = byte32(timeStampSave, 0); // Time stamp
-            dataOut[11] = byte32(timeStampSave, 1);
-            dataOut[12] = byte32(timeStampSave, 2);
-            dataOut[13] = byte32(timeStampSave, 3);
-            dataOut[14] = byte32(cntGO1, 0);   // Trigger count
-            dataOut[15] = byte32(cntGO1, 1);
-            dataOut[16] = byte32(cntGO1, 2);
-            dataOut[17] = byte32(cntGO1, 3);
-            dataOut[18] = byte32(timeWord, 0); // Time and date
-            dataOut[19] = byte32(timeWord, 1);
-            dataOut[20] = byte32(timeWord, 2);
-            dataOut[21] = byte32(timeWord, 3);
-            dataOut[22] = trgStatus;
-            dataOut[23] = byte16(adc2_sampleArray[0], 0);   // T1
-            dataOut[24] = byte16(adc2_sampleArray[0], 1);
-            dataOut[25] = byte16(adc1_sampleArray[0], 0);   // T2
-            dataOut[26] = byte16(adc1_sampleArray[0], 1);
-            dataOut[27] = byte16(adc2_sampleArray[2], 0);   // T3
-            dataOut[28] = byte16(adc2_sampleArray[2], 1);
-            dataOut[29] = byte16(adc1_sampleArray[1], 0);   // T4
-            dataOut[30] = byte16(adc1_sampleArray[1], 1);
-            dataOut[31] = byte16(adc2_sampleArray[1], 0);   // G
-            dataOut[32] = byte16(adc2_sampleArray[1], 1);
-            dataOut[33] = byte16(adc1_sampleArray[2], 0);   // Extra (for test work)
-            dataOut[34] = byte16(adc1_sampleArray[2], 1);
-            dataOut[35] = byte16(dtmin, 0);   // TOT
-            dataOut[36] = byte16(dtmin, 1);
-            dataOut[37] = byte16(tkrData.triggerCount, 0);
-            dataOut[38] = byte16(tkrData.triggerCount, 1);
-            dataOut[39] = tkrData.cmdCount;
-            dataOut[40] = tkrData.trgPattern;
-            dataOut[41] = nI;   // Number of TOF readouts since the last trigger
-            dataOut[42] = nJ; 
-            dataOut[43] = byte16(aTOF,0);    // TOF chip reference clock (for debugging)
-            dataOut[44] = byte16(aTOF,1);
-            dataOut[45] = byte16(bTOF,0);
-            dataOut[46] = byte16(bTOF,1);
-            dataOut[47] = byte16(aCLK,0);    // Internal clock at time of TOF event
-            dataOut[48] = byte16(aCLK,1);
-            dataOut[49] = byte16(bCLK,0);
-            dataOut[50] = byte16(bCLK,1);
-            dataOut[51] = tkrData.nTkrBoards;
-            nDataReady = 52;
-            for (int brd=0; brd<tkrData.nTkrBoards; ++brd) {
-                if (nDataReady > MAX_DATA_OUT - (5 + tkrData.boardHits[brd].nBytes)) {
-                    addError(ERR_EVT_TOO_BIG, dataOut[6], dataOut[10]);
-                    break;
-                }
-                dataOut[nDataReady++] = brd;
-                dataOut[nDataReady++] = tkrData.boardHits[brd].nBytes;
-                for (int b=0; b<tkrData.boardHits[brd].nBytes; ++b) {
-                    dataOut[nDataReady++] = tkrData.boardHits[brd].hitList[b];
-                }
-                free(tkrData.boardHits[brd].hitList);
-                tkrData.boardHits[brd].nBytes = 0;
-            }
-            // Four byte trailer
-            dataOut[nDataReady++] = 0x46;
-            dataOut[nDataReady++] = 0x49;
-            dataOut[nDataReady++] = 0x4E;
-            dataOut[nDataReady++] = 0x49;
-            eventDataReady = true;
-            adc1_sampleArray[0] = 0;
-            adc1_sampleArray[1] = 0;
-            adc1_sampleArray[2] = 0;
-            adc2_sampleArray[0] = 0;
-            adc2_sampleArray[1] = 0;
-            adc2_sampleArray[2] = 0;
-            for (int j=0; j<TOFMAX_EVT; ++j) {
-                tofA.filled[j] = false;
-                tofB.filled[j] = false;
-            }
-            tofA.ptr = 0;
-            tofB.ptr = 0;
-            tkrData.nTkrBoards = 0;
-            ch1CtrSave = Cntr8_V1_1_ReadCount();
-            ch2CtrSave = Cntr8_V1_2_ReadCount();
-            ch3CtrSave = Cntr8_V1_3_ReadCount();
-            ch4CtrSave = Cntr8_V1_4_ReadCount();
-            ch5CtrSave = Cntr8_V1_5_ReadCount();
-            ch1CountSave = ch1Count;
-            ch2CountSave = ch2Count;
-            ch3CountSave = ch3Count;
-            ch4CountSave = ch4Count;
-            ch5CountSave = ch5Count;
-        }
-        
-        // Data goes out by USBUART, for bench testing, or by SPI to the main PSOC
-        // Format: 3 byte aligned packeckets with a 3 byte header (ID byte followed by 0x00FF) 
-        //         and 3 byte EOR (0xFF00FF)
-        //         We use two different ID bytes: one for a fixed-length 3-byte packet; another for variable length
-        // Variable length packet: the first byte in the first packet gives the number of bytes to follow.
-        //                         The last packet gets padded with 0 for bytes not used.
-        
-        if (nDataReady > 0) {
-            dataLED(true);
-            if (nDataReady <= 3) {
-                dataPacket[0] = FIX_HEAD;
-                dataPacket[3] = dataOut[0];
-                dataPacket[4] = dataOut[1];
-                dataPacket[5] = dataOut[2];
-                if (outputMode == USBUART_OUTPUT) {
-                    while (USBUART_CDCIsReady() == 0u);  // Wait for the UART to be ready
-                    USBUART_PutData(dataPacket, 9);   
-                } else {
-                    set_SPI_SSN(SSN_Main, true);
-                    SPIM_PutArray(dataPacket, 9);
-                    //for (int i=0; i<9; ++i) SPIM_WriteTxData(dataPacket[i]);
-                }
-            } else {
-                int nPackets = (nDataReady - 1)/3 + 1;
-                dataPacket[0] = VAR_HEAD;
-                dataPacket[3] = nDataReady;
-                dataPacket[4] = 0;
-                dataPacket[5] = 0;
-                if (outputMode == USBUART_OUTPUT) {
-                    while(USBUART_CDCIsReady() == 0u);
-                    USBUART_PutData(dataPacket, 9);  
-                } else {
-                    set_SPI_SSN(SSN_Main, true);
-                    for (int i=0; i<9; ++i) {
-                        SPIM_WriteTxData(dataPacket[i]);
-                    }
-                }     
-                for (int i=0; i<nPackets; ++i) {
-                    if (i == nPackets-1) {
-                        if (3*i+1 >= nDataReady) dataOut[3*i+1] = 0xEE;
-                        if (3*i+2 >= nDataReady) dataOut[3*i+2] = 0xFF;
-                    }
-                    dataPacket[3] = dataOut[3*i];
-                    dataPacket[4] = dataOut[3*i+1];
-                    dataPacket[5] = dataOut[3*i+2]; 
-                    if (outputMode == USBUART_OUTPUT) {
-                        while(USBUART_CDCIsReady() == 0u);
-                        USBUART_PutData(dataPacket, 9);   
-                    } else {                        
-                        set_SPI_SSN(SSN_Main, false);
-                        for (int i=0; i<9; ++i) {
-                            SPIM_WriteTxData(dataPacket[i]);
-                        }
-                    }
-                }
-            }
-            nDataReady = 0;
-            if (eventDataReady) {   // re-enable the trigger after event data has been output
-                triggerEnable(true);
-                eventDataReady = false;
-            }
-            dataLED(false);
-        }
-        
-        // Time-out protection in case the expected data for a command are never sent
-        if (!awaitingCommand) {
-            if (time() - cmdStartTime > TIMEOUT) {
-                awaitingCommand = true;
-                nCmdTimeOut++;
-            }
-        }        
-        
-        // Get a 29-byte command input from the UART or USB-UART
-        // reads partial to full commands from either input and adds them to a buffer for parsing 
-        uint8 count = 0; //Temporary variable to keep count of revelant new command bytes 
-        if (USBUART_GetConfiguration() != 0u) {    // USB is active
-            if (USBUART_DataIsReady() != 0u) { // command bytes are ready
-                uint8 tempBuffer[BUFFER_LEN]; //new buffer to get the data from USBUART_GetAll
-                uint8 partialCount = 0; //count to end of buffer if it wraps around
-                count = USBUART_GetAll(tempBuffer); // get the bytes from USB
-                if((bufferWrite + count) > (uint8)(BUFFER_LEN)) //check if new bytes will push the cirucular buffer past boundary
-                {
-                    partialCount = BUFFER_LEN - bufferRead ;// bytes to coppy to boundary
-                    memcpy((buffer + bufferWrite) , tempBuffer, partialCount); // copy from tempBuffer to boundary of buffer
-                    bufferWrite = 0;// move index to low boundary
-                }
-                memcpy((buffer + bufferWrite) , (tempBuffer + partialCount), (count - partialCount)); // copy rest of bytes from tempBuffer to buffer
-                bufferWrite += (count - partialCount); //move write index to next byte, will not wrap
-                if(WRAP((BUFFER_LEN - bufferRead + bufferWrite), BUFFER_LEN) < count) //Check if write index moved past read by making sure the buufered bytes are at least count
-                {
-                    bufferRead = WRAPINC(bufferWrite, BUFFER_LEN); //buffer overflowed, discard bytes that didn't have cmd
-                    //TODO error type for discarged bytes
-                }
-                    
-            }
-        }
-        if (0 == count) //only 1 source per loop, so don't read URT if already read USB
-        {
-            
-            count = UART_CMD_GetRxBufferSize(); //number of bytes to read TODO decrease buffer size of UART_CMD
-    //        if (count == 0 && UART_CMD_GetRxBufferSize() >= 29) {   // Command from UART 
-    //            count = 29;
-            for (int i=0; i<count; ++i) { //loop to copy all bytes
-                buffer[bufferWrite] = UART_CMD_ReadRxData(); //copy 1 byte
-                bufferWrite = WRAPINC(bufferWrite, BUFFER_LEN); //increment write index
-            }
-            if(WRAP((BUFFER_LEN - bufferRead + bufferWrite), BUFFER_LEN) < count) //Check if write index moved past read by making sure the buufered bytes are at least count
-            {
-                bufferRead = WRAPINC(bufferWrite, BUFFER_LEN); //buffer overflowed, discard bytes that didn't have cmd
-                //TODO error type for discarded bytes
-            }
-            
-        }
-        count = WRAP((BUFFER_LEN - bufferRead + bufferWrite), BUFFER_LEN); //Count of active buffered bytes to parse
-        if (count >= 29) {// command is 29 bytes long so that is the min to parse
-            bool badCMD = false; // this flag true will stop further checks
-            while (!(badCMD || ('S' == buffer[bufferRead])))//Find S to start the command, discard bytes until found
-            {
-                if(--count < 29) //Check if command cannot exist in remaining bytes 
-                {
-                    badCMD = true; //command is bad so stop further checks
-                }
-                //TODO error type for discarded bytes
-                bufferRead = WRAPINC(bufferRead, BUFFER_LEN); //increment read index
-            }
-            if (!badCMD) //continue checks
-            {
-                for (int i=0; i<9; ++i) {   // Check that all 3 command copies are identical
-                    if (buffer[WRAP(bufferRead + i, BUFFER_LEN)] != buffer[WRAP(bufferRead + i+9, BUFFER_LEN)] || buffer[WRAP(bufferRead + i, BUFFER_LEN)] != buffer[WRAP(bufferRead + i+18, BUFFER_LEN)]) { //single byte doesn't match
-                        addError(ERR_BAD_CMD, code[buffer[WRAP(bufferRead + i, BUFFER_LEN)]], WRAP(bufferRead + i+9, BUFFER_LEN)); //command doesn't match in triplicate
-                        badCMD = true; //command is bad so stop futher checks
-                        bufferRead = WRAPINC(bufferRead, BUFFER_LEN); //discard byte that leads to misalignment
-                        break;//stop futher checks
-                    }
-                }
-                if(!badCMD) //continue checks
-                {
-                    if (('W' != buffer[WRAP(bufferRead + 26, BUFFER_LEN)]) || ('\r' !=  buffer[WRAP(bufferRead + 27, BUFFER_LEN)]) || ('\n' !=  buffer[WRAP(bufferRead + 28, BUFFER_LEN)]))
-                    {
-                        addError(ERR_BAD_CMD, code[buffer[WRAP(bufferRead + 26, BUFFER_LEN)]], WRAP(bufferRead + 27, BUFFER_LEN));
-                        badCMD = true; //command is bad so stop futher checks
-                        bufferRead = WRAPINC(bufferRead, BUFFER_LEN); //discard byte that leads to misalignment
-                    }
-                }
-            }
-            if (!badCMD) //if not set, command passed all checks
-            {
-                cmdCountGLB++;
-                //cmdTime = time();
-                uint8 nib3 = code[buffer[WRAP(bufferRead + 3, BUFFER_LEN)]];
-                uint8 nib4 = code[buffer[WRAP(bufferRead + 4, BUFFER_LEN)]];
-                uint8 addressByte = (nib3<<4) | nib4;
-                uint8 PSOCaddress = (addressByte & '\x3C')>>2;
-                if (PSOCaddress == eventPSOCaddress) {                    
-                    uint8 nib1 = code[buffer[WRAP(bufferRead + 1, BUFFER_LEN)]];  // No check on code. Illegal characters get translated to 0.
-                    uint8 nib2 = code[buffer[WRAP(bufferRead + 2, BUFFER_LEN)]];
-                    uint8 dataByte = (nib1<<4) | nib2;
-                    if (awaitingCommand) {
-                        awaitingCommand = false;
-                        cmdStartTime = time();
-                        cmdCount++;
-                        dCnt = 0;
-                        nDataBytes = ((addressByte & '\xC0') >> 4) | (addressByte & '\x03');
-                        command = dataByte;
-                        if (nDataBytes == 0) cmdDone = true;
-                    } else {
-                        uint8 byteCnt = ((addressByte & '\xC0') >> 4) | (addressByte & '\x03');
-                        if (byteCnt != 0) {
-                            cmdData[byteCnt-1] = dataByte;
-                            dCnt++;
-                            if (dCnt == nDataBytes) {
-                                cmdDone = true; 
-                            }
-                        } else {
-                            addError(ERR_BAD_BYTE, command, nDataBytes);
-                            badCMD = true;
-                        }
-                    }
-                }
-                bufferRead = WRAP(bufferRead + 29, BUFFER_LEN);//command processed, move read index past it
-                if (cmdDone) {
-                    cmdDone = false;
-                    awaitingCommand = true;
-                    uint16 DACsetting12;
-                    uint32 tStart;
-                    int16 Bvolt;
-                    uint8 DACaddress = 0;
-                    uint16 thrSetting;
-                    uint8 nCalClusters;
-                    uint8 fpgaAddress;
-                    uint8 chipAddress;
-                    // If the trigger is enabled, ignore all commands besides disable trigger, 
-                    // so that nothing can interrupt the readout.
-                    if (command == '\x3D' || command == '\x44' || !isTriggerEnabled()) {
-                        switch (command) { 
-                            case '\x01':         // Load a threshold DAC setting
-                                switch (cmdData[0]) {
-                                    case 0x05: 
-                                        thrSetting = (uint16)cmdData[1];
-                                        thrSetting = (thrSetting<<8) | (uint16)cmdData[2];
-                                        rc = loadDAC(I2C_Address_DAC_Ch5, thrSetting);
-                                        if (rc != 0) {
-                                            addError(ERR_DAC_LOAD, rc, I2C_Address_DAC_Ch5);
-                                        }
-                                        break;
-                                    case 0x01:
-                                        VDAC8_Ch1_SetValue(cmdData[1]);
-                                        thrDACsettings[0] = cmdData[1];
-                                        break;
-                                    case 0x02:
-                                        VDAC8_Ch2_SetValue(cmdData[1]);
-                                        thrDACsettings[1] = cmdData[1];
-                                        break;
-                                    case 0x03:
-                                        VDAC8_Ch3_SetValue(cmdData[1]);
-                                        thrDACsettings[2] = cmdData[1];
-                                        break;
-                                    case 0x04:
-                                        VDAC8_Ch4_SetValue(cmdData[1]);
-                                        thrDACsettings[3] = cmdData[1];
-                                        break;
-                                }
-                                break;
-                            case '\x02':         // Get a threshold DAC setting
-                                if (cmdData[0] == 0x05) {
-                                    nDataReady = 2;
-                                    rc = readDAC(I2C_Address_DAC_Ch5, &DACsetting12);
-                                    if (rc != 0) {
-                                        DACsetting12 = 0;
-                                        addError(ERR_DAC_READ, rc, DACaddress);
-                                    }
-                                    dataOut[0] = (uint8)((DACsetting12 & 0xFF00)>>8);
-                                    dataOut[1] = (uint8)(DACsetting12 & 0x00FF);
-                                } else if (cmdData[0] < 5) {
-                                    nDataReady = 1;
-                                    dataOut[0] = thrDACsettings[cmdData[0]-1];
-                                } else {
-                                    nDataReady = 1;
-                                    dataOut[0] = 0;
-                                }
-                                break;
-                            case '\x03':         // Read back all of the accumulated error codes
-                                if (nErrors == 0) {
-                                    nDataReady = 3;
-                                    dataOut[0] = 0x00;
-                                    dataOut[1] = 0xEE;
-                                    dataOut[2] = 0xFF;
-                                    break;
-                                }
-                                nDataReady = nErrors*3;
-                                for (int i=0; i<nErrors; ++i) {
-                                    dataOut[i*3] = errors[i].errorCode;
-                                    dataOut[i*3 + 1] = errors[i].value0;
-                                    dataOut[i*3 + 2] = errors[i].value1;                                    
-                                }
-                                nErrors = 0;
-                                break;
-                            case '\x04':        // Load the TOF DACs
-                                if (cmdData[0] == 1) {
-                                    DACaddress = I2C_Address_TOF_DAC1;
-                                } else if (cmdData[0] == 2) {
-                                    DACaddress = I2C_Address_TOF_DAC2;
-                                } else break;
-                                uint16 thrSetting = (uint16)cmdData[1];
-                                thrSetting = (thrSetting<<8) | (uint16)cmdData[2];
-                                rc = loadDAC(DACaddress, thrSetting);
-                                if (rc != 0) {
-                                    addError(ERR_TOF_DAC_LOAD, rc, DACaddress);
-                                }
-                                break;
-                            case '\x05':        // Read the TOF DAC settings
-                                if (cmdData[0] == 1) {
-                                    DACaddress = I2C_Address_TOF_DAC1;
-                                } else if (cmdData[0] == 2) {
-                                    DACaddress = I2C_Address_TOF_DAC2;
-                                } else break;
-                                rc = readDAC(DACaddress, &DACsetting12);
-                                if (rc != 0) {
-                                    DACsetting12 = 0;
-                                    addError(ERR_TOF_DAC_READ, rc, DACaddress);                                         
-                                }
-                                
-                                nDataReady = 2;
-                                dataOut[0] = (uint8)((DACsetting12 & 0xFF00)>>8);
-                                dataOut[1] = (uint8)(DACsetting12 & 0x00FF);
-                                break;
-                            case '\x06':        // Turn LED on or off, for communication test
-                                if (cmdData[0] == 1) {
-                                    LED2_OnOff(true);
-                                } else {
-                                    LED2_OnOff(false);
-                                }
-                                break;
-                            case '\x07':        // Return the version number
-                                nDataReady = 1;
-                                dataOut[0] = VERSION;
-                                break;
-                            case '\x10':        // Send an arbitrary command to the tracker
-                                tkrCmdCode = cmdData[1];
-                                // Ignore commands that are supposed to be internal to the tracker,
-                                // to avoid confusing the tracker logic.
-                                if (tkrCmdCode == 0x52 || tkrCmdCode == 0x53) break;
-                                tkrLED(true);
-                                UART_TKR_PutChar(cmdData[0]);   // FPGA address
-                                UART_TKR_PutChar(tkrCmdCode);
-                                uint8 nDataTKR = cmdData[2];
-                                UART_TKR_PutChar(nDataTKR);
-                                for (int i=0; i<nDataTKR; ++i) {
-                                    UART_TKR_PutChar(cmdData[3+i]);
-                                }
-                                // Wait around for up to a second for all the data to transmit
-                                tStart = time();
-                                while (UART_TKR_GetTxBufferSize() > 0) {                                           
-                                    if (time() - tStart > 200) {
-                                        addError(ERR_TX_FAILED, tkrCmdCode, command);
-                                        tkrLED(false);
-                                        break;
-                                    }
-                                }                                
-                                if (tkrCmdCode == 0x67 || tkrCmdCode == 0x6C) {
-                                    tkrLED(false);
-                                    break; // This command has no echo
-                                }
-                                // Now look for the bytes coming back from the Tracker.
-                                if (tkrCmdCode >= 0x20 && tkrCmdCode <= 0x25) {
-                                    getASICdata();
-                                } else if (tkrCmdCode == 0x46) {
-                                    getTKRi2cData();
-                                } else {
-                                    rc = getTrackerData();
-                                    if (rc != 0) {
-                                        addError(ERR_GET_TKR_DATA, rc, command);
-                                    }
-                                }
-                                tkrLED(false);
-                                break;
-                            case '\x41':        // Load a tracker ASIC mask register
-                                tkrLED(true);
-                                fpgaAddress = cmdData[0] & 0x07;
-                                chipAddress = cmdData[1] & 0x1F;
-                                uint8 regType = cmdData[2] & 0x03;
-                                uint8 fill = cmdData[3] & 0x01;
-                                nCalClusters = cmdData[4];
-                                if (nCalClusters > (nDataBytes - 5)/2) {
-                                    nCalClusters = (nDataBytes - 5)/2;
-                                }   
-                                int ptr = 5;
-                                uint64 mask = 0;
-                                for (int i=0; i<nCalClusters; ++i) {
-                                    uint64 mask0 = 0;
-                                    int nch = cmdData[ptr];
-                                    int ch0 = 64-nch-cmdData[ptr+1];
-                                    mask0 = mask0 +1;
-                                    for (int j=1; j<nch; ++j) {
-                                        mask0 = mask0<<1;
-                                        mask0 = mask0 + 1;
-                                    }
-                                    mask0 = mask0<<ch0;
-                                    mask = mask | mask0;
-                                    ptr = ptr + 2;
-                                }
-                                if (fill) mask = ~mask;
-                                if (regType == CALMASK) tkrCmdCode = '\x15';
-                                else if (regType == DATAMASK) tkrCmdCode = '\x13';
-                                else tkrCmdCode = '\x14';
-                                UART_TKR_PutChar(fpgaAddress);
-                                UART_TKR_PutChar(tkrCmdCode);  
-                                UART_TKR_PutChar('\x09');
-                                UART_TKR_PutChar(chipAddress);
-                                uint8 bytesToSend[8];
-                                for (int j=0; j<8; ++j) {
-                                    bytesToSend[j] = (uint8)(mask & 0x00000000000000FF);
-                                    mask = mask>>8;
-                                }
-                                for (int j=7; j>=0; --j) {
-                                    UART_TKR_PutChar(bytesToSend[j]);
-                                }
-                                
-                                // Wait around for up to a second for all the data to transmit
-                                tStart = time();
-                                while (UART_TKR_GetTxBufferSize() > 0) {                                           
-                                    if (time() - tStart > 200) {
-                                        addError(ERR_TX_FAILED, tkrCmdCode, command);
-                                        tkrLED(false);
-                                        break;
-                                    }
-                                }    
-                                rc = getTrackerData();  // Get the command echo
-                                if (rc != 0) {
-                                    addError(ERR_GET_TKR_DATA, rc, tkrCmdCode);
-                                }
-                                tkrLED(false);
-                                break;
-                            case '\x42':        // Start a tracker calibration sequence
-                                // First send a calibration strobe command
-                                tkrLED(true);
-                                tkrCmdCode = '\x02';
-                                UART_TKR_PutChar('\x00');
-                                UART_TKR_PutChar(tkrCmdCode);
-                                UART_TKR_PutChar('\x03');
-                                UART_TKR_PutChar('\x1F');
-                                uint8 FPGA = cmdData[0];
-                                uint8 trgDelay = cmdData[1];
-                                uint8 trgTag = cmdData[2] & 0x03;
-                                uint8 byte2 = (trgDelay & 0x3f)<<2;
-                                byte2 = byte2 | trgTag;
-                                UART_TKR_PutChar(byte2);
-                                UART_TKR_PutChar(FPGA);
-                                // Wait around for up to a second for all the data to transmit
-                                tStart = time();
-                                while (UART_TKR_GetTxBufferSize() > 0) {                                           
-                                    if (time() - tStart > 200) {
-                                        addError(ERR_TX_FAILED, tkrCmdCode, command);
-                                        tkrLED(false);
-                                        break;
-                                    }
-                                }    
-                                // Catch the trigger output and send back to the computer                              
-                                getTrackerBoardTriggerData(FPGA);
-                                tkrLED(false);
-                                break;
-                            case '\x43':   // Send a tracker read-event command for calibration events
-                                tkrLED(true);
-                                tkrCmdCode = '\x01';
-                                trgTag = cmdData[0] & 0x03;
-                                UART_TKR_PutChar('\x00');
-                                UART_TKR_PutChar(tkrCmdCode);
-                                UART_TKR_PutChar('\x01');
-                                UART_TKR_PutChar(0x04 | trgTag);
-                                // Wait around for up to a second for all the data to transmit
-                                tStart = time();
-                                while (UART_TKR_GetTxBufferSize() > 0) {                                           
-                                    if (time() - tStart > 200) {
-                                        addError(ERR_TX_FAILED, tkrCmdCode, command);
-                                        tkrLED(false);
-                                        break;
-                                    }
-                                }    
-                                //CyDelay(1);
-                                // Read the data from the tracker
-                                rc = getTrackerData();
-                                if (rc != 0) {
-                                    addError(ERR_GET_TKR_DATA, rc, command);
-                                }
-                                
-                                // Then send the data out as a tracker-only event
-                                dataOut[0] = 0x5A;
-                                dataOut[1] = 0x45;
-                                dataOut[2] = 0x52;
-                                dataOut[3] = 0x4F;
-                                dataOut[4] = tkrData.nTkrBoards;
-                                nDataReady = 5;
-                                for (int brd=0; brd<tkrData.nTkrBoards; ++brd) {
-                                    if (nDataReady > MAX_DATA_OUT - (5 + tkrData.boardHits[brd].nBytes)) {
-                                        addError(ERR_EVT_TOO_BIG, dataOut[6], dataOut[10]);
-                                        break;
-                                    }
-                                    dataOut[nDataReady++] = brd;
-                                    dataOut[nDataReady++] = tkrData.boardHits[brd].nBytes;
-                                    for (int b=0; b<tkrData.boardHits[brd].nBytes; ++b) {
-                                        dataOut[nDataReady++] = tkrData.boardHits[brd].hitList[b];
-                                    }
-                                    free(tkrData.boardHits[brd].hitList);
-                                    tkrData.boardHits[brd].nBytes = 0;
-                                }
-                                dataOut[nDataReady++] = 0x46;
-                                dataOut[nDataReady++] = 0x49;
-                                dataOut[nDataReady++] = 0x4E;
-                                dataOut[nDataReady++] = 0x49;
-                                tkrLED(false);
-                                break;
-                            case '\x0C':        // Reset the TOF chip
-                                set_SPI_SSN(SSN_TOF, true);
-                                SPIM_WriteTxData(powerOnRESET);
-                                break;
-                            case '\x0D':        // Modify TOF configuration (disable trigger first)
-                                if (cmdData[0] < TOFSIZE) {
-                                    tofConfig[cmdData[0]] = tofConfig[1];
-                                    set_SPI_SSN(SSN_TOF, true);
-                                    SPIM_WriteTxData(writeConfig);
-                                    for (int i=0; i<TOFSIZE; ++i) {
-                                        SPIM_WriteTxData(tofConfig[i]);
-                                    }
-                                    CyDelay(1);
-                                }
-                                break;
-                            case '\x0E':        // Read the TOF IC configuration
-                                SPIM_ClearRxBuffer();
-                                set_SPI_SSN(SSN_TOF, true);
-                                SPIM_WriteTxData(readConfig);
-                                //CyDelay(1);
-                                while (SPIM_GetRxBufferSize() == 0) SPIM_WriteTxData(0x00);
-                                SPIM_ReadRxData();    // The first byte read back is always garbage.
-                                for (int bt=0; bt<TOFSIZE; ++bt) {
-                                    while (SPIM_GetRxBufferSize() == 0) SPIM_WriteTxData(0x00);
-                                    dataOut[bt] = SPIM_ReadRxData();
-                                    //dataOut[bt] = tofConfig[bt];
-                                }
-                                nDataReady = TOFSIZE;
-                                set_SPI_SSN(0, false);
-                                break;
-                            case '\x20':        // Read bus voltages (positive only)
-                                readI2Creg(2, cmdData[0], INA226_BusV_Reg, dataOut);
-                                nDataReady = 2;
-                                break;
-                            case '\x21':        // Read currents (Note: bit 15 is a sign bit, 2's complement)
-                                readI2Creg(2, cmdData[0], INA226_ShuntV_Reg, dataOut);
-                                nDataReady = 2;
-                                break;
-                            case '\x22':        // Read the board temperature
-                                readI2Creg(2, I2C_Address_TMP100, TMP100_Temp_Reg, dataOut);
-                                nDataReady = 2;
-                                break;
-                            case '\x23':        // Read an RTC register
-                                readI2Creg(1, I2C_Address_RTC, cmdData[0], dataOut);
-                                nDataReady = 1;
-                                break;
-                            case '\x24':        // Write an RTC register
-                                loadI2Creg(I2C_Address_RTC , cmdData[0], cmdData[1]);
-                                break;
-                            case '\x25':        // Read the watch battery voltage
-                                Bvolt = ADC_DelSig_1_CountsTo_mVolts(ADC_DelSig_1_Read32());
-                                nDataReady = 2;
-                                dataOut[0] = (uint8)((Bvolt & 0xFF00)>>8);
-                                dataOut[1] = (uint8)(Bvolt & 0x00FF);
-                                break;
-                            case '\x26':       // Read a barometer register
-                                readI2Creg(1, I2C_Address_Barometer, cmdData[0], dataOut);
-                                nDataReady = 1;
-                                break;
-                            case '\x27':       // Load a barometer register
-                                loadI2Creg(I2C_Address_Barometer, cmdData[0], cmdData[1]);
-                                break;
-                            case '\x30':       // Set the output mode
-                                if (cmdData[0] == USBUART_OUTPUT || cmdData[0] == SPI_OUTPUT) {
-                                    outputMode = cmdData[0];
-                                }
-                                break;
-                            case '\x31':       // Initialize the SPI interface
-                                SPIM_Init();
-                                SPIM_Enable();
-                                break;
-                            case '\x32':       // Send TOF info to USB-UART (temporary testing)
-                                outputTOF = true;                               
-                                break;
-                            case '\x3F':
-                                outputTOF = false;
-                                break;
-                            case '\x34':       // Get the number of TOF events stored
-                                nDataReady = 2;
-                                dataOut[0] = tofA.ptr;
-                                dataOut[1] = tofB.ptr;
-                                break;
-                            case '\x35':       // Read most recent TOF event from channel A or B (for testing)
-                                nDataReady = 9;
-                                if (cmdData[0] == 0) {
-                                    uint8 idx = tofA.ptr - 1;
-                                    if (idx < 0) idx = idx + TOFMAX_EVT;
-                                    if (tofA.filled[idx]) {
-                                        uint32 AT = tofA.shiftReg[idx];
-                                        uint16 stopA = (uint16)(AT & 0x0000FFFF);
-                                        uint16 refA = (uint16)((AT & 0xFFFF0000)>>16);
-                                        dataOut[0] = (uint8)((refA & 0xFF00)>>8);
-                                        dataOut[1] = (uint8)(refA & 0x00FF);
-                                        dataOut[2] = 0;
-                                        dataOut[3] = (uint8)((stopA & 0xFF00)>>8);
-                                        dataOut[4] = (uint8)(stopA & 0x00FF);
-                                        dataOut[5] = 0;
-                                        dataOut[6] = (uint8)((tofA.clkCnt[idx] & 0xFF00)>>8);
-                                        dataOut[7] = (uint8)(tofA.clkCnt[idx] & 0x00FF);
-                                        dataOut[8] = tofA.ptr;
-                                        for (int j=0; j<TOFMAX_EVT; ++j) {
-                                            tofA.filled[j] = false;
-                                        }
-                                        tofA.ptr = 0;
-                                    } else {
-                                        for (int i=0; i<8; ++i) dataOut[i] = 0;
-                                        dataOut[8] = idx;
-                                    }
-                                } else {
-                                    uint8 idx = tofB.ptr - 1;
-                                    if (idx < 0) idx = idx + TOFMAX_EVT;
-                                    if (tofB.filled[idx]) {
-                                        uint32 BT = tofB.shiftReg[idx];
-                                        uint16 stopB = (uint16)(BT & 0x0000FFFF);
-                                        uint16 refB = (uint16)((BT & 0xFFFF0000)>>16);
-                                        dataOut[0] = (uint8)((refB & 0xFF00)>>8);
-                                        dataOut[1] = (uint8)(refB & 0x00FF);
-                                        dataOut[2] = 0;
-                                        dataOut[3] = (uint8)((stopB & 0xFF00)>>8);
-                                        dataOut[4] = (uint8)(stopB & 0x00FF);
-                                        dataOut[5] = 0;
-                                        dataOut[6] = (uint8)((tofB.clkCnt[idx] & 0xFF00)>>8);
-                                        dataOut[7] = (uint8)(tofB.clkCnt[idx] & 0x00FF);
-                                        dataOut[8] = tofB.ptr;
-                                        for (int j=0; j<TOFMAX_EVT; ++j) {
-                                            tofB.filled[j] = false;
-                                        }
-                                        tofB.ptr = 0;
-                                    } else {
-                                        for (int i=0; i<8; ++i) dataOut[i] = 0;
-                                        dataOut[8] = idx;
-                                        for (int j=0; j<TOFMAX_EVT; ++j) {
-                                            tofB.filled[j] = false;
-                                            tofA.filled[j] = false;
-                                        }
-                                        tofB.ptr = 0;
-                                        tofA.ptr = 0;
-                                    }
-                                }
-                                break; 
-                            case '\x36':     // Set a trigger mask
-                                if (cmdData[0] == 1) {
-                                    setTriggerMask('e', cmdData[1]);
-                                } else if (cmdData[0] == 2) {
-                                    setTriggerMask('p', cmdData[1]);
-                                }
-                                break;
-                            case '\x37':    // Read a channel counter
-                                nDataReady = 3;
-                                switch (cmdData[0]) {
-                                    case 0x01:
-                                        dataOut[2] = Cntr8_V1_1_ReadCount();
-                                        dataOut[1] = (uint8)(ch1Count & 0x00FF);
-                                        dataOut[0] = (uint8)((ch1Count & 0xFF00)>>8);
-                                        break;
-                                    case 0x02:
-                                        dataOut[2] = Cntr8_V1_2_ReadCount();
-                                        dataOut[1] = (uint8)(ch2Count & 0x00FF);
-                                        dataOut[0] = (uint8)((ch2Count & 0xFF00)>>8);
-                                        break;
-                                    case 0x03:
-                                        dataOut[2] = Cntr8_V1_3_ReadCount();
-                                        dataOut[1] = (uint8)(ch3Count & 0x00FF);
-                                        dataOut[0] = (uint8)((ch3Count & 0xFF00)>>8);
-                                        break;
-                                    case 0x04:
-                                        dataOut[2] = Cntr8_V1_4_ReadCount();
-                                        dataOut[1] = (uint8)(ch4Count & 0x00FF);
-                                        dataOut[0] = (uint8)((ch4Count & 0xFF00)>>8);
-                                        break;
-                                    case 0x05:
-                                        dataOut[2] = Cntr8_V1_5_ReadCount();
-                                        dataOut[1] = (uint8)(ch5Count & 0x00FF);
-                                        dataOut[0] = (uint8)((ch5Count & 0xFF00)>>8);
-                                        break;
-                                }
-                                break;
-                            case '\x38':   // Reset the logic and counters, after reading back 24 bits of the clock count
-                                nDataReady = 3;
-                                uint32 now = time();
-                                dataOut[0] = (uint8)((now & 0x00FF0000)>>16);
-                                dataOut[1] = (uint8)((now & 0x0000FF00)>>8);
-                                dataOut[2] = (uint8)(now & 0x000000FF);
-                                logicReset();
-                                break;
-                            case '\x39':   // Set trigger prescales
-                                if (cmdData[0] == 1) {
-                                    Cntr8_V1_TKR_WritePeriod(cmdData[1]);
-                                } else if (cmdData[0] == 2) {
-                                    Cntr8_V1_PMT_WritePeriod(cmdData[1]);
-                                }
-                                break;
-                            case '\x3A':   // Set trigger coincidence window
-                                setCoincidenceWindow(cmdData[0]);
-                                break;
-                            case '\x3B':   // Enable or disable the trigger
-                                if (cmdData[0] == 1) {
-                                    triggerEnable(true);
-                                } else if (cmdData[0] == 0) {
-                                    triggerEnable(false);
-                                }
-                                break;
-                            case '\x44':  // End a run and send out the run summary
-                                triggered = false;   // this might throw out the last event
-                                triggerEnable(false);
-                                dataOut[0] = byte32(cntGO1, 0);
-                                dataOut[1] = byte32(cntGO1, 1);
-                                dataOut[2] = byte32(cntGO1, 2);
-                                dataOut[3] = byte32(cntGO1, 3);
-                                dataOut[4] = byte32(cntGO, 0);
-                                dataOut[5] = byte32(cntGO, 1);
-                                dataOut[6] = byte32(cntGO, 2);
-                                dataOut[7] = byte32(cntGO, 3);
-                                nDataReady = 8;
-                                break;
-                            case '\x3C':  // Start a run
-                                for (int j=0; j<TOFMAX_EVT; ++j) {
-                                    tofA.filled[j] = false;
-                                    tofB.filled[j] = false;
-                                }
-                                clkCnt = 0;
-                                tofA.ptr = 0;
-                                tofB.ptr = 0;
-                                ch1Count = 0;
-                                ch2Count = 0;
-                                ch3Count = 0;
-                                ch4Count = 0;
-                                ch5Count = 0;
-                                runNumber = cmdData[0];
-                                runNumber = (runNumber<<8) | cmdData[1];
-                                // Make sure that the TOT FIFOs are empty
-                                while (ShiftReg_A_GetFIFOStatus(ShiftReg_A_OUT_FIFO) != ShiftReg_A_RET_FIFO_EMPTY) {
-                                    ShiftReg_A_ReadData();
-                                }
-                                while (ShiftReg_B_GetFIFOStatus(ShiftReg_B_OUT_FIFO) != ShiftReg_B_RET_FIFO_EMPTY) {
-                                    ShiftReg_B_ReadData();
-                                }
-                                
-                                cntGO = 0;
-                                cntGO1 = 0;
-                                triggerEnable(true);
-                                Control_Reg_Pls_Write(PULSE_CNTR_RST);
-                                // Enable the tracker trigger
-                                tkrCmdCode = 0x65;
-                                while (UART_TKR_ReadTxStatus() & UART_TKR_TX_STS_FIFO_FULL);
-                                UART_TKR_WriteTxData(0x00);    // Address byte
-                                while (UART_TKR_ReadTxStatus() & UART_TKR_TX_STS_FIFO_FULL);
-                                UART_TKR_WriteTxData(tkrCmdCode);    // Trigger enable
-                                while (UART_TKR_ReadTxStatus() & UART_TKR_TX_STS_FIFO_FULL);
-                                UART_TKR_WriteTxData(0x00);    // Number of data bytes
-                                uint8 rc = getTrackerData();   // Get the echo. Note that any delay put before this results in
-                                                               // the first few bytes of the echo getting missed. Don't know why.
-                                if (rc != 0) {
-                                    addError(ERR_TKR_TRG_ENABLE, dataOut[2], rc);;
-                                }
-                                nDataReady = 0;  // Don't send the echo back to the UART
-                                break;
-                            case '\x3D':  // Return trigger enable status
-                                nDataReady =1;
-                                if (isTriggerEnabled()) dataOut[0] = 1;
-                                else dataOut[0] = 0;
-                                break;
-                            case '\x3E':  // Return trigger mask register
-                                nDataReady = 1;
-                                uint8 reg = 0;
-                                if (cmdData[0] == 1) {
-                                    reg = getTriggerMask('e');
-                                } else if (cmdData[0] == 2) {
-                                    reg = getTriggerMask('p');
-                                }
-                                dataOut[0] = reg;
-                                break;
-                            case '\x33':    // Read a saved channel counter, from end of run
-                                nDataReady = 3;
-                                switch (cmdData[0]) {
-                                    case 0x01:
-                                        dataOut[2] = ch1CtrSave;
-                                        dataOut[1] = (uint8)(ch1CountSave & 0x00FF);
-                                        dataOut[0] = (uint8)((ch1CountSave & 0xFF00)>>8);
-                                        break;
-                                    case 0x02:
-                                        dataOut[2] = ch2CtrSave;
-                                        dataOut[1] = (uint8)(ch2CountSave & 0x00FF);
-                                        dataOut[0] = (uint8)((ch2CountSave & 0xFF00)>>8);
-                                        break;
-                                    case 0x03:
-                                        dataOut[2] = ch3CtrSave;
-                                        dataOut[1] = (uint8)(ch3CountSave & 0x00FF);
-                                        dataOut[0] = (uint8)((ch3CountSave & 0xFF00)>>8);
-                                        break;
-                                    case 0x04:
-                                        dataOut[2] = ch4CtrSave;
-                                        dataOut[1] = (uint8)(ch4CountSave & 0x00FF);
-                                        dataOut[0] = (uint8)((ch4CountSave & 0xFF00)>>8);
-                                        break;
-                                    case 0x05:
-                                        dataOut[2] = ch5CtrSave;
-                                        dataOut[1] = (uint8)(ch5CountSave & 0x00FF);
-                                        dataOut[0] = (uint8)((ch5CountSave & 0xFF00)>>8);
-                                        break;
-                                }
-                                break;
-                            case '\x40':  // Read all TOF data (for testing)
-                                nDataReady = 3;
-                                uint8 nA = 0;
-                                uint8 nB = 0;
-                                for (int i=0; i<TOFMAX_EVT; ++i) {
-                                    if (tofA.filled[i]) ++nA;
-                                    if (tofB.filled[i]) ++nB;
-                                }
-                                dataOut[2] = 1;
-                                if (nA > 21 || nB > 21) {
-                                    dataOut[2] = 2;
-                                    if (nA > 21) nA = 21;
-                                    if (nB > 21) nB = 21;
-                                }
-                                dataOut[0] = nA;
-                                dataOut[1] = nB;
-                                int iptr = tofA.ptr;
-                                int jptr = tofB.ptr;
-                                uint8 cnt = 0;
-                                //LED2_OnOff(true);
-                                for (int i=0; i<TOFMAX_EVT; ++i) {
-                                    if (!tofA.filled[i]) continue;
-                                    --iptr;
-                                    if (iptr < 0) iptr += TOFMAX_EVT;
-                                    uint32 AT = tofA.shiftReg[iptr];
-                                    uint16 stopA = (uint16)(AT & 0x0000FFFF);
-                                    uint16 refA = (uint16)((AT & 0xFFFF0000)>>16);
-                                    dataOut[nDataReady] = byte16(refA,0);
-                                    ++nDataReady;
-                                    dataOut[nDataReady] = byte16(refA,1);
-                                    ++nDataReady;
-                                    dataOut[nDataReady] = byte16(stopA,0);
-                                    ++nDataReady;
-                                    dataOut[nDataReady] = byte16(stopA,1);
-                                    ++nDataReady;
-                                    dataOut[nDataReady] = byte16(tofA.clkCnt[iptr],0);
-                                    ++nDataReady;
-                                    dataOut[nDataReady] = byte16(tofA.clkCnt[iptr],1);
-                                    ++nDataReady;
-                                    ++cnt;
-                                    if (cnt >= nA) break;
-                                }
-                                cnt = 0;
-                                for (int i=0; i<TOFMAX_EVT; ++i) {
-                                    if (!tofB.filled[i]) continue;
-                                    --jptr;
-                                    if (jptr < 0) jptr += TOFMAX_EVT;
-                                    uint32 BT = tofB.shiftReg[jptr];
-                                    uint16 stopB = (uint16)(BT & 0x0000FFFF);
-                                    uint16 refB = (uint16)((BT & 0xFFFF0000)>>16);
-                                    dataOut[nDataReady] = byte16(refB,0);
-                                    ++nDataReady;
-                                    dataOut[nDataReady] = byte16(refB,1);
-                                    ++nDataReady;
-                                    dataOut[nDataReady] = byte16(stopB,0);
-                                    ++nDataReady;
-                                    dataOut[nDataReady] = byte16(stopB,1);
-                                    ++nDataReady;
-                                    dataOut[nDataReady] = byte16(tofB.clkCnt[jptr],0);
-                                    ++nDataReady;
-                                    dataOut[nDataReady] = byte16(tofB.clkCnt[jptr],1);
-                                    ++nDataReady;
-                                    ++cnt;
-                                    if (cnt >= nB) break;
-                                }
-                                for (int j=0; j<TOFMAX_EVT; ++j) {
-                                    tofB.filled[j] = false;
-                                    tofA.filled[j] = false;
-                                }
-                                tofB.ptr = 0;
-                                tofA.ptr = 0;
-                                break;
-                            case '\x45': // Set the time and date of the real-time-clock
-                                timeDate->Sec = cmdData[0];
-                                timeDate->Min = cmdData[1];
-                                timeDate->Hour = cmdData[2];
-                                timeDate->DayOfWeek = cmdData[3];
-                                timeDate->DayOfMonth = cmdData[4];
-                                timeDate->DayOfYear = cmdData[6] + cmdData[5]*256;
-                                timeDate->Month = cmdData[7];
-                                timeDate->Year = cmdData[9] + cmdData[8]*256;
-                                RTC_1_WriteTime(timeDate);
-                                //LED2_OnOff(true);
-                                break;
-                            case '\x46': // get the time and date of the real-time-clock
-                                nDataReady = 10;
-                                timeDate = RTC_1_ReadTime();
-                                dataOut[0] = timeDate->Sec;
-                                dataOut[1] = timeDate->Min;
-                                dataOut[2] = timeDate->Hour;
-                                dataOut[3] = timeDate->DayOfWeek;
-                                dataOut[4] = timeDate->DayOfMonth;
-                                dataOut[5] = timeDate->DayOfYear/256;
-                                dataOut[6] = timeDate->DayOfYear%256;
-                                dataOut[7] = timeDate->Month;
-                                dataOut[8] = timeDate->Year/256;
-                                dataOut[9] = timeDate->Year%256;
-                                break;
-                        } // End of command switch
-                        command = 0;
-                    } else { // Log an error if the user is sending spurious commands while the trigger is enabled
-                        addError(ERR_CMD_IGNORE, command, 0);
-                    }
-                }
-            } // End of command polling            
-        }
-        
-        // Send out Tracker housekeeping data immediately after receiving it from the Tracker
-        if (!isTriggerEnabled() && nTkrHouseKeeping>0) {
-            nDataReady = nTkrHouseKeeping + 7;
-            dataOut[0] = nDataReady;
-            dataOut[1] = 0xC7;
-            dataOut[2] = nTkrHouseKeeping;
-            dataOut[3] = byte16(tkrCmdCount,0);
-            dataOut[4] = byte16(tkrCmdCount,1);
-            dataOut[5] = tkrHouseKeepingFPGA;
-            dataOut[6] = tkrCmdCode;
-            for (int i=0; i<nTkrHouseKeeping; ++i) {
-                dataOut[6+i] = tkrHouseKeeping[i];
-            }
-            nTkrHouseKeeping = 0;
-        }
-        
-    }
-}
-
-/* [] END OF FILE */
+/* ========================================
+ *
+ * Robert P. Johnson
+ * Copyright U.C. Santa Cruz, 2020
+ * All Rights Reserved
+ * UNPUBLISHED, LICENSED SOFTWARE.
+ *
+ * CONFIDENTIAL AND PROPRIETARY INFORMATION
+ * WHICH IS THE PROPERTY OF U.C. Santa Cruz.
+ *
+ * Code to run in the Event PSOC on the AESOP-Lite DAQ board.
+ *
+ * ========================================
+*/
+#include "project.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+
+#define VERSION 1
+
+/*=========================================================================
+ *
+ * Calibration/PMT input connections, from left to right looking down at the end of the DAQ board:
+ *              T3        G        T4        T1        T2
+ * Connector  J10/12    J2/11    J17/18    J15/16    J25/26
+ * Peak det.   p4[3]    p4[7]     p3[0]     p0[7]     p3[4]
+ * Schem pin   11         17       13         7        20
+ * ADC          2          2        1         2         1
+ * ADC Chan     2          1        1         0         0
+ * Preamp      p4[6]    p3[2]     p3[3]     p4[5]      p2[0]
+ * Schem pin    9         16       15        14        19
+ * Channel      2          1        4         3         5 
+ * TOF                              2         1   
+ * Trig bit     1         N/A       0         3         2
+ *
+ * The 4 PSOC DACs are labeled by channel number.
+ * Note that T2 is the channel with the external 12-bit DAC for setting its threshold. The digital signal goes to p2[0].
+ * T1 and T4 are connected to the two channels that go to the TOF chip.
+ * The guard signal, G, does not participate in the trigger logic but is discriminated and registered in the data.
+ *
+ *  Event output format:
+ *  Header "ZERO" in ASCII (5A, 45, 52, 4F)
+ *  Event Header:
+ *      - Run number 2 bytes
+ *      - Event number 4 bytes (counts accepted triggers)
+ *      - Trigger time stamp 4 bytes
+ *      - Trigger count (including deadtime) 4 bytes
+ *      - real time and date 4 bytes
+ *      - Trigger status word 1 byte               
+ *  PHA Data:
+ *      - T1 2 bytes
+ *      - T2 2 bytes
+ *      - T3 2 bytes
+ *      - T4 2 bytes
+ *      - Guard 2 bytes
+ *      - extra channel 2 bytes (can be removed once not needed)
+ *  TOF Data:
+ *      Time difference in units of 10 ps, 2 bytes, signed integer
+ *  Tracker trigger count 2 bytes
+ *  Tracker command count 1 byte
+ *  Tracker trigger pattern 1 byte
+ *  TOF debugging data 10 bytes (can be removed once not needed)
+ *  Number of tracker boards 1 byte
+ *  Tracker Data
+ *  Trailer "FINI" in ASCII (46, 49, 4e, 49)
+ *
+ *  The Event PSOC can take commands from the USB-UART or main PSOC UART.    
+ *    Each command is formatted as "S1234<sp>xyW" repeated 3 times, followed by <cr><lf>
+ *    where 1234 are 4 ASCII characters, each representing a nibble 
+ *    12 gives us the data byte and 34 the address byte             
+ *    data byte: {7:0} gives the command code                 
+ *    address byte: {7:6} and {1:0] give the number of data-byte "commands" to follow, 0 to 15
+ *                  {5:2} = 0x8 indicate the event PSOC        
+ *    All data arrive in up to 15 subsequent data-byte "commands" For those,
+ *    bits {7:0} of the command byte are the data for the command in progress
+ *    bits {7:6} and {1:0} give the data-byte number, 1 through 15
+ *    Subsequent commands must wait until after the correct number of data bytes has arrived
+ *    The "xy" characters of the first command may carry a sequence number as two hex nibbles (1 to 255).
+ *    Anything else, such as the literal "xy", means an untagged command (sequence number 0).
+ *
+ *  Alternatively, a command with all of its data can be sent in a single binary frame. The two formats
+ *  can be mixed on the same input, since the parser looks at the first byte to decide which one it has:
+ *    Byte 0          sync byte 0xA5 (never appears in the ASCII format, which always starts with "S")
+ *    Byte 1          PSOC address (0x08 for the event PSOC)
+ *    Byte 2          sequence number, 0 for an untagged command
+ *    Byte 3          command code
+ *    Byte 4          number of data bytes, 0 to 16
+ *    Bytes 5 to n+4  data bytes
+ *    Last 2 bytes    CRC-16/CCITT (polynomial 0x1021, initial value 0xFFFF) of bytes 1 through n+4, MSB first
+ *
+ *  Output data of up to 3 bytes go out in a single 9-byte packet {0xDB, sequence number, 0xFF, 3 data bytes,
+ *  0xFF, 0x00, 0xFF}. Longer data start with a packet {0xDC, sequence number, 0xFF, length, length MSB,
+ *  length LSB, 0xFF, 0x00, 0xFF} followed by the data 3 bytes per 0xDC packet. The single length byte is
+ *  capped at 255 for long events, so a reader should take the 16-bit length whenever it is nonzero.
+ *
+ *  In the USB bulk output mode (output mode 2), each reply or event goes out instead as one record
+ *  {0xDD, sequence number, number of data bytes (2 bytes, MSB first), data bytes}, and the records are packed
+ *  back to back into full 64-byte USB packets. A partly filled packet is sent after about 10 ms without output,
+ *  and a transfer that ends on a full packet is ended by a zero-length packet at that point.
+ *  The 9-byte packets of the USB-UART output mode are packed into 64-byte USB packets in the same way,
+ *  except that command replies are sent right away.
+ *
+ *  The second byte of every output packet header holds the sequence number of the command that produced it,
+ *  or 0 for untagged commands, events and other unsolicited data. A tagged command that has no data to return
+ *  is answered with a 3-byte packet {command code, 0xAC, 0x00}; a tagged command that is ignored because the
+ *  trigger is enabled is answered with {command code, 0xAE, error code}.
+ *
+ *    The following commands are defined:
+ *    Byte Code    Number Data Bytes            Data Byte Definition
+ */
+/* I2C mode */
+#define ACK  (1u)
+#define NACK (0u)
+#define I2C_READ (1u)
+#define I2C_WRITE (0u)
+
+/* Default DAC threshold setting */
+#define THRDEF (5u)
+
+/* Timeout in 5 millisecond units when waiting for command completion */
+#define TIMEOUT 200u 
+
+/* Packet IDs */
+#define FIX_HEAD ('\xDB')
+#define VAR_HEAD ('\xDC')
+#define BULK_HEAD ('\xDD')
+#define LINK_HEAD ('\xDE')
+
+/* Replies to tagged commands that do not return data */
+#define CMD_ACK 0xACu
+#define CMD_NAK 0xAEu
+
+#if defined (__GNUC__)
+    /* Add an explicit reference to the floating point printf library */
+    /* to allow the usage of floating point conversion specifiers. */
+    /* This is not linked in by default with the newlib-nano library. */
+    asm (".global _printf_float");
+#endif
+
+#define FIFO_LEN 100
+#define MXERR 64
+#define MAX_CMD_DATA 16
+#define TOFSIZE 17
+#define TKRHOUSE_LEN 70
+#define TOFMAX_EVT 64
+#define MAX_TKR_BOARDS 8
+#define MAX_TKR_BOARD_BYTES 203     // Two leading bytes, 12 bit header, 12 chips * (12-bit header and up to 10 12-bit cluster words) + CRC byte
+#define USBFS_DEVICE (0u)
+#define BUFFER_LEN  64u            // Size of one USB-UART packet
+#define CMD_RING_LEN 256u          // Size of the circular buffer for incoming command bytes (several commands)
+#define MAX_DATA_OUT (52 + MAX_TKR_BOARDS*(2 + MAX_TKR_BOARD_BYTES) + 4)   // Largest possible event: header, all hit lists, trailer
+#define MXERR 64
+#define SPI_OUTPUT 0u
+#define USBUART_OUTPUT 1u
+#define USB_BULK_OUTPUT 2u
+#define USB_PACKET_LEN 64u         // Full-speed bulk packet size
+#define USB_FLUSH_TIME 2u          // Send a partly filled USB packet, or end a transfer, after this many 5 ms clock ticks
+#define CALMASK 1u
+#define DATAMASK 2u
+#define TRIGMASK 3u
+
+#define ERR_DAC_LOAD 1u
+#define ERR_DAC_READ 2u 
+#define ERR_TOF_DAC_LOAD 3u
+#define ERR_TOF_DAC_READ 4u
+#define ERR_CMD_IGNORE 5u
+#define ERR_TKR_READ_TIMEOUT 6u
+#define ERR_TKR_BAD_ID 7u
+#define ERR_TKR_BAD_LENGTH 8u
+#define ERR_TKR_BAD_ECHO 9u
+#define ERR_GET_TKR_DATA 10u
+#define ERR_TKR_BAD_FPGA 11u
+#define ERR_TKR_BAD_TRAILER 12u
+#define ERR_TKR_BAD_NDATA 13u
+#define ERR_PMT_DAQ_TIMEOUT 14u
+#define ERR_TKR_NUM_BOARDS 15u
+#define ERR_TKR_BAD_BOARD_ID 16u
+#define ERR_TKR_BOARD_SHORT 17u
+#define ERR_TKR_NO_MEMORY 18u
+#define ERR_TX_FAILED 19u
+#define ERR_BAD_CMD 20u
+#define ERR_EVT_TOO_BIG 21u
+#define ERR_BAD_BYTE 22u
+#define ERR_TKR_BAD_STATUS 23u
+#define ERR_TKR_TRG_ENABLE 24u
+#define ERR_TKR_BAD_TRGHEAD 25u
+#define ERR_BAD_CRC 26u
+#define ERR_BAD_FRAME 27u
+#define ERR_CMD_OVERFLOW 28u
+#define ERR_TKR_TX_FULL 29u
+#define ERR_TKR_NO_REPLY 30u
+#define ERR_TKR_IMAGE 31u
+#define ERR_L2_CONFIG 32u
+#define ERR_TRG_CLASS 33u
+#define ERR_DEGRADE_CONFIG 34u
+
+#define TKR_READ_TIMEOUT 31u    // Length of time to wait before giving a time-out error
+#define TKR_TX_LEN 64u          // Size of the queue of bytes waiting to go out to the Tracker
+#define TKR_MAX_PENDING 8u      // Maximum number of Tracker commands waiting for a reply
+#define TKR_REPLY_TIMEOUT 200u  // Give up on a Tracker reply after 1 second
+#define TKR_IMAGE_LEN 2048u     // Size of the staged Tracker configuration image; larger images are sent in parts
+#define TKR_IMAGE_MAP_LEN ((TKR_IMAGE_LEN/3 + 7)/8)   // Bytes in the pass/fail bitmap, one bit per record of at least 3 bytes
+#define TKR_RX_LEN 264u         // Longest Tracker reply kept whole: a housekeeping frame with 255 data bytes
+
+// Formats of Tracker replies, known from the command that the reply answers
+#define TKR_RX_FRAME 0u         // {length, ID code, ...}: event data, housekeeping or command echo
+#define TKR_RX_ASIC 1u          // ASIC register data: {n, n bytes}
+#define TKR_RX_I2C 2u           // Four bytes of i2c register data
+#define TKR_RX_TRIGGER 3u       // Calibration trigger primitives: a rubbish byte, then 9 bytes
+
+// What continues once a Tracker reply is complete or has been given up on (see tkrComplete)
+#define TKR_NO_REPLY 0u         // No reply expected
+#define TKR_FOR_NONE 1u         // Nothing waits for the reply (housekeeping still goes out by taskHousekeeping)
+#define TKR_FOR_COMMAND 2u      // The reply goes out as the reply of the command in tkrCmdWait
+#define TKR_FOR_STATUS 3u       // Event build: data-ready status, then the read-event command
+#define TKR_FOR_EVENT 4u        // Event build: the event hit lists
+#define TKR_FOR_IMAGE 5u        // The configuration image record being sent
+#define TKR_FOR_TRG_ENABLE 6u   // The trigger-enable echo at the start of a run
+
+// Progress of the Tracker readout of an event (evtTkrStep)
+#define EVT_TKR_IDLE 0u         // Not started
+#define EVT_TKR_STATUS 1u       // Waiting for the Tracker to report that the data are ready
+#define EVT_TKR_READ 2u         // Waiting for the event data
+#define EVT_TKR_DONE 3u         // Data in, or given up on: taskEventBuild can finish the event
+
+//added for new cmd buffer parsing -Brian Lucas
+#define WRAPINC(a,b) ((a + 1) % (b)) //Macro to increment an index a around a circular buffer of size b  
+#define WRAP(a,b) ((a) % (b)) //Macro to bring new calculated index a into the bounds of a circular buffer of size b
+
+// Binary command frames
+#define ASCII_CMD_LEN 29u                 // Length of a triplicated ASCII command, including <cr><lf>
+#define BIN_SYNC 0xA5u                    // First byte of a binary command frame
+#define BIN_HEAD_LEN 5u                   // Sync, address, sequence number, command code, number of data bytes
+#define BIN_FRAME_LEN(n) (BIN_HEAD_LEN + (n) + 2u)
+
+// ASCII code translation to hex nibbles. Illegal characters get translated to 0.
+const uint8 code[256] = {
+    ['1'] = 1, ['2'] = 2, ['3'] = 3, ['4'] = 4, ['5'] = 5, ['6'] = 6, ['7'] = 7, ['8'] = 8, ['9'] = 9,
+    ['A'] = 10, ['B'] = 11, ['C'] = 12, ['D'] = 13, ['E'] = 14, ['F'] = 15,
+    ['a'] = 10, ['b'] = 11, ['c'] = 12, ['d'] = 13, ['e'] = 14, ['f'] = 15   // not case sensitive for ABCDEF
+};
+
+// Lookup table for the CRC-16/CCITT used to protect binary command frames
+const uint16 crcTable[256] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+    0x1231, 0x0210, 0x3273, 0x2252, 0x52B5, 0x4294, 0x72F7, 0x62D6,
+    0x9339, 0x8318, 0xB37B, 0xA35A, 0xD3BD, 0xC39C, 0xF3FF, 0xE3DE,
+    0x2462, 0x3443, 0x0420, 0x1401, 0x64E6, 0x74C7, 0x44A4, 0x5485,
+    0xA56A, 0xB54B, 0x8528, 0x9509, 0xE5EE, 0xF5CF, 0xC5AC, 0xD58D,
+    0x3653, 0x2672, 0x1611, 0x0630, 0x76D7, 0x66F6, 0x5695, 0x46B4,
+    0xB75B, 0xA77A, 0x9719, 0x8738, 0xF7DF, 0xE7FE, 0xD79D, 0xC7BC,
+    0x48C4, 0x58E5, 0x6886, 0x78A7, 0x0840, 0x1861, 0x2802, 0x3823,
+    0xC9CC, 0xD9ED, 0xE98E, 0xF9AF, 0x8948, 0x9969, 0xA90A, 0xB92B,
+    0x5AF5, 0x4AD4, 0x7AB7, 0x6A96, 0x1A71, 0x0A50, 0x3A33, 0x2A12,
+    0xDBFD, 0xCBDC, 0xFBBF, 0xEB9E, 0x9B79, 0x8B58, 0xBB3B, 0xAB1A,
+    0x6CA6, 0x7C87, 0x4CE4, 0x5CC5, 0x2C22, 0x3C03, 0x0C60, 0x1C41,
+    0xEDAE, 0xFD8F, 0xCDEC, 0xDDCD, 0xAD2A, 0xBD0B, 0x8D68, 0x9D49,
+    0x7E97, 0x6EB6, 0x5ED5, 0x4EF4, 0x3E13, 0x2E32, 0x1E51, 0x0E70,
+    0xFF9F, 0xEFBE, 0xDFDD, 0xCFFC, 0xBF1B, 0xAF3A, 0x9F59, 0x8F78,
+    0x9188, 0x81A9, 0xB1CA, 0xA1EB, 0xD10C, 0xC12D, 0xF14E, 0xE16F,
+    0x1080, 0x00A1, 0x30C2, 0x20E3, 0x5004, 0x4025, 0x7046, 0x6067,
+    0x83B9, 0x9398, 0xA3FB, 0xB3DA, 0xC33D, 0xD31C, 0xE37F, 0xF35E,
+    0x02B1, 0x1290, 0x22F3, 0x32D2, 0x4235, 0x5214, 0x6277, 0x7256,
+    0xB5EA, 0xA5CB, 0x95A8, 0x8589, 0xF56E, 0xE54F, 0xD52C, 0xC50D,
+    0x34E2, 0x24C3, 0x14A0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+    0xA7DB, 0xB7FA, 0x8799, 0x97B8, 0xE75F, 0xF77E, 0xC71D, 0xD73C,
+    0x26D3, 0x36F2, 0x0691, 0x16B0, 0x6657, 0x7676, 0x4615, 0x5634,
+    0xD94C, 0xC96D, 0xF90E, 0xE92F, 0x99C8, 0x89E9, 0xB98A, 0xA9AB,
+    0x5844, 0x4865, 0x7806, 0x6827, 0x18C0, 0x08E1, 0x3882, 0x28A3,
+    0xCB7D, 0xDB5C, 0xEB3F, 0xFB1E, 0x8BF9, 0x9BD8, 0xABBB, 0xBB9A,
+    0x4A75, 0x5A54, 0x6A37, 0x7A16, 0x0AF1, 0x1AD0, 0x2AB3, 0x3A92,
+    0xFD2E, 0xED0F, 0xDD6C, 0xCD4D, 0xBDAA, 0xAD8B, 0x9DE8, 0x8DC9,
+    0x7C26, 0x6C07, 0x5C64, 0x4C45, 0x3CA2, 0x2C83, 0x1CE0, 0x0CC1,
+    0xEF1F, 0xFF3E, 0xCF5D, 0xDF7C, 0xAF9B, 0xBFBA, 0x8FD9, 0x9FF8,
+    0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93, 0x3EB2, 0x0ED1, 0x1EF0
+};
+
+// Add one byte to a running CRC-16/CCITT. Start with crc = 0xFFFF.
+uint16 crc16(uint16 crc, uint8 theByte) {
+    return (crc << 8) ^ crcTable[((crc >> 8) ^ theByte) & 0xFF];
+}
+
+uint8 buffer[CMD_RING_LEN];  // Circular Buffer for incoming UART and USB-UART commands
+uint16 bufferRead = 0; //index of byte to read circular raw ASCII buffer of commands -Brian
+uint16 bufferWrite = 0; //index of byte to write circular raw ASCII buffer of commands, if read = write then empty
+uint32 nCmdBytesLost = 0;     // Command bytes overwritten because the circular buffer was full
+uint32 nCmdBytesSkipped = 0;  // Command bytes discarded by the parser while looking for a valid command
+uint16 cmdBufferMaxFill = 0;  // Largest number of bytes seen waiting in the circular buffer
+
+uint16 nDataReady;
+uint8 cmdSeq = 0;                 // Sequence number of the command being executed, 0 if untagged
+uint8 dataSeq = 0;                // Sequence number to put in the header of the data in dataOut
+uint8 dataOut[MAX_DATA_OUT + 2];  // Buffer for output data, with room to pad out the last 3-byte packet
+uint16 tkrCmdCount;               // Command count returned from the Tracker
+uint8 tkrCmdCode;                 // Command code echoed from the Tracker
+
+// Register pointers for the power monitoring chips
+const uint8 INA226_Config_Reg = 0x00;
+const uint8 INA226_ShuntV_Reg = 0x01;
+const uint8 INA226_BusV_Reg = 0x02;
+const uint8 INA226_Power_Reg = 0x03;
+const uint8 INA226_Current_Reg = 0x04;
+const uint8 INA226_Calib_Reg = 0x05;
+const uint8 INA226_Mask_Reg = 0x06;
+const uint8 INA226_Alert_Reg = 0x07;
+
+const uint8 I2C_Address_TMP100 = '\x48';
+const uint8 TMP100_Temp_Reg = '\x00';
+const uint8 I2C_Address_Barometer = '\x70';
+const uint8 I2C_Address_RTC = '\x6F';
+
+// Masks for DC control register
+const uint8 LED1 = '\x08';
+const uint8 LED2 = '\x10';
+const uint8 RSTPEAK = '\x10';
+const uint8 TKRLED = '\x20'; 
+const uint8 DATLED = '\x40';
+
+#define trgBit_T4 = 0x01;
+#define trgBit_T3 = 0x02;
+#define trgBit_T2 = 0x04;
+#define trgBit_T1 = 0x08;
+
+/* Bit definitions for the pulse control register */
+#define PULSE_TOF_RESET 0x01
+#define PULSE_TKR_TRIG 0x02
+#define PULSE_LOGIC_RST 0x04
+#define PULSE_CNTR_RST 0x08
+
+// Slave addresses for the SPI interface
+const uint8 SSN_TOF = 2;
+const uint8 SSN_Main = 1;
+
+const uint8 triggerEnable_Mask = '\x04';
+const uint8 SSN_Mask = '\xFC';
+
+// Command codes for the TOF chip
+const uint8 TOF_enable = 0x18;
+const uint8 powerOnRESET = 0x30;
+const uint8 writeConfig = 0x80;
+const uint8 readConfig = 0x40;
+const uint8 readResults =  0x60;
+
+RTC_1_TIME_DATE* timeDate;
+
+// TOF circular data buffers
+struct TOF {
+    uint32 shiftReg[TOFMAX_EVT];
+    uint16 clkCnt[TOFMAX_EVT];
+    bool filled[TOFMAX_EVT];
+    uint8 ptr;
+} tofA, tofB;
+
+// Result of matching the two TOF channels with an event
+struct TOFmatch {
+    uint8 nA;          // Number of channel A readouts within two clock periods of the event
+    uint8 nB;          // Number of channel B readouts within two clock periods of the event
+    int16 dtmin;       // Smallest time difference B - A, in 10 picosecond units, 32767 if there was no pair
+    uint16 aTOF;       // TOF chip reference clocks of that pair
+    uint16 bTOF;
+    uint16 aCLK;       // Internal clock at the time of those TOF readouts
+    uint16 bCLK;
+};
+bool outputTOF;
+uint32 tofA_sampleArray[3] = {0};
+uint32 tofB_sampleArray[3] = {0};
+
+// Temporary storage of Tracker housekeeping data
+uint8 nTkrHouseKeeping;
+uint8 tkrHouseKeepingFPGA;
+uint8 tkrHouseKeepingCMD;
+uint8 tkrHouseKeeping[TKRHOUSE_LEN];
+
+// Tracker command transactions. Outgoing commands are queued in tkrTxBuf and fed to the UART hardware
+// FIFO as it empties, and each reply is matched to the oldest pending transaction with the same command code.
+struct TkrTransaction {
+    uint8 fpga;
+    uint8 code;
+    uint8 owner;        // What continues when the reply comes in, TKR_FOR_*
+    uint32 order;       // Transaction number, to find the oldest one
+    uint32 sendTime;    // time() when the command was queued
+    bool pending;
+};
+struct TkrTransaction tkrTrans[TKR_MAX_PENDING];
+uint8 tkrTxBuf[TKR_TX_LEN];
+uint16 tkrTxRead = 0;
+uint16 tkrTxWrite = 0;
+uint32 nTkrTransactions = 0;  // Commands queued for the Tracker
+uint32 nTkrUnmatched = 0;     // Replies that matched no pending transaction
+uint32 nTkrNoReply = 0;       // Transactions dropped after waiting TKR_REPLY_TIMEOUT for a reply
+
+// Staged Tracker configuration image: a list of Tracker command records {FPGA, code, nData, data}, loaded
+// in blocks by command 0x4A and then sent to the Tracker one record per scheduler pass after command 0x4B
+uint8 tkrImage[TKR_IMAGE_LEN];
+uint16 tkrImageLen = 0;
+uint16 tkrImagePtr = 0;                // Offset of the next record to send
+uint16 nTkrImageRecords = 0;           // Records sent so far
+uint16 nTkrImageFailed = 0;
+uint8 tkrImageFail[TKR_IMAGE_MAP_LEN]; // Bit set for each record that got no good reply
+uint8 tkrImageSeq = 0;                 // Sequence number of the 0x4B command, for the reply
+bool tkrImageRunning = false;
+bool tkrImageWait = false;             // The record sent is waiting for its reply
+bool tkrImageSent = false;             // The record has been sent, and tkrImageOK tells how it went
+bool tkrImageOK = false;
+
+// Tracker reply being received. Bytes are parsed as they come in, by taskTracker, and whatever was waiting
+// for the reply continues from tkrComplete once it is whole. Event hit lists go straight into tkrData.
+struct TkrRx {
+    uint8 kind;         // TKR_RX_*, from the oldest pending transaction when the first byte came in
+    uint8 code;         // Command code of that transaction
+    uint8 owner;        // TKR_FOR_* of the transaction the reply was matched to
+    uint16 n;           // Bytes received into buf
+    uint16 need;        // Bytes needed in buf before the reply is looked at again; 0 between replies
+    uint8 brd;          // Event frames: boards done
+    uint8 lyr;          // Event frames: layer of the hit list being received
+    uint8 nHit;         // Event frames: bytes of that hit list received, 0 outside of a hit list
+    uint8 nBrdBytes;    // Event frames: length of that hit list
+    uint32 startTime;   // time() when the first byte came in, for the read time-out
+    uint8 buf[TKR_RX_LEN];
+} tkrRx;
+
+// Command waiting for its Tracker reply. No other command is executed until the reply has gone out.
+uint8 tkrCmdWait = 0;                  // Command code, 0 if none
+uint8 tkrCmdSeq = 0;                   // Its sequence number
+bool tkrCmdReplied = false;            // The Tracker reply came in, or was given up on
+bool tkrCmdOK = false;
+uint8 tkrCmdReply[TKR_RX_LEN];         // The reply bytes to send out
+uint16 nTkrCmdReply = 0;
+uint8 tkrCalFPGA;                      // FPGA whose calibration trigger data are expected (command 0x42)
+
+// Tracker part of the event readout
+uint8 evtTkrStep = EVT_TKR_IDLE;
+uint8 nTkrStatusTry = 0;
+bool evtTkrOK = false;
+
+uint32 timeStamp;
+uint8 trgStatus;
+bool triggered;
+
+struct TkrData {
+    uint16 triggerCount;
+    uint8 cmdCount;
+    uint8 trgPattern;              // bit 7 = non-bending; bit 6 = bending
+    uint8 nTkrBoards;              // number of boards read out
+    struct BoardHits {
+        uint8 nBytes;              // number of bytes in the hit list
+        uint8* hitList;            // pointer to the variable length hit list
+    } boardHits[MAX_TKR_BOARDS];
+} tkrData;
+
+struct Error {
+    uint8 errorCode;
+    uint8 value0;
+    uint8 value1;
+} errors[MXERR];
+uint8 nErrors = 0;
+
+uint32 clkCnt;
+uint32 time() {
+    //uint8 cnt200val = Counter_1_ReadCounter();
+    uint8 cnt200val = Cntr8_Timer_ReadCount();
+    return clkCnt + cnt200val;
+}
+
+char8 *parity[] = { "None", "Odd", "Even", "Mark", "Space" };
+char8 *stop[] = { "1", "1.5", "2" };
+
+uint16 ch1Count, ch1CountSave;
+uint16 ch2Count, ch2CountSave;
+uint16 ch3Count, ch3CountSave;
+uint16 ch4Count, ch4CountSave;
+uint16 ch5Count, ch5CountSave;
+uint8 ch1CtrSave, ch2CtrSave, ch3CtrSave, ch4CtrSave, ch5CtrSave;
+uint32 cntGO;
+uint32 cntGO1;
+uint16 runNumber;
+uint16 runMaxEvents;      // Number of events kept after which the run ends by itself, 0 for no limit
+uint32 nEvtKept;          // Events of this run kept for output, not prescaled away or rejected by the level-2 filter
+uint16 runMaxSeconds;     // Duration in seconds after which the run ends by itself, 0 for no limit
+bool runLimited = false;  // A run with a limit is in progress and has not yet ended
+
+/* Defines for DMA_1 and DMA_2 */
+#define DMA_BYTES_PER_BURST 2
+#define DMA_REQUEST_PER_BURST 1
+#define DMA_NO_OF_SAMPLES 3
+#define DMA_SRC_BASE (CYDEV_PERIPH_BASE)
+#define DMA_DST_BASE (CYDEV_SRAM_BASE)
+
+void LED2_OnOff(bool on) {
+    uint8 status = Control_Reg_SSN_Read() & ~LED2;
+    if (on) {
+        Control_Reg_SSN_Write(status | LED2);
+    } else {
+        Control_Reg_SSN_Write(status);
+    }
+}
+
+void addError(uint8 code, uint8 val1, uint8 val2) {
+    if (nErrors < MXERR) {
+        errors[nErrors].errorCode = code;
+        errors[nErrors].value0 = val1;
+        errors[nErrors].value1 = val2;
+        nErrors++;
+    }
+}
+
+// Load a single I2C byte register
+uint8 loadI2Creg(uint8 I2C_Address, uint8 regAddress, uint8 regValue) {
+
+    // Send the start byte, with address
+    uint8 rc = I2C_2_MasterSendStart(I2C_Address,I2C_WRITE);
+    if (rc != I2C_2_MSTR_NO_ERROR) return rc;
+    
+    // Send the register address
+    rc = I2C_2_MasterWriteByte(regAddress);
+    if (rc != I2C_2_MSTR_NO_ERROR) return rc;
+    
+    // Send the register value
+    rc = I2C_2_MasterWriteByte(regValue);
+    if (rc != I2C_2_MSTR_NO_ERROR) return rc;
+    
+    // Send the stop condition
+    rc = I2C_2_MasterSendStop();
+    if(rc != I2C_2_MSTR_NO_ERROR) return rc;
+    
+    /* Wait for the data transfer to complete */
+    rc = I2C_2_MasterStatus();
+    if (rc != I2C_2_MSTAT_CLEAR) {
+        while(I2C_2_MasterStatus() == I2C_2_MSTAT_XFER_INP) CyDelay(100);
+    }  
+    
+    return 0;    
+}
+
+// Read bytes from an I2C chip register
+uint8 readI2Creg(int nBytes, uint8 I2C_Address, uint8 regAddress, uint8 regValue[]) {
+   
+    // Send the start byte, with address and control set to write
+    uint8 rc = I2C_2_MasterSendStart(I2C_Address,I2C_WRITE);
+    if (rc != I2C_2_MSTR_NO_ERROR) return rc;
+    
+    // Send the register address
+    rc = I2C_2_MasterWriteByte(regAddress);
+    if (rc != I2C_2_MSTR_NO_ERROR) return rc;
+
+    // Send the stop condition
+    rc = I2C_2_MasterSendStop();
+    if(rc != I2C_2_MSTR_NO_ERROR) return rc;    
+
+    // Wait for the data transfer to complete 
+    rc = I2C_2_MasterStatus();
+    if (rc != I2C_2_MSTAT_CLEAR) {
+        while(I2C_2_MasterStatus() == I2C_2_MSTAT_XFER_INP) CyDelay(100);
+    }      
+    
+    // Send the start byte, with address and control set to read
+    rc = I2C_2_MasterSendStart(I2C_Address,I2C_READ);
+    if (rc != I2C_2_MSTR_NO_ERROR) return rc;
+    
+    for (int i=0; i<nBytes-1; ++i) {
+        regValue[i] = I2C_2_MasterReadByte(ACK);
+    }
+    regValue[nBytes-1] = I2C_2_MasterReadByte(NACK);
+        
+    // Send the stop condition
+    rc = I2C_2_MasterSendStop();
+    if(rc != I2C_2_MSTR_NO_ERROR) return rc;
+    
+    /* Wait for the data transfer to complete */
+    rc = I2C_2_MasterStatus();
+    if (rc != I2C_2_MSTAT_CLEAR) {
+        while(I2C_2_MasterStatus() == I2C_2_MSTAT_XFER_INP) CyDelay(100);
+    }  
+    
+    return 0;    
+}
+
+// Load the AD5622 DAC
+uint8 loadDAC(uint8 I2C_Address, uint16 voltage) {
+    
+    uint8 nib0 = (voltage & 0x00FF);
+    uint8 nib1 = (voltage & 0x0F00)>>8;
+    
+    uint8 rc;
+    
+    rc = I2C_2_MasterSendStart(I2C_Address,I2C_WRITE);
+    if (rc != I2C_2_MSTR_NO_ERROR) return rc;
+    
+    rc = I2C_2_MasterWriteByte(nib1);
+    if (rc != I2C_2_MSTR_NO_ERROR) return rc;
+    
+    rc = I2C_2_MasterWriteByte(nib0);
+    if(rc != I2C_2_MSTR_NO_ERROR) return rc;
+    
+    rc = I2C_2_MasterSendStop();
+    if(rc != I2C_2_MSTR_NO_ERROR) return rc;
+    
+    /* Wait for the data transfer to complete */
+    rc = I2C_2_MasterStatus();
+    if (rc != I2C_2_MSTAT_CLEAR) {
+        while(I2C_2_MasterStatus() == I2C_2_MSTAT_XFER_INP) CyDelay(100);
+    }  
+    
+    return 0;
+} // end of loadDAC
+
+// Read back the setting from the AD5622 DAC and return it
+uint8 readDAC(uint8 I2C_Address, uint16* rvalue) {
+           
+    uint8 bytes[2];
+    //I2C_2_MasterClearReadBuf();
+    //uint8 rc = I2C_2_MasterReadBuf(I2C_Address, bytes, 2, I2C_2_MODE_COMPLETE_XFER);
+    uint8 rc = I2C_2_MasterSendStart(I2C_Address,I2C_READ);
+    if (rc != I2C_2_MSTR_NO_ERROR) return rc;    
+
+    bytes[0] = I2C_2_MasterReadByte(ACK);
+    bytes[1] = I2C_2_MasterReadByte(NACK);
+
+    rc = I2C_2_MasterSendStop();
+    if (rc != I2C_2_MSTR_NO_ERROR) return rc;
+
+    *rvalue = ((uint16)(bytes[0] & '\x3F'))<<6;
+    *rvalue = *rvalue | ((uint16)(bytes[1] & '\xFC')>>2);
+    
+    rc = I2C_2_MasterStatus();    
+    if (rc != I2C_2_MSTAT_CLEAR) {
+        while(I2C_2_MasterStatus() == I2C_2_MSTAT_XFER_INP) CyDelay(100);
+    } 
+    return 0;
+}
+
+bool isTriggerEnabled() {
+    uint8 regValue = Control_Reg_SSN_Read();
+    return (regValue & triggerEnable_Mask);
+}
+
+// A run is in progress while the trigger is enabled or while a triggered event is waiting to be read out
+// (the GO interrupt disables the trigger until the event has been sent out).
+bool isRunInProgress() {
+    return isTriggerEnabled() || triggered;
+}
+
+// True once a run started with an event or time limit has reached it. The clock counter is reset at the
+// start of each run, so time() is the run duration in 5 ms ticks.
+bool runLimitReached() {
+    if (!runLimited) return false;
+    if (runMaxEvents > 0 && nEvtKept >= runMaxEvents) return true;
+    return runMaxSeconds > 0 && time() >= (uint32)runMaxSeconds*200u;
+}
+
+// Commands that only read back values already held in the PSOC, without using the I2C, SPI or tracker
+// interfaces, take a few microseconds and are safe to execute between events during a run.
+bool isRunSafe(uint8 cmd) {
+    switch (cmd) {
+        case 0x03:   // Read the error codes
+        case 0x07:   // Version number
+        case 0x33:   // Saved channel counter
+        case 0x34:   // Number of TOF events stored
+        case 0x37:   // Channel counter
+        case 0x3D:   // Trigger enable status
+        case 0x3E:   // Trigger mask register
+        case 0x46:   // RTC time and date
+        case 0x47:   // Command input statistics
+        case 0x48:   // Task scheduler statistics
+        case 0x49:   // Tracker transaction counters
+        case 0x4D:   // Level-2 filter counters
+        case 0x50:   // SPI link credits
+        case 0x51:   // SPI link counters
+        case 0x53:   // Event content level and backlog
+            return true;
+    }
+    return false;
+}
+
+void setPeakDetResetWait(uint8 waitTime) {
+    Count7_3_WritePeriod(waitTime);
+}
+
+void setTriggerMask(char trigger, uint8 mask) {
+    mask = mask & 0x0F;
+    if (trigger == 'e') {
+        Control_Reg_Trg1_Write(mask);
+    } else if (trigger == 'p') {
+        Control_Reg_Trg2_Write(mask);
+    }
+}
+
+uint8 getTriggerMask(char trigger) {
+    if (trigger == 'e') return Control_Reg_Trg1_Read();
+    else if (trigger == 'p') return Control_Reg_Trg2_Read();
+    return 0;
+}
+
+// Control of the SPI slave address. The slave select is active low.
+// Note that the TOF chip needs to go high, for reset, before each SPI transaction.
+void set_SPI_SSN(uint8 SSN, bool clearBuffer) {
+    // SSN = SSN_Main = 1 for main PSOC
+    // SSN = SSN_TOF  = 2 for TOF chip
+    // SSN = 0 (or anything else) to deselect all slaves
+    while (!(SPIM_ReadTxStatus() & SPIM_STS_SPI_IDLE));
+    uint8 regValue = Control_Reg_SSN_Read() & SSN_Mask;
+    Control_Reg_SSN_Write(regValue | (SSN_Main | SSN_TOF));
+    if (SSN == SSN_TOF) {
+        Control_Reg_SSN_Write(regValue | SSN_Main);
+    } else if (SSN == SSN_Main) {
+        Control_Reg_SSN_Write(regValue | SSN_TOF);
+    }
+    if (clearBuffer) SPIM_ClearTxBuffer();
+}
+
+// Control of the trigger enable bit
+void triggerEnable(bool enable) {
+    uint8 regValue = Control_Reg_SSN_Read() & ~triggerEnable_Mask;
+    if (enable) {
+        // Reset the TOF chip time reference. It also gets reset every 5 ms by interrupt.
+        //Control_Reg_Pls_Write(PULSE_TOF_RESET);
+        
+        // Enable both TOF chip channels
+        //set_SPI_SSN(SSN_TOF, true);
+        //SPIM_WriteTxData(writeConfig+1);
+        //SPIM_WriteTxData(0x05);
+        
+        // Enable the master trigger
+        Control_Reg_SSN_Write(regValue | triggerEnable_Mask);  
+    } else {
+        //LED2_OnOff(false);
+        // Disable the master trigger
+        Control_Reg_SSN_Write(regValue);
+        
+        // Stop the TOF chip acquisition by disabling both channels
+        //set_SPI_SSN(SSN_TOF, true);
+        //SPIM_WriteTxData(writeConfig+1);
+        //SPIM_WriteTxData(0x00);
+    }
+}
+
+uint8 byte32(uint32 word, int byte) {
+    const uint32 mask[4] = {0xFF000000, 0x00FF0000, 0x0000FF00, 0x000000FF};
+    return (uint8)((word & mask[byte]) >> (3-byte)*8);
+}
+uint8 byte16(uint16 word, int byte) {
+    const uint16 mask[2] = {0xFF00, 0x00FF};
+    return (uint8)((word & mask[byte]) >> (1-byte)*8);
+}
+
+// Copy newly received command bytes into the circular command buffer. If the buffer fills up,
+// the oldest unparsed bytes are overwritten and counted as lost.
+void cmdBufferPut(uint8* bytes, uint16 nBytes) {
+    uint16 nLost = 0;
+    for (uint16 i=0; i<nBytes; ++i) {
+        buffer[bufferWrite] = bytes[i];
+        bufferWrite = WRAPINC(bufferWrite, CMD_RING_LEN);
+        if (bufferWrite == bufferRead) {  // buffer full, discard the oldest byte
+            bufferRead = WRAPINC(bufferRead, CMD_RING_LEN);
+            nLost++;
+        }
+    }
+    if (nLost > 0) {
+        nCmdBytesLost += nLost;
+        addError(ERR_CMD_OVERFLOW, byte16(nLost, 0), byte16(nLost, 1));
+    }
+    uint16 fill = WRAP((CMD_RING_LEN - bufferRead + bufferWrite), CMD_RING_LEN);
+    if (fill > cmdBufferMaxFill) cmdBufferMaxFill = fill;
+}
+
+void logicReset() {
+    //LED2_OnOff(true);
+    int state = isr_clk200_GetState();
+    isr_clk200_Disable();
+    int stateTrg = isr_GO1_GetState();
+    isr_GO1_Disable();
+    clkCnt = 0;             
+    ch1Count = 0;
+    ch2Count = 0;
+    ch3Count = 0;
+    ch4Count = 0;
+    ch5Count = 0;
+    cntGO = 0;
+    cntGO1 = 0;
+    Control_Reg_Pls_Write(PULSE_LOGIC_RST);
+    Control_Reg_Pls_Write(PULSE_CNTR_RST);
+    CyDelay(20);
+    if (stateTrg) isr_GO1_Enable();
+    if (state) isr_clk200_Enable();
+    //LED2_OnOff(false);
+    tkrRx.need = 0;      // Drop any Tracker reply half received, before its hit lists go
+    tkrRx.nHit = 0;
+    for (int brd=0; brd<MAX_TKR_BOARDS; ++brd) {
+        if (tkrData.boardHits[brd].nBytes > 0) {
+            tkrData.boardHits[brd].nBytes = 0;
+            free(tkrData.boardHits[brd].hitList);
+        }
+    }
+}
+
+void tkrLED(bool on) {
+    if (on) {
+        uint8 status = Control_Reg_SSN_Read() & ~TKRLED;
+        Control_Reg_SSN_Write(status | TKRLED);
+    } else {
+        Timer_1_Start();
+    }
+}
+
+// Move queued command bytes into the Tracker UART hardware FIFO until it is full. The Tracker UART has no
+// transmit interrupt in this design, so this gets called from tkrSend and from the Tracker background task.
+void tkrTxPump() {
+    while (tkrTxRead != tkrTxWrite && !(UART_TKR_ReadTxStatus() & UART_TKR_TX_STS_FIFO_FULL)) {
+        UART_TKR_WriteTxData(tkrTxBuf[tkrTxRead]);
+        tkrTxRead = WRAPINC(tkrTxRead, TKR_TX_LEN);
+    }
+}
+
+// Queue a command for the Tracker without waiting for it to go out. Unless owner is TKR_NO_REPLY, the command
+// is entered as a pending transaction, to be matched up by tkrReply, and owner says what continues when the
+// reply comes in. Returns false if there is no room.
+bool tkrSend(uint8 fpga, uint8 code, uint8 nData, uint8* data, uint8 owner) {
+    uint16 nFree = TKR_TX_LEN - 1 - WRAP(TKR_TX_LEN - tkrTxRead + tkrTxWrite, TKR_TX_LEN);
+    if (nData + 3 > nFree) {
+        addError(ERR_TKR_TX_FULL, code, nData);
+        return false;
+    }
+    if (owner != TKR_NO_REPLY) {
+        int slot = -1;
+        for (uint8 i=0; i<TKR_MAX_PENDING; ++i) {
+            if (!tkrTrans[i].pending) {
+                slot = i;
+                break;
+            }
+        }
+        if (slot < 0) {
+            addError(ERR_TKR_TX_FULL, code, TKR_MAX_PENDING);
+            return false;
+        }
+        tkrTrans[slot].fpga = fpga;
+        tkrTrans[slot].code = code;
+        tkrTrans[slot].owner = owner;
+        tkrTrans[slot].order = nTkrTransactions;
+        tkrTrans[slot].sendTime = time();
+        tkrTrans[slot].pending = true;
+    }
+    nTkrTransactions++;
+    tkrCmdCode = code;
+    tkrTxBuf[tkrTxWrite] = fpga;
+    tkrTxWrite = WRAPINC(tkrTxWrite, TKR_TX_LEN);
+    tkrTxBuf[tkrTxWrite] = code;
+    tkrTxWrite = WRAPINC(tkrTxWrite, TKR_TX_LEN);
+    tkrTxBuf[tkrTxWrite] = nData;
+    tkrTxWrite = WRAPINC(tkrTxWrite, TKR_TX_LEN);
+    for (int i=0; i<nData; ++i) {
+        tkrTxBuf[tkrTxWrite] = data[i];
+        tkrTxWrite = WRAPINC(tkrTxWrite, TKR_TX_LEN);
+    }
+    tkrTxPump();
+    return true;
+}
+
+// Oldest pending transaction, or -1 if there is none
+int tkrOldest() {
+    int oldest = -1;
+    for (uint8 i=0; i<TKR_MAX_PENDING; ++i) {
+        if (!tkrTrans[i].pending) continue;
+        if (oldest < 0 || (int32)(tkrTrans[i].order - tkrTrans[oldest].order) < 0) oldest = i;
+    }
+    return oldest;
+}
+
+// Match a reply from the Tracker to the oldest pending transaction with the same command code. Replies come
+// back in the order the commands were sent, so repeats of the same command are told apart by their order.
+// The owner of the transaction is kept in tkrRx, for when the reply is complete.
+// Returns false if no transaction is waiting for it.
+bool tkrReply(uint8 code) {
+    int match = -1;
+    for (uint8 i=0; i<TKR_MAX_PENDING; ++i) {
+        if (!tkrTrans[i].pending || tkrTrans[i].code != code) continue;
+        if (match < 0 || (int32)(tkrTrans[i].order - tkrTrans[match].order) < 0) match = i;
+    }
+    if (match < 0) {
+        nTkrUnmatched++;
+        return false;
+    }
+    tkrTrans[match].pending = false;
+    tkrRx.owner = tkrTrans[match].owner;
+    return true;
+}
+
+uint8 nTkrPending() {
+    uint8 n = 0;
+    for (uint8 i=0; i<TKR_MAX_PENDING; ++i) {
+        if (tkrTrans[i].pending) n++;
+    }
+    return n;
+}
+
+// Ask the Tracker for the event data, once it has reported that they are ready
+void tkrReadEvent() {
+    uint8 trgTagMode = 0x00;       // Use internally generated trigger tags
+    evtTkrStep = EVT_TKR_READ;
+    tkrLED(true);
+    if (!tkrSend(0x00, 0x01, 1, &trgTagMode, TKR_FOR_EVENT)) {
+        evtTkrOK = false;
+        evtTkrStep = EVT_TKR_DONE;
+    }
+}
+
+// Continue whatever was waiting for a Tracker reply, now that the reply is complete (ok) or has been given up
+// on. The reply bytes are those to send out if a command asked for them.
+void tkrComplete(uint8 owner, bool ok, const uint8* reply, uint16 nReply) {
+    switch (owner) {
+        case TKR_FOR_COMMAND:
+            if (tkrCmdWait == 0) break;   // the command gave up waiting
+            memcpy(tkrCmdReply, reply, nReply);
+            nTkrCmdReply = nReply;
+            tkrCmdOK = ok;
+            tkrCmdReplied = true;
+            break;
+        case TKR_FOR_STATUS:   // Check that the Tracker has the data, asking again up to 10 times
+            if (evtTkrStep != EVT_TKR_STATUS) break;
+            nTkrStatusTry++;
+            if (ok && nTkrHouseKeeping > 0) {
+                nTkrHouseKeeping = 0;
+                if (tkrHouseKeeping[0] != 0x59 && nTkrStatusTry <= 9) {
+                    if (tkrHouseKeeping[0] != 0x4E) addError(ERR_TKR_BAD_STATUS, tkrHouseKeeping[0], nTkrStatusTry);
+                    if (tkrSend(0x00, 0x57, 0, NULL, TKR_FOR_STATUS)) break;
+                }
+            } else {
+                addError(ERR_TKR_BAD_STATUS, 0, nTkrStatusTry);
+            }
+            tkrReadEvent();
+            break;
+        case TKR_FOR_EVENT:
+            if (evtTkrStep != EVT_TKR_READ) break;   // the event was thrown out by the end of the run
+            evtTkrOK = ok;
+            evtTkrStep = EVT_TKR_DONE;
+            break;
+        case TKR_FOR_IMAGE:
+            tkrImageOK = ok;
+            tkrImageWait = false;
+            break;
+        case TKR_FOR_TRG_ENABLE:
+            if (!ok) addError(ERR_TKR_TRG_ENABLE, nReply == 3 ? reply[2] : 0, 1);
+            break;
+    }
+}
+
+// Finish the reply being received, and start looking for a new one with the next byte
+void tkrRxEnd(bool ok, const uint8* reply, uint16 nReply) {
+    uint8 owner = tkrRx.owner;
+    tkrRx.need = 0;
+    tkrRx.nHit = 0;
+    tkrComplete(owner, ok, reply, nReply);
+}
+
+// Start a new reply, in the format that the oldest pending transaction expects
+void tkrRxStart() {
+    int oldest = tkrOldest();
+    tkrRx.code = oldest < 0 ? 0 : tkrTrans[oldest].code;
+    tkrRx.owner = TKR_FOR_NONE;
+    tkrRx.n = 0;
+    tkrRx.nHit = 0;
+    tkrRx.startTime = time();
+    if (tkrRx.code >= 0x20 && tkrRx.code <= 0x25) {
+        tkrRx.kind = TKR_RX_ASIC;
+        tkrRx.need = 1;
+    } else if (tkrRx.code == 0x46) {
+        tkrRx.kind = TKR_RX_I2C;
+        tkrRx.need = 4;
+    } else if (tkrRx.code == 0x02) {
+        tkrRx.kind = TKR_RX_TRIGGER;
+        tkrRx.need = 10;
+    } else {
+        tkrRx.kind = TKR_RX_FRAME;
+        tkrRx.need = 2;
+    }
+}
+
+// Move on to the next hit list of an event frame, or finish the frame after the last one
+void tkrRxNextBoard() {
+    tkrRx.nHit = 0;
+    tkrRx.brd++;
+    if (tkrRx.brd < tkrData.nTkrBoards) {
+        tkrRx.n = 6;         // Keep the frame header, and receive the board header after it
+        tkrRx.need = 9;
+    } else {
+        tkrRxEnd(true, NULL, 0);
+    }
+}
+
+// Look at an event frame once tkrRx.need bytes are in: first the header, then the header of each hit list
+void tkrRxEvent() {
+    uint8* b = tkrRx.buf;
+    if (tkrRx.n == 6) {
+        tkrData.triggerCount = ((uint16)b[2] << 8) | b[3];
+        tkrData.cmdCount = b[4];
+        if (!tkrReply(0x01)) {
+            addError(ERR_TKR_BAD_ECHO, 0xD3, tkrData.cmdCount);
+        }
+        uint8 nBoards = b[5];
+        tkrData.trgPattern = nBoards & 0xC0;
+        nBoards = nBoards & 0x3F;
+        if (nBoards > MAX_TKR_BOARDS) {
+            addError(ERR_TKR_NUM_BOARDS, nBoards, tkrData.trgPattern);
+            nBoards = 0;
+        }
+        tkrData.nTkrBoards = nBoards;
+        tkrRx.brd = 0;
+        if (nBoards == 0) tkrRxEnd(true, NULL, 0);
+        else tkrRx.need = 9;
+        return;
+    }
+    uint8 brd = tkrRx.brd;
+    uint8 nBrdBytes = b[6];         // Length of the hit list, in bytes
+    if (nBrdBytes < 4) {
+        addError(ERR_TKR_BOARD_SHORT, nBrdBytes, brd);
+        tkrRxEnd(false, NULL, 0);
+        return;
+    }
+    uint8 IDbyte = b[7];            // Hit list identifier, should always be 11100111
+    if (IDbyte != 0xE7) {
+        addError(ERR_TKR_BAD_BOARD_ID, IDbyte, brd);
+        tkrRxEnd(false, NULL, 0);
+        return;
+    }
+    uint8 byte2 = b[8];             // Byte containing the board address
+    if (byte2 > 8) {   // Formal check. Note that 8 denotes the master board, which really is layer 0
+        addError(ERR_TKR_BAD_FPGA, byte2, brd);
+    }
+    uint8 lyr = 0x7 & byte2;  // Get rid of the master bit, leaving just the layer number
+    if (tkrData.boardHits[lyr].nBytes > 0) {    // Left over from a readout that never finished
+        free(tkrData.boardHits[lyr].hitList);
+    }
+    if (nBrdBytes > MAX_TKR_BOARD_BYTES) {    // This really should never happen, due to ASIC 10-hit limit
+        tkrData.boardHits[lyr].nBytes = MAX_TKR_BOARD_BYTES;
+    } else {
+        tkrData.boardHits[lyr].nBytes = nBrdBytes;
+    }
+    tkrData.boardHits[lyr].hitList = (uint8*) malloc(nBrdBytes);
+    if (tkrData.boardHits[lyr].hitList == NULL) {
+        tkrData.boardHits[lyr].nBytes = 0;
+        addError(ERR_TKR_NO_MEMORY, nBrdBytes-2, brd);
+        tkrRxEnd(false, NULL, 0);
+        return;
+    }
+    tkrData.boardHits[lyr].hitList[0] = IDbyte;
+    tkrData.boardHits[lyr].hitList[1] = byte2;
+    tkrRx.lyr = lyr;
+    tkrRx.nBrdBytes = nBrdBytes;
+    tkrRx.nHit = 2;          // The rest of the hit list goes straight into hitList
+}
+
+// Look at a reply once tkrRx.need bytes are in, and either finish it or say how many more bytes it needs
+void tkrRxStep() {
+    uint8* b = tkrRx.buf;
+    uint8 len = b[0];
+    switch (tkrRx.kind) {
+        case TKR_RX_ASIC:        // ASIC register data
+            if (tkrRx.n == 1 && len > 0) {
+                tkrRx.need = 1 + len;
+                return;
+            }
+            tkrRxEnd(tkrReply(tkrRx.code), b, tkrRx.n);
+            return;
+        case TKR_RX_I2C:         // i2c register data
+            tkrRxEnd(tkrReply(tkrRx.code), b, 4);
+            return;
+        case TKR_RX_TRIGGER:     // Trigger primitives, after a first byte that is rubbish (not sure why. . .)
+            tkrRxEnd(tkrReply(tkrRx.code), b + 1, 9);
+            return;
+    }
+    uint8 IDcode = b[1];
+    if (tkrRx.n == 2) {
+        if (IDcode == 0xD3) {         // Event data
+            if (len != 5) {           // Formal check
+                addError(ERR_TKR_BAD_LENGTH, IDcode, len);
+                tkrRxEnd(false, NULL, 0);
+                return;
+            }
+            tkrRx.need = 6;
+        } else if (IDcode == 0xC7) {  // Housekeeping data
+            tkrRx.need = 3;
+        } else if (IDcode == 0xF1) {  // Command Echo
+            if (len != 4) {           // Formal check
+                addError(ERR_TKR_BAD_LENGTH, IDcode, len);
+            }
+            tkrRx.need = 5;
+        } else {    // WTF?!?   Not sure what to do with this situation, besides flag it and pass it on
+            if (nErrors < MXERR) {
+                addError(ERR_TKR_BAD_ID, IDcode, len);
+            }
+            tkrRx.need = 2 + len;
+            if (len == 0) tkrRxEnd(tkrReply(tkrRx.code), NULL, 0);
+        }
+        return;
+    }
+    if (IDcode == 0xD3) {
+        tkrRxEvent();
+    } else if (IDcode == 0xC7) {
+        uint8 nData = b[2];
+        if (tkrRx.n == 3) {
+            tkrRx.need = 7 + nData;
+            return;
+        }
+        if (len != nData+6) {   // Formal check
+            addError(ERR_TKR_BAD_NDATA, len, nData);
+        }
+        tkrCmdCount = ((uint16)b[3] << 8) | b[4];
+        tkrHouseKeepingFPGA = b[5];
+        if (tkrHouseKeepingFPGA > 8) {   // Formal check
+            addError(ERR_TKR_BAD_FPGA, tkrCmdCode, tkrHouseKeepingFPGA);
+        }
+        tkrHouseKeepingCMD = b[6];
+        bool matched = tkrReply(tkrHouseKeepingCMD);   // Match to the command that asked for it
+        if (!matched) {
+            addError(ERR_TKR_BAD_ECHO, tkrHouseKeepingCMD, tkrCmdCode);
+        }
+        nTkrHouseKeeping = nData < TKRHOUSE_LEN ? nData : TKRHOUSE_LEN;  // Overwrite any old data, even if never sent out
+        memcpy(tkrHouseKeeping, b + 7, nTkrHouseKeeping);
+        if (nTkrHouseKeeping > 0 && tkrHouseKeeping[nTkrHouseKeeping-1] != 0x0F) {    // Formal check
+            addError(ERR_TKR_BAD_TRAILER, tkrCmdCode, tkrHouseKeeping[nTkrHouseKeeping-1]);
+        }
+        tkrRxEnd(matched, NULL, 0);
+    } else if (IDcode == 0xF1) {
+        tkrCmdCount = ((uint16)b[2] << 8) | b[3];
+        uint8 tkrCmdCodeEcho = b[4];
+        bool matched = tkrReply(tkrCmdCodeEcho);
+        if (!matched) {
+            addError(ERR_TKR_BAD_ECHO, tkrCmdCodeEcho, tkrCmdCode);
+        }
+        tkrRxEnd(matched, b + 2, 3);
+    } else {
+        tkrRxEnd(tkrReply(tkrRx.code), b + 2, len);
+    }
+}
+
+// Take in one byte from the Tracker UART
+void tkrRxByte(uint8 theByte) {
+    if (tkrRx.need == 0) tkrRxStart();
+    if (tkrRx.nHit > 0) {      // Inside an event hit list
+        if (tkrRx.nHit < MAX_TKR_BOARD_BYTES) {
+            tkrData.boardHits[tkrRx.lyr].hitList[tkrRx.nHit] = theByte;
+        }
+        tkrRx.nHit++;
+        if (tkrRx.nHit == tkrRx.nBrdBytes) tkrRxNextBoard();
+        return;
+    }
+    tkrRx.buf[tkrRx.n++] = theByte;
+    if (tkrRx.n == tkrRx.need) tkrRxStep();
+}
+
+CY_ISR(Store_A)
+{
+    if (ShiftReg_A_GetIntStatus() == ShiftReg_A_STORE) {
+        while (ShiftReg_A_GetFIFOStatus(ShiftReg_A_OUT_FIFO) != ShiftReg_A_RET_FIFO_EMPTY) {
+            uint32 AT = ShiftReg_A_ReadData();
+            tofA.shiftReg[tofA.ptr] = AT;
+            tofA.clkCnt[tofA.ptr] = (uint16)time();
+            tofA.filled[tofA.ptr] = true;
+            tofA.ptr++;
+            if (tofA.ptr >= TOFMAX_EVT) tofA.ptr = 0;
+            if (outputTOF) {    
+                //LED2_OnOff(true);
+                //trgLEDoff = true;
+                uint8 oReg[7];
+                oReg[0] = 0xAA;
+                oReg[1] = (AT & 0x0000FF00)>>8;
+                oReg[2] =  AT & 0x000000FF;
+                oReg[3] = (AT & 0xFF000000)>>24;
+                oReg[4] = (AT & 0x00FF0000)>>16;            
+                uint16 clk16 = (uint16)time();
+                oReg[5] = (uint8)((clk16 & 0xFF00)>>8);
+                oReg[6] = (uint8)(clk16 & 0x00FF);             
+                //while(USBUART_CDCIsReady() == 0u);
+                USBUART_PutData(oReg,7);
+            }
+        }
+    }
+}
+
+CY_ISR(Store_B)
+{
+    if (ShiftReg_B_GetIntStatus() == ShiftReg_B_STORE) { 
+        while (ShiftReg_B_GetFIFOStatus(ShiftReg_B_OUT_FIFO) != ShiftReg_B_RET_FIFO_EMPTY) {
+            uint32 BT = ShiftReg_B_ReadData();
+            tofB.shiftReg[tofB.ptr] = BT;
+//            tofB.stop[tofB.ptr] = (uint16)(BT & 0x0000FFFF);
+//            tofB.ref[tofB.ptr] = (uint16)((BT & 0xFFFF0000)>>16);
+            tofB.clkCnt[tofB.ptr] = (uint16)time();
+            tofB.filled[tofB.ptr] = true;
+            tofB.ptr++;
+            if (tofB.ptr >= TOFMAX_EVT) tofB.ptr = 0;
+            if (outputTOF) {  
+                //LED2_OnOff(true);
+                Timer_1_Start();
+                uint8 oReg[7];
+                oReg[0] = 0xBB;
+                oReg[1] = (BT & 0x0000FF00)>>8;
+                oReg[2] =  BT & 0x000000FF;
+                oReg[3] = (BT & 0xFF000000)>>24;
+                oReg[4] = (BT & 0x00FF0000)>>16;
+                uint16 clk16 = (uint16)time();
+                oReg[5] = (uint8)((clk16 & 0xFF00)>>8);
+                oReg[6] = (uint8)(clk16 & 0x00FF);                  
+                //while(USBUART_CDCIsReady() == 0u);
+                USBUART_PutData(oReg,7);
+            }
+        }
+    }
+}
+
+CY_ISR(intTimer) {
+    uint8 status = Control_Reg_SSN_Read();
+    status = status & ~DATLED;
+    status = status & ~TKRLED;
+    //status = status & ~LED2;
+    Control_Reg_SSN_Write(status);
+    Timer_1_Stop();
+}
+
+CY_ISR(clk200) {  // Interrupt every second
+    clkCnt += 200;     // Increment the clock counter used for time stamps
+    uint8 status = Control_Reg_SSN_Read();
+    uint8 blink = status & LED1;
+    if (blink == 0x00) blink = LED1;
+    else blink = 0x00;
+    status = (status & ~LED1) | blink;
+    Control_Reg_SSN_Write(status);
+}
+
+CY_ISR(isrCh1)
+{
+    ch1Count++;
+}
+
+CY_ISR(isrCh2)
+{
+    ch2Count++;
+}
+
+CY_ISR(isrCh3)
+{
+    ch3Count++;
+}
+
+CY_ISR(isrCh4)
+{
+    ch4Count++;
+}
+
+CY_ISR(isrCh5)
+{
+    ch5Count++;
+}
+
+CY_ISR(isrGO1)    // GO signal (system trigger). Start the full event readout if trigger is enabled.
+{
+    if (isTriggerEnabled()) {
+        // Disable the trigger until the event readout has been completed
+        triggerEnable(false);
+        trgStatus = Status_Reg_Trg_Read();
+        cntGO++;
+        triggered = true;
+        timeStamp = time();
+        timeDate = RTC_1_ReadTime();
+        //LED2_OnOff(true);
+        Timer_1_Start();
+    }
+    cntGO1++;     // Count all GO signals during a run, even if the trigger is not enabled.
+    
+    // At this point execution returns to its normal flow, allowing other interrupts. The remainder of the
+    // event readout process is done in main(), in the infinite for loop.
+}
+
+void dataLED(bool on) {
+    uint8 status;
+    if (on) {
+        status = Control_Reg_SSN_Read() & ~DATLED;
+        Control_Reg_SSN_Write(status | DATLED);
+    } else {
+        Timer_1_Start();
+    }
+}
+
+void setCoincidenceWindow(uint8 dt) {
+    TrigWindow_V1_1_Count7_1_WritePeriod(dt);
+    TrigWindow_V1_2_Count7_1_WritePeriod(dt);
+    TrigWindow_V1_3_Count7_1_WritePeriod(dt);
+    TrigWindow_V1_4_Count7_1_WritePeriod(dt);
+    TrigWindow_V1_5_Count7_1_WritePeriod(dt);
+}
+
+// State shared between main() and the tasks of the main loop
+uint8 dataPacket[9];               // Buffer for output of a 3-byte data packet
+uint8 outputMode = SPI_OUTPUT; //USBUART_OUTPUT;
+
+// Protection of the SPI link to the main PSOC, off by default and set with command 0x4F. With LINK_TRAILER each
+// event is followed by a LINK_HEAD packet carrying an 8-bit event sequence number, the CRC-16 of the event data
+// and the number of events dropped since the previous one. With LINK_CREDITS an event goes out only against a
+// credit granted by the main PSOC with command 0x50. The trigger stays disabled while an event waits for a
+// credit, and an event that has waited longer than linkHoldLimit is dropped and counted.
+#define LINK_TRAILER 0x01u
+#define LINK_CREDITS 0x02u
+uint8 linkMode = 0;
+uint8 linkHoldLimit = 100;     // In 5 ms ticks
+uint8 linkCredits = 0;
+uint8 linkSeq = 0;
+uint8 linkDropsPending = 0;    // Events dropped since the last trailer sent
+uint32 nLinkSent = 0;
+uint32 nLinkDropped = 0;
+uint32 eventReadyTime;         // time() when the event in dataOut was built
+uint8 thrDACsettings[] = {THRDEF, THRDEF, THRDEF, THRDEF};
+const uint8 I2C_Address_DAC_Ch5 = '\x0E';
+const uint8 I2C_Address_TOF_DAC1 = '\x0C';
+const uint8 I2C_Address_TOF_DAC2 = '\x0F';
+uint16 adc1_sampleArray[3] = {0};  // Filled by DMA_1 from SAR ADC 1
+uint16 adc2_sampleArray[3] = {0};  // Filled by DMA_2 from SAR ADC 2
+int command = 0;
+int dCnt = 0;
+int cmdCountGLB = 0;               // Count of all command packets received
+int cmdCount = 0;                  // Count of all event PSOC commands received
+uint8 cmdData[MAX_CMD_DATA];       // Data sent with commands
+int nCmdTimeOut = 0;
+const uint8 eventPSOCaddress = '\x08';
+bool eventDataReady = false;
+bool awaitingCommand = true;
+time_t cmdStartTime;
+uint8 nDataBytes = 0;
+uint8 rc;
+bool cmdDone = false;
+
+// Default configuration of the TOF chip. The second byte should be 0x05 for stop events to be accepted.
+// That is not normally turned on here by default, but rather is turned on when the master trigger is enabled.
+// The reference clock is 12 MHz, which has a period of 83333 picoseconds. With 16 bits it will count up to
+// about 5.46 milliseconds. We reset it every 5 milliseconds, so it should only get up to a count of 60,000
+// which is EA60 in hex. We set the LSB by dividing the reference clock period by 8333, which is ~10ps.
+// Only 14 bit are needed, then, for the stop clocks, but 16 bits are read out. The maximum stop-clock count
+// should be 8333, or hex 208D.
+// Addr0: B5  Make active STOPA, STOPB, REFCLK, LVDS LCLK & LCLKOUT, Ref clk reset
+// Addr1: 05  Activate A and B top inputs; no channel combine; standard resolution
+// Addr2: 0C  Ref and Stop both set to 16 bits; single data rate, no common read, std FIFO
+// Addr3: 8D  Ref Clk divisions = 00208D = 8333 which sets the LSB to be 10 picoseconds with a 12 MHz reference clock
+// Addr4: 20  Ref Clk divisions
+// Addr5: 00  Ref Clk divisions
+// Addr6: 00  Normal LVDS operation; no test pattern
+// Addr7: 08  0ps LVDS adjustment
+// Addr8 through 15 are defaults
+// Addr16 00  Differential LVDS input
+uint8 tofConfig[TOFSIZE] = {0xB5, 0x05, 0x0C, 0x8D, 0x20, 0x00, 0x00, 0x08, 0xA1, 0x13, 0x00,
+                     0x0A, 0xCC, 0xCC, 0xF1, 0x7D, 0x00};
+
+// Cooperative run-to-completion scheduler for the main loop. On each pass the highest-priority task that
+// is ready runs to completion, so the event readout and output always go ahead of command processing and
+// housekeeping at the next task boundary. Background tasks, which have no ready function, take turns when
+// nothing else is ready, and after every foreground task, so that a foreground task that stays ready for a
+// long time (such as sending a Tracker image) cannot starve the command input, USB or Tracker time-outs.
+// The run time, latency and budget overruns of each task can be read with command 0x48.
+#define N_TASKS 9u
+#define SYSTICK_RELOAD 0xFFFFFFu   // SysTick is a 24-bit down counter, clocked by the CPU clock
+struct Task {
+    bool (*ready)(void);       // NULL for a background task
+    void (*run)(void);
+    uint32 budget;             // Expected maximum run time, in microseconds
+    uint32 nRuns;
+    uint32 nOverBudget;        // Number of runs that took longer than the budget
+    uint32 maxRunTime;         // Longest run time, in microseconds
+    uint32 maxLatency;         // Longest wait from becoming ready to running, in microseconds
+    uint32 readySince;         // cpuTicks() when the task was first seen to be ready
+    bool waiting;
+};
+struct Task tasks[N_TASKS];    // Defined with the task list, after the task functions
+
+volatile uint32 sysTickWraps = 0;
+void sysTickWrap() {   // SysTick interrupt callback
+    sysTickWraps++;
+}
+
+// Free-running count of CPU clock cycles: the SysTick count extended to 32 bits by counting its wrap-arounds
+uint32 cpuTicks() {
+    uint32 wraps, value;
+    do {
+        wraps = sysTickWraps;
+        value = CySysTickGetValue();
+    } while (wraps != sysTickWraps);
+    return (wraps << 24) + (SYSTICK_RELOAD - value);
+}
+
+// Staging buffer for USB output. Packets and records are packed into full 64-byte USB packets,
+// instead of one USB transaction for each 9-byte packet.
+uint8 usbStage[USB_PACKET_LEN];
+uint8 nUsbStaged = 0;
+uint32 usbStageTime;              // time() when the first byte went into an empty staging buffer, or the last full packet went out
+bool usbEndTransfer = false;      // The last packet sent was full, so the host waits for more until a zero-length packet
+
+// Send the staged bytes. With nothing staged, end a transfer whose last packet was full with a zero-length packet.
+void usbFlush() {
+    if (nUsbStaged == 0) {
+        if (usbEndTransfer) {
+            while (USBUART_CDCIsReady() == 0u);
+            USBUART_PutData(NULL, 0);
+            usbEndTransfer = false;
+        }
+        return;
+    }
+    while (USBUART_CDCIsReady() == 0u);
+    USBUART_PutData(usbStage, nUsbStaged);
+    usbEndTransfer = nUsbStaged == USB_PACKET_LEN;
+    usbStageTime = time();
+    nUsbStaged = 0;
+}
+
+// Append bytes to the USB staging buffer, sending each packet as soon as it is full
+void usbPut(uint8* bytes, uint16 nBytes) {
+    while (nBytes > 0) {
+        if (nUsbStaged == 0) usbStageTime = time();
+        uint16 n = USB_PACKET_LEN - nUsbStaged;
+        if (n > nBytes) n = nBytes;
+        memcpy(usbStage + nUsbStaged, bytes, n);
+        nUsbStaged += n;
+        bytes += n;
+        nBytes -= n;
+        if (nUsbStaged == USB_PACKET_LEN) usbFlush();
+    }
+}
+
+// Search for TOF data nearly coincident with the event time stamp. Note that each TOF chip channel operates
+// asynchronously w.r.t. the instrument trigger, so we have to correlate the two channels with each other and
+// with the event by looking at the course timing information.
+void matchTOF(uint16 timeStamp16, struct TOFmatch* m) {
+    int nI=0;
+    uint8 idx[TOFMAX_EVT];
+    for (int i=0; i<TOFMAX_EVT; ++i) {           // Make a list of TOF hits in channel A
+        int iptr = tofA.ptr - i - 1;             // Work backwards in time, starting with the most recent measurement
+        if (iptr < 0) iptr = iptr + TOFMAX_EVT;  // Wrap around the circular buffer
+        if (!tofA.filled[iptr]) continue;        // Use only entries filled since the previous readout
+        if (timeStamp16 == tofA.clkCnt[iptr] || timeStamp16 == tofA.clkCnt[iptr]+1) {
+            idx[nI] = iptr;                      // Only look at entries within two 5ms clock periods of the event time stamp
+            ++nI;
+        }
+    }
+    m->aCLK = 65535;
+    m->bCLK = 65535;
+    m->aTOF = 65535;
+    m->bTOF = 65535;
+    m->dtmin = 32767;
+    int nJ=0;
+    for (int j=0; j<TOFMAX_EVT; ++j) {           // Loop over the TOF hits in channel B
+        int jptr = tofB.ptr - j - 1;             // Work backwards in time, starting with the most recent measurement
+        if (jptr < 0) jptr = jptr + TOFMAX_EVT;  // Wrap around the circular buffer
+        if (!tofB.filled[jptr]) continue;        // Use only entries filled since the previous readout
+        // Look only at entries filled within two 5 ms clock periods of the event time stamp
+        if (!(tofB.clkCnt[jptr] == timeStamp16 || tofB.clkCnt[jptr] == timeStamp16-1)) continue;
+        uint32 BT = tofB.shiftReg[jptr];
+        uint16 stopB = (uint16)(BT & 0x0000FFFF);       // Stop time for channel B
+        uint16 refB = (uint16)((BT & 0xFFFF0000)>>16);  // Reference clock for channel B
+        int timej = refB*8333 + stopB;                  // Full time for channel B in 10 picosecond units
+        ++nJ;
+        for (int i=0; i<nI; ++i) {                          // Loop over the channel A hits
+            int iptr = idx[i];
+            if (abs(tofA.clkCnt[iptr] - tofB.clkCnt[jptr]) > 1) continue; // Two channels must be within +- 1 clock period
+            uint32 AT = tofA.shiftReg[iptr];
+            uint16 stopA = (uint16)(AT & 0x0000FFFF);       // Stop time for channel A
+            uint16 refA = (uint16)((AT & 0xFFFF0000)>>16);  // Reference clock for channel A
+            int timei = refA*8333 + stopA;                  // Full time for channel A in 10 picosecond units
+            // Here we try to handle cases in which a reference clock rolled over
+            int dt;
+            if (refA > 49152 && refB < 16384) {
+                dt = timej - (timei - 500000000);
+            } else if (refB > 49152 && refA < 16384) {
+                dt = (timej - 500000000) - timei; 
+            } else {
+                dt = timej - timei;
+            }
+            if (abs(dt) < abs(m->dtmin)) { // Keep the smallest time difference of all combinations
+                m->dtmin = dt;
+                m->aCLK = tofA.clkCnt[iptr];  // Save the clock and reference counts for debugging
+                m->bCLK = tofB.clkCnt[jptr];
+                m->aTOF = refA;
+                m->bTOF = refB;
+            }
+        }
+    }
+    m->nA = nI;
+    m->nB = nJ;
+}
+
+// Prescaling by trigger class, applied by the event builder before the level-2 filter. Each bit of trgStatus
+// (PMT primary, PMT secondary, tracker-0, tracker-1, guard) is a class with its own prescale, set by command
+// 0x4E, and an event is sent out if any of its classes is accepted. The counters, reset at the start of each
+// run, go out with the run summary.
+#define N_TRG_CLASSES 5u
+struct TrgClass {
+    uint16 prescale;             // Accept one in this many events of the class; 0 or 1 to accept all
+    uint16 countdown;            // Events of the class still to be prescaled away before the next is accepted
+    uint32 nRaw;
+    uint32 nAccepted;
+    uint32 nPrescaled;
+} trgClass[N_TRG_CLASSES];
+
+bool trgClassKeep(uint8 status) {
+    bool keep = (status & ((1u << N_TRG_CLASSES) - 1)) == 0;    // Nothing to prescale without a class bit
+    for (uint8 i=0; i<N_TRG_CLASSES; ++i) {
+        if (!(status & (1u << i))) continue;
+        trgClass[i].nRaw++;
+        if (trgClass[i].countdown > 1) {
+            trgClass[i].countdown--;
+            trgClass[i].nPrescaled++;
+        } else {
+            trgClass[i].countdown = trgClass[i].prescale;
+            trgClass[i].nAccepted++;
+            keep = true;
+        }
+    }
+    return keep;
+}
+
+// Level-2 event filter, applied by the event builder once the detector has been read out. Events that fail it
+// are counted but not sent out, except for one in every l2.prescale of them, which goes out with EVT_FLAG_L2_FAIL
+// set so that the filter efficiency can be measured. Set up with command 0x4C; the counters are read with
+// command 0x4D and reset at the start of each run.
+#define N_PMT_CH 6u
+#define EVT_FLAG_L2_FAIL 0x01u   // Event flags go in the low bits of byte 40, below the tracker trigger pattern
+struct L2Filter {
+    bool enabled;
+    uint8 minLayers;             // Minimum number of tracker layers with at least one chip hit
+    uint16 adcMin[N_PMT_CH];     // Pulse-height windows, in event order: T1, T2, T3, T4, G, Ex
+    uint16 adcMax[N_PMT_CH];
+    int16 dtMin;                 // TOF dtmin window, in 10 ps units. An event with no TOF match has dtmin = 32767.
+    int16 dtMax;
+    uint16 prescale;             // Send one in this many failing events; 0 to send none
+    uint16 nFailed;              // Failing events since the last one sent
+    uint32 nTested;
+    uint32 nPassed;
+    uint32 nRejected;
+    uint32 nSampled;             // Failing events sent out anyway
+} l2 = {false, 0, {0, 0, 0, 0, 0, 0}, {0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF}, -32768, 32767, 0, 0, 0, 0, 0, 0};
+
+bool l2Pass(const uint16* adc, int16 dtmin) {
+    uint8 nLayers = 0;
+    for (int brd=0; brd<tkrData.nTkrBoards; ++brd) {    // The number of chips hit is in bits 24-27 of the hit list
+        if (tkrData.boardHits[brd].nBytes >= 4 && (tkrData.boardHits[brd].hitList[3] >> 4) > 0) ++nLayers;
+    }
+    if (nLayers < l2.minLayers) return false;
+    for (uint8 ch=0; ch<N_PMT_CH; ++ch) {
+        if (adc[ch] < l2.adcMin[ch] || adc[ch] > l2.adcMax[ch]) return false;
+    }
+    return dtmin >= l2.dtMin && dtmin <= l2.dtMax;
+}
+
+// Decide whether to send out the event just read out, and set its flags
+bool l2Keep(const uint16* adc, int16 dtmin, uint8* flags) {
+    if (!l2.enabled) return true;
+    l2.nTested++;
+    if (l2Pass(adc, dtmin)) {
+        l2.nPassed++;
+        return true;
+    }
+    if (l2.prescale > 0 && ++l2.nFailed >= l2.prescale) {
+        l2.nFailed = 0;
+        l2.nSampled++;
+        *flags |= EVT_FLAG_L2_FAIL;
+        return true;
+    }
+    l2.nRejected++;
+    return false;
+}
+
+// Adaptive event content. There is no queue of events behind dataOut, so the output backlog is measured by how
+// long events wait to go out: the time from the end of the event build until the event has been handed to the
+// SPI or USB interface, or dropped for lack of a link credit, smoothed over about 8 events. When the backlog
+// rises above the watermark of the next level, events are built with less content; the level steps back down
+// once the backlog falls below half of the watermark of the current level. The level goes out in bits 1-2 of
+// byte 40, and each level leaves out more than the one before:
+//   level 1: the TOF debug fields, bytes 43-50, are left out and the tracker data follow from byte 43
+//   level 2: the PMT pulse heights are zero suppressed: a byte with a bit set for each channel above its
+//            threshold, followed by the pulse heights of those channels only. This tail, with the tracker data
+//            after it, fills bytes 23-34 (padded with 0 if it is shorter) and continues from byte 43.
+//   level 3: each tracker board is summarized as {layer, chips hit, clusters} instead of its hit list
+// Set up with command 0x52; the level, the backlog and the number of events sent at each level are read with
+// command 0x53, and the counters are reset at the start of each run.
+#define N_DEGRADE_LEVELS 4u
+#define EVT_DEGRADE_SHIFT 1u
+#define EVT_DEGRADE_MASK 0x06u
+struct Degrade {
+    uint8 minLevel;                      // Level used even when there is no backlog
+    uint16 mark[N_DEGRADE_LEVELS];       // Backlog watermark of levels 1-3, in 100 us units; 0 to never enter the level
+    uint16 pmtThreshold[N_PMT_CH];       // Zero-suppression thresholds, in event order: T1, T2, T3, T4, G, Ex
+    uint8 level;
+    uint32 backlog;                      // Smoothed output wait, in microseconds
+    uint32 nEvents[N_DEGRADE_LEVELS];    // Events sent out at each level
+} degrade = {0, {0, 0, 0, 0}, {0, 0, 0, 0, 0, 0}, 0, 0, {0, 0, 0, 0}};
+uint32 eventReadyTicks;                  // cpuTicks() when the event in dataOut was built
+
+// Fold the output wait of the event just sent or dropped into the backlog, and move the level up or down
+void degradeUpdate() {
+    uint32 wait = (cpuTicks() - eventReadyTicks)/BCLK__BUS_CLK__MHZ;
+    degrade.backlog = degrade.backlog - degrade.backlog/8 + wait/8;
+    uint32 backlog = degrade.backlog/100;
+    while (degrade.level < N_DEGRADE_LEVELS-1 && degrade.mark[degrade.level+1] > 0
+                                              && backlog > degrade.mark[degrade.level+1]) degrade.level++;
+    while (degrade.level > 0 && backlog < degrade.mark[degrade.level]/2) degrade.level--;
+}
+
+// Read n bits, most significant first, starting at bit number 'bit' of a hit list; bits past its end read as 0
+uint8 hitBits(const uint8* hits, uint8 nBytes, uint16 bit, uint8 n) {
+    uint8 value = 0;
+    for (uint8 i=0; i<n; ++i, ++bit) {
+        value = value << 1;
+        if ((bit >> 3) < nBytes) value |= (hits[bit >> 3] >> (7 - (bit & 7))) & 1;
+    }
+    return value;
+}
+
+// Count the clusters in a hit list by walking the 12-bit chip headers, which start at bit 28 and give the
+// number of clusters of the chip in their bits 2-5. Each cluster takes another 12 bits.
+uint8 hitListClusters(const uint8* hits, uint8 nBytes) {
+    if (nBytes < 4) return 0;
+    uint16 nClusters = 0;
+    uint16 bit = 28;
+    for (uint8 chip=0; chip<(hits[3] >> 4) && bit + 12 <= 8*(uint16)nBytes; ++chip) {
+        uint8 nClust = hitBits(hits, nBytes, bit+2, 4);
+        nClusters += nClust;
+        bit += 12 + 12*(uint16)nClust;
+    }
+    return nClusters > 255 ? 255 : nClusters;
+}
+
+// Position in dataOut of byte t of the event tail, as laid out from level 2 on
+uint16 tailPos(uint16 t) {
+    return t < 12 ? 23 + t : 31 + t;
+}
+
+// Cut the event in dataOut, not yet followed by its trailer, down to the content of a level, and return its
+// new length. Bytes 35-42 never move, so that the flags can always be found in byte 40.
+uint16 degradeEvent(uint8 level, const uint16* adc, uint16 nData) {
+    dataOut[40] |= level << EVT_DEGRADE_SHIFT;
+    if (level == 0) return nData;
+    if (level == 1) {
+        memmove(dataOut + 43, dataOut + 51, nData - 51);
+        return nData - 8;
+    }
+    uint8 head[1 + 2*N_PMT_CH + 1 + 3*MAX_TKR_BOARDS];   // Channel bits, pulse heights, and for level 3 the boards
+    uint16 nHead = 1;
+    head[0] = 0;
+    for (uint8 ch=0; ch<N_PMT_CH; ++ch) {
+        if (adc[ch] <= degrade.pmtThreshold[ch]) continue;
+        head[0] |= 1u << ch;
+        head[nHead++] = byte16(adc[ch], 0);
+        head[nHead++] = byte16(adc[ch], 1);
+    }
+    uint16 nBoardBytes = nData - 51;   // nBoards and the hit lists, still at byte 51
+    if (level == 3) {
+        uint8 nBoards = 0;
+        uint16 in = 52;
+        uint16 nBoardsAt = nHead++;
+        while (nBoards < dataOut[51] && nBoards < MAX_TKR_BOARDS && in + 2 <= nData) {   // Boards actually in the event
+            uint8 nBytes = dataOut[in+1];
+            head[nHead++] = dataOut[in];
+            head[nHead++] = nBytes >= 4 ? dataOut[in+5] >> 4 : 0;    // Bits 24-27 of the hit list
+            head[nHead++] = hitListClusters(dataOut + in + 2, nBytes);
+            in += 2 + nBytes;
+            nBoards++;
+        }
+        head[nBoardsAt] = nBoards;
+        nBoardBytes = 0;
+    }
+    // Every byte of the tail goes to the same place or further forward, so the hit lists can be moved in order
+    uint16 t = 0;
+    for (int i=0; i<nHead; ++i) dataOut[tailPos(t++)] = head[i];
+    for (int i=0; i<nBoardBytes; ++i) dataOut[tailPos(t++)] = dataOut[51 + i];
+    while (t < 12) dataOut[tailPos(t++)] = 0;
+    return tailPos(t);
+}
+
+// The event in dataOut has been sent or dropped: re-enable the trigger for the next one, unless the run is over
+void eventDone() {
+    eventDataReady = false;
+    if (!runLimitReached()) triggerEnable(true);
+}
+
+// Task: build an event and send it out each time a GO is received. The task runs twice per event: first to
+// read the PMTs and ask the Tracker for its data, then, once tkrComplete has the Tracker data in, to format
+// the event. The GO interrupt keeps the trigger disabled, and triggered set, until the event is finished.
+bool taskEventBuildReady() {
+    if (!triggered) return false;
+    if (evtTkrStep == EVT_TKR_IDLE) return true;
+    return evtTkrStep == EVT_TKR_DONE && nDataReady == 0;   // wait until any command output still in dataOut has been sent
+}
+
+// Wait for the PMT digitizers, then ask the Tracker whether its data are ready. tkrComplete goes on to
+// read the event when they are.
+void startEventBuild() {
+    //    if ((Status_Reg_2_Read() & 0x01) != 0) {
+    //        uint8 status = Control_Reg_1_Read() & ~RSTPEAK;
+    //        Control_Reg_1_Write(status | RSTPEAK);     // Reset the peak detector
+    //        phSAR = ADC_SAR_1_GetResult16();
+    //    }
+
+    //LED2_OnOff(true);
+    // Read the digitized PMT data after waiting for the digitizers to finish
+    uint t0 = time();
+    while (!(Status_Reg_M_Read() & 0x08)) {   // Wait here for the done signal
+        if (time() - t0 > 20) {
+            addError(ERR_PMT_DAQ_TIMEOUT, (uint8)cntGO, (uint8)(cntGO >> 8));
+            break;
+        }
+    }
+    // By this point the ADC sample arrays should have been filled by DMA
+    // Check that a tracker trigger was received and whether data are ready
+    // This check generally works the first try and can maybe be removed in the long run.
+    nTkrStatusTry = 0;
+    evtTkrStep = EVT_TKR_STATUS;
+    if (!tkrSend(0x00, 0x57, 0, NULL, TKR_FOR_STATUS)) {    // Check status
+        tkrReadEvent();
+    }
+}
+
+// Read out the detector and format the event in dataOut
+void taskEventBuild() {
+    if (evtTkrStep == EVT_TKR_IDLE) {
+        startEventBuild();
+        return;
+    }
+    uint32 timeStampSave = timeStamp;  // Store current count so it cannot change via interrupt
+    triggered = false;
+    evtTkrStep = EVT_TKR_IDLE;
+    if (!evtTkrOK) {
+        addError(ERR_GET_TKR_DATA, 1, 0x77);
+    }
+    tkrLED(false);
+
+    struct TOFmatch tof;
+    matchTOF((uint16)(timeStampSave & 0x0000FFFF), &tof);
+    uint16 adc[N_PMT_CH] = {adc2_sampleArray[0], adc1_sampleArray[0], adc2_sampleArray[2],
+                            adc1_sampleArray[1], adc2_sampleArray[1], adc1_sampleArray[2]};
+    uint8 evtFlags = 0;
+    bool keep = trgClassKeep(trgStatus) && l2Keep(adc, tof.dtmin, &evtFlags);
+
+    // Build the event by filling the output buffer according to the output format.
+    // Pack the time and date information into a 4-byte unsigned integer
+    uint32 timeWord = ((uint32)timeDate->Year - 2000) << 26;
+    timeWord = timeWord | ((uint32)timeDate->Month << 22);
+    timeWord = timeWord | ((uint32)timeDate->DayOfMonth << 17);
+    timeWord = timeWord | ((uint32)timeDate->Hour << 12);
+    timeWord = timeWord | ((uint32)timeDate->Min << 6);
+    timeWord = timeWord | ((uint32)timeDate->Sec); 
+    //
+    // Start the event with a 4-byte header
+    dataOut[0] = 0x5A;
+    dataOut[1] = 0x45;
+    dataOut[2] = 0x52;
+    dataOut[3] = 0x4F;
+    dataOut[4] = byte16(runNumber, 0);
+    dataOut[5] = byte16(runNumber, 1);
+    dataOut[6] = byte32(cntGO, 0);     // Event number
+    dataOut[7] = byte32(cntGO, 1);
+    dataOut[8] = byte32(cntGO, 2);
+    dataOut[9] = byte32(cntGO, 3);
+    dataOut[10] = byte32(timeStampSave, 0); // Time stamp
+    dataOut[11] = byte32(timeStampSave, 1);
+    dataOut[12] = byte32(timeStampSave, 2);
+    dataOut[13] = byte32(timeStampSave, 3);
+    dataOut[14] = byte32(cntGO1, 0);   // Trigger count
+    dataOut[15] = byte32(cntGO1, 1);
+    dataOut[16] = byte32(cntGO1, 2);
+    dataOut[17] = byte32(cntGO1, 3);
+    dataOut[18] = byte32(timeWord, 0); // Time and date
+    dataOut[19] = byte32(timeWord, 1);
+    dataOut[20] = byte32(timeWord, 2);
+    dataOut[21] = byte32(timeWord, 3);
+    dataOut[22] = trgStatus;
+    dataOut[23] = byte16(adc2_sampleArray[0], 0);   // T1
+    dataOut[24] = byte16(adc2_sampleArray[0], 1);
+    dataOut[25] = byte16(adc1_sampleArray[0], 0);   // T2
+    dataOut[26] = byte16(adc1_sampleArray[0], 1);
+    dataOut[27] = byte16(adc2_sampleArray[2], 0);   // T3
+    dataOut[28] = byte16(adc2_sampleArray[2], 1);
+    dataOut[29] = byte16(adc1_sampleArray[1], 0);   // T4
+    dataOut[30] = byte16(adc1_sampleArray[1], 1);
+    dataOut[31] = byte16(adc2_sampleArray[1], 0);   // G
+    dataOut[32] = byte16(adc2_sampleArray[1], 1);
+    dataOut[33] = byte16(adc1_sampleArray[2], 0);   // Extra (for test work)
+    dataOut[34] = byte16(adc1_sampleArray[2], 1);
+    dataOut[35] = byte16(tof.dtmin, 0);   // TOT
+    dataOut[36] = byte16(tof.dtmin, 1);
+    dataOut[37] = byte16(tkrData.triggerCount, 0);
+    dataOut[38] = byte16(tkrData.triggerCount, 1);
+    dataOut[39] = tkrData.cmdCount;
+    dataOut[40] = tkrData.trgPattern | evtFlags;
+    dataOut[41] = tof.nA;   // Number of TOF readouts since the last trigger
+    dataOut[42] = tof.nB; 
+    dataOut[43] = byte16(tof.aTOF,0);    // TOF chip reference clock (for debugging)
+    dataOut[44] = byte16(tof.aTOF,1);
+    dataOut[45] = byte16(tof.bTOF,0);
+    dataOut[46] = byte16(tof.bTOF,1);
+    dataOut[47] = byte16(tof.aCLK,0);    // Internal clock at time of TOF event
+    dataOut[48] = byte16(tof.aCLK,1);
+    dataOut[49] = byte16(tof.bCLK,0);
+    dataOut[50] = byte16(tof.bCLK,1);
+    dataOut[51] = tkrData.nTkrBoards;
+    nDataReady = 52;
+    for (int brd=0; brd<tkrData.nTkrBoards; ++brd) {
+        if (nDataReady > MAX_DATA_OUT - (5 + tkrData.boardHits[brd].nBytes)) {
+            addError(ERR_EVT_TOO_BIG, dataOut[6], dataOut[10]);
+            break;
+        }
+        dataOut[nDataReady++] = brd;
+        dataOut[nDataReady++] = tkrData.boardHits[brd].nBytes;
+        for (int b=0; b<tkrData.boardHits[brd].nBytes; ++b) {
+            dataOut[nDataReady++] = tkrData.boardHits[brd].hitList[b];
+        }
+        free(tkrData.boardHits[brd].hitList);
+        tkrData.boardHits[brd].nBytes = 0;
+    }
+    nDataReady = degradeEvent(degrade.level > degrade.minLevel ? degrade.level : degrade.minLevel, adc, nDataReady);
+    // Four byte trailer
+    dataOut[nDataReady++] = 0x46;
+    dataOut[nDataReady++] = 0x49;
+    dataOut[nDataReady++] = 0x4E;
+    dataOut[nDataReady++] = 0x49;
+    dataSeq = 0;
+    eventDataReady = true;
+    eventReadyTime = time();
+    eventReadyTicks = cpuTicks();
+    if (!keep) {     // Prescaled away or rejected by the level-2 filter: drop the event and get ready for the next trigger
+        nDataReady = 0;
+        eventDone();
+    } else {
+        nEvtKept++;
+    }
+    adc1_sampleArray[0] = 0;
+    adc1_sampleArray[1] = 0;
+    adc1_sampleArray[2] = 0;
+    adc2_sampleArray[0] = 0;
+    adc2_sampleArray[1] = 0;
+    adc2_sampleArray[2] = 0;
+    for (int j=0; j<TOFMAX_EVT; ++j) {
+        tofA.filled[j] = false;
+        tofB.filled[j] = false;
+    }
+    tofA.ptr = 0;
+    tofB.ptr = 0;
+    tkrData.nTkrBoards = 0;
+    ch1CtrSave = Cntr8_V1_1_ReadCount();
+    ch2CtrSave = Cntr8_V1_2_ReadCount();
+    ch3CtrSave = Cntr8_V1_3_ReadCount();
+    ch4CtrSave = Cntr8_V1_4_ReadCount();
+    ch5CtrSave = Cntr8_V1_5_ReadCount();
+    ch1CountSave = ch1Count;
+    ch2CountSave = ch2Count;
+    ch3CountSave = ch3Count;
+    ch4CountSave = ch4Count;
+    ch5CountSave = ch5Count;
+}
+
+// Data goes out by USBUART, for bench testing, or by SPI to the main PSOC
+// Format: 3 byte aligned packeckets with a 3 byte header (ID byte followed by 0x00FF) 
+//         and 3 byte EOR (0xFF00FF)
+//         We use two different ID bytes: one for a fixed-length 3-byte packet; another for variable length
+// Variable length packet: the first byte in the first packet gives the number of bytes to follow.
+//                         The last packet gets padded with 0 for bytes not used.
+
+// True while an event in dataOut is held back for lack of a credit from the main PSOC
+bool linkWaiting() {
+    return eventDataReady && outputMode == SPI_OUTPUT && (linkMode & LINK_CREDITS) && linkCredits == 0;
+}
+
+bool taskOutputReady() {
+    if (nDataReady == 0) return false;
+    return !linkWaiting() || time() - eventReadyTime > linkHoldLimit;
+}
+
+// Send the LINK_HEAD packet that follows an event on the SPI link
+void linkTrailer() {
+    uint16 crc = 0xFFFF;
+    for (int i=0; i<nDataReady; ++i) crc = crc16(crc, dataOut[i]);
+    dataPacket[0] = LINK_HEAD;
+    dataPacket[1] = linkSeq++;
+    dataPacket[3] = byte16(crc, 0);
+    dataPacket[4] = byte16(crc, 1);
+    dataPacket[5] = linkDropsPending;
+    linkDropsPending = 0;
+    set_SPI_SSN(SSN_Main, false);
+    SPIM_PutArray(dataPacket, 9);
+}
+
+void taskOutput() {
+    if (linkWaiting()) {    // No credit came in time: drop the event
+        nLinkDropped++;
+        if (linkDropsPending < 255) linkDropsPending++;
+        nDataReady = 0;
+        degradeUpdate();
+        eventDone();
+        return;
+    }
+    dataLED(true);
+    dataPacket[1] = dataSeq;
+    if (outputMode == USB_BULK_OUTPUT) {
+        uint8 header[4] = {BULK_HEAD, dataSeq, byte16(nDataReady, 0), byte16(nDataReady, 1)};
+        usbPut(header, 4);
+        usbPut(dataOut, nDataReady);
+    } else if (nDataReady <= 3) {
+        dataPacket[0] = FIX_HEAD;
+        dataPacket[3] = dataOut[0];
+        dataPacket[4] = dataOut[1];
+        dataPacket[5] = dataOut[2];
+        if (outputMode == USBUART_OUTPUT) {
+            usbPut(dataPacket, 9);
+        } else {
+            set_SPI_SSN(SSN_Main, true);
+            SPIM_PutArray(dataPacket, 9);
+            //for (int i=0; i<9; ++i) SPIM_WriteTxData(dataPacket[i]);
+        }
+    } else {
+        int nPackets = (nDataReady - 1)/3 + 1;
+        dataPacket[0] = VAR_HEAD;
+        dataPacket[3] = nDataReady > 255 ? 255 : nDataReady;   // Old 8-bit length, for short replies
+        dataPacket[4] = byte16(nDataReady, 0);                  // Full 16-bit length
+        dataPacket[5] = byte16(nDataReady, 1);
+        if (outputMode == USBUART_OUTPUT) {
+            usbPut(dataPacket, 9);
+        } else {
+            set_SPI_SSN(SSN_Main, true);
+            for (int i=0; i<9; ++i) {
+                SPIM_WriteTxData(dataPacket[i]);
+            }
+        }     
+        for (int i=0; i<nPackets; ++i) {
+            if (i == nPackets-1) {
+                if (3*i+1 >= nDataReady) dataOut[3*i+1] = 0xEE;
+                if (3*i+2 >= nDataReady) dataOut[3*i+2] = 0xFF;
+            }
+            dataPacket[3] = dataOut[3*i];
+            dataPacket[4] = dataOut[3*i+1];
+            dataPacket[5] = dataOut[3*i+2]; 
+            if (outputMode == USBUART_OUTPUT) {
+                usbPut(dataPacket, 9);
+            } else {                        
+                set_SPI_SSN(SSN_Main, false);
+                for (int i=0; i<9; ++i) {
+                    SPIM_WriteTxData(dataPacket[i]);
+                }
+            }
+        }
+    }
+    if (!eventDataReady) usbFlush();   // send command replies right away; events wait for a full USB packet
+    if (eventDataReady && outputMode == SPI_OUTPUT) {
+        nLinkSent++;
+        if (linkMode & LINK_CREDITS) linkCredits--;
+        if (linkMode & LINK_TRAILER) linkTrailer();
+    }
+    if (eventDataReady) {
+        degrade.nEvents[(dataOut[40] & EVT_DEGRADE_MASK) >> EVT_DEGRADE_SHIFT]++;
+        degradeUpdate();
+    }
+    nDataReady = 0;
+    dataSeq = 0;
+    if (eventDataReady) eventDone();
+    dataLED(false);
+}
+
+// End the run and put the run summary in dataOut: the number of triggers and the number of events read out,
+// followed for each trigger class by the number of events with the class bit set, accepted and prescaled away
+void endRun() {
+    triggerEnable(false);
+    runLimited = false;
+    dataOut[0] = byte32(cntGO1, 0);
+    dataOut[1] = byte32(cntGO1, 1);
+    dataOut[2] = byte32(cntGO1, 2);
+    dataOut[3] = byte32(cntGO1, 3);
+    dataOut[4] = byte32(cntGO, 0);
+    dataOut[5] = byte32(cntGO, 1);
+    dataOut[6] = byte32(cntGO, 2);
+    dataOut[7] = byte32(cntGO, 3);
+    nDataReady = 8;
+    for (uint8 i=0; i<N_TRG_CLASSES; ++i) {
+        for (int j=0; j<4; ++j) {
+            dataOut[nDataReady+j] = byte32(trgClass[i].nRaw, j);
+            dataOut[nDataReady+4+j] = byte32(trgClass[i].nAccepted, j);
+            dataOut[nDataReady+8+j] = byte32(trgClass[i].nPrescaled, j);
+        }
+        nDataReady += 12;
+    }
+}
+
+// Task: end a run that has reached its event or time limit, once its last event has been sent out, and send
+// the run summary unsolicited, exactly as command 0x44 would.
+bool taskRunEndReady() {
+    return runLimitReached() && !triggered && nDataReady == 0;
+}
+
+void taskRunEnd() {
+    triggerEnable(false);
+    if (triggered) return;   // a GO came in just before the trigger was disabled; send that event out first
+    endRun();
+    dataSeq = 0;
+}
+
+// Task: execute a command once it has been received completely. During a run, a run-safe command is held
+// until there is a gap between events, so that it never delays an event readout. Other commands are
+// rejected, except for ending the run. While a Tracker image is being sent, only run-safe commands execute
+// and the others wait for it to finish. A command that asked the Tracker for data finishes when the reply
+// comes in, and no other command runs before that. Nothing runs while output is still waiting in dataOut.
+bool taskCommandExecReady() {
+    if (tkrCmdWait != 0) return tkrCmdReplied && nDataReady == 0;
+    if (!cmdDone || (tkrImageRunning && !isRunSafe(command))) return false;
+    if (nDataReady > 0) return command == 0x50 && linkWaiting();   // a credit must get through to a waiting event
+    return !(isRunInProgress() && isRunSafe(command) && triggered);
+}
+
+// Send out the reply of the command in tkrCmdWait, now that the Tracker has answered
+void finishTkrCommand() {
+    tkrLED(false);
+    if (!tkrCmdOK) {
+        addError(ERR_GET_TKR_DATA, 1, tkrCmdWait);
+    }
+    if (tkrCmdWait == 0x43) {   // Send the data out as a tracker-only event
+        dataOut[0] = 0x5A;
+        dataOut[1] = 0x45;
+        dataOut[2] = 0x52;
+        dataOut[3] = 0x4F;
+        dataOut[4] = tkrData.nTkrBoards;
+        nDataReady = 5;
+        for (int brd=0; brd<tkrData.nTkrBoards; ++brd) {
+            if (nDataReady > MAX_DATA_OUT - (5 + tkrData.boardHits[brd].nBytes)) {
+                addError(ERR_EVT_TOO_BIG, dataOut[6], dataOut[10]);
+                break;
+            }
+            dataOut[nDataReady++] = brd;
+            dataOut[nDataReady++] = tkrData.boardHits[brd].nBytes;
+            for (int b=0; b<tkrData.boardHits[brd].nBytes; ++b) {
+                dataOut[nDataReady++] = tkrData.boardHits[brd].hitList[b];
+            }
+            free(tkrData.boardHits[brd].hitList);
+            tkrData.boardHits[brd].nBytes = 0;
+        }
+        dataOut[nDataReady++] = 0x46;
+        dataOut[nDataReady++] = 0x49;
+        dataOut[nDataReady++] = 0x4E;
+        dataOut[nDataReady++] = 0x49;
+    } else {
+        memcpy(dataOut, tkrCmdReply, nTkrCmdReply);
+        nDataReady = nTkrCmdReply;
+        if (tkrCmdWait == 0x42 && nDataReady > 0) {
+            // The first good byte of the trigger data encodes the FPGA address, so we check it here
+            uint8 fpgaRet = (dataOut[0] & 0x38)>>3;
+            if (fpgaRet != tkrCalFPGA) {
+                addError(ERR_TKR_BAD_TRGHEAD, tkrCalFPGA, fpgaRet);
+            }
+        }
+    }
+    if (tkrCmdSeq != 0 && nDataReady == 0) {  // Acknowledge a tagged command that returns no data
+        nDataReady = 3;
+        dataOut[0] = tkrCmdWait;
+        dataOut[1] = CMD_ACK;
+        dataOut[2] = 0x00;
+    }
+    if (!eventDataReady) dataSeq = tkrCmdSeq;
+    tkrCmdWait = 0;
+    tkrCmdReplied = false;
+}
+
+void taskCommandExec() {
+    if (tkrCmdWait != 0) {
+        finishTkrCommand();
+        return;
+    }
+    cmdDone = false;
+    awaitingCommand = true;
+    uint16 DACsetting12;
+    int16 Bvolt;
+    uint8 DACaddress = 0;
+    uint16 thrSetting;
+    uint8 nCalClusters;
+    uint8 fpgaAddress;
+    uint8 chipAddress;
+    // If a run is in progress, ignore all commands besides the run-safe ones and end of run,
+    // so that nothing can interrupt the readout.
+    if (command == '\x44' || !isRunInProgress() || isRunSafe(command)) {
+        switch (command) { 
+            case '\x01':         // Load a threshold DAC setting
+                switch (cmdData[0]) {
+                    case 0x05: 
+                        thrSetting = (uint16)cmdData[1];
+                        thrSetting = (thrSetting<<8) | (uint16)cmdData[2];
+                        rc = loadDAC(I2C_Address_DAC_Ch5, thrSetting);
+                        if (rc != 0) {
+                            addError(ERR_DAC_LOAD, rc, I2C_Address_DAC_Ch5);
+                        }
+                        break;
+                    case 0x01:
+                        VDAC8_Ch1_SetValue(cmdData[1]);
+                        thrDACsettings[0] = cmdData[1];
+                        break;
+                    case 0x02:
+                        VDAC8_Ch2_SetValue(cmdData[1]);
+                        thrDACsettings[1] = cmdData[1];
+                        break;
+                    case 0x03:
+                        VDAC8_Ch3_SetValue(cmdData[1]);
+                        thrDACsettings[2] = cmdData[1];
+                        break;
+                    case 0x04:
+                        VDAC8_Ch4_SetValue(cmdData[1]);
+                        thrDACsettings[3] = cmdData[1];
+                        break;
+                }
+                break;
+            case '\x02':         // Get a threshold DAC setting
+                if (cmdData[0] == 0x05) {
+                    nDataReady = 2;
+                    rc = readDAC(I2C_Address_DAC_Ch5, &DACsetting12);
+                    if (rc != 0) {
+                        DACsetting12 = 0;
+                        addError(ERR_DAC_READ, rc, DACaddress);
+                    }
+                    dataOut[0] = (uint8)((DACsetting12 & 0xFF00)>>8);
+                    dataOut[1] = (uint8)(DACsetting12 & 0x00FF);
+                } else if (cmdData[0] < 5) {
+                    nDataReady = 1;
+                    dataOut[0] = thrDACsettings[cmdData[0]-1];
+                } else {
+                    nDataReady = 1;
+                    dataOut[0] = 0;
+                }
+                break;
+            case '\x03':         // Read back all of the accumulated error codes
+                if (nErrors == 0) {
+                    nDataReady = 3;
+                    dataOut[0] = 0x00;
+                    dataOut[1] = 0xEE;
+                    dataOut[2] = 0xFF;
+                    break;
+                }
+                nDataReady = nErrors*3;
+                for (int i=0; i<nErrors; ++i) {
+                    dataOut[i*3] = errors[i].errorCode;
+                    dataOut[i*3 + 1] = errors[i].value0;
+                    dataOut[i*3 + 2] = errors[i].value1;                                    
+                }
+                nErrors = 0;
+                break;
+            case '\x04':        // Load the TOF DACs
+                if (cmdData[0] == 1) {
+                    DACaddress = I2C_Address_TOF_DAC1;
+                } else if (cmdData[0] == 2) {
+                    DACaddress = I2C_Address_TOF_DAC2;
+                } else break;
+                uint16 thrSetting = (uint16)cmdData[1];
+                thrSetting = (thrSetting<<8) | (uint16)cmdData[2];
+                rc = loadDAC(DACaddress, thrSetting);
+                if (rc != 0) {
+                    addError(ERR_TOF_DAC_LOAD, rc, DACaddress);
+                }
+                break;
+            case '\x05':        // Read the TOF DAC settings
+                if (cmdData[0] == 1) {
+                    DACaddress = I2C_Address_TOF_DAC1;
+                } else if (cmdData[0] == 2) {
+                    DACaddress = I2C_Address_TOF_DAC2;
+                } else break;
+                rc = readDAC(DACaddress, &DACsetting12);
+                if (rc != 0) {
+                    DACsetting12 = 0;
+                    addError(ERR_TOF_DAC_READ, rc, DACaddress);                                         
+                }
+
+                nDataReady = 2;
+                dataOut[0] = (uint8)((DACsetting12 & 0xFF00)>>8);
+                dataOut[1] = (uint8)(DACsetting12 & 0x00FF);
+                break;
+            case '\x06':        // Turn LED on or off, for communication test
+                if (cmdData[0] == 1) {
+                    LED2_OnOff(true);
+                } else {
+                    LED2_OnOff(false);
+                }
+                break;
+            case '\x07':        // Return the version number
+                nDataReady = 1;
+                dataOut[0] = VERSION;
+                break;
+            case '\x10':        // Send an arbitrary command to the tracker
+                tkrCmdCode = cmdData[1];
+                // Ignore commands that are supposed to be internal to the tracker,
+                // to avoid confusing the tracker logic.
+                if (tkrCmdCode == 0x52 || tkrCmdCode == 0x53) break;
+                tkrLED(true);
+                uint8 nDataTKR = cmdData[2];
+                if (nDataTKR > MAX_CMD_DATA - 3) nDataTKR = MAX_CMD_DATA - 3;
+                bool hasEcho = (tkrCmdCode != 0x67 && tkrCmdCode != 0x6C);
+                if (!tkrSend(cmdData[0], tkrCmdCode, nDataTKR, &cmdData[3], hasEcho ? TKR_FOR_COMMAND : TKR_NO_REPLY)
+                        || !hasEcho) {
+                    tkrLED(false);
+                    break;
+                }
+                tkrCmdWait = command;    // The bytes coming back from the Tracker are the reply
+                break;
+            case '\x41':        // Load a tracker ASIC mask register
+                tkrLED(true);
+                fpgaAddress = cmdData[0] & 0x07;
+                chipAddress = cmdData[1] & 0x1F;
+                uint8 regType = cmdData[2] & 0x03;
+                uint8 fill = cmdData[3] & 0x01;
+                nCalClusters = cmdData[4];
+                if (nCalClusters > (nDataBytes - 5)/2) {
+                    nCalClusters = (nDataBytes - 5)/2;
+                }   
+                int ptr = 5;
+                uint64 mask = 0;
+                for (int i=0; i<nCalClusters; ++i) {
+                    uint64 mask0 = 0;
+                    int nch = cmdData[ptr];
+                    int ch0 = 64-nch-cmdData[ptr+1];
+                    mask0 = mask0 +1;
+                    for (int j=1; j<nch; ++j) {
+                        mask0 = mask0<<1;
+                        mask0 = mask0 + 1;
+                    }
+                    mask0 = mask0<<ch0;
+                    mask = mask | mask0;
+                    ptr = ptr + 2;
+                }
+                if (fill) mask = ~mask;
+                uint8 maskCode;
+                if (regType == CALMASK) maskCode = '\x15';
+                else if (regType == DATAMASK) maskCode = '\x13';
+                else maskCode = '\x14';
+                uint8 bytesToSend[9];
+                bytesToSend[0] = chipAddress;
+                for (int j=8; j>0; --j) {      // Mask goes out most significant byte first
+                    bytesToSend[j] = (uint8)(mask & 0x00000000000000FF);
+                    mask = mask>>8;
+                }
+                if (!tkrSend(fpgaAddress, maskCode, 9, bytesToSend, TKR_FOR_COMMAND)) {
+                    tkrLED(false);
+                    break;
+                }
+                tkrCmdWait = command;    // The command echo is the reply
+                break;
+            case '\x42':        // Start a tracker calibration sequence
+                // First send a calibration strobe command
+                tkrLED(true);
+                uint8 FPGA = cmdData[0];
+                uint8 trgDelay = cmdData[1];
+                uint8 trgTag = cmdData[2] & 0x03;
+                uint8 byte2 = (trgDelay & 0x3f)<<2;
+                byte2 = byte2 | trgTag;
+                uint8 strobeData[3] = {0x1F, byte2, FPGA};
+                if (!tkrSend(0x00, 0x02, 3, strobeData, TKR_FOR_COMMAND)) {
+                    tkrLED(false);
+                    break;
+                }
+                // Catch the trigger output and send back to the computer
+                tkrCalFPGA = FPGA;
+                tkrCmdWait = command;
+                break;
+            case '\x43':   // Send a tracker read-event command for calibration events
+                tkrLED(true);
+                trgTag = 0x04 | (cmdData[0] & 0x03);
+                if (!tkrSend(0x00, 0x01, 1, &trgTag, TKR_FOR_COMMAND)) {
+                    tkrLED(false);
+                    break;
+                }
+                tkrCmdWait = command;    // The data go out as a tracker-only event once they are in
+                break;
+            case '\x0C':        // Reset the TOF chip
+                set_SPI_SSN(SSN_TOF, true);
+                SPIM_WriteTxData(powerOnRESET);
+                break;
+            case '\x0D':        // Modify TOF configuration (disable trigger first)
+                if (cmdData[0] < TOFSIZE) {
+                    tofConfig[cmdData[0]] = tofConfig[1];
+                    set_SPI_SSN(SSN_TOF, true);
+                    SPIM_WriteTxData(writeConfig);
+                    for (int i=0; i<TOFSIZE; ++i) {
+                        SPIM_WriteTxData(tofConfig[i]);
+                    }
+                    CyDelay(1);
+                }
+                break;
+            case '\x0E':        // Read the TOF IC configuration
+                SPIM_ClearRxBuffer();
+                set_SPI_SSN(SSN_TOF, true);
+                SPIM_WriteTxData(readConfig);
+                //CyDelay(1);
+                while (SPIM_GetRxBufferSize() == 0) SPIM_WriteTxData(0x00);
+                SPIM_ReadRxData();    // The first byte read back is always garbage.
+                for (int bt=0; bt<TOFSIZE; ++bt) {
+                    while (SPIM_GetRxBufferSize() == 0) SPIM_WriteTxData(0x00);
+                    dataOut[bt] = SPIM_ReadRxData();
+                    //dataOut[bt] = tofConfig[bt];
+                }
+                nDataReady = TOFSIZE;
+                set_SPI_SSN(0, false);
+                break;
+            case '\x20':        // Read bus voltages (positive only)
+                readI2Creg(2, cmdData[0], INA226_BusV_Reg, dataOut);
+                nDataReady = 2;
+                break;
+            case '\x21':        // Read currents (Note: bit 15 is a sign bit, 2's complement)
+                readI2Creg(2, cmdData[0], INA226_ShuntV_Reg, dataOut);
+                nDataReady = 2;
+                break;
+            case '\x22':        // Read the board temperature
+                readI2Creg(2, I2C_Address_TMP100, TMP100_Temp_Reg, dataOut);
+                nDataReady = 2;
+                break;
+            case '\x23':        // Read an RTC register
+                readI2Creg(1, I2C_Address_RTC, cmdData[0], dataOut);
+                nDataReady = 1;
+                break;
+            case '\x24':        // Write an RTC register
+                loadI2Creg(I2C_Address_RTC , cmdData[0], cmdData[1]);
+                break;
+            case '\x25':        // Read the watch battery voltage
+                Bvolt = ADC_DelSig_1_CountsTo_mVolts(ADC_DelSig_1_Read32());
+                nDataReady = 2;
+                dataOut[0] = (uint8)((Bvolt & 0xFF00)>>8);
+                dataOut[1] = (uint8)(Bvolt & 0x00FF);
+                break;
+            case '\x26':       // Read a barometer register
+                readI2Creg(1, I2C_Address_Barometer, cmdData[0], dataOut);
+                nDataReady = 1;
+                break;
+            case '\x27':       // Load a barometer register
+                loadI2Creg(I2C_Address_Barometer, cmdData[0], cmdData[1]);
+                break;
+            case '\x30':       // Set the output mode
+                if (cmdData[0] == USBUART_OUTPUT || cmdData[0] == SPI_OUTPUT || cmdData[0] == USB_BULK_OUTPUT) {
+                    usbFlush();
+                    outputMode = cmdData[0];
+                }
+                break;
+            case '\x31':       // Initialize the SPI interface
+                SPIM_Init();
+                SPIM_Enable();
+                break;
+            case '\x32':       // Send TOF info to USB-UART (temporary testing)
+                outputTOF = true;                               
+                break;
+            case '\x3F':
+                outputTOF = false;
+                break;
+            case '\x34':       // Get the number of TOF events stored
+                nDataReady = 2;
+                dataOut[0] = tofA.ptr;
+                dataOut[1] = tofB.ptr;
+                break;
+            case '\x35':       // Read most recent TOF event from channel A or B (for testing)
+                nDataReady = 9;
+                if (cmdData[0] == 0) {
+                    uint8 idx = tofA.ptr > 0 ? tofA.ptr - 1 : TOFMAX_EVT - 1;
+                    if (tofA.filled[idx]) {
+                        uint32 AT = tofA.shiftReg[idx];
+                        uint16 stopA = (uint16)(AT & 0x0000FFFF);
+                        uint16 refA = (uint16)((AT & 0xFFFF0000)>>16);
+                        dataOut[0] = (uint8)((refA & 0xFF00)>>8);
+                        dataOut[1] = (uint8)(refA & 0x00FF);
+                        dataOut[2] = 0;
+                        dataOut[3] = (uint8)((stopA & 0xFF00)>>8);
+                        dataOut[4] = (uint8)(stopA & 0x00FF);
+                        dataOut[5] = 0;
+                        dataOut[6] = (uint8)((tofA.clkCnt[idx] & 0xFF00)>>8);
+                        dataOut[7] = (uint8)(tofA.clkCnt[idx] & 0x00FF);
+                        dataOut[8] = tofA.ptr;
+                        for (int j=0; j<TOFMAX_EVT; ++j) {
+                            tofA.filled[j] = false;
+                        }
+                        tofA.ptr = 0;
+                    } else {
+                        for (int i=0; i<8; ++i) dataOut[i] = 0;
+                        dataOut[8] = idx;
+                    }
+                } else {
+                    uint8 idx = tofB.ptr > 0 ? tofB.ptr - 1 : TOFMAX_EVT - 1;
+                    if (tofB.filled[idx]) {
+                        uint32 BT = tofB.shiftReg[idx];
+                        uint16 stopB = (uint16)(BT & 0x0000FFFF);
+                        uint16 refB = (uint16)((BT & 0xFFFF0000)>>16);
+                        dataOut[0] = (uint8)((refB & 0xFF00)>>8);
+                        dataOut[1] = (uint8)(refB & 0x00FF);
+                        dataOut[2] = 0;
+                        dataOut[3] = (uint8)((stopB & 0xFF00)>>8);
+                        dataOut[4] = (uint8)(stopB & 0x00FF);
+                        dataOut[5] = 0;
+                        dataOut[6] = (uint8)((tofB.clkCnt[idx] & 0xFF00)>>8);
+                        dataOut[7] = (uint8)(tofB.clkCnt[idx] & 0x00FF);
+                        dataOut[8] = tofB.ptr;
+                        for (int j=0; j<TOFMAX_EVT; ++j) {
+                            tofB.filled[j] = false;
+                        }
+                        tofB.ptr = 0;
+                    } else {
+                        for (int i=0; i<8; ++i) dataOut[i] = 0;
+                        dataOut[8] = idx;
+                        for (int j=0; j<TOFMAX_EVT; ++j) {
+                            tofB.filled[j] = false;
+                            tofA.filled[j] = false;
+                        }
+                        tofB.ptr = 0;
+                        tofA.ptr = 0;
+                    }
+                }
+                break; 
+            case '\x36':     // Set a trigger mask
+                if (cmdData[0] == 1) {
+                    setTriggerMask('e', cmdData[1]);
+                } else if (cmdData[0] == 2) {
+                    setTriggerMask('p', cmdData[1]);
+                }
+                break;
+            case '\x37':    // Read a channel counter
+                nDataReady = 3;
+                switch (cmdData[0]) {
+                    case 0x01:
+                        dataOut[2] = Cntr8_V1_1_ReadCount();
+                        dataOut[1] = (uint8)(ch1Count & 0x00FF);
+                        dataOut[0] = (uint8)((ch1Count & 0xFF00)>>8);
+                        break;
+                    case 0x02:
+                        dataOut[2] = Cntr8_V1_2_ReadCount();
+                        dataOut[1] = (uint8)(ch2Count & 0x00FF);
+                        dataOut[0] = (uint8)((ch2Count & 0xFF00)>>8);
+                        break;
+                    case 0x03:
+                        dataOut[2] = Cntr8_V1_3_ReadCount();
+                        dataOut[1] = (uint8)(ch3Count & 0x00FF);
+                        dataOut[0] = (uint8)((ch3Count & 0xFF00)>>8);
+                        break;
+                    case 0x04:
+                        dataOut[2] = Cntr8_V1_4_ReadCount();
+                        dataOut[1] = (uint8)(ch4Count & 0x00FF);
+                        dataOut[0] = (uint8)((ch4Count & 0xFF00)>>8);
+                        break;
+                    case 0x05:
+                        dataOut[2] = Cntr8_V1_5_ReadCount();
+                        dataOut[1] = (uint8)(ch5Count & 0x00FF);
+                        dataOut[0] = (uint8)((ch5Count & 0xFF00)>>8);
+                        break;
+                }
+                break;
+            case '\x38':   // Reset the logic and counters, after reading back 24 bits of the clock count
+                nDataReady = 3;
+                uint32 now = time();
+                dataOut[0] = (uint8)((now & 0x00FF0000)>>16);
+                dataOut[1] = (uint8)((now & 0x0000FF00)>>8);
+                dataOut[2] = (uint8)(now & 0x000000FF);
+                logicReset();
+                break;
+            case '\x39':   // Set trigger prescales
+                if (cmdData[0] == 1) {
+                    Cntr8_V1_TKR_WritePeriod(cmdData[1]);
+                } else if (cmdData[0] == 2) {
+                    Cntr8_V1_PMT_WritePeriod(cmdData[1]);
+                }
+                break;
+            case '\x3A':   // Set trigger coincidence window
+                setCoincidenceWindow(cmdData[0]);
+                break;
+            case '\x3B':   // Enable or disable the trigger
+                if (cmdData[0] == 1) {
+                    triggerEnable(true);
+                } else if (cmdData[0] == 0) {
+                    triggerEnable(false);
+                }
+                break;
+            case '\x44':  // End a run and send out the run summary
+                triggered = false;   // this might throw out the last event
+                evtTkrStep = EVT_TKR_IDLE;
+                endRun();
+                break;
+            case '\x3C':  // Start a run
+                for (int j=0; j<TOFMAX_EVT; ++j) {
+                    tofA.filled[j] = false;
+                    tofB.filled[j] = false;
+                }
+                clkCnt = 0;
+                tofA.ptr = 0;
+                tofB.ptr = 0;
+                ch1Count = 0;
+                ch2Count = 0;
+                ch3Count = 0;
+                ch4Count = 0;
+                ch5Count = 0;
+                runNumber = cmdData[0];
+                runNumber = (runNumber<<8) | cmdData[1];
+                // Optional limits: data bytes 3-4 give a number of events kept for output (triggers that the
+                // prescalers or the level-2 filter drop do not count), 5-6 a duration in seconds
+                runMaxEvents = nDataBytes >= 4 ? ((uint16)cmdData[2]<<8) | cmdData[3] : 0;
+                runMaxSeconds = nDataBytes >= 6 ? ((uint16)cmdData[4]<<8) | cmdData[5] : 0;
+                runLimited = runMaxEvents > 0 || runMaxSeconds > 0;
+                // Make sure that the TOT FIFOs are empty
+                while (ShiftReg_A_GetFIFOStatus(ShiftReg_A_OUT_FIFO) != ShiftReg_A_RET_FIFO_EMPTY) {
+                    ShiftReg_A_ReadData();
+                }
+                while (ShiftReg_B_GetFIFOStatus(ShiftReg_B_OUT_FIFO) != ShiftReg_B_RET_FIFO_EMPTY) {
+                    ShiftReg_B_ReadData();
+                }
+
+                cntGO = 0;
+                cntGO1 = 0;
+                nEvtKept = 0;
+                l2.nFailed = 0;
+                l2.nTested = 0;
+                l2.nPassed = 0;
+                l2.nRejected = 0;
+                l2.nSampled = 0;
+                for (uint8 i=0; i<N_DEGRADE_LEVELS; ++i) degrade.nEvents[i] = 0;
+                for (uint8 i=0; i<N_TRG_CLASSES; ++i) {
+                    trgClass[i].countdown = 0;
+                    trgClass[i].nRaw = 0;
+                    trgClass[i].nAccepted = 0;
+                    trgClass[i].nPrescaled = 0;
+                }
+                triggerEnable(true);
+                Control_Reg_Pls_Write(PULSE_CNTR_RST);
+                // Enable the tracker trigger
+                if (!tkrSend(0x00, 0x65, 0, NULL, TKR_FOR_TRG_ENABLE)) {    // Trigger enable; tkrComplete checks the echo
+                    addError(ERR_TKR_TRG_ENABLE, 0x65, 0);
+                }
+                break;
+            case '\x3D':  // Return trigger enable status
+                nDataReady =1;
+                if (isTriggerEnabled()) dataOut[0] = 1;
+                else dataOut[0] = 0;
+                break;
+            case '\x3E':  // Return trigger mask register
+                nDataReady = 1;
+                uint8 reg = 0;
+                if (cmdData[0] == 1) {
+                    reg = getTriggerMask('e');
+                } else if (cmdData[0] == 2) {
+                    reg = getTriggerMask('p');
+                }
+                dataOut[0] = reg;
+                break;
+            case '\x33':    // Read a saved channel counter, from end of run
+                nDataReady = 3;
+                switch (cmdData[0]) {
+                    case 0x01:
+                        dataOut[2] = ch1CtrSave;
+                        dataOut[1] = (uint8)(ch1CountSave & 0x00FF);
+                        dataOut[0] = (uint8)((ch1CountSave & 0xFF00)>>8);
+                        break;
+                    case 0x02:
+                        dataOut[2] = ch2CtrSave;
+                        dataOut[1] = (uint8)(ch2CountSave & 0x00FF);
+                        dataOut[0] = (uint8)((ch2CountSave & 0xFF00)>>8);
+                        break;
+                    case 0x03:
+                        dataOut[2] = ch3CtrSave;
+                        dataOut[1] = (uint8)(ch3CountSave & 0x00FF);
+                        dataOut[0] = (uint8)((ch3CountSave & 0xFF00)>>8);
+                        break;
+                    case 0x04:
+                        dataOut[2] = ch4CtrSave;
+                        dataOut[1] = (uint8)(ch4CountSave & 0x00FF);
+                        dataOut[0] = (uint8)((ch4CountSave & 0xFF00)>>8);
+                        break;
+                    case 0x05:
+                        dataOut[2] = ch5CtrSave;
+                        dataOut[1] = (uint8)(ch5CountSave & 0x00FF);
+                        dataOut[0] = (uint8)((ch5CountSave & 0xFF00)>>8);
+                        break;
+                }
+                break;
+            case '\x40':  // Read all TOF data (for testing)
+                nDataReady = 3;
+                uint8 nA = 0;
+                uint8 nB = 0;
+                for (int i=0; i<TOFMAX_EVT; ++i) {
+                    if (tofA.filled[i]) ++nA;
+                    if (tofB.filled[i]) ++nB;
+                }
+                dataOut[2] = 1;
+                if (nA > 21 || nB > 21) {
+                    dataOut[2] = 2;
+                    if (nA > 21) nA = 21;
+                    if (nB > 21) nB = 21;
+                }
+                dataOut[0] = nA;
+                dataOut[1] = nB;
+                int iptr = tofA.ptr;
+                int jptr = tofB.ptr;
+                uint8 cnt = 0;
+                //LED2_OnOff(true);
+                for (int i=0; i<TOFMAX_EVT; ++i) {
+                    if (!tofA.filled[i]) continue;
+                    --iptr;
+                    if (iptr < 0) iptr += TOFMAX_EVT;
+                    uint32 AT = tofA.shiftReg[iptr];
+                    uint16 stopA = (uint16)(AT & 0x0000FFFF);
+                    uint16 refA = (uint16)((AT & 0xFFFF0000)>>16);
+                    dataOut[nDataReady] = byte16(refA,0);
+                    ++nDataReady;
+                    dataOut[nDataReady] = byte16(refA,1);
+                    ++nDataReady;
+                    dataOut[nDataReady] = byte16(stopA,0);
+                    ++nDataReady;
+                    dataOut[nDataReady] = byte16(stopA,1);
+                    ++nDataReady;
+                    dataOut[nDataReady] = byte16(tofA.clkCnt[iptr],0);
+                    ++nDataReady;
+                    dataOut[nDataReady] = byte16(tofA.clkCnt[iptr],1);
+                    ++nDataReady;
+                    ++cnt;
+                    if (cnt >= nA) break;
+                }
+                cnt = 0;
+                for (int i=0; i<TOFMAX_EVT; ++i) {
+                    if (!tofB.filled[i]) continue;
+                    --jptr;
+                    if (jptr < 0) jptr += TOFMAX_EVT;
+                    uint32 BT = tofB.shiftReg[jptr];
+                    uint16 stopB = (uint16)(BT & 0x0000FFFF);
+                    uint16 refB = (uint16)((BT & 0xFFFF0000)>>16);
+                    dataOut[nDataReady] = byte16(refB,0);
+                    ++nDataReady;
+                    dataOut[nDataReady] = byte16(refB,1);
+                    ++nDataReady;
+                    dataOut[nDataReady] = byte16(stopB,0);
+                    ++nDataReady;
+                    dataOut[nDataReady] = byte16(stopB,1);
+                    ++nDataReady;
+                    dataOut[nDataReady] = byte16(tofB.clkCnt[jptr],0);
+                    ++nDataReady;
+                    dataOut[nDataReady] = byte16(tofB.clkCnt[jptr],1);
+                    ++nDataReady;
+                    ++cnt;
+                    if (cnt >= nB) break;
+                }
+                for (int j=0; j<TOFMAX_EVT; ++j) {
+                    tofB.filled[j] = false;
+                    tofA.filled[j] = false;
+                }
+                tofB.ptr = 0;
+                tofA.ptr = 0;
+                break;
+            case '\x45': // Set the time and date of the real-time-clock
+                timeDate->Sec = cmdData[0];
+                timeDate->Min = cmdData[1];
+                timeDate->Hour = cmdData[2];
+                timeDate->DayOfWeek = cmdData[3];
+                timeDate->DayOfMonth = cmdData[4];
+                timeDate->DayOfYear = cmdData[6] + cmdData[5]*256;
+                timeDate->Month = cmdData[7];
+                timeDate->Year = cmdData[9] + cmdData[8]*256;
+                RTC_1_WriteTime(timeDate);
+                //LED2_OnOff(true);
+                break;
+            case '\x46': // get the time and date of the real-time-clock
+                nDataReady = 10;
+                timeDate = RTC_1_ReadTime();
+                dataOut[0] = timeDate->Sec;
+                dataOut[1] = timeDate->Min;
+                dataOut[2] = timeDate->Hour;
+                dataOut[3] = timeDate->DayOfWeek;
+                dataOut[4] = timeDate->DayOfMonth;
+                dataOut[5] = timeDate->DayOfYear/256;
+                dataOut[6] = timeDate->DayOfYear%256;
+                dataOut[7] = timeDate->Month;
+                dataOut[8] = timeDate->Year/256;
+                dataOut[9] = timeDate->Year%256;
+                break;
+            case '\x47': // Return the command input statistics: bytes lost to overflow, bytes skipped, buffer high-water mark
+                nDataReady = 10;
+                for (int i=0; i<4; ++i) {
+                    dataOut[i] = byte32(nCmdBytesLost, i);
+                    dataOut[4+i] = byte32(nCmdBytesSkipped, i);
+                }
+                dataOut[8] = byte16(cmdBufferMaxFill, 0);
+                dataOut[9] = byte16(cmdBufferMaxFill, 1);
+                break;
+            case '\x48': // Return the task statistics, 14 bytes per task in priority order, and reset them if the data byte is 1
+                nDataReady = 0;
+                for (uint8 i=0; i<N_TASKS; ++i) {
+                    for (int j=0; j<4; ++j) {
+                        dataOut[nDataReady+j] = byte32(tasks[i].nRuns, j);
+                        dataOut[nDataReady+4+j] = byte32(tasks[i].maxRunTime, j);
+                        dataOut[nDataReady+8+j] = byte32(tasks[i].maxLatency, j);
+                    }
+                    dataOut[nDataReady+12] = byte16(tasks[i].nOverBudget, 0);
+                    dataOut[nDataReady+13] = byte16(tasks[i].nOverBudget, 1);
+                    nDataReady += 14;
+                    if (nDataBytes > 0 && cmdData[0] == 1) {
+                        tasks[i].nRuns = 0;
+                        tasks[i].maxRunTime = 0;
+                        tasks[i].maxLatency = 0;
+                        tasks[i].nOverBudget = 0;
+                    }
+                }
+                break;
+            case '\x49': // Return the Tracker transaction counters: queued(4), unmatched replies(4), no reply(4), pending(1)
+                nDataReady = 13;
+                for (int j=0; j<4; ++j) {
+                    dataOut[j] = byte32(nTkrTransactions, j);
+                    dataOut[4+j] = byte32(nTkrUnmatched, j);
+                    dataOut[8+j] = byte32(nTkrNoReply, j);
+                }
+                dataOut[12] = nTkrPending();
+                break;
+            case '\x4A': // Load a block of the Tracker configuration image: offset (2 bytes), then the image bytes
+                if (nDataBytes < 2) break;
+                uint16 offset = ((uint16)cmdData[0] << 8) | cmdData[1];
+                if (offset == 0) tkrImageLen = 0;     // Start a new image
+                if (offset != tkrImageLen || (uint32)offset + nDataBytes - 2 > TKR_IMAGE_LEN) {
+                    addError(ERR_TKR_IMAGE, byte16(offset, 0), byte16(offset, 1));
+                    break;
+                }
+                memcpy(tkrImage + tkrImageLen, cmdData + 2, nDataBytes - 2);
+                tkrImageLen += nDataBytes - 2;
+                break;
+            case '\x4B': // Send the Tracker configuration image, given its CRC (2 bytes). The reply, once all records are
+                          // sent, is the number of records (2), number failed (2) and a bitmap of failed records.
+                nTkrImageRecords = 0;
+                nTkrImageFailed = 0;
+                memset(tkrImageFail, 0, TKR_IMAGE_MAP_LEN);
+                uint16 crcImage = 0xFFFF;
+                for (int i=0; i<tkrImageLen; ++i) crcImage = crc16(crcImage, tkrImage[i]);
+                uint16 ptrImage = 0;
+                while (ptrImage + 3 <= tkrImageLen) ptrImage += 3 + tkrImage[ptrImage + 2];
+                if (tkrImageLen == 0 || ptrImage != tkrImageLen || nDataBytes < 2 ||
+                                        crcImage != (((uint16)cmdData[0] << 8) | cmdData[1])) {
+                    addError(ERR_TKR_IMAGE, byte16(crcImage, 0), byte16(crcImage, 1));
+                    nDataReady = 4;     // Rejected: 0 records, 0xFFFF failed
+                    dataOut[0] = 0;
+                    dataOut[1] = 0;
+                    dataOut[2] = 0xFF;
+                    dataOut[3] = 0xFF;
+                    break;
+                }
+                tkrImagePtr = 0;
+                tkrImageSent = false;
+                tkrImageWait = false;
+                tkrImageSeq = cmdSeq;
+                tkrImageRunning = true;
+                break;
+            case '\x4C': // Set up the level-2 filter. The first data byte selects the setting:
+                          //   0: enable (1) or disable (0)       1: minimum number of tracker layers hit
+                          //   2: PMT window: channel 1-6, minimum (2), maximum (2)
+                          //   3: TOF dtmin window: minimum (2), maximum (2), signed     4: prescale of failing events (2)
+                if (cmdData[0] == 0 && nDataBytes >= 2) {
+                    l2.enabled = cmdData[1] == 1;
+                    l2.nFailed = 0;
+                } else if (cmdData[0] == 1 && nDataBytes >= 2) {
+                    l2.minLayers = cmdData[1];
+                } else if (cmdData[0] == 2 && nDataBytes >= 6 && cmdData[1] >= 1 && cmdData[1] <= N_PMT_CH) {
+                    l2.adcMin[cmdData[1]-1] = ((uint16)cmdData[2] << 8) | cmdData[3];
+                    l2.adcMax[cmdData[1]-1] = ((uint16)cmdData[4] << 8) | cmdData[5];
+                } else if (cmdData[0] == 3 && nDataBytes >= 5) {
+                    l2.dtMin = (int16)(((uint16)cmdData[1] << 8) | cmdData[2]);
+                    l2.dtMax = (int16)(((uint16)cmdData[3] << 8) | cmdData[4]);
+                } else if (cmdData[0] == 4 && nDataBytes >= 3) {
+                    l2.prescale = ((uint16)cmdData[1] << 8) | cmdData[2];
+                } else {
+                    addError(ERR_L2_CONFIG, cmdData[0], nDataBytes);
+                }
+                break;
+            case '\x4D': // Return the level-2 filter counters: events tested, passed, rejected, and failed but sent (4 each)
+                nDataReady = 16;
+                for (int j=0; j<4; ++j) {
+                    dataOut[j] = byte32(l2.nTested, j);
+                    dataOut[4+j] = byte32(l2.nPassed, j);
+                    dataOut[8+j] = byte32(l2.nRejected, j);
+                    dataOut[12+j] = byte32(l2.nSampled, j);
+                }
+                break;
+            case '\x4E': // Set the prescale of a trigger class: class 1-5 (trgStatus bit 0-4), prescale (2)
+                if (nDataBytes < 3 || cmdData[0] < 1 || cmdData[0] > N_TRG_CLASSES) {
+                    addError(ERR_TRG_CLASS, cmdData[0], nDataBytes);
+                    break;
+                }
+                trgClass[cmdData[0]-1].prescale = ((uint16)cmdData[1] << 8) | cmdData[2];
+                trgClass[cmdData[0]-1].countdown = 0;
+                break;
+            case '\x4F': // Set the SPI link protection: LINK_TRAILER and LINK_CREDITS bits, and optionally the longest
+                          // time, in 5 ms ticks, that an event waits for a credit before it is dropped
+                linkMode = cmdData[0] & (LINK_TRAILER | LINK_CREDITS);
+                if (nDataBytes >= 2) linkHoldLimit = cmdData[1];
+                linkCredits = 0;
+                break;
+            case '\x50': // Grant credits for sending events on the SPI link. No reply, not even when tagged, since
+                          // this can be executed while an event is waiting in dataOut.
+                linkCredits = linkCredits + cmdData[0] > 255 ? 255 : linkCredits + cmdData[0];
+                break;
+            case '\x51': // Return the SPI link counters: events sent (4), events dropped (4), credits, sequence number, mode
+                nDataReady = 11;
+                for (int j=0; j<4; ++j) {
+                    dataOut[j] = byte32(nLinkSent, j);
+                    dataOut[4+j] = byte32(nLinkDropped, j);
+                }
+                dataOut[8] = linkCredits;
+                dataOut[9] = linkSeq;
+                dataOut[10] = linkMode;
+                break;
+            case '\x52': // Set up the adaptive event content. The first data byte selects the setting:
+                          //   0: level to use even without a backlog, 0-3
+                          //   1-3: backlog watermark of that level (2), in 100 us units, 0 to never enter the level
+                          //   4: PMT zero-suppression threshold: channel 1-6, threshold (2)
+                if (cmdData[0] == 0 && nDataBytes >= 2 && cmdData[1] < N_DEGRADE_LEVELS) {
+                    degrade.minLevel = cmdData[1];
+                } else if (cmdData[0] >= 1 && cmdData[0] < N_DEGRADE_LEVELS && nDataBytes >= 3) {
+                    degrade.mark[cmdData[0]] = ((uint16)cmdData[1] << 8) | cmdData[2];
+                    degrade.level = 0;
+                } else if (cmdData[0] == 4 && nDataBytes >= 4 && cmdData[1] >= 1 && cmdData[1] <= N_PMT_CH) {
+                    degrade.pmtThreshold[cmdData[1]-1] = ((uint16)cmdData[2] << 8) | cmdData[3];
+                } else {
+                    addError(ERR_DEGRADE_CONFIG, cmdData[0], nDataBytes);
+                }
+                break;
+            case '\x53': // Return the event content level, the output backlog (2, in 100 us units) and the
+                          // number of events sent out at each level 0-3 (4 each)
+                nDataReady = 19;
+                uint16 backlog = degrade.backlog/100 > 0xFFFF ? 0xFFFF : degrade.backlog/100;
+                dataOut[0] = degrade.level > degrade.minLevel ? degrade.level : degrade.minLevel;
+                dataOut[1] = byte16(backlog, 0);
+                dataOut[2] = byte16(backlog, 1);
+                for (uint8 i=0; i<N_DEGRADE_LEVELS; ++i) {
+                    for (int j=0; j<4; ++j) dataOut[3+4*i+j] = byte32(degrade.nEvents[i], j);
+                }
+                break;
+        } // End of command switch
+        if (tkrCmdWait != 0) {
+            tkrCmdSeq = cmdSeq;    // The reply goes out from finishTkrCommand
+        } else {
+            if (cmdSeq != 0 && nDataReady == 0 && command != 0x4B && command != 0x50) {  // Acknowledge a tagged command that returns no data
+                nDataReady = 3;
+                dataOut[0] = command;
+                dataOut[1] = CMD_ACK;
+                dataOut[2] = 0x00;
+            }
+            if (!eventDataReady) dataSeq = cmdSeq;   // a credit grant can be executed while an event waits in dataOut
+        }
+        command = 0;
+    } else { // Log an error if the user is sending spurious commands while the trigger is enabled
+        addError(ERR_CMD_IGNORE, command, 0);
+        if (cmdSeq != 0) {
+            nDataReady = 3;
+            dataOut[0] = command;
+            dataOut[1] = CMD_NAK;
+            dataOut[2] = ERR_CMD_IGNORE;
+            dataSeq = cmdSeq;
+        }
+    }
+}
+
+// Task: send out Tracker housekeeping data immediately after receiving it from the Tracker
+bool taskHousekeepingReady() {
+    return !isTriggerEnabled() && nTkrHouseKeeping>0 && nDataReady == 0;
+}
+
+void taskHousekeeping() {
+    nDataReady = nTkrHouseKeeping + 7;
+    dataSeq = 0;
+    dataOut[0] = nDataReady;
+    dataOut[1] = 0xC7;
+    dataOut[2] = nTkrHouseKeeping;
+    dataOut[3] = byte16(tkrCmdCount,0);
+    dataOut[4] = byte16(tkrCmdCount,1);
+    dataOut[5] = tkrHouseKeepingFPGA;
+    dataOut[6] = tkrCmdCode;
+    for (int i=0; i<nTkrHouseKeeping; ++i) {
+        dataOut[6+i] = tkrHouseKeeping[i];
+    }
+    nTkrHouseKeeping = 0;
+}
+
+// Background task: command time-out, input and parsing
+void taskCommandInput() {
+    // Time-out protection in case the expected data for a command are never sent
+    if (!awaitingCommand) {
+        if (time() - cmdStartTime > TIMEOUT) {
+            awaitingCommand = true;
+            nCmdTimeOut++;
+        }
+    }        
+
+    // Get command input from the UART and USB-UART
+    // reads partial to full commands from either input and adds them to a buffer for parsing 
+    uint8 tempBuffer[BUFFER_LEN]; //new buffer to get the data from USBUART_GetAll or the UART
+    uint16 count = 0; //Temporary variable to keep count of revelant new command bytes 
+    if (USBUART_GetConfiguration() != 0u) {    // USB is active
+        if (USBUART_DataIsReady() != 0u) { // command bytes are ready
+            count = USBUART_GetAll(tempBuffer); // get the bytes from USB
+            cmdBufferPut(tempBuffer, count);
+        }
+    }
+    count = UART_CMD_GetRxBufferSize(); //number of bytes waiting in the UART software buffer
+    while (count > 0) { // drain it in blocks
+        uint16 nBlock = count < BUFFER_LEN ? count : BUFFER_LEN;
+        for (int i=0; i<nBlock; ++i) tempBuffer[i] = UART_CMD_ReadRxData();
+        cmdBufferPut(tempBuffer, nBlock);
+        count -= nBlock;
+    }
+    count = WRAP((CMD_RING_LEN - bufferRead + bufferWrite), CMD_RING_LEN); //Count of active buffered bytes to parse
+    if (cmdDone) count = 0;  // a command is still waiting to be executed, so hold off parsing the next one
+    while (count > 0 && 'S' != buffer[bufferRead] && BIN_SYNC != buffer[bufferRead]) { //Find the start of an ASCII or binary command, discard bytes until found
+        nCmdBytesSkipped++;
+        bufferRead = WRAPINC(bufferRead, CMD_RING_LEN); //increment read index
+        count--;
+    }
+    if (count >= BIN_HEAD_LEN && BIN_SYNC == buffer[bufferRead]) { // binary command frame, see the header for the format
+        uint8 nBin = buffer[WRAP(bufferRead + 4, CMD_RING_LEN)];
+        if (nBin > MAX_CMD_DATA) {
+            addError(ERR_BAD_FRAME, buffer[WRAP(bufferRead + 3, CMD_RING_LEN)], nBin);
+            nCmdBytesSkipped++;
+            bufferRead = WRAPINC(bufferRead, CMD_RING_LEN); //not a real frame, discard the sync byte and resynchronize
+        } else if (count >= BIN_FRAME_LEN(nBin)) { // wait until the whole frame has arrived
+            uint16 crc = 0xFFFF;
+            for (uint16 i=1; i<BIN_HEAD_LEN + nBin; ++i) {
+                crc = crc16(crc, buffer[WRAP(bufferRead + i, CMD_RING_LEN)]);
+            }
+            uint16 crcFrame = ((uint16)buffer[WRAP(bufferRead + BIN_HEAD_LEN + nBin, CMD_RING_LEN)] << 8) | buffer[WRAP(bufferRead + BIN_HEAD_LEN + nBin + 1, CMD_RING_LEN)];
+            if (crc != crcFrame) {
+                addError(ERR_BAD_CRC, buffer[WRAP(bufferRead + 3, CMD_RING_LEN)], nBin);
+                nCmdBytesSkipped++;
+                bufferRead = WRAPINC(bufferRead, CMD_RING_LEN); //discard the sync byte and resynchronize
+            } else {
+                cmdCountGLB++;
+                if (buffer[WRAP(bufferRead + 1, CMD_RING_LEN)] == eventPSOCaddress) {
+                    if (!awaitingCommand) {   // An ASCII command still waiting for data frames: abandon it
+                        addError(ERR_BAD_BYTE, command, dCnt);
+                        awaitingCommand = true;
+                    }
+                    cmdStartTime = time();
+                    cmdCount++;
+                    cmdSeq = buffer[WRAP(bufferRead + 2, CMD_RING_LEN)];
+                    command = buffer[WRAP(bufferRead + 3, CMD_RING_LEN)];
+                    nDataBytes = nBin;
+                    dCnt = nBin;
+                    for (int i=0; i<nBin; ++i) {
+                        cmdData[i] = buffer[WRAP(bufferRead + BIN_HEAD_LEN + i, CMD_RING_LEN)];
+                    }
+                    cmdDone = true;  // the whole command arrives in one frame
+                }
+                bufferRead = WRAP(bufferRead + BIN_FRAME_LEN(nBin), CMD_RING_LEN);//frame processed, move read index past it
+            }
+        }
+    } else if (count >= ASCII_CMD_LEN) {// command is 29 bytes long so that is the min to parse
+        bool badCMD = false; // this flag true will stop further checks
+        for (int i=0; i<9; ++i) {   // Check that all 3 command copies are identical
+            if (buffer[WRAP(bufferRead + i, CMD_RING_LEN)] != buffer[WRAP(bufferRead + i+9, CMD_RING_LEN)] || buffer[WRAP(bufferRead + i, CMD_RING_LEN)] != buffer[WRAP(bufferRead + i+18, CMD_RING_LEN)]) { //single byte doesn't match
+                addError(ERR_BAD_CMD, code[buffer[WRAP(bufferRead + i, CMD_RING_LEN)]], WRAP(bufferRead + i+9, CMD_RING_LEN)); //command doesn't match in triplicate
+                badCMD = true; //command is bad so stop futher checks
+                nCmdBytesSkipped++;
+                bufferRead = WRAPINC(bufferRead, CMD_RING_LEN); //discard byte that leads to misalignment
+                break;//stop futher checks
+            }
+        }
+        if(!badCMD) //continue checks
+        {
+            if (('W' != buffer[WRAP(bufferRead + 26, CMD_RING_LEN)]) || ('\r' !=  buffer[WRAP(bufferRead + 27, CMD_RING_LEN)]) || ('\n' !=  buffer[WRAP(bufferRead + 28, CMD_RING_LEN)]))
+            {
+                addError(ERR_BAD_CMD, code[buffer[WRAP(bufferRead + 26, CMD_RING_LEN)]], WRAP(bufferRead + 27, CMD_RING_LEN));
+                badCMD = true; //command is bad so stop futher checks
+                nCmdBytesSkipped++;
+                bufferRead = WRAPINC(bufferRead, CMD_RING_LEN); //discard byte that leads to misalignment
+            }
+        }
+        if (!badCMD) //if not set, command passed all checks
+        {
+            cmdCountGLB++;
+            //cmdTime = time();
+            uint8 nib3 = code[buffer[WRAP(bufferRead + 3, CMD_RING_LEN)]];
+            uint8 nib4 = code[buffer[WRAP(bufferRead + 4, CMD_RING_LEN)]];
+            uint8 addressByte = (nib3<<4) | nib4;
+            uint8 PSOCaddress = (addressByte & '\x3C')>>2;
+            if (PSOCaddress == eventPSOCaddress) {                    
+                uint8 nib1 = code[buffer[WRAP(bufferRead + 1, CMD_RING_LEN)]];  // No check on code. Illegal characters get translated to 0.
+                uint8 nib2 = code[buffer[WRAP(bufferRead + 2, CMD_RING_LEN)]];
+                uint8 dataByte = (nib1<<4) | nib2;
+                if (awaitingCommand) {
+                    awaitingCommand = false;
+                    cmdStartTime = time();
+                    cmdCount++;
+                    dCnt = 0;
+                    nDataBytes = ((addressByte & '\xC0') >> 4) | (addressByte & '\x03');
+                    command = dataByte;
+                    cmdSeq = (code[buffer[WRAP(bufferRead + 6, CMD_RING_LEN)]]<<4) | code[buffer[WRAP(bufferRead + 7, CMD_RING_LEN)]];
+                    if (nDataBytes == 0) cmdDone = true;
+                } else {
+                    uint8 byteCnt = ((addressByte & '\xC0') >> 4) | (addressByte & '\x03');
+                    if (byteCnt != 0) {
+                        cmdData[byteCnt-1] = dataByte;
+                        dCnt++;
+                        if (dCnt == nDataBytes) {
+                            cmdDone = true; 
+                        }
+                    } else {
+                        addError(ERR_BAD_BYTE, command, nDataBytes);
+                        badCMD = true;
+                    }
+                }
+            }
+            bufferRead = WRAP(bufferRead + 29, CMD_RING_LEN);//command processed, move read index past it
+        }
+    }
+}
+
+// Background task: USB-UART enumeration
+void taskUSB() {
+    if (USBUART_IsConfigurationChanged() != 0u) {
+        /* Wait for USB-UART Device to enumerate */
+        if (USBUART_GetConfiguration() != 0u) {
+            /* Enumeration is done, enable OUT endpoint to receive data from Host */
+            USBUART_CDC_Init();
+        }
+    }
+    if ((nUsbStaged > 0 || usbEndTransfer) && time() - usbStageTime >= USB_FLUSH_TIME) usbFlush();
+}
+
+// Task: send the next record of the Tracker configuration image, and once tkrComplete has its reply, check
+// it and move on to the next record
+bool taskTkrImageReady() {
+    return tkrImageRunning && !tkrImageWait && nDataReady == 0;
+}
+
+void taskTkrImage() {
+    uint8* record = tkrImage + tkrImagePtr;
+    if (!tkrImageSent) {
+        uint8 code = record[1];
+        bool hasEcho = (code != 0x67 && code != 0x6C);
+        tkrLED(true);
+        tkrImageOK = tkrSend(record[0], code, record[2], record + 3, hasEcho ? TKR_FOR_IMAGE : TKR_NO_REPLY);
+        if (tkrImageOK && hasEcho) {
+            tkrImageSent = true;
+            tkrImageWait = true;
+            return;
+        }
+    }
+    tkrImageSent = false;
+    tkrLED(false);
+    if (!tkrImageOK) {
+        tkrImageFail[nTkrImageRecords/8] |= 1 << (nTkrImageRecords % 8);
+        nTkrImageFailed++;
+    }
+    nTkrImageRecords++;
+    tkrImagePtr += 3 + record[2];
+    if (tkrImagePtr >= tkrImageLen) {
+        tkrImageRunning = false;
+        dataOut[0] = byte16(nTkrImageRecords, 0);
+        dataOut[1] = byte16(nTkrImageRecords, 1);
+        dataOut[2] = byte16(nTkrImageFailed, 0);
+        dataOut[3] = byte16(nTkrImageFailed, 1);
+        uint16 nMap = (nTkrImageRecords + 7)/8;
+        memcpy(dataOut + 4, tkrImageFail, nMap);
+        nDataReady = 4 + nMap;
+        dataSeq = tkrImageSeq;
+    }
+}
+
+// Background task: keep the Tracker UART fed from the command queue, parse the reply bytes that have come in,
+// and give up on replies that stopped part way or never came
+void taskTracker() {
+    tkrTxPump();
+    while (UART_TKR_ReadRxStatus() & UART_TKR_RX_STS_FIFO_NOTEMPTY) {
+        tkrRxByte(UART_TKR_ReadRxData());
+    }
+    uint32 now = time();
+    if (tkrRx.need > 0 && now - tkrRx.startTime > TKR_READ_TIMEOUT) {
+        addError(ERR_TKR_READ_TIMEOUT, (uint8)tkrRx.n, tkrRx.nHit);
+        tkrRxEnd(false, NULL, 0);
+    }
+    for (uint8 i=0; i<TKR_MAX_PENDING; ++i) {
+        if (tkrTrans[i].pending && now - tkrTrans[i].sendTime > TKR_REPLY_TIMEOUT) {
+            tkrTrans[i].pending = false;
+            nTkrNoReply++;
+            addError(ERR_TKR_NO_REPLY, tkrTrans[i].code, tkrTrans[i].fpga);
+            tkrRx.need = 0;     // Whatever is still coming in is out of step
+            tkrRx.nHit = 0;
+            tkrComplete(tkrTrans[i].owner, false, NULL, 0);
+        }
+    }
+}
+
+// Task list in order of priority
+struct Task tasks[N_TASKS] = {
+    {.ready = taskEventBuildReady, .run = taskEventBuild, .budget = 5000},
+    {.ready = taskOutputReady, .run = taskOutput, .budget = 2000},
+    {.ready = taskRunEndReady, .run = taskRunEnd, .budget = 200},
+    {.ready = taskCommandExecReady, .run = taskCommandExec, .budget = 10000},
+    {.ready = taskTkrImageReady, .run = taskTkrImage, .budget = 5000},
+    {.ready = taskHousekeepingReady, .run = taskHousekeeping, .budget = 200},
+    {.ready = NULL, .run = taskCommandInput, .budget = 500},
+    {.ready = NULL, .run = taskUSB, .budget = 100},
+    {.ready = NULL, .run = taskTracker, .budget = 100}
+};
+uint8 nextBackground = 0;
+bool foregroundRan = false;     // The last pass ran a foreground task, so this one goes to a background task
+
+void runTask(uint8 i) {
+    uint32 tStart = cpuTicks();
+    uint32 latency = (tStart - tasks[i].readySince)/BCLK__BUS_CLK__MHZ;
+    tasks[i].run();
+    uint32 runTime = (cpuTicks() - tStart)/BCLK__BUS_CLK__MHZ;
+    tasks[i].waiting = false;
+    tasks[i].nRuns++;
+    if (latency > tasks[i].maxLatency) tasks[i].maxLatency = latency;
+    if (runTime > tasks[i].maxRunTime) tasks[i].maxRunTime = runTime;
+    if (runTime > tasks[i].budget) tasks[i].nOverBudget++;
+}
+
+// One pass of the scheduler: run the highest-priority ready task, or else, or if the last pass ran a
+// foreground task, the next background task
+void schedule() {
+    uint32 now = cpuTicks();
+    int next = -1;
+    for (uint8 i=0; i<N_TASKS; ++i) {
+        if (tasks[i].ready == NULL || tasks[i].ready()) {
+            if (!tasks[i].waiting) {
+                tasks[i].waiting = true;
+                tasks[i].readySince = now;
+            }
+            if (next < 0 && tasks[i].ready != NULL) next = i;
+        } else {
+            tasks[i].waiting = false;
+        }
+    }
+    foregroundRan = next >= 0 && !foregroundRan;
+    if (!foregroundRan) {
+        do {
+            nextBackground = (nextBackground + 1) % N_TASKS;
+        } while (tasks[nextBackground].ready != NULL);
+        next = nextBackground;
+    }
+    runTask(next);
+}
+
+int main(void)
+{     
+    triggered = false;
+    tkrData.nTkrBoards = 0;
+    tofA.ptr = 0;
+    tofB.ptr = 0;
+    outputTOF = false;
+    for (int i=0; i<TOFMAX_EVT; ++i) {
+        tofA.filled[i] = false;
+        tofB.filled[i] = false;
+    }
+    
+    nDataReady = 0;
+    clkCnt = 0;
+    nTkrHouseKeeping = 0;
+    
+    runNumber = 0;
+    timeStamp = time();
+    
+    // Set the invariant parts of the header and trailer bytes of the output packet.
+    dataPacket[1] = '\x00';
+    dataPacket[2] = '\xFF';
+    dataPacket[6] = '\xFF';
+    dataPacket[7] = '\x00';
+    dataPacket[8] = '\xFF';
+    
+    // General hardware logic reset (not including the tracker), and reset of counters
+    logicReset();
+    
+    CyGlobalIntEnable; /* Enable global interrupts. */
+
+    /* Initialize interrupts */
+    isr_timer_StartEx(intTimer);
+    isr_clk200_StartEx(clk200);
+    isr_Store_A_StartEx(Store_A);
+    isr_Store_B_StartEx(Store_B);
+    isr_Ch1_StartEx(isrCh1);
+    isr_Ch2_StartEx(isrCh2);
+    isr_Ch3_StartEx(isrCh3);
+    isr_Ch4_StartEx(isrCh4);
+    isr_Ch5_StartEx(isrCh5);
+    isr_GO1_StartEx(isrGO1);   
+    
+    /* Start up the various hardware components */
+    I2C_2_Start();
+    
+    // Counters for loading TOF shift registers. The periods are set in the schematic and should never change!
+    Count7_1_Start();
+    Count7_2_Start();
+    
+    // Set up the counter used for timing. It counts a 200 Hz clock derived from the watch crystal, and every 200 counts
+    // i.e. once each second, it interrupts the CPU, which then increments a 1 Hz count. The time() function adds the two
+    // counts together to get a time tag that increments every 5 ms. Note that the main purpose of the 200 Hz clock is to
+    // send a hardware reset to the time-of-flight chip every 5 ms, so that we know exactly when its counting starts.
+    //Counter_1_Start();
+    //Counter_1_WritePeriod(199);  // Should count from 0 to 199, for a period of 200
+    //Counter_1_SetCaptureMode(Counter_1__B_COUNTER__SOFTWARE_CONTROL);
+    Cntr8_Timer_WritePeriod(199);
+    
+    // Counter for the delay time to wait before resetting the peak detectors.
+    Count7_3_Start();
+    // The peak detector output takes about 4us to settle down after its upward swing, so at 12MHz this should be at least 48 ticks to set
+    // the time to start digitizing. This also affects wait times to sent peak detector resets and start looking for new triggers.
+    setPeakDetResetWait(72);
+
+    // TOF shift registers
+    ShiftReg_A_Start();
+    ShiftReg_B_Start();
+    
+    SPIM_Start();
+    
+    USBUART_Start(USBFS_DEVICE, USBUART_3V_OPERATION);
+    
+    Comp_Ch1_Start();
+    Comp_Ch2_Start();
+    Comp_Ch3_Start();
+    Comp_Ch4_Start();
+    
+    // Internal and external voltage DACs
+    VDAC8_Ch1_Start();
+    VDAC8_Ch1_SetValue(THRDEF);   // This is in DAC counts, 4 mV/bit
+    VDAC8_Ch2_Start();
+    VDAC8_Ch2_SetValue(THRDEF);
+    VDAC8_Ch3_Start();
+    VDAC8_Ch3_SetValue(THRDEF);
+    VDAC8_Ch4_Start();
+    VDAC8_Ch4_SetValue(THRDEF);
+    loadDAC(I2C_Address_DAC_Ch5, 0x000F);
+    loadDAC(I2C_Address_TOF_DAC1, 0x00FF);
+    loadDAC(I2C_Address_TOF_DAC2, 0x00FF);
+    
+    ADC_SAR_1_Start();
+    ADC_SAR_2_Start();
+    ADC_DelSig_1_Start();
+ 
+    UART_TKR_Start();
+    UART_CMD_Start();
+
+    // Start counters buried inside of the edge detectors for the trigger inputs
+    TrigWindow_V1_1_Count7_1_Start();
+    TrigWindow_V1_2_Count7_1_Start();
+    TrigWindow_V1_3_Count7_1_Start();
+    TrigWindow_V1_4_Count7_1_Start();
+    TrigWindow_V1_5_Count7_1_Start();
+    setCoincidenceWindow(12);
+    
+    // Start the internal real-time-clock component
+    RTC_1_Start();
+    
+    // Configure the i2c Real-Time-Clock if that bus extends to the event PSOC (normally not)
+    //loadI2Creg(I2C_Address_RTC, 0x00, 0x59);
+    //loadI2Creg(I2C_Address_RTC, 0x07, 0x80);     
+    
+    /* Variable declarations for DMA_1 */
+    uint8 DMA_1_Chan;
+    uint8 DMA_1_TD[1];  
+
+    /* Variable declarations for DMA_2 */
+    uint8 DMA_2_Chan;
+    uint8 DMA_2_TD[1];   
+            
+    /* DMA Configuration for DMA_1 SAR ADC */
+    DMA_1_Chan = DMA_1_DmaInitialize(DMA_BYTES_PER_BURST, DMA_REQUEST_PER_BURST, 
+                 HI16(DMA_SRC_BASE), HI16(DMA_DST_BASE));
+    DMA_1_TD[0] = CyDmaTdAllocate();
+    CyDmaTdSetConfiguration(DMA_1_TD[0], DMA_BYTES_PER_BURST*DMA_NO_OF_SAMPLES, DMA_1_TD[0], 
+                                 DMA_1__TD_TERMOUT_EN | CY_DMA_TD_INC_DST_ADR);
+    CyDmaTdSetAddress(DMA_1_TD[0], LO16((uint32)ADC_SAR_1_SAR_WRK0_PTR), LO16((uint32)adc1_sampleArray));
+    CyDmaChSetInitialTd(DMA_1_Chan, DMA_1_TD[0]);
+    CyDmaChEnable(DMA_1_Chan, 1);             /* Enable the DMA channel for the ADC */
+    
+    /* DMA Configuration for DMA_2 SAR ADC */
+    DMA_2_Chan = DMA_2_DmaInitialize(DMA_BYTES_PER_BURST, DMA_REQUEST_PER_BURST, 
+                 HI16(DMA_SRC_BASE), HI16(DMA_DST_BASE));
+    DMA_2_TD[0] = CyDmaTdAllocate();
+    CyDmaTdSetConfiguration(DMA_2_TD[0], DMA_BYTES_PER_BURST*DMA_NO_OF_SAMPLES, DMA_2_TD[0], 
+                                 DMA_1__TD_TERMOUT_EN | CY_DMA_TD_INC_DST_ADR);
+    CyDmaTdSetAddress(DMA_2_TD[0], LO16((uint32)ADC_SAR_2_SAR_WRK0_PTR), LO16((uint32)adc2_sampleArray));
+    CyDmaChSetInitialTd(DMA_2_Chan, DMA_2_TD[0]);
+    CyDmaChEnable(DMA_2_Chan, 1);             /* Enable the DMA channel for the ADC */
+    
+    // Variable declarations for DMA_3,4 
+    /*
+    #define TOF_DMA_BYTES_PER_BURST 4
+    #define TOF_DMA_REQUEST_PER_BURST 1
+    #define TOF_DMA_NO_OF_SAMPLES 1
+    uint8 DMA_3_Chan;
+    uint8 DMA_3_TD[1];   
+    uint8 DMA_4_Chan;
+    uint8 DMA_4_TD[1];   
+
+    // DMA Configuration for TOF shift register A 
+    DMA_3_Chan = DMA_3_DmaInitialize(TOF_DMA_BYTES_PER_BURST, TOF_DMA_REQUEST_PER_BURST, 
+                 HI16(DMA_SRC_BASE), HI16(DMA_DST_BASE));
+    DMA_3_TD[0] = CyDmaTdAllocate();
+    CyDmaTdSetConfiguration(DMA_3_TD[0], TOF_DMA_BYTES_PER_BURST*TOF_DMA_NO_OF_SAMPLES, DMA_3_TD[0], 
+                                 DMA_3__TD_TERMOUT_EN | CY_DMA_TD_INC_DST_ADR);
+    CyDmaTdSetAddress(DMA_3_TD[0], LO16((uint32)ShiftReg_A_OUT_FIFO_VAL_LSB_PTR), LO16((uint32)tofA_sampleArray));
+    CyDmaChSetInitialTd(DMA_3_Chan, DMA_3_TD[0]);
+    CyDmaChEnable(DMA_3_Chan, 1);        
+    
+    // DMA Configuration for TOF shift register B 
+    DMA_4_Chan = DMA_4_DmaInitialize(TOF_DMA_BYTES_PER_BURST, TOF_DMA_REQUEST_PER_BURST, 
+                 HI16(DMA_SRC_BASE), HI16(DMA_DST_BASE));
+    DMA_4_TD[0] = CyDmaTdAllocate();
+    CyDmaTdSetConfiguration(DMA_4_TD[0], TOF_DMA_BYTES_PER_BURST*TOF_DMA_NO_OF_SAMPLES, DMA_4_TD[0], 
+                                 DMA_4__TD_TERMOUT_EN | CY_DMA_TD_INC_DST_ADR);
+    CyDmaTdSetAddress(DMA_4_TD[0], LO16((uint32)ShiftReg_B_OUT_FIFO_VAL_LSB_PTR), LO16((uint32)tofB_sampleArray));
+    CyDmaChSetInitialTd(DMA_4_Chan, DMA_4_TD[0]);
+    CyDmaChEnable(DMA_4_Chan, 1);        
+    */
+    
+    // Set up the configuration of the TOF chip AS6501:
+    SPIM_ClearTxBuffer();
+    SPIM_ClearRxBuffer();
+
+    set_SPI_SSN(SSN_TOF, true);
+    SPIM_WriteTxData(powerOnRESET);
+    CyDelay(1);
+
+    // Set up the default AS6501 TOF configuration
+    set_SPI_SSN(SSN_TOF, true);
+    SPIM_WriteTxData(writeConfig);
+    for (int i=0; i<TOFSIZE; ++i) {
+        SPIM_WriteTxData(tofConfig[i]);
+    }
+    CyDelay(1);
+    
+    // Enable the TOF
+    set_SPI_SSN(SSN_TOF, true);
+    SPIM_WriteTxData(TOF_enable); 
+    
+    
+    // Set up the default trigger configuration
+    Cntr8_V1_TKR_WritePeriod(255);    // Tracker trigger prescale
+    Cntr8_V1_PMT_WritePeriod(255);    // PMT hadron trigger prescale
+    setTriggerMask('e',0x01);
+    setTriggerMask('p',0x05);
+
+    // Enable interrupts and configure TOF shift register interrupt signals
+    isr_timer_Enable();
+    isr_clk200_Enable();
+    isr_Store_A_Enable();
+    ShiftReg_A_EnableInt();
+    ShiftReg_A_SetIntMode(ShiftReg_A_STORE_INT_EN);
+    isr_Store_B_Enable();
+    ShiftReg_B_EnableInt();
+    ShiftReg_B_SetIntMode(ShiftReg_B_STORE_INT_EN);    
+    isr_Ch1_Enable();
+    isr_Ch2_Enable();
+    isr_Ch3_Enable();
+    isr_Ch4_Enable();
+    isr_Ch5_Enable();
+    isr_GO1_Enable();
+    
+    set_SPI_SSN(0, false);   // Deselect all SPI slaves
+    //uint32 cmdTime = time();
+    triggerEnable(false);
+    
+    // SysTick provides the time base for the task statistics
+    CySysTickStart();
+    CySysTickSetReload(SYSTICK_RELOAD);
+    CySysTickSetCallback(0, sysTickWrap);
+    for(;;)
+    {
+        schedule();
+    }
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,144 @@
+# Reader for the event PSOC USB bulk output mode (output mode 2, see setOutputMode("bulk") in PSOC_cmd.py).
+# Each reply or event arrives as one record {0xDD, sequence number, length MSB, length LSB, data},
+# and records are packed back to back into full 64-byte USB packets.
+#
+# The records can be read from three sources:
+#   SerialSource   the USB-UART (CDC) port, through the operating system serial driver
+#   UsbSource      the CDC bulk IN endpoint directly with pyusb, bypassing the serial driver
+#   LoopbackSource a simulator that packs given records into 64-byte packets, for testing without hardware
+#
+# Usage:
+#   reader = BulkReader(SerialSource(PSOC_cmd.ser))
+#   for seq, data in reader.records(): ...
+import sys
+import time
+
+BULK_HEAD = 0xDD
+USB_PACKET_LEN = 64
+
+class SerialSource:
+  def __init__(self, port):
+    self.port = port
+
+  def read(self):
+    return self.port.read(max(self.port.in_waiting, 1))
+
+class UsbSource:
+  # Default vendor and product IDs of the Cypress USBUART component
+  def __init__(self, vendor=0x04B4, product=0xF232, timeout=200):
+    import usb.core
+    import usb.util
+    self.timeout = timeout
+    self.dev = usb.core.find(idVendor=vendor, idProduct=product)
+    if self.dev is None:
+      raise IOError("UsbSource: no device found with ID " + hex(vendor) + ":" + hex(product))
+    self.endpoint = None
+    for intf in self.dev.get_active_configuration():
+      for ep in intf:
+        if (usb.util.endpoint_direction(ep.bEndpointAddress) == usb.util.ENDPOINT_IN and
+            usb.util.endpoint_type(ep.bmAttributes) == usb.util.ENDPOINT_TYPE_BULK):
+          if self.dev.is_kernel_driver_active(intf.bInterfaceNumber):
+            self.dev.detach_kernel_driver(intf.bInterfaceNumber)
+          self.endpoint = ep
+          break
+      if self.endpoint is not None: break
+    if self.endpoint is None:
+      raise IOError("UsbSource: the device has no bulk IN endpoint")
+
+  def read(self):
+    import usb.core
+    try:
+      return bytes(self.endpoint.read(16*USB_PACKET_LEN, self.timeout))
+    except usb.core.USBTimeoutError:
+      return b''
+
+class LoopbackSource:
+  # records: list of (sequence number, data bytes)
+  def __init__(self, records):
+    stream = b''
+    for seq, data in records:
+      stream = stream + bytes([BULK_HEAD, seq, len(data) >> 8, len(data) & 0xFF]) + bytes(data)
+    self.packets = [stream[i:i+USB_PACKET_LEN] for i in range(0, len(stream), USB_PACKET_LEN)]
+
+  def read(self):
+    if len(self.packets) == 0: return b''
+    return self.packets.pop(0)
+
+# The source may be None if the bytes are given to feed() instead of read by next()
+class BulkReader:
+  def __init__(self, source):
+    self.source = source
+    self.buffer = b''
+    self.nSkipped = 0      # bytes discarded while looking for a record header
+
+  # Take the next complete record out of the buffer as (sequence number, data), or return None
+  def _record(self):
+    if len(self.buffer) > 0 and self.buffer[0] != BULK_HEAD:     # resynchronize on the next record header
+      start = self.buffer.find(BULK_HEAD)
+      if start < 0: start = len(self.buffer)
+      self.buffer = self.buffer[start:]
+      self.nSkipped += start
+    if len(self.buffer) < 4: return None
+    nData = (self.buffer[2] << 8) | self.buffer[3]
+    if len(self.buffer) < 4 + nData: return None
+    record = (self.buffer[1], self.buffer[4:4+nData])
+    self.buffer = self.buffer[4+nData:]
+    return record
+
+  # Return the next record as (sequence number, data), or None if nothing arrives within the time-out
+  def next(self, timeout=1.0):
+    tStart = time.time()
+    while True:
+      record = self._record()
+      if record is not None: return record
+      if time.time() - tStart > timeout: return None
+      self.buffer = self.buffer + self.source.read()
+
+  # Add bytes that have arrived and return the list of records completed, as (sequence number, data)
+  def feed(self, data):
+    self.buffer = self.buffer + data
+    out = []
+    record = self._record()
+    while record is not None:
+      out.append(record)
+      record = self._record()
+    return out
+
+  def records(self, timeout=1.0):
+    while True:
+      record = self.next(timeout)
+      if record is None: return
+      yield record
+
+# Event records start with "ZERO" and end with "FINI"
+def isEvent(data):
+  return data[0:4] == b'ZERO' and data[-4:] == b'FINI'
+
+# Read events for the given number of seconds and report the data rate
+def measureRate(reader, seconds):
+  nEvents = 0
+  nBytes = 0
+  tStart = time.time()
+  while time.time() - tStart < seconds:
+    record = reader.next(0.1)
+    if record is None: continue
+    nBytes += len(record[1]) + 4
+    if isEvent(record[1]): nEvents += 1
+  dt = time.time() - tStart
+  print("measureRate: " + str(nEvents) + " events, " + str(nBytes) + " bytes in " + str(round(dt,2)) + " s = " +
+        str(round(nBytes/dt/1000., 1)) + " kB/s, " + str(reader.nSkipped) + " bytes skipped")
+  return nEvents, nBytes
+
+if __name__ == "__main__":
+  if len(sys.argv) > 1 and sys.argv[1] == "loopback":
+    records = [(0, b'ZERO' + bytes(range(48)) + b'FINI') for i in range(1000)] + [(5, b'\x01\x02\x03')]
+    reader = BulkReader(LoopbackSource(records))
+    nEvents, nBytes = measureRate(reader, 0.5)
+    print("loopback: " + ("passed" if nEvents == 1000 else "FAILED"))
+  elif len(sys.argv) > 1:
+    import serial
+    reader = BulkReader(SerialSource(serial.Serial(sys.argv[1], 115200, timeout=.1)))
+    measureRate(reader, float(sys.argv[2]) if len(sys.argv) > 2 else 10.)
+  else:
+    reader = BulkReader(UsbSource())
+    measureRate(reader, 10.)
@@ -0,0 +1,189 @@
+# Raw capture and replay of the serial link to the event PSOC.
+# CaptureSerial wraps an open serial port and tees every byte read from it and written to it into a capture
+# file, with the time each chunk went through. ReplaySerial is a serial-port stand-in that plays the received
+# bytes of a capture back, either as fast as the reader can take them or with the original timing, so that
+# the decoders (PSOC_cmd, PSOC_pipeline, PSOC_bulk) can be benchmarked and regression tested on real data.
+#
+# File layout, little endian: "AESOCAP1", start time (8, float), then records of
+#   time (8, float seconds since 1970), direction (1, 0 = received, 1 = sent), length (4), data
+#
+# Usage:
+#   PSOC_cmd.openCOM("/dev/ttyACM0")
+#   PSOC_cmd.startCapture("bench.cap")   # every later PSOC_cmd call is captured
+#   ...
+#   PSOC_cmd.stopCapture()
+#   python3 PSOC_capture.py bench.cap packets   # replay through the FIX_HEAD/VAR_HEAD packet decoder
+#   python3 PSOC_capture.py bench.cap bulk      # replay through the bulk record decoder
+import sys
+import mmap
+import time
+import struct
+import hashlib
+
+MAGIC = b'AESOCAP1'
+RX = 0
+TX = 1
+RECORD = struct.Struct('<dBI')
+
+class CaptureSerial:
+  def __init__(self, port, fileName):
+    self.port = port
+    self.f = open(fileName, 'wb')
+    self.f.write(MAGIC + struct.pack('<d', time.time()))
+    self.nRx = 0
+    self.nTx = 0
+
+  def _log(self, direction, data):
+    self.f.write(RECORD.pack(time.time(), direction, len(data)))
+    self.f.write(data)
+
+  def read(self, size=1):
+    data = self.port.read(size)
+    if len(data) > 0:
+      self._log(RX, data)
+      self.nRx += len(data)
+    return data
+
+  def write(self, data):
+    data = bytes(data)
+    self._log(TX, data)
+    self.nTx += len(data)
+    return self.port.write(data)
+
+  # Close the capture file and return the serial port it was wrapping
+  def stopCapture(self):
+    self.f.close()
+    return self.port
+
+  def close(self):
+    self.f.close()
+    self.port.close()
+
+  def __getattr__(self, name):         # in_waiting, timeout, reset_input_buffer, ...
+    return getattr(self.port, name)
+
+class ReplaySerial:
+  # realTime: deliver each chunk no earlier than its original arrival time, relative to the first one
+  def __init__(self, fileName, realTime=False, timeout=0.2):
+    self.f = open(fileName, 'rb')
+    self.map = mmap.mmap(self.f.fileno(), 0, access=mmap.ACCESS_READ)
+    if self.map[0:8] != MAGIC:
+      raise IOError("ReplaySerial: " + fileName + " is not a capture file")
+    self.startTime = struct.unpack_from('<d', self.map, 8)[0]
+    self.chunks = []            # (time, offset, length) of each received chunk
+    self.nWritten = 0
+    offset = 16
+    while offset + RECORD.size <= len(self.map):
+      t, direction, n = RECORD.unpack_from(self.map, offset)
+      offset += RECORD.size
+      if offset + n > len(self.map): break
+      if direction == RX: self.chunks.append((t, offset, n))
+      offset += n
+    self.nBytes = sum(c[2] for c in self.chunks)
+    self.realTime = realTime
+    self.timeout = timeout
+    self.rewind()
+
+  def rewind(self):
+    self.iChunk = 0
+    self.pos = 0
+    self.nRead = 0
+    self.t0 = None
+
+  @property
+  def exhausted(self):
+    return self.nRead >= self.nBytes
+
+  def _due(self, i):
+    if not self.realTime: return True
+    if self.t0 is None: self.t0 = time.time() - self.chunks[0][0]
+    return time.time() >= self.t0 + self.chunks[i][0]
+
+  @property
+  def in_waiting(self):
+    if not self.realTime: return self.nBytes - self.nRead
+    if self.iChunk >= len(self.chunks) or not self._due(self.iChunk): return 0
+    return self.chunks[self.iChunk][2] - self.pos
+
+  def read(self, size=1):
+    data = b''
+    tStart = time.time()
+    while len(data) < size and self.iChunk < len(self.chunks):
+      if not self._due(self.iChunk):
+        if time.time() - tStart > self.timeout: break
+        time.sleep(0.001)
+        continue
+      t, offset, n = self.chunks[self.iChunk]
+      take = min(size - len(data), n - self.pos)
+      data += self.map[offset+self.pos:offset+self.pos+take]
+      self.pos += take
+      if self.pos == n:
+        self.iChunk += 1
+        self.pos = 0
+    self.nRead += len(data)
+    return data
+
+  def write(self, data):          # Commands go nowhere on replay
+    self.nWritten += len(data)
+    return len(data)
+
+  def reset_input_buffer(self):
+    pass
+
+  def close(self):
+    self.map.close()
+    self.f.close()
+
+# Replay a capture through one of the host decoders as fast as possible. Returns (number of replies and events,
+# number of events, seconds, digest of everything decoded), the digest being for comparing decoder versions.
+def replayBench(fileName, decoder="packets"):
+  port = ReplaySerial(fileName)
+  digest = hashlib.sha1()
+  nRecords = 0
+  nEvents = 0
+  tStart = time.time()
+  tLast = tStart
+  if decoder == "bulk":
+    import PSOC_bulk
+    reader = PSOC_bulk.BulkReader(PSOC_bulk.SerialSource(port))
+    while not port.exhausted or len(reader.buffer) > 0:
+      record = reader.next(0.)
+      if record is None:
+        if port.exhausted: break
+        continue
+      nRecords += 1
+      if PSOC_bulk.isEvent(record[1]): nEvents += 1
+      digest.update(bytes([record[0]]) + record[1])
+      tLast = time.time()
+  else:
+    import PSOC_pipeline
+    pipe = PSOC_pipeline.CommandPipeline(port)
+    while True:
+      try:
+        id, data = pipe.unsolicited.get(timeout=0.05)
+      except Exception:
+        if port.exhausted: break
+        continue
+      nRecords += 1
+      if data[0:4] == b'ZERO' and data[-4:] == b'FINI': nEvents += 1
+      digest.update(bytes([id]) + bytes(data))
+      tLast = time.time()
+    pipe.close()
+  dt = tLast - tStart
+  port.close()
+  return nRecords, nEvents, dt, digest.hexdigest()
+
+if __name__ == "__main__":
+  if len(sys.argv) < 2:
+    print("usage: python3 PSOC_capture.py <capture file> [packets|bulk]")
+    sys.exit(1)
+  decoder = sys.argv[2] if len(sys.argv) > 2 else "packets"
+  port = ReplaySerial(sys.argv[1])
+  print(sys.argv[1] + ": " + str(len(port.chunks)) + " received chunks, " + str(port.nBytes) + " bytes, captured " +
+        time.ctime(port.startTime))
+  port.close()
+  nRecords, nEvents, dt, digest = replayBench(sys.argv[1], decoder)
+  print("replay through the " + decoder + " decoder: " + str(nRecords) + " records, " + str(nEvents) + " events in " +
+        str(round(dt, 3)) + " s = " + str(round(nEvents/max(dt, 1.e-6))) + " events/s, " +
+        str(round(port.nBytes/max(dt, 1.e-6)/1.e6, 2)) + " MB/s")
+  print("digest " + digest)
@@ -4,7 +4,9 @@ import numpy
 import binascii
 from bitstring import BitArray
 import math
+import itertools
 import numpy as np
+import PSOC_runfile
 
 # Address = 8 for the event PSOC, 10 for the main PSOC
 addrMain = 10
@@ -14,13 +16,29 @@ CALMASK = 1
 DATAMASK = 2
 TRIGMASK = 3
 
+# Command format for the event PSOC: "ascii" (triplicated 29-byte commands) or "binary" (one CRC-protected frame)
+cmdFormat = "ascii"
+binPending = None     # binary command waiting for its data bytes: [address, cmdCode, nData, dataList, seq]
+BIN_SYNC = 0xA5
+
 def openCOM(portName):
   global ser
   ser = serial.Serial(portName, 115200, timeout=.2)
   
 def closeCOM():
   ser.close()
-  
+
+# Copy every byte read from and written to the port into a raw capture file, for replay by PSOC_capture.py.
+# Objects that keep their own reference to the port (CommandPipeline, BulkReader) must be made after this.
+def startCapture(fileName):
+  global ser
+  import PSOC_capture
+  ser = PSOC_capture.CaptureSerial(ser, fileName)
+
+def stopCapture():
+  global ser
+  if hasattr(ser, 'stopCapture'): ser = ser.stopCapture()
+
 # Convert a string of bytes into a decimal integer
 def bytes2int(str):
    if str == b'':
@@ -37,8 +55,41 @@ def getBinaryString(byteList):
     strReturn = strReturn + strByte
   return strReturn
 
+# Select the command format used for the event PSOC. The main PSOC always gets ASCII commands.
+def setCmdFormat(format):
+   global cmdFormat, binPending
+   if format != "ascii" and format != "binary":
+     print("setCmdFormat: unknown format " + str(format))
+     return
+   cmdFormat = format
+   binPending = None
+
+# CRC-16/CCITT (polynomial 0x1021, initial value 0xFFFF), as checked by the event PSOC
+def crc16(byteList):
+   crc = 0xFFFF
+   for byte in byteList:
+     crc = crc ^ (byte << 8)
+     for i in range(8):
+       if crc & 0x8000: crc = ((crc << 1) ^ 0x1021) & 0xFFFF
+       else: crc = (crc << 1) & 0xFFFF
+   return crc
+
+# Put together a complete binary command frame: sync, address, sequence number, command code, number of data bytes, data, CRC
+def mkBinCmd(cmdCode, address, dataList, seq=0):
+   frame = bytes([address & 0xFF, seq & 0xFF, cmdCode & 0xFF, len(dataList)] + [x & 0xFF for x in dataList])
+   crc = crc16(frame)
+   return bytes([BIN_SYNC]) + frame + crc.to_bytes(2,'big')
+
 # Put together the command header for transmission 
-def mkCmdHdr(nData, cmdCode, address):
+# In binary mode the event PSOC command is held back until its last data byte is supplied by mkDataByte,
+# and the whole frame is returned at that point; empty byte strings are returned in the meantime.
+# A nonzero seq (1 to 255) tags the command, and the event PSOC returns it in the header of its reply.
+def mkCmdHdr(nData, cmdCode, address, seq=0):
+   global binPending
+   if cmdFormat == "binary" and address == addrEvnt:
+     if nData == 0: return mkBinCmd(cmdCode, address, [], seq)
+     binPending = [address, cmdCode, nData, [0]*nData, seq]
+     return b''
    dataByte = cmdCode
    addressNib = (address & 0x00F) << 2
    add11 = nData & 0x003
@@ -55,8 +106,12 @@ def mkCmdHdr(nData, cmdCode, address):
    nib4 = (addressByte & 0x0F)
    nib4 = ord(hex(nib4)[2]).to_bytes(1,'big')
    nib5 = ord(' ').to_bytes(1,'big')
-   nib6 = ord('x').to_bytes(1,'big')
-   nib7 = ord('y').to_bytes(1,'big')
+   if seq == 0:
+     nib6 = ord('x').to_bytes(1,'big')
+     nib7 = ord('y').to_bytes(1,'big')
+   else:
+     nib6 = ord(hex((seq & 0xF0) >> 4)[2]).to_bytes(1,'big')
+     nib7 = ord(hex(seq & 0x0F)[2]).to_bytes(1,'big')
    nib8 = ord('W').to_bytes(1,'big')
    cmd1 = nib0 + nib1 + nib2 + nib3 + nib4 + nib5 + nib6 + nib7 + nib8
    CR = 13
@@ -67,6 +122,16 @@ def mkCmdHdr(nData, cmdCode, address):
 
 # Assemble one data byte for transmission to the main PSOC
 def mkDataByte(dataByte, address, byteID):
+   global binPending
+   if cmdFormat == "binary" and address == addrEvnt:
+     if binPending is None or byteID < 1 or byteID > binPending[2]:
+       print("mkDataByte: data byte " + str(byteID) + " without a matching binary command header")
+       return b''
+     binPending[3][byteID-1] = dataByte
+     if byteID < binPending[2]: return b''
+     frame = mkBinCmd(binPending[1], binPending[0], binPending[3], binPending[4])
+     binPending = None
+     return frame
    addressByte = ((address & 0x00F) << 2) | ((byteID & 0x00C)<<4) | (byteID & 0x003)
    #print("  mkDataByte: dataByte= " + hex(dataByte))
    #print("  mkDataByte: addressByte= " + hex(addressByte))
@@ -127,6 +192,33 @@ def setTriggerPrescale(whichOne, count):
     data2 = mkDataByte(count, addrEvnt, 2)
     ser.write(data2)
 
+# Firmware prescale of a trigger class, by the trgStatus bit that it sets: an event is sent out if any of its
+# classes is accepted. A prescale of 0 or 1 accepts every event of the class.
+trgClassNames = ["PMT primary", "PMT secondary", "tracker-0", "tracker-1", "guard"]
+def setTriggerClassPrescale(whichOne, prescale):
+    if whichOne not in trgClassNames:
+        print("setTriggerClassPrescale: unrecognized trigger class " + whichOne)
+        return
+    cmdHeader = mkCmdHdr(3, 0x4E, addrEvnt)
+    ser.write(cmdHeader)
+    ser.write(mkDataByte(trgClassNames.index(whichOne) + 1, addrEvnt, 1))
+    ser.write(mkDataByte(prescale >> 8, addrEvnt, 2))
+    ser.write(mkDataByte(prescale & 0xFF, addrEvnt, 3))
+    print("setTriggerClassPrescale: " + whichOne + " prescale set to " + str(prescale))
+
+# Decode and print the run summary sent at the end of a run: the number of triggers, the number of events
+# read out, and for each trigger class the number of events with its bit set, accepted and prescaled away
+def printRunSummary(caller, data):
+    summary = {'triggers': bytes2int(data[0:4]), 'events': bytes2int(data[4:8]), 'classes': {}}
+    print(caller + ": run summary: " + str(summary['triggers']) + " triggers, " + str(summary['events']) + " events read out")
+    for i in range(min(len(trgClassNames), (len(data) - 8)//12)):
+        d = data[8+12*i:20+12*i]
+        counts = [bytes2int(d[0:4]), bytes2int(d[4:8]), bytes2int(d[8:12])]
+        summary['classes'][trgClassNames[i]] = counts
+        print("    " + trgClassNames[i] + ": " + str(counts[0]) + " events, " + str(counts[1]) + " accepted, " +
+              str(counts[2]) + " prescaled away")
+    return summary
+
 def setTriggerWindow(count):
     cmdHeader = mkCmdHdr(1, 0x3A, addrEvnt)
     ser.write(cmdHeader)
@@ -306,9 +398,8 @@ def tkrReadi2cReg(FPGA,i2cAddress):
   ret = ser.read(3)
   if ret != b'\xDC\x00\xFF':
     print("tkrReadi2cReg: invalid header returned: " + str(ret))
-  nBytes = bytes2int(ser.read(1))
+  nBytes = varLength(ser.read(3))
   #print("tkrReadi2cReg: number of bytes returned = " + str(nBytes))
-  ser.read(2)
   ret = ser.read(3)
   if ret != b'\xFF\x00\xFF':
     print("tkrReadi2cReg: invalid trailer returned: " + str(ret))      
@@ -439,10 +530,8 @@ def readCalEvent(trgTag):
         print("readCalEvent: looking for start of event. Received bytes " + str(ret.hex()))
         if ret == b'\xDC\x00\xFF': break
         time.sleep(0.1) 
-    ret = ser.read(1)
-    nData = bytes2int(ret)
+    nData = varLength(ser.read(3))
     print("ReadCalEvent: expecting " + str(nData) + " bytes of data for this event.")
-    ser.read(2)
     ret = ser.read(3)
     if ret != b'\xFF\x00\xFF':
         print("ReadCalEvent: invalid trailer returned: " + str(ret))  
@@ -490,9 +579,19 @@ def readCalEvent(trgTag):
     #print("           Hit list= " + getBinaryString(hitList))
     rc = ParseASIChitList(getBinaryString(hitList),True)
             
-# Execute a run for a specified number of events to be acquired
-def limitedRun(runNumber, numEvnts):
-    cmdHeader = mkCmdHdr(4, 0x3C, addrEvnt)
+# Execute a run for a specified number of events to be acquired, and/or for a number of seconds (0 for no limit).
+# Only events sent out count against numEvnts: triggers that the prescalers or the level-2 filter drop do not.
+# At least one of the two limits must be given. The event PSOC ends the run by itself when either limit is reached
+# and then sends the run summary. Should the summary be more than RUN_END_MARGIN seconds late, or no event arrive
+# for maxIdle seconds, the run is ended from here; if the summary still does not come, the run is given up.
+# runFile: optionally a PSOC_runfile.RunWriter, to keep every event record verbatim
+# monitor: optionally a PSOC_monitor.OnlineMonitor, to follow the rates and spectra while the run goes on
+RUN_END_MARGIN = 10.
+def limitedRun(runNumber, numEvnts, runFile=None, monitor=None, seconds=0, maxIdle=60.):
+    if numEvnts == 0 and seconds == 0:
+        print("limitedRun: run " + str(runNumber) + " has no limit on either the number of events or the time; not started")
+        return None
+    cmdHeader = mkCmdHdr(6 if seconds > 0 else 4, 0x3C, addrEvnt)
     ser.write(cmdHeader)
     data1 = mkDataByte(runNumber>>8, addrEvnt, 1)
     ser.write(data1)
@@ -502,7 +601,11 @@ def limitedRun(runNumber, numEvnts):
     ser.write(data3)
     data4 = mkDataByte(numEvnts & 0x00FF, addrEvnt, 4)
     ser.write(data4)
-    print("limitedRun: starting run number " + str(runNumber) + " for " + str(numEvnts) + " events")
+    if seconds > 0:
+        ser.write(mkDataByte(seconds>>8, addrEvnt, 5))
+        ser.write(mkDataByte(seconds & 0x00FF, addrEvnt, 6))
+    print("limitedRun: starting run number " + str(runNumber) + " for " + str(numEvnts) + " events" +
+          (", at most " + str(seconds) + " seconds" if seconds > 0 else ""))
     f = open("dataFile_run" + str(runNumber) + ".txt", "w")
     print("limitedRun: trigger enable status = " + str(triggerEnableStatus()))
     time.sleep(0.1)
@@ -520,18 +623,33 @@ def limitedRun(runNumber, numEvnts):
     lastTime = 0
     timeSum = 0
     numHits = 0
-    for event in range(numEvnts):
-        # Wait for an event to show up
+    nEvents = 0
+    cntGo = 0
+    trigger = 0
+    lastArrival = startTime
+    tEndSent = None      # when the host ended the run itself
+    for event in itertools.count():
+        # Wait for an event, or for the run summary that ends the run, to show up
         while True:
             ret = ser.read(3)
             print("limitedRun: looking for start of event. Received bytes " + str(ret.hex()))
             if ret == b'\xDC\x00\xFF': break
+            deadline = lastArrival + maxIdle
+            if seconds > 0: deadline = min(deadline, startTime + seconds + RUN_END_MARGIN)
+            if tEndSent is not None: deadline = tEndSent + RUN_END_MARGIN
+            if time.time() > deadline:
+                if tEndSent is not None: break
+                print("limitedRun: neither an event nor the run summary received in time; ending the run")
+                ser.write(mkCmdHdr(0, 0x44, addrEvnt))
+                tEndSent = time.time()
             time.sleep(0.1)
+        if ret != b'\xDC\x00\xFF':
+            print("limitedRun: no run summary received for run " + str(runNumber))
+            break
+        lastArrival = time.time()
         verbose = True
         print("limitedRun: reading event " + str(event) + " of run " + str(runNumber))
-        ret = ser.read(1)
-        nData = bytes2int(ret)
-        ser.read(2)
+        nData = varLength(ser.read(3))
         ret = ser.read(3)
         if ret != b'\xFF\x00\xFF':
             print("limitedRun: invalid trailer returned: " + str(ret))  
@@ -560,22 +678,35 @@ def limitedRun(runNumber, numEvnts):
             ret = ser.read(3)
             if ret != b'\xFF\x00\xFF':
                 print("limitedRun: invalid trailer returned: " + str(ret)) 
-        run = dataList[4]*256 + dataList[5]
-        trigger = dataList[6]*16777216 + dataList[7]*65536 + dataList[8]*256 + dataList[9]
-        if verbose: print("   Trigger " + str(trigger) + ", Data List length = " + str(len(dataList)))            
-        timeStamp = dataList[10]*16777216 + dataList[11]*65536 + dataList[12]*256 + dataList[13]
+        record = b''.join(byteList)[0:nData]
+        if record[0:4] != b'ZERO':
+            printRunSummary("limitedRun", record)
+            break
+        nEvents = nEvents + 1
+        if runFile is not None: runFile.write(record)
+        if monitor is not None: monitor.update(record)
+        # Events sent at a reduced content level are expanded to the full layout by decodeEvent
+        evt = PSOC_runfile.decodeEvent(record)
+        if evt is None:
+            print("limitedRun: malformed event record " + record.hex())
+            nEvents = nEvents - 1
+            continue
+        run = evt['run']
+        trigger = evt['event']
+        if verbose: print("   Trigger " + str(trigger) + ", record length = " + str(nData) + ", content level = " + str(evt['level']))
+        timeStamp = evt['timeStamp']
         deltaTime = timeStamp - lastTime
         if event > 0:
             if verbose: print("    Time since the previous event = " + str(deltaTime))
             timeSum += deltaTime
         lastTime = timeStamp
-        T1 = dataList[19]*256 + dataList[20]
-        T2 = dataList[21]*256 + dataList[22]
-        T3 = dataList[23]*256 + dataList[24]
-        T4 = dataList[25]*256 + dataList[26]
-        G =  dataList[27]*256 + dataList[28]
-        Ex = dataList[29]*256 + dataList[30]
-        cntGo = dataList[14]*16777216 + dataList[15]*65536 + dataList[16]*256 + dataList[17]
+        T1 = evt['T1']
+        T2 = evt['T2']
+        T3 = evt['T3']
+        T4 = evt['T4']
+        G =  evt['G']
+        Ex = evt['Ex']
+        cntGo = evt['cntGO1']
         if verbose:
             print("        T1 ADC=" + str(T1))
             print("        T2 ADC=" + str(T2))
@@ -583,40 +714,33 @@ def limitedRun(runNumber, numEvnts):
             print("        T4 ADC=" + str(T4))
             print("         G ADC=" + str(G))
             print("        Ex ADC=" + str(Ex))
-        nTOFA = dataList[37]
-        nTOFB = dataList[38]
-        dtmin = 10*np.int16(dataList[31]*256 + dataList[32])
+        nTOFA = evt['nTOFA']
+        nTOFB = evt['nTOFB']
+        dtmin = 10*evt['dtmin']
         if verbose:
             print("        TimeStamp = " + str(timeStamp))
             print("        TOF=" + str(dtmin) + " Number A=" + str(nTOFA) + " Number B=" + str(nTOFB))
             print("        run=" + str(run) + "  trigger " + str(trigger))
-        tofA = 10*(dataList[39]*256 + dataList[40])
-        tofB = 10*(dataList[41]*256 + dataList[42])
-        clkA = dataList[43]*256 + dataList[44]
-        clkB = dataList[45]*256 + dataList[46]
-        trgStatus = dataList[18]
-        nTkrLyrs = dataList[47]
+        # The TOF debug fields are left out from content level 1 on
+        tofA = 10*(evt['tofA'] or 0)
+        tofB = 10*(evt['tofB'] or 0)
+        clkA = evt['clkA'] or 0
+        clkB = evt['clkB'] or 0
+        trgStatus = evt['trgStatus']
+        summary = evt.get('layerSummary', [])
+        nTkrLyrs = len(evt['boards']) + len(summary)
         if verbose: 
             print("        REF-A=" + str(tofA) + "  REF-B=" + str(tofB))
             print("        TOF clkA=" + str(clkA) + "  TOF clkB=" + str(clkB))
             print("        Trigger status = " + str(hex(trgStatus)))
             print("      Number of tracker layers read out = " + str(nTkrLyrs))
-            iPtr = 48
-            for brd in range(nTkrLyrs):
-                brdNum = dataList[iPtr]
-                iPtr = iPtr + 1
-                nBytes = dataList[iPtr]
-                iPtr = iPtr + 1
-                #print("           " + str(brd) + " Hit list from tracker board " + str(brdNum) + " with " + str(nBytes) + " bytes:")
-                hitList = []
-                for hit in range(nBytes):
-                    #print("                      " + str(hit) + "  " + hex(dataList[iPtr]))
-                    hitList.append(byteList[iPtr])
-                    iPtr = iPtr + 1
-            #print("           Hit list= " + getBinaryString(hitList))
-            rc = ParseASIChitList(getBinaryString(hitList),True)
+        for brdNum, hitList in evt['boards']:
+            rc = ParseASIChitList(getBinaryString([hitList[i:i+1] for i in range(len(hitList))]), verbose)
             if rc[0] != 0: nBadTkr = nBadTkr + 1
             numHits = numHits + rc[1]
+        for layer, nChips, nClust in summary:     # level 3: only the cluster count of each board was sent
+            if verbose: print("      Layer " + str(layer) + ": " + str(nChips) + " chips hit, " + str(nClust) + " clusters")
+            numHits = numHits + nClust
         if trgStatus & 0x01: pmtTrg1 = pmtTrg1 + 1
         if trgStatus & 0x02: pmtTrg2 = pmtTrg2 + 1
         if trgStatus & 0x04: tkrTrg0 = tkrTrg0 + 1
@@ -642,22 +766,22 @@ def limitedRun(runNumber, numEvnts):
     endTime = time.time()
     runTime = endTime - startTime
     print("Elapsed time for the run = " + str(runTime) + " seconds")
-    timeSum = timeSum/float(numEvnts - 1)
+    timeSum = timeSum/float(max(nEvents - 1, 1))
     print("Average time between event time stamps = " + str(timeSum))
     Sigma = [0.,0.,0.,0.,0.,0.]
-    TOFavg = TOFavg/float(numEvnts)
-    TOFavg2 = TOFavg2/float(numEvnts)
-    numHitsAvg = numHits/float(numEvnts)
+    TOFavg = TOFavg/float(max(nEvents, 1))
+    TOFavg2 = TOFavg2/float(max(nEvents, 1))
+    numHitsAvg = numHits/float(max(nEvents, 1))
     print("Average number of hits per event = " + str(numHitsAvg))
     sigmaTOF = math.sqrt(TOFavg2 - TOFavg*TOFavg)
     for ch in range(6):
-        ADCavg[ch] = ADCavg[ch]/float(numEvnts)
-        ADCavg2[ch] = ADCavg2[ch]/float(numEvnts)
+        ADCavg[ch] = ADCavg[ch]/float(max(nEvents, 1))
+        ADCavg2[ch] = ADCavg2[ch]/float(max(nEvents, 1))
         Sigma[ch] = math.sqrt(ADCavg2[ch] - ADCavg[ch]*ADCavg[ch])
     f.close()
     print("Number of triggers generated = " + str(cntGo))
     print("Number of triggers accepted = " + str(trigger))
-    live = trigger/float(cntGo)
+    live = trigger/float(max(cntGo, 1))
     print("Live time fraction = " + str(live))
     print("Number of primary PMT triggers captured = " + str(pmtTrg1))
     print("Number of secondary PMT triggers captured = " + str(pmtTrg2))
@@ -736,6 +860,8 @@ def setOutputMode(mode):
     ser.write(cmdHeader)
     if mode == "UART":
         imode = 1
+    elif mode == "bulk":    # USB records packed into 64-byte packets, read with PSOC_bulk.py
+        imode = 2
     else: 
         imode = 0
     data1 = mkDataByte(imode, PSOCaddress, 1)
@@ -1143,9 +1269,8 @@ def readAllTOFdata(address):
         return
     if ret != b'\xDC\x00\xFF':
         print("readAllTOFdata: invalid header returned: " + str(ret))
-    nData = bytes2int(ser.read(1))
+    nData = varLength(ser.read(3))
     print("readAllTOFdata: number of bytes in event = " + str(nData))
-    ser.read(2)
     ret = ser.read(3)
     if ret != b'\xFF\x00\xFF':
         print("readAllTOFdata: invalid trailer returned: " + str(ret))
@@ -1278,6 +1403,181 @@ def readTofConfig():
         if ret != b'\xFF\x00\xFF':
             print("readTofConfig: invalid trailer returned: " + str(ret)) 
 
+# Number of data bytes from the 3 data bytes of the first VAR_HEAD packet: the 16-bit length in the last two,
+# or the single length byte in the first from firmware that does not send the 16-bit length
+def varLength(lenBytes):
+    nData = (lenBytes[1] << 8) | lenBytes[2]
+    if nData == 0: nData = lenBytes[0]
+    return nData
+
+# Read a variable-length reply (VAR_HEAD packets) and return its data bytes
+def readVarReply(caller):
+    ret = ser.read(3)
+    if ret != b'\xDC\x00\xFF':
+        print(caller + ": invalid header returned: " + str(ret))
+    nData = varLength(ser.read(3))
+    ret = ser.read(3)
+    if ret != b'\xFF\x00\xFF':
+        print(caller + ": invalid trailer returned: " + str(ret))
+    data = b''
+    for packet in range(int((nData+2)/3)):
+        ret = ser.read(3)
+        if ret != b'\xDC\x00\xFF':
+            print(caller + ": invalid header returned: " + str(ret))
+        data = data + ser.read(3)
+        ret = ser.read(3)
+        if ret != b'\xFF\x00\xFF':
+            print(caller + ": invalid trailer returned: " + str(ret))
+    return data[0:nData]
+
+# Read the event PSOC command input statistics: bytes lost to buffer overflow, bytes skipped by the parser,
+# and the largest number of bytes seen waiting in the command buffer
+def readCmdStats():
+    cmdHeader = mkCmdHdr(0, 0x47, addrEvnt)
+    ser.write(cmdHeader)
+    time.sleep(0.1)
+    data = readVarReply("readCmdStats")
+    nLost = bytes2int(data[0:4])
+    nSkipped = bytes2int(data[4:8])
+    maxFill = bytes2int(data[8:10])
+    print("readCmdStats: command bytes lost= " + str(nLost) + ", skipped= " + str(nSkipped) + ", max buffer fill= " + str(maxFill))
+    return [nLost, nSkipped, maxFill]
+
+# Read the event PSOC task scheduler statistics. Times are in microseconds. Set reset=True to clear them afterwards.
+taskNames = ["event build", "output", "run end", "command execution", "tracker image", "housekeeping", "command input", "USB", "tracker"]
+def readTaskStats(reset=False):
+    if reset:
+        cmdHeader = mkCmdHdr(1, 0x48, addrEvnt)
+        ser.write(cmdHeader)
+        ser.write(mkDataByte(1, addrEvnt, 1))
+    else:
+        cmdHeader = mkCmdHdr(0, 0x48, addrEvnt)
+        ser.write(cmdHeader)
+    time.sleep(0.1)
+    data = readVarReply("readTaskStats")
+    stats = []
+    for i in range(int(len(data)/14)):
+        d = data[14*i:14*i+14]
+        stats.append([bytes2int(d[0:4]), bytes2int(d[4:8]), bytes2int(d[8:12]), bytes2int(d[12:14])])
+        print("readTaskStats: " + taskNames[i] + ": runs= " + str(stats[i][0]) + ", max run time= " + str(stats[i][1]) +
+              " us, max latency= " + str(stats[i][2]) + " us, over budget= " + str(stats[i][3]))
+    return stats
+
+# Read the event PSOC counters of commands queued for the tracker, replies matching no command,
+# commands that never got a reply, and commands still waiting for a reply
+def readTkrTransStats():
+    cmdHeader = mkCmdHdr(0, 0x49, addrEvnt)
+    ser.write(cmdHeader)
+    time.sleep(0.1)
+    data = readVarReply("readTkrTransStats")
+    nSent = bytes2int(data[0:4])
+    nUnmatched = bytes2int(data[4:8])
+    nNoReply = bytes2int(data[8:12])
+    nPending = data[12]
+    print("readTkrTransStats: tracker commands sent= " + str(nSent) + ", unmatched replies= " + str(nUnmatched) +
+          ", no reply= " + str(nNoReply) + ", pending= " + str(nPending))
+    return [nSent, nUnmatched, nNoReply, nPending]
+
+# Level-2 event filter in the event PSOC. Events failing it are dropped, except one in every prescale of them,
+# which is sent out flagged (see EVT_FLAG_L2_FAIL in PSOC_runfile.py). All the cuts apply together once enabled.
+def setL2(setting, dataList):
+    cmdHeader = mkCmdHdr(1+len(dataList), 0x4C, addrEvnt)
+    ser.write(cmdHeader)
+    ser.write(mkDataByte(setting, addrEvnt, 1))
+    for i in range(len(dataList)):
+        ser.write(mkDataByte(dataList[i] & 0xFF, addrEvnt, 2+i))
+
+def enableL2(enable):
+    setL2(0, [1 if enable else 0])
+    print("enableL2: level-2 filter " + ("enabled" if enable else "disabled"))
+
+# Minimum number of tracker layers with at least one chip hit
+def setL2MinLayers(nLayers):
+    setL2(1, [nLayers])
+
+# Pulse-height window for PMT channel 1-6 (T1, T2, T3, T4, G, Ex), in ADC counts
+def setL2PMTWindow(channel, adcMin, adcMax):
+    setL2(2, [channel, adcMin >> 8, adcMin, adcMax >> 8, adcMax])
+
+# TOF dtmin window, in units of 10 ps. Events without a TOF match have dtmin = 32767.
+def setL2TOFWindow(dtMin, dtMax):
+    setL2(3, [dtMin >> 8, dtMin, dtMax >> 8, dtMax])
+
+# Send one in every prescale failing events anyway, for efficiency studies; 0 to send none
+def setL2Prescale(prescale):
+    setL2(4, [prescale >> 8, prescale])
+
+# Read the level-2 filter counters of the current run: events tested, passed, rejected, and failed but sent out
+def readL2Stats():
+    cmdHeader = mkCmdHdr(0, 0x4D, addrEvnt)
+    ser.write(cmdHeader)
+    time.sleep(0.1)
+    data = readVarReply("readL2Stats")
+    stats = [bytes2int(data[4*i:4*i+4]) for i in range(4)]
+    print("readL2Stats: tested= " + str(stats[0]) + ", passed= " + str(stats[1]) + ", rejected= " + str(stats[2]) +
+          ", failed but sent= " + str(stats[3]))
+    return stats
+
+# Protection of the SPI link from the event PSOC to the main PSOC (output mode 0), normally set up by the main PSOC.
+# trailer: follow each event with a 0xDE packet {0xDE, sequence number, 0xFF, CRC-16 (2), events dropped, 0xFF00FF}
+# credits: send events only against credits granted with grantLinkCredits; an event that has waited holdLimit
+#          5 ms ticks for one is dropped
+def setLinkProtection(trailer, credits, holdLimit=100):
+    cmdHeader = mkCmdHdr(2, 0x4F, addrEvnt)
+    ser.write(cmdHeader)
+    ser.write(mkDataByte((1 if trailer else 0) | (2 if credits else 0), addrEvnt, 1))
+    ser.write(mkDataByte(holdLimit, addrEvnt, 2))
+
+def grantLinkCredits(nEvents):
+    cmdHeader = mkCmdHdr(1, 0x50, addrEvnt)
+    ser.write(cmdHeader)
+    ser.write(mkDataByte(nEvents, addrEvnt, 1))
+
+# Read the SPI link counters: events sent, events dropped for lack of a credit, credits left, next sequence number, mode
+def readLinkStats():
+    cmdHeader = mkCmdHdr(0, 0x51, addrEvnt)
+    ser.write(cmdHeader)
+    time.sleep(0.1)
+    data = readVarReply("readLinkStats")
+    stats = [bytes2int(data[0:4]), bytes2int(data[4:8]), data[8], data[9], data[10]]
+    print("readLinkStats: events sent= " + str(stats[0]) + ", dropped= " + str(stats[1]) + ", credits= " + str(stats[2]) +
+          ", next sequence number= " + str(stats[3]) + ", mode= " + str(stats[4]))
+    return stats
+
+# Adaptive event content. When events wait longer to go out than the watermark of a level, on average, the event
+# PSOC sends less of each event: level 1 leaves out the TOF debug fields, level 2 also zero suppresses the PMT
+# pulse heights, level 3 also sends a {layer, chips hit, clusters} summary of each tracker board instead of its
+# hit list. The level is in the event flags; see eventLevel and decodeEvent in PSOC_runfile.py.
+def setEventContent(setting, dataList):
+    cmdHeader = mkCmdHdr(1+len(dataList), 0x52, addrEvnt)
+    ser.write(cmdHeader)
+    ser.write(mkDataByte(setting, addrEvnt, 1))
+    for i in range(len(dataList)):
+        ser.write(mkDataByte(dataList[i] & 0xFF, addrEvnt, 2+i))
+
+# Content level to use even when the output keeps up, 0-3
+def setContentMinLevel(level):
+    setEventContent(0, [level])
+
+# Output wait, in units of 100 us, above which level 1-3 is used; 0 to never use the level
+def setContentWatermark(level, mark):
+    setEventContent(level, [mark >> 8, mark])
+
+# Pulse heights of PMT channel 1-6 (T1, T2, T3, T4, G, Ex) at or below which the channel is not sent, from level 2
+def setContentPMTThreshold(channel, threshold):
+    setEventContent(4, [channel, threshold >> 8, threshold])
+
+# Read the content level, the output backlog in units of 100 us, and the events sent out at each level in this run
+def readContentStats():
+    cmdHeader = mkCmdHdr(0, 0x53, addrEvnt)
+    ser.write(cmdHeader)
+    time.sleep(0.1)
+    data = readVarReply("readContentStats")
+    stats = [data[0], bytes2int(data[1:3])] + [bytes2int(data[3+4*i:7+4*i]) for i in range(4)]
+    print("readContentStats: level= " + str(stats[0]) + ", backlog= " + str(stats[1]/10.) + " ms, events sent at levels 0-3= " +
+          str(stats[2:6]))
+    return stats
+
 # Receive and check the echo from a tracker command
 def getTkrEcho():
     ret = ser.read(3)
@@ -1448,9 +1748,8 @@ def getTkrHousekeeping():
                 print("getTkrHousekeeping: invalid trailer returned: " + str(ret))
         readErrors(0)
         return [0,1,2,3,4,5,6,7,8,9]            
-    nData = bytes2int(ser.read(1))
+    nData = varLength(ser.read(3))
     #print("getTkrHousekeeping: nData= " + str(nData))
-    ser.read(2)
     ret = ser.read(3)
     if ret != b'\xFF\x00\xFF':
         print("getTkrHousekeeping: invalid trailer returned: " + str(ret))  
@@ -1953,7 +2252,8 @@ def tkrGetASICconfig(FPGA, chipAddress):
     else:
         print("tkrGetASICconfig: the polarity setting is negative.")
 
-def tkrLoadASICconfig(FPGA, address, oneShot, gain, shaping, bufSpeed, trigDelay, trigWindow, ioCurrent, maxClust):
+# The three bytes of the 24-bit ASIC configuration register, most significant first
+def asicConfigBytes(oneShot, gain, shaping, bufSpeed, trigDelay, trigWindow, ioCurrent, maxClust):
     gain = gain & 0x01
     oneShot = oneShot & 0x01
     shaping = shaping & 0x01
@@ -1969,7 +2269,11 @@ def tkrLoadASICconfig(FPGA, address, oneShot, gain, shaping, bufSpeed, trigDelay
     nib4 = trigDelay & 0x0F
     nib5 = (trigDelay & 0x10)>>4 | trigWindow<<1 | ioCurrent<<2
     nib6 = maxClust
-    all = nib6<<20 | nib5<<16 | nib4<<12 | nib3<<8 | nib2<<4 | nib1
+    return [(nib6<<4) | nib5, (nib4<<4) | nib3, (nib2<<4) | nib1]
+
+def tkrLoadASICconfig(FPGA, address, oneShot, gain, shaping, bufSpeed, trigDelay, trigWindow, ioCurrent, maxClust):
+    [byte5, byte6, byte7] = asicConfigBytes(oneShot, gain, shaping, bufSpeed, trigDelay, trigWindow, ioCurrent, maxClust)
+    all = byte5<<16 | byte6<<8 | byte7
     print("tkrLoadASICconfig: for FPGA " + str(FPGA) + ", chip " + str(address) + 
              ", the register setting will be " + str(hex(all)))
     PSOCaddress = addrEvnt
@@ -1988,15 +2292,12 @@ def tkrLoadASICconfig(FPGA, address, oneShot, gain, shaping, bufSpeed, trigDelay
     data4 = mkDataByte(address, PSOCaddress, 4)
     #print("tkrLoadASICconfig: data4 = " +str(data4))
     ser.write(data4)    
-    byte5 = (nib6<<4) | nib5
     data5 = mkDataByte(byte5, PSOCaddress, 5)
     #print("tkrLoadASICconfig: byte5 = " +str(hex(byte5)))
     ser.write(data5)
-    byte6 = (nib4<<4) | nib3
     data6 = mkDataByte(byte6, PSOCaddress, 6)
     #print("tkrLoadASICconfig: byte6 = " +str(hex(byte6)))
     ser.write(data6)
-    byte7 = (nib2<<4) | nib1
     data7 = mkDataByte(byte7, PSOCaddress, 7)
     #print("tkrLoadASICconfig: byte7 = " +str(hex(byte7)))
     ser.write(data7)
@@ -2004,6 +2305,105 @@ def tkrLoadASICconfig(FPGA, address, oneShot, gain, shaping, bufSpeed, trigDelay
     echo = getTkrEcho()
     if (str(binascii.hexlify(echo)) != "b'12'"):
         print("tkrLoadASICconfig: incorrect echo received (" + str(binascii.hexlify(echo)) + "), should be b'0f'")  
+
+TKR_IMAGE_LEN = 2048    # Size of the image buffer of the event PSOC
+
+# Tracker configuration image, for loading many ASIC registers with a single upstream transfer.
+# The image is a list of tracker commands {FPGA, command code, number of data bytes, data}. It is built
+# up on the host with the tkrImage functions, loaded into the event PSOC with tkrLoadImage, and the
+# event PSOC then sends the commands to the tracker and checks every echo itself.
+# Usage:
+#   image = tkrImageNew()
+#   tkrImageASICconfig(image, 0, 31, 0, 0, 0, 3, 5, 0, 1, 10)
+#   tkrImageDAC(image, 0, 31, "threshold", 25, "low")
+#   tkrImageMask(image, 0, 31, DATAMASK, "unmask", [])
+#   failed = tkrLoadImage(image)
+def tkrImageNew():
+    return {"bytes": b'', "records": []}
+
+# Append an arbitrary tracker command to the image
+def tkrImageCmd(image, FPGA, cmdCode, dataList, description=""):
+    image["bytes"] = image["bytes"] + bytes([FPGA & 0xFF, cmdCode & 0xFF, len(dataList)] + [x & 0xFF for x in dataList])
+    image["records"].append(description if description != "" else "command " + hex(cmdCode) + " to FPGA " + str(FPGA))
+
+def tkrImageASICconfig(image, FPGA, chip, oneShot, gain, shaping, bufSpeed, trigDelay, trigWindow, ioCurrent, maxClust):
+    regBytes = asicConfigBytes(oneShot, gain, shaping, bufSpeed, trigDelay, trigWindow, ioCurrent, maxClust)
+    tkrImageCmd(image, FPGA, 0x12, [chip] + regBytes, "configuration of chip " + str(chip) + " on FPGA " + str(FPGA))
+
+def tkrImageDAC(image, FPGA, chip, select, value, range):
+    if select == "threshold": cmdCode = 0x11
+    else: cmdCode = 0x10
+    value = value & 0x7F
+    if range == "high": value = value + 128
+    tkrImageCmd(image, FPGA, cmdCode, [chip, value], select + " DAC of chip " + str(chip) + " on FPGA " + str(FPGA))
+
+# Mask register, with the channel clusters given as [number of channels, first channel] as in tkrSetDataMask.
+# The 64-bit mask is computed here the same way as in the event PSOC command 0x41.
+def tkrImageMask(image, FPGA, chip, regType, sense, list):
+    mask = 0
+    for item in list:
+        mask = mask | (((1 << item[0]) - 1) << (64 - item[0] - item[1]))
+    if sense == "unmask": mask = ~mask & 0xFFFFFFFFFFFFFFFF
+    if regType == CALMASK: cmdCode = 0x15
+    elif regType == DATAMASK: cmdCode = 0x13
+    else: cmdCode = 0x14
+    tkrImageCmd(image, FPGA, cmdCode, [chip] + [b for b in mask.to_bytes(8, 'big')],
+                "mask register " + str(regType) + " of chip " + str(chip) + " on FPGA " + str(FPGA))
+
+# Load one part of an image, no longer than TKR_IMAGE_LEN, into the event PSOC and have it sent to the tracker.
+# Returns the number of records sent and the indices, within the part, of those that failed; None if rejected.
+def tkrLoadImagePart(imageBytes, nRecords):
+    blockLen = 13         # Two offset bytes plus 13 image bytes fill an ASCII command
+    for offset in range(0, len(imageBytes), blockLen):
+        block = imageBytes[offset:offset+blockLen]
+        ser.write(mkCmdHdr(2+len(block), 0x4A, addrEvnt, 1))
+        ser.write(mkDataByte(offset >> 8, addrEvnt, 1))
+        ser.write(mkDataByte(offset & 0xFF, addrEvnt, 2))
+        for i in range(len(block)):
+            ser.write(mkDataByte(block[i], addrEvnt, 3+i))
+        ack = ser.read(9)      # Wait for each block to be acknowledged, so as not to overrun the command buffer
+        if ack[0:6] != bytes([0xDB, 1, 0xFF, 0x4A, 0xAC, 0x00]):
+            print("tkrLoadImage: bad acknowledgement " + str(binascii.hexlify(ack)) + " for the block at offset " + str(offset))
+            return None
+    crc = crc16(imageBytes)
+    ser.write(mkCmdHdr(2, 0x4B, addrEvnt))
+    ser.write(mkDataByte(crc >> 8, addrEvnt, 1))
+    ser.write(mkDataByte(crc & 0xFF, addrEvnt, 2))
+    tStart = time.time()
+    while ser.in_waiting == 0 and time.time() - tStart < 0.2*nRecords + 1.0:
+        time.sleep(0.01)
+    data = readVarReply("tkrLoadImage")
+    nSent = bytes2int(data[0:2])
+    nFailed = bytes2int(data[2:4])
+    if nFailed == 0xFFFF:
+        print("tkrLoadImage: the event PSOC rejected the image")
+        return None
+    return nSent, [i for i in range(nSent) if data[4 + i//8] & (1 << (i % 8))]
+
+# Load the image into the event PSOC, have it sent to the tracker, and return the list of records that failed.
+# An image larger than the event PSOC buffer, as that of a full tracker is, goes in consecutive parts, cut
+# between records.
+def tkrLoadImage(image):
+    imageBytes = image["bytes"]
+    parts = []         # [first byte, end, number of records]
+    ptr = 0
+    while ptr + 3 <= len(imageBytes):
+        end = ptr + 3 + imageBytes[ptr+2]
+        if len(parts) == 0 or end - parts[-1][0] > TKR_IMAGE_LEN: parts.append([ptr, ptr, 0])
+        parts[-1][1] = end
+        parts[-1][2] += 1
+        ptr = end
+    failed = []
+    nRecords = 0
+    for first, end, nPart in parts:
+        result = tkrLoadImagePart(imageBytes[first:end], nPart)
+        if result is None: return None
+        failed = failed + [nRecords + i for i in result[1]]
+        nRecords = nRecords + result[0]
+    for i in failed:
+        print("tkrLoadImage: no good echo for record " + str(i) + ", " + image["records"][i])
+    print("tkrLoadImage: sent " + str(nRecords) + " tracker commands in " + str(len(parts)) + " parts, " + str(len(failed)) + " failed")
+    return failed
         
 # Re-initialize the event PSOC SPI interface        
 def initSPI():
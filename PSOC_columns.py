@@ -0,0 +1,188 @@
+# Columnar export of event PSOC runs, for analysis with numpy instead of per-event Python loops.
+# Each event header field becomes one array with one entry per event, and the tracker clusters are kept as
+# ragged arrays: flat arrays with one entry per cluster, plus an offset array such that the clusters of
+# event i are entries clusterOffset[i] to clusterOffset[i+1]-1 (and likewise for the boards read out).
+#
+# Usage:
+#   exportRun("run123.aeso", "run123.npz")      # or a directory name, for one .npy file per column
+#   col = loadColumns("run123.npz")
+#   numpy.histogram(col['T1'][col['trgStatus'] & 0x01 != 0], bins=100)
+#   nClust = numpy.diff(col['clusterOffset'])
+#   stripsLayer3 = col['clusterStrip'][col['clusterLayer'] == 3]
+# Events sent at a reduced content level (col['level'] > 0) are expanded to the full layout first, with 0 for
+# the fields left out. At level 3 their boards come with no clusters, but boardChips and boardClusters are taken
+# from the summary the firmware sent, and boardOK is True since there is no hit list to check.
+import os
+import sys
+import time
+import numpy as np
+import PSOC_runfile
+from PSOC_runfile import RunReader, pyDecodeHitList
+
+EVENT_HEADER_LEN = 52
+useNative = PSOC_runfile._psocdecode is not None    # use the compiled decoder, when it has been built
+
+# The fixed part of an event record, as laid out by the event builder in DAQ.cydsn/main.c
+HEADER_DTYPE = np.dtype({
+  'names':   ['run', 'event', 'timeStamp', 'cntGO1', 'timeWord', 'trgStatus', 'T1', 'T2', 'T3', 'T4', 'G', 'Ex',
+              'dtmin', 'tkrTrgCount', 'tkrCmdCount', 'tkrTrgPattern', 'nTOFA', 'nTOFB', 'tofA', 'tofB', 'clkA', 'clkB',
+              'nBoards'],
+  'formats': ['>u2', '>u4', '>u4', '>u4', '>u4', 'u1', '>u2', '>u2', '>u2', '>u2', '>u2', '>u2',
+              '>i2', '>u2', 'u1', 'u1', 'u1', 'u1', '>u2', '>u2', '>u2', '>u2',
+              'u1'],
+  'offsets': [4, 6, 10, 14, 18, 22, 23, 25, 27, 29, 31, 33,
+              35, 37, 39, 40, 41, 42, 43, 45, 47, 49,
+              51],
+  'itemsize': EVENT_HEADER_LEN})
+
+# The (layer, chips hit, clusters) of each board of a level-3 event record, or None for any other record
+def boardSummary(data):
+  if len(data) < 4 or bytes(data[0:4]) != b'ZERO' or PSOC_runfile.eventLevel(data) != 3: return None
+  return PSOC_runfile.layerSummary(data)
+
+# Convert the events of a run file to columns. Returns the dictionary of arrays.
+def runColumns(reader):
+  if useNative: return nativeRunColumns(reader)
+  headers = bytearray()
+  hostTime = []
+  boardOffset = [0]
+  boardLayer = []
+  boardChips = []
+  boardClusters = []
+  boardOK = []
+  clusterOffset = [0]
+  clusterLayer = []
+  clusterChip = []
+  clusterFirst = []
+  clusterWidth = []
+  nSkipped = 0
+  for type, tRecord, data in reader.records():
+    if type != PSOC_runfile.REC_EVENT: continue
+    summary = boardSummary(data)
+    data = PSOC_runfile.expandEvent(data)
+    if data is None or len(data) < EVENT_HEADER_LEN + 4 or data[0:4] != b'ZERO' or data[-4:] != b'FINI':
+      nSkipped += 1
+      continue
+    iPtr = EVENT_HEADER_LEN
+    nBoards = data[51]
+    for brd in range(nBoards):
+      if iPtr + 2 > len(data) - 4: break
+      nBytes = data[iPtr+1]
+      fpga, tag, clusters, ok = pyDecodeHitList(bytes(data[iPtr+2:iPtr+2+nBytes]))
+      boardLayer.append(data[iPtr])
+      if summary is not None:
+        boardChips.append(summary[brd][1])
+        boardClusters.append(summary[brd][2])
+      else:
+        boardChips.append(len(set(c[0] for c in clusters)))    # chips with clusters
+        boardClusters.append(len(clusters))
+      boardOK.append(ok or summary is not None)
+      for chip, first, width in clusters:
+        clusterLayer.append(data[iPtr])
+        clusterChip.append(chip)
+        clusterFirst.append(first)
+        clusterWidth.append(width)
+      iPtr += 2 + nBytes
+    headers += data[0:EVENT_HEADER_LEN]
+    hostTime.append(tRecord)
+    boardOffset.append(len(boardLayer))
+    clusterOffset.append(len(clusterLayer))
+  col = headerColumns(bytes(headers))
+  col['hostTime'] = np.array(hostTime, dtype=np.float64)
+  col['boardOffset'] = np.array(boardOffset, dtype=np.int64)
+  col['boardLayer'] = np.array(boardLayer, dtype=np.uint8)
+  col['boardChips'] = np.array(boardChips, dtype=np.uint8)
+  col['boardClusters'] = np.array(boardClusters, dtype=np.uint8)
+  col['boardOK'] = np.array(boardOK, dtype=bool)
+  col['clusterOffset'] = np.array(clusterOffset, dtype=np.int64)
+  col['clusterLayer'] = np.array(clusterLayer, dtype=np.uint8)
+  col['clusterChip'] = np.array(clusterChip, dtype=np.uint8)
+  col['clusterFirst'] = np.array(clusterFirst, dtype=np.uint8)
+  col['clusterWidth'] = np.array(clusterWidth, dtype=np.uint8)
+  return finishColumns(col, reader, nSkipped)
+
+# The same with the compiled decoder, which does the loop over events, boards and clusters
+def nativeRunColumns(reader):
+  records = []
+  hostTime = []
+  summaries = []
+  for type, tRecord, data in reader.records():
+    if type != PSOC_runfile.REC_EVENT: continue
+    summaries.append(boardSummary(data))
+    data = PSOC_runfile.expandEvent(data)
+    records.append(data if data is not None else b'')
+    hostTime.append(tRecord)
+  raw = PSOC_runfile._psocdecode.decodeEvents(records)
+  valid = np.frombuffer(raw['valid'], dtype=np.uint8).astype(bool)
+  col = headerColumns(raw['headers'])
+  col['hostTime'] = np.array(hostTime, dtype=np.float64)[valid]
+  for name in ['boardOffset', 'clusterOffset']:
+    col[name] = np.frombuffer(raw[name], dtype=np.int64)
+  for name in ['boardLayer', 'clusterLayer', 'clusterChip', 'clusterFirst', 'clusterWidth']:
+    col[name] = np.frombuffer(raw[name], dtype=np.uint8)
+  col['boardOK'] = np.frombuffer(raw['boardOK'], dtype=np.uint8).astype(bool)
+  col['boardChips'] = np.frombuffer(raw['boardChips'], dtype=np.uint8).copy()
+  col['boardClusters'] = np.frombuffer(raw['boardClusters'], dtype=np.uint8).copy()
+  # The boards of level-3 events come out of the decoder empty: fill in their summaries
+  for i, summary in enumerate(s for s, ok in zip(summaries, valid) if ok):
+    if summary is None: continue
+    first = col['boardOffset'][i]
+    for brd, (layer, nChips, nClust) in enumerate(summary[0:col['boardOffset'][i+1] - first]):
+      col['boardChips'][first + brd] = nChips
+      col['boardClusters'][first + brd] = nClust
+      col['boardOK'][first + brd] = True
+  return finishColumns(col, reader, len(records) - int(valid.sum()))
+
+def headerColumns(headers):
+  hdr = np.frombuffer(headers, dtype=HEADER_DTYPE)
+  col = {name: hdr[name].astype(HEADER_DTYPE[name].newbyteorder('=')) for name in HEADER_DTYPE.names}
+  col['flags'] = col['tkrTrgPattern'] & 0x3F      # event flags share byte 40 with the tracker trigger pattern
+  col['tkrTrgPattern'] &= 0xC0
+  col['level'] = (col['flags'] & PSOC_runfile.EVT_DEGRADE_MASK) >> PSOC_runfile.EVT_DEGRADE_SHIFT
+  return col
+
+def finishColumns(col, reader, nSkipped):
+  # Cluster center in strips across the layer, as in ParseASIChitList (the chips count strips backwards)
+  col['clusterStrip'] = (64.*(col['clusterChip'] + 1.) - (col['clusterFirst'] + 0.5 + (col['clusterWidth'] - 1.)/2.)).astype(np.float32)
+  col['runNumber'] = np.array(reader.runNumber, dtype=np.uint16)
+  col['nSkipped'] = np.array(nSkipped, dtype=np.int64)
+  return col
+
+# Write the columns of a run file either to one .npz file, or, if outName does not end in .npz, to a
+# directory of .npy files that loadColumns can memory map
+def exportRun(runFileName, outName):
+  reader = RunReader(runFileName)
+  col = runColumns(reader)
+  reader.close()
+  if outName.endswith('.npz'):
+    np.savez(outName, **col)
+  else:
+    os.makedirs(outName, exist_ok=True)
+    for name, array in col.items():
+      np.save(os.path.join(outName, name + '.npy'), array)
+  return col
+
+# Load exported columns as a dictionary of arrays. The .npy directory layout is memory mapped.
+def loadColumns(name):
+  if name.endswith('.npz'):
+    with np.load(name) as f:
+      return {key: f[key] for key in f.files}
+  col = {}
+  for fileName in os.listdir(name):
+    if fileName.endswith('.npy'):
+      col[fileName[:-4]] = np.load(os.path.join(name, fileName), mmap_mode='r')
+  return col
+
+if __name__ == "__main__":
+  if len(sys.argv) < 3:
+    print("usage: python3 PSOC_columns.py <run file> <output .npz file or directory>")
+    sys.exit(1)
+  tStart = time.time()
+  col = exportRun(sys.argv[1], sys.argv[2])
+  tExport = time.time() - tStart
+  tStart = time.time()
+  col = loadColumns(sys.argv[2])
+  tLoad = time.time() - tStart
+  print(sys.argv[1] + ": " + str(len(col['event'])) + " events, " + str(len(col['clusterLayer'])) + " clusters, " +
+        str(int(col['nSkipped'])) + " records skipped; exported in " + str(round(tExport, 2)) + " s, loaded in " +
+        str(round(1000.*tLoad, 1)) + " ms")
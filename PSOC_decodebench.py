@@ -0,0 +1,105 @@
+# Benchmark of the host decoders with and without the compiled module (_psocdecode.c), which also checks that
+# both give the same results. Build the module first with "python3 setup.py build_ext --inplace".
+#
+# Usage: python3 PSOC_decodebench.py [run file]
+# Without a run file, a synthetic run with realistic tracker hit lists is made up.
+import os
+import sys
+import time
+import random
+import struct
+import tempfile
+import numpy as np
+import PSOC_runfile
+import PSOC_columns
+import PSOC_pipeline
+
+# Write a synthetic run laid out as the event builder does, with tracker hits in about half of the layers
+def mkRun(fileName, nEvents, seed=1):
+  from PSOC_emulator import mkHitList
+  rnd = random.Random(seed)
+  with PSOC_runfile.RunWriter(fileName, 1, {"synthetic": True}) as w:
+    for n in range(nEvents):
+      boards = b''
+      nBoards = 0
+      for lyr in range(8):
+        if rnd.random() < 0.5: continue
+        chips = [(chip, [(rnd.choice([1, 1, 2, 3]), rnd.randrange(60)) for i in range(rnd.randrange(1, 4))])
+                 for chip in rnd.sample(range(12), rnd.choice([1, 1, 2, 3]))]
+        hitList = mkHitList(8 if lyr == 0 else lyr, n, chips)
+        boards += bytes([lyr, len(hitList)]) + hitList
+        nBoards += 1
+      header = struct.pack('>HIIIIB6HhHBBBB4H', 1, n, 200*n, n + n//10, 0, rnd.choice([1, 3, 4, 5, 0x0C]),
+                           *[rnd.randrange(4096) for ch in range(6)], rnd.randrange(-500, 500), n & 0xFFFF, 1, 0xC0, 1, 1, 0, 0, 0, 0)
+      w.write(b'ZERO' + header + bytes([nBoards]) + boards + b'FINI')
+
+# The event records framed in 9-byte packets, as the event PSOC sends them in output mode 0
+def mkPacketStream(events):
+  stream = bytearray()
+  for data in events:
+    n = len(data)
+    stream += bytes([0xDC, 0, 0xFF, min(n, 255), n >> 8, n & 0xFF, 0xFF, 0x00, 0xFF])
+    padded = bytes(data) + b'\x00'*((3 - n % 3) % 3)
+    for i in range(0, len(padded), 3):
+      stream += bytes([0xDC, 0, 0xFF]) + padded[i:i+3] + b'\xFF\x00\xFF'
+  return bytes(stream)
+
+def timeIt(function):
+  tStart = time.time()
+  result = function()
+  return result, time.time() - tStart
+
+def decodeStream(stream, native):
+  decoder = PSOC_pipeline.PacketDecoder()
+  decoder.useNative = native
+  out = []
+  for i in range(0, len(stream), 4096):
+    out += decoder.feed(stream[i:i+4096])
+  return out
+
+def report(what, nEvents, tPython, tNative, same):
+  line = "  {:<28s} python {:9.0f} events/s".format(what, nEvents/tPython)
+  if tNative is not None:
+    line += "   compiled {:10.0f} events/s   x{:5.1f}   {}".format(nEvents/tNative, tPython/tNative, "same results" if same else "RESULTS DIFFER")
+  print(line)
+
+if __name__ == "__main__":
+  native = PSOC_runfile._psocdecode is not None
+  if len(sys.argv) > 1:
+    fileName = sys.argv[1]
+  else:
+    fileName = os.path.join(tempfile.gettempdir(), "decodebench.aeso")
+    mkRun(fileName, 20000)
+  reader = PSOC_runfile.RunReader(fileName)
+  events = [bytes(data) for data in reader.events()]
+  print(fileName + ": " + str(len(events)) + " events; compiled decoder " + ("found" if native else "not built"))
+  allOK = True
+
+  PSOC_columns.useNative = False
+  colPy, tPy = timeIt(lambda: PSOC_columns.runColumns(reader))
+  colC, tC = None, None
+  if native:
+    PSOC_columns.useNative = True
+    colC, tC = timeIt(lambda: PSOC_columns.runColumns(reader))
+  same = colC is None or all(np.array_equal(colPy[key], colC[key]) for key in colPy)
+  report("run file to columns", len(events), tPy, tC, same)
+  allOK = allOK and same
+
+  hitLists = [hitList for data in events for brd, hitList in PSOC_runfile.decodeEvent(data)['boards']]
+  outPy, tPy = timeIt(lambda: [PSOC_runfile.pyDecodeHitList(h) for h in hitLists])
+  outC, tC = None, None
+  if native: outC, tC = timeIt(lambda: [PSOC_runfile._psocdecode.decodeHitList(h) for h in hitLists])
+  same = outC is None or outPy == outC
+  report("hit lists (" + str(len(hitLists)) + ")", len(events), tPy, tC, same)
+  allOK = allOK and same
+
+  stream = mkPacketStream(events)
+  outPy, tPy = timeIt(lambda: decodeStream(stream, False))
+  outC, tC = None, None
+  if native: outC, tC = timeIt(lambda: decodeStream(stream, True))
+  same = outC is None or outPy == outC
+  report("packet framing", len(events), tPy, tC, same)
+  allOK = allOK and same and [bytes(p[2]) for p in outPy] == events
+
+  reader.close()
+  print("decodebench: " + ("passed" if allOK else "FAILED"))
@@ -0,0 +1,626 @@
+# Software emulator of the event PSOC, for running and benchmarking the host scripts without hardware.
+# It opens a Linux pseudo-terminal that openCOM() can attach to like a real COM port, parses the
+# triplicated ASCII commands and binary command frames the way the firmware does, answers with the
+# FIX_HEAD/VAR_HEAD packet framing (or bulk records in output mode 2), and during a run sends synthetic
+# events at a configurable rate, laid out as in the firmware event builder.
+#
+# Usage from the command line, leaving the emulator running until Ctrl-C:
+#   python3 PSOC_emulator.py [event rate in Hz]
+# or from Python:
+#   emu = Emulator(rate=500.)
+#   emu.start()
+#   openCOM(emu.portName)
+#   ...
+#   emu.stop()
+# "python3 PSOC_emulator.py selftest [seconds]" runs a run through the emulator and reports the rate
+# at which the host library decodes the events.
+import os
+import sys
+import tty
+import time
+import random
+import select
+import threading
+import PSOC_cmd
+import PSOC_runfile
+
+VERSION = 1
+FIX_HEAD = 0xDB
+VAR_HEAD = 0xDC
+BULK_HEAD = 0xDD
+LINK_HEAD = 0xDE
+BIN_SYNC = 0xA5
+CMD_ACK = 0xAC
+CMD_NAK = 0xAE
+ASCII_CMD_LEN = 29
+MAX_CMD_DATA = 16
+MXERR = 64
+N_TRG_CLASSES = 5
+LINK_TRAILER = 0x01
+LINK_CREDITS = 0x02
+ERR_CMD_IGNORE = 5
+ERR_BAD_CMD = 20
+ERR_BAD_BYTE = 22
+ERR_BAD_CRC = 26
+ERR_BAD_FRAME = 27
+ERR_TKR_IMAGE = 31
+ERR_L2_CONFIG = 32
+ERR_TRG_CLASS = 33
+ERR_DEGRADE_CONFIG = 34
+RUN_SAFE = (0x03, 0x07, 0x33, 0x34, 0x37, 0x3D, 0x3E, 0x46, 0x47, 0x48, 0x49, 0x4D, 0x50, 0x51, 0x53)
+N_DEGRADE_LEVELS = 4
+NO_ECHO = (0x67, 0x6C)        # Tracker commands that have no echo
+TKR_IMAGE_LEN = 2048
+TKR_RECORD_TIME = 0.002       # Time to send a Tracker configuration image record and check its echo
+
+# Encode an ASIC hit list as sent by a tracker FPGA.
+# chips: list of (chip address, list of (cluster width, first strip))
+def mkHitList(FPGA, eventTag, chips):
+  bits = "11100111" + "0" + format(FPGA, '07b')
+  bits = bits + format(eventTag & 0x7F, '07b') + "0" + format(len(chips), '04b')
+  for chip, clusters in chips:
+    bits = bits + "00" + format(len(clusters), '04b') + "00" + format(chip, '04b')
+    for width, first in clusters:
+      bits = bits + format(width-1, '06b') + format(first, '06b')
+  bits = bits + PSOC_cmd.CRC6('1' + bits) + "11"
+  bits = bits + "0"*((8 - len(bits) % 8) % 8)
+  return bytes([int(bits[i:i+8], 2) for i in range(0, len(bits), 8)])
+
+# Cut an event (a list of bytes, without its trailer) down to a content level, as degradeEvent in the firmware
+# does; see eventLevel in PSOC_runfile.py for the layouts
+def degradeEvent(event, level, adc, thresholds):
+  event[40] |= level << PSOC_runfile.EVT_DEGRADE_SHIFT
+  if level == 0: return event
+  if level == 1: return event[0:43] + event[51:]
+  head = [0]
+  for ch in range(len(adc)):
+    if adc[ch] <= thresholds[ch]: continue
+    head[0] |= 1 << ch
+    head = head + list(adc[ch].to_bytes(2, 'big'))
+  tkr = event[51:]
+  if level == 3:
+    tkr = [event[51]]
+    iPtr = 52
+    for brd in range(event[51]):
+      hitList = bytes(event[iPtr+2:iPtr+2+event[iPtr+1]])
+      nChips = hitList[3] >> 4 if len(hitList) >= 4 else 0
+      tkr = tkr + [event[iPtr], nChips, min(len(PSOC_runfile.decodeHitList(hitList)[2]), 255)]
+      iPtr += 2 + event[iPtr+1]
+  tail = head + tkr
+  tail = tail + [0]*(12 - len(tail))
+  return event[0:23] + tail[0:12] + event[35:43] + tail[12:]
+
+class Emulator:
+  # rate: mean event rate in Hz during a run, with random (Poisson) arrival times
+  # occupancy: probability that a tracker layer has hits in an event
+  def __init__(self, rate=100., occupancy=0.5, seed=None):
+    self.rate = rate
+    self.occupancy = occupancy
+    self.random = random.Random(seed)
+    self.master, self.slave = os.openpty()
+    tty.setraw(self.slave)
+    os.set_blocking(self.master, False)
+    self.portName = os.ttyname(self.slave)
+    self.buffer = b''
+    self.awaitingCommand = True
+    self.command = 0
+    self.cmdSeq = 0
+    self.cmdData = [0]*MAX_CMD_DATA
+    self.nDataBytes = 0
+    self.dCnt = 0
+    self.errors = []
+    self.outputMode = 1
+    self.thrDAC = [0, 0, 0, 0, 0]
+    self.tofDAC = [0, 0]
+    self.trgMask = [0, 0]
+    self.led = False
+    self.triggerEnabled = False
+    self.runNumber = 0
+    self.runMaxEvents = 0
+    self.runEndTime = None   # time.time() at which a run with a duration limit ends
+    self.l2 = {'enabled': False, 'minLayers': 0, 'adcMin': [0]*6, 'adcMax': [0xFFFF]*6, 'dtMin': -32768, 'dtMax': 32767, 'prescale': 0}
+    self.l2Failed = 0
+    self.l2Counts = [0, 0, 0, 0]   # tested, passed, rejected, failed but sent
+    self.trgPrescale = [0]*N_TRG_CLASSES
+    self.trgCountdown = [0]*N_TRG_CLASSES
+    self.trgCounts = [[0, 0, 0] for i in range(N_TRG_CLASSES)]   # events of each class: raw, accepted, prescaled away
+    self.linkMode = 0               # SPI link protection, applied in output mode 0
+    self.linkHoldLimit = 100
+    self.linkCredits = 0
+    self.linkSeq = 0
+    self.linkDropsPending = 0
+    self.linkCounts = [0, 0]        # events sent, events dropped
+    self.heldEvent = None           # [event, time held] of an event waiting for a credit
+    self.degrade = {'minLevel': 0, 'mark': [0]*N_DEGRADE_LEVELS, 'pmtThreshold': [0]*6}
+    self.degradeLevel = 0
+    self.backlog = 0                # smoothed output wait, in microseconds
+    self.degradeCounts = [0]*N_DEGRADE_LEVELS
+    self.tEventBuilt = 0.
+    self.cntGO = 0
+    self.cntGO1 = 0
+    self.nextEvent = 0.
+    self.tkrCmdCount = 0
+    self.tkrImage = []
+    self.tkrImagePtr = None         # offset of the next record to send, while an image is being sent
+    self.tkrImageRecords = 0
+    self.tkrImageSeq = 0
+    self.nextImageRecord = 0.
+    self.heldCommands = []          # commands that wait for the image to have been sent
+    self.nCommands = 0
+    self.nEvents = 0
+    self.nKept = 0       # events of the run kept for output, against runMaxEvents
+    self.nBytesOut = 0
+    self.running = False
+    self.thread = None
+
+  def start(self):
+    self.running = True
+    self.thread = threading.Thread(target=self._loop, daemon=True)
+    self.thread.start()
+
+  def stop(self):
+    self.running = False
+    if self.thread is not None: self.thread.join()
+    os.close(self.master)
+    os.close(self.slave)
+
+  def _loop(self):
+    while self.running:
+      timeout = 0.05
+      if self.triggerEnabled: timeout = max(0., min(timeout, self.nextEvent - time.time()))
+      if self.tkrImagePtr is not None: timeout = max(0., min(timeout, self.nextImageRecord - time.time()))
+      ready = select.select([self.master], [], [], timeout)[0]
+      if ready:
+        try:
+          self.buffer = self.buffer + os.read(self.master, 4096)
+        except BlockingIOError:
+          continue
+        except OSError:
+          return
+        self._parse()
+      if self.tkrImagePtr is not None and time.time() >= self.nextImageRecord:
+        self._tkrImageRecord()
+      if self.heldEvent is not None:
+        self._releaseHeld()
+      elif self.triggerEnabled and (self.runEndTime is not None and time.time() >= self.runEndTime or
+                                    self.runMaxEvents > 0 and self.nKept >= self.runMaxEvents):
+        self.endRun()
+      elif self.triggerEnabled and time.time() >= self.nextEvent:
+        self._event()
+        # One event per pass, so that commands are still read when the host cannot keep up with the rate
+        self.nextEvent = max(self.nextEvent, time.time() - 0.1) + self.random.expovariate(self.rate)
+
+  def addError(self, code, value0, value1):
+    if len(self.errors) < MXERR: self.errors.append([code, value0 & 0xFF, value1 & 0xFF])
+
+  # Send an event, with the SPI link protection of the firmware in output mode 0: an event waits for a credit
+  # (holding off further events) and is followed by the sequence number and CRC packet
+  def _sendEvent(self, event):
+    if self.outputMode == 0 and self.linkMode & LINK_CREDITS and self.linkCredits == 0:
+      self.heldEvent = [event, time.time()]
+      return
+    self.output(event)
+    self.degradeCounts[PSOC_runfile.eventLevel(event)] += 1
+    self._degradeUpdate()
+    if self.outputMode != 0: return
+    self.linkCounts[0] += 1
+    if self.linkMode & LINK_CREDITS: self.linkCredits -= 1
+    if self.linkMode & LINK_TRAILER:
+      crc = PSOC_cmd.crc16(event)
+      self._write(bytes([LINK_HEAD, self.linkSeq, 0xFF, crc >> 8, crc & 0xFF, self.linkDropsPending, 0xFF, 0x00, 0xFF]))
+      self.linkSeq = (self.linkSeq + 1) & 0xFF
+      self.linkDropsPending = 0
+
+  def _releaseHeld(self):
+    event, tHeld = self.heldEvent
+    if self.linkCredits > 0 or self.outputMode != 0 or not self.linkMode & LINK_CREDITS:
+      self.heldEvent = None
+      self._sendEvent(event)
+    elif time.time() - tHeld > 0.005*self.linkHoldLimit:
+      self.heldEvent = None
+      self.linkCounts[1] += 1
+      self.linkDropsPending = min(self.linkDropsPending + 1, 255)
+      self._degradeUpdate()
+
+  # Output backlog and content level, as in the firmware: the wait of each event from being built until it has
+  # been written or dropped, smoothed over about 8 events, against the watermarks set with command 0x52
+  def _degradeUpdate(self):
+    wait = int((time.time() - self.tEventBuilt)*1.e6)
+    self.backlog = self.backlog - self.backlog//8 + wait//8
+    mark = self.degrade['mark']
+    while self.degradeLevel < N_DEGRADE_LEVELS-1 and 0 < mark[self.degradeLevel+1] < self.backlog//100:
+      self.degradeLevel += 1
+    while self.degradeLevel > 0 and self.backlog//100 < mark[self.degradeLevel]//2:
+      self.degradeLevel -= 1
+
+  # Wait for the host to take the data, like a real link, until the emulator is stopped
+  def _write(self, data):
+    while len(data) > 0 and self.running:
+      if not select.select([], [self.master], [], 0.1)[1]: continue
+      try:
+        n = os.write(self.master, data)
+      except BlockingIOError:
+        continue
+      self.nBytesOut += n
+      data = data[n:]
+
+  # Send out data with the same framing as the firmware output task
+  def output(self, data, seq=0):
+    nData = len(data)
+    if self.outputMode == 2:
+      self._write(bytes([BULK_HEAD, seq, nData >> 8, nData & 0xFF]) + bytes(data))
+      return
+    trailer = b'\xFF\x00\xFF'
+    if nData <= 3:
+      data = list(data) + [0]*(3 - nData)
+      self._write(bytes([FIX_HEAD, seq, 0xFF] + data[0:3]) + trailer)
+      return
+    packets = bytes([VAR_HEAD, seq, 0xFF, min(nData, 255), nData >> 8, nData & 0xFF]) + trailer
+    data = list(data)
+    if nData % 3 != 0: data = data + [0xEE, 0xFF][0:3 - nData % 3]
+    for i in range(0, len(data), 3):
+      packets = packets + bytes([VAR_HEAD, seq, 0xFF] + data[i:i+3]) + trailer
+    self._write(packets)
+
+  # Command parser, following the firmware command input task
+  def _parse(self):
+    while len(self.buffer) > 0:
+      start = 0
+      while start < len(self.buffer) and self.buffer[start] not in (ord('S'), BIN_SYNC): start += 1
+      self.buffer = self.buffer[start:]
+      if len(self.buffer) == 0: return
+      if self.buffer[0] == BIN_SYNC:
+        if len(self.buffer) < 5: return
+        nBin = self.buffer[4]
+        if nBin > MAX_CMD_DATA:
+          self.addError(ERR_BAD_FRAME, self.buffer[3], nBin)
+          self.buffer = self.buffer[1:]
+          continue
+        if len(self.buffer) < 7 + nBin: return
+        frame = self.buffer[0:7 + nBin]
+        if PSOC_cmd.crc16(frame[1:5+nBin]) != (frame[5+nBin] << 8) | frame[6+nBin]:
+          self.addError(ERR_BAD_CRC, frame[3], nBin)
+          self.buffer = self.buffer[1:]
+          continue
+        self.buffer = self.buffer[7 + nBin:]
+        if frame[1] != PSOC_cmd.addrEvnt: continue
+        if not self.awaitingCommand:     # an ASCII command still waiting for data frames is abandoned
+          self.addError(ERR_BAD_BYTE, self.command, self.dCnt)
+          self.awaitingCommand = True
+        self.nCommands += 1
+        self.execute(frame[3], list(frame[5:5+nBin]), frame[2])
+        continue
+      if len(self.buffer) < ASCII_CMD_LEN: return
+      cmd = self.buffer[0:ASCII_CMD_LEN]
+      if cmd[0:9] != cmd[9:18] or cmd[0:9] != cmd[18:27] or cmd[26:29] != b'W\r\n':
+        self.addError(ERR_BAD_CMD, 0, 0)
+        self.buffer = self.buffer[1:]
+        continue
+      self.buffer = self.buffer[ASCII_CMD_LEN:]
+      try:
+        dataByte = int(cmd[1:3], 16)
+        addressByte = int(cmd[3:5], 16)
+      except ValueError:
+        self.addError(ERR_BAD_CMD, 0, 0)
+        continue
+      if (addressByte & 0x3C) >> 2 != PSOC_cmd.addrEvnt: continue
+      nibbles = ((addressByte & 0xC0) >> 4) | (addressByte & 0x03)
+      if self.awaitingCommand:
+        self.awaitingCommand = False
+        self.nCommands += 1
+        self.command = dataByte
+        self.nDataBytes = nibbles
+        self.dCnt = 0
+        try:
+          self.cmdSeq = int(cmd[6:8], 16)
+        except ValueError:
+          self.cmdSeq = 0
+      elif nibbles != 0:
+        self.cmdData[nibbles-1] = dataByte
+        self.dCnt += 1
+      else:
+        self.addError(ERR_BAD_BYTE, self.command, self.nDataBytes)
+      if not self.awaitingCommand and self.dCnt == self.nDataBytes:
+        self.awaitingCommand = True
+        self.execute(self.command, self.cmdData[0:self.nDataBytes], self.cmdSeq)
+
+  # Execute one command, returning the same replies as the firmware command task
+  def execute(self, command, data, seq):
+    if self.tkrImagePtr is not None and command not in RUN_SAFE:
+      self.heldCommands.append((command, data, seq))
+      return
+    nData = len(data)
+    data = data + [0]*(MAX_CMD_DATA - nData)
+    if self.triggerEnabled and command != 0x44 and command not in RUN_SAFE:
+      self.addError(ERR_CMD_IGNORE, command, 0)
+      if seq != 0: self.output([command, CMD_NAK, ERR_CMD_IGNORE], seq)
+      return
+    reply = []
+    if command == 0x01:
+      if data[0] >= 1 and data[0] <= 5: self.thrDAC[data[0]-1] = data[1] if data[0] < 5 else (data[1] << 8) | data[2]
+    elif command == 0x02:
+      if data[0] == 5: reply = [self.thrDAC[4] >> 8, self.thrDAC[4] & 0xFF]
+      elif data[0] >= 1 and data[0] < 5: reply = [self.thrDAC[data[0]-1]]
+    elif command == 0x03:
+      if len(self.errors) == 0: reply = [0x00, 0xEE, 0xFF]
+      for error in self.errors: reply = reply + error
+      self.errors = []
+    elif command == 0x04:
+      if data[0] in (1, 2): self.tofDAC[data[0]-1] = (data[1] << 8) | data[2]
+    elif command == 0x05:
+      if data[0] in (1, 2): reply = [self.tofDAC[data[0]-1] >> 8, self.tofDAC[data[0]-1] & 0xFF]
+    elif command == 0x06:
+      self.led = data[0] == 1
+    elif command == 0x07:
+      reply = [VERSION]
+    elif command == 0x10 or command == 0x41:
+      tkrCode = data[1] if command == 0x10 else (0x15, 0x13, 0x14)[min(max(data[2] & 0x03, 1), 3) - 1]
+      self.tkrCmdCount = (self.tkrCmdCount + 1) & 0xFFFF
+      if command == 0x41 or tkrCode not in NO_ECHO:
+        reply = [self.tkrCmdCount >> 8, self.tkrCmdCount & 0xFF, tkrCode]
+    elif command == 0x30:
+      self.outputMode = data[0]
+    elif command == 0x36:
+      if data[0] in (1, 2): self.trgMask[data[0]-1] = data[1]
+    elif command == 0x3B:
+      self.triggerEnabled = data[0] == 1
+      self.nextEvent = time.time()
+    elif command == 0x3C:
+      self.runNumber = (data[0] << 8) | data[1]
+      self.runMaxEvents = (data[2] << 8) | data[3]
+      runSeconds = (data[4] << 8) | data[5]
+      self.runEndTime = time.time() + runSeconds if runSeconds > 0 else None
+      self.cntGO = 0
+      self.cntGO1 = 0
+      self.nKept = 0
+      self.l2Failed = 0
+      self.l2Counts = [0, 0, 0, 0]
+      self.trgCountdown = [0]*N_TRG_CLASSES
+      self.trgCounts = [[0, 0, 0] for i in range(N_TRG_CLASSES)]
+      self.degradeCounts = [0]*N_DEGRADE_LEVELS
+      self.triggerEnabled = True
+      self.nextEvent = time.time()
+    elif command == 0x3D:
+      reply = [1 if self.triggerEnabled else 0]
+    elif command == 0x3E:
+      if data[0] in (1, 2): reply = [self.trgMask[data[0]-1]]
+    elif command == 0x44:
+      reply = self.runSummary()
+    elif command == 0x47:
+      reply = [0]*10
+    elif command == 0x48:
+      reply = [0]*(14*9)
+    elif command == 0x49:
+      reply = list(self.tkrCmdCount.to_bytes(4, 'big')) + [0]*9
+    elif command == 0x4A and nData >= 2:
+      offset = (data[0] << 8) | data[1]
+      if offset == 0: self.tkrImage = []    # start a new image
+      if offset != len(self.tkrImage) or offset + nData - 2 > TKR_IMAGE_LEN:
+        self.addError(ERR_TKR_IMAGE, offset >> 8, offset)
+      else:
+        self.tkrImage = self.tkrImage + data[2:nData]
+    elif command == 0x4B:
+      crc = PSOC_cmd.crc16(self.tkrImage)
+      ptr = 0
+      while ptr + 3 <= len(self.tkrImage): ptr += 3 + self.tkrImage[ptr+2]
+      if len(self.tkrImage) == 0 or ptr != len(self.tkrImage) or nData < 2 or crc != (data[0] << 8) | data[1]:
+        self.addError(ERR_TKR_IMAGE, crc >> 8, crc)
+        reply = [0, 0, 0xFF, 0xFF]
+      else:      # the records go out one at a time from _loop, and the reply comes after the last one
+        self.tkrImagePtr = 0
+        self.tkrImageRecords = 0
+        self.tkrImageSeq = seq
+        self.nextImageRecord = time.time()
+        return
+    elif command == 0x4C:
+      if data[0] == 0:
+        self.l2['enabled'] = data[1] == 1
+        self.l2Failed = 0
+      elif data[0] == 1: self.l2['minLayers'] = data[1]
+      elif data[0] == 2 and data[1] >= 1 and data[1] <= 6:
+        self.l2['adcMin'][data[1]-1] = (data[2] << 8) | data[3]
+        self.l2['adcMax'][data[1]-1] = (data[4] << 8) | data[5]
+      elif data[0] == 3:
+        self.l2['dtMin'] = int.from_bytes(bytes(data[1:3]), 'big', signed=True)
+        self.l2['dtMax'] = int.from_bytes(bytes(data[3:5]), 'big', signed=True)
+      elif data[0] == 4: self.l2['prescale'] = (data[1] << 8) | data[2]
+      else: self.addError(ERR_L2_CONFIG, data[0], nData)
+    elif command == 0x4D:
+      reply = [b for count in self.l2Counts for b in count.to_bytes(4, 'big')]
+    elif command == 0x4E:
+      if data[0] >= 1 and data[0] <= N_TRG_CLASSES:
+        self.trgPrescale[data[0]-1] = (data[1] << 8) | data[2]
+        self.trgCountdown[data[0]-1] = 0
+      else: self.addError(ERR_TRG_CLASS, data[0], nData)
+    elif command == 0x4F:
+      self.linkMode = data[0] & (LINK_TRAILER | LINK_CREDITS)
+      if nData >= 2: self.linkHoldLimit = data[1]
+      self.linkCredits = 0
+    elif command == 0x50:
+      self.linkCredits = min(self.linkCredits + data[0], 255)
+      return     # never a reply, as it can come while an event is waiting
+    elif command == 0x51:
+      reply = list(self.linkCounts[0].to_bytes(4, 'big')) + list(self.linkCounts[1].to_bytes(4, 'big'))
+      reply = reply + [self.linkCredits, self.linkSeq, self.linkMode]
+    elif command == 0x52:
+      if data[0] == 0 and nData >= 2 and data[1] < N_DEGRADE_LEVELS: self.degrade['minLevel'] = data[1]
+      elif 1 <= data[0] < N_DEGRADE_LEVELS and nData >= 3:
+        self.degrade['mark'][data[0]] = (data[1] << 8) | data[2]
+        self.degradeLevel = 0
+      elif data[0] == 4 and nData >= 4 and data[1] >= 1 and data[1] <= 6:
+        self.degrade['pmtThreshold'][data[1]-1] = (data[2] << 8) | data[3]
+      else: self.addError(ERR_DEGRADE_CONFIG, data[0], nData)
+    elif command == 0x53:
+      reply = [max(self.degradeLevel, self.degrade['minLevel'])] + list(min(self.backlog//100, 0xFFFF).to_bytes(2, 'big'))
+      for count in self.degradeCounts: reply = reply + list(count.to_bytes(4, 'big'))
+    if seq != 0 and len(reply) == 0: reply = [command, CMD_ACK, 0x00]
+    if len(reply) > 0: self.output(reply, seq)
+
+  # Send the next record of the Tracker configuration image; the emulated Tracker always echoes correctly
+  def _tkrImageRecord(self):
+    self.tkrCmdCount = (self.tkrCmdCount + 1) & 0xFFFF
+    self.tkrImagePtr += 3 + self.tkrImage[self.tkrImagePtr+2]
+    self.tkrImageRecords += 1
+    self.nextImageRecord += TKR_RECORD_TIME
+    if self.tkrImagePtr < len(self.tkrImage): return
+    self.tkrImagePtr = None
+    n = self.tkrImageRecords
+    self.output([n >> 8, n & 0xFF, 0, 0] + [0]*((n + 7)//8), self.tkrImageSeq)
+    held = self.heldCommands
+    self.heldCommands = []
+    for command, data, seq in held: self.execute(command, data, seq)
+
+  # End the run and return the run summary: the number of triggers and the number of events read out
+  def runSummary(self):
+    self.triggerEnabled = False
+    if self.heldEvent is not None:    # the firmware drops an event still waiting for a credit before the run ends
+      self.heldEvent = None
+      self.linkCounts[1] += 1
+      self.linkDropsPending = min(self.linkDropsPending + 1, 255)
+    self.runMaxEvents = 0
+    self.runEndTime = None
+    summary = list(self.cntGO1.to_bytes(4, 'big')) + list(self.cntGO.to_bytes(4, 'big'))
+    for counts in self.trgCounts:
+      for count in counts: summary = summary + list(count.to_bytes(4, 'big'))
+    return summary
+
+  # A run that reached its event or time limit ends by itself, with the run summary sent unsolicited
+  def endRun(self):
+    self.output(self.runSummary())
+
+  # Prescaling by trigger class, as in the firmware event builder: True if any class of the event is accepted
+  def _trgClassKeep(self, trgStatus):
+    keep = trgStatus & ((1 << N_TRG_CLASSES) - 1) == 0
+    for i in range(N_TRG_CLASSES):
+      if not trgStatus & (1 << i): continue
+      self.trgCounts[i][0] += 1
+      if self.trgCountdown[i] > 1:
+        self.trgCountdown[i] -= 1
+        self.trgCounts[i][2] += 1
+      else:
+        self.trgCountdown[i] = self.trgPrescale[i]
+        self.trgCounts[i][1] += 1
+        keep = True
+    return keep
+
+  # Level-2 filter, as in the firmware event builder: returns the event flags, or None to drop the event
+  def _l2Flags(self, adc, dtmin, boards):
+    l2 = self.l2
+    if not l2['enabled']: return 0
+    self.l2Counts[0] += 1
+    nLayers = sum(1 for lyr, hitList in boards if len(hitList) >= 4 and hitList[3] >> 4 > 0)
+    if (nLayers >= l2['minLayers'] and all(l2['adcMin'][ch] <= adc[ch] <= l2['adcMax'][ch] for ch in range(6)) and
+        l2['dtMin'] <= dtmin <= l2['dtMax']):
+      self.l2Counts[1] += 1
+      return 0
+    self.l2Failed += 1
+    if l2['prescale'] > 0 and self.l2Failed >= l2['prescale']:
+      self.l2Failed = 0
+      self.l2Counts[3] += 1
+      return PSOC_runfile.EVT_FLAG_L2_FAIL
+    self.l2Counts[2] += 1
+    return None
+
+  # Build a synthetic event with the firmware event layout
+  def _event(self):
+    rnd = self.random
+    self.cntGO1 += 1 + (rnd.random() < 0.1)     # Some triggers are lost to dead time
+    self.cntGO += 1
+    timeStamp = int(time.time()*200) & 0xFFFFFFFF
+    trgStatus = rnd.choice([0x01, 0x03, 0x04, 0x05, 0x0C, 0x11])
+    event = list(b'ZERO')
+    event = event + list(self.runNumber.to_bytes(2, 'big')) + list(self.cntGO.to_bytes(4, 'big'))
+    event = event + list(timeStamp.to_bytes(4, 'big')) + list(self.cntGO1.to_bytes(4, 'big'))
+    event = event + [0, 0, 0, 0] + [trgStatus]
+    adc = [max(0, min(4095, int(rnd.gauss(400, 120)))) for ch in range(6)]
+    dtmin = int(rnd.gauss(0, 50))
+    for ch in range(6):
+      event = event + list(adc[ch].to_bytes(2, 'big'))
+    event = event + list((dtmin & 0xFFFF).to_bytes(2, 'big'))
+    self.tkrCmdCount = (self.tkrCmdCount + 1) & 0xFFFF
+    boards = []
+    for lyr in range(8):
+      if rnd.random() >= self.occupancy: continue
+      chips = []
+      for chip in rnd.sample(range(12), rnd.choice([1, 1, 1, 2, 3])):
+        nClust = min(10, 1 + int(rnd.expovariate(1.0)))
+        chips.append((chip, [(rnd.choice([1, 1, 2, 3]), rnd.randrange(60)) for i in range(nClust)]))
+      boards.append((lyr, mkHitList(8 if lyr == 0 else lyr, self.cntGO, chips)))
+    if not self._trgClassKeep(trgStatus): return
+    flags = self._l2Flags(adc, dtmin, boards)
+    if flags is None: return
+    event = event + list((self.cntGO & 0xFFFF).to_bytes(2, 'big')) + [self.tkrCmdCount & 0xFF, flags]
+    event = event + [1, 1] + [0]*8 + [len(boards)]
+    for lyr, hitList in boards:
+      event = event + [lyr, len(hitList)] + list(hitList)
+    event = degradeEvent(event, max(self.degradeLevel, self.degrade['minLevel']), adc, self.degrade['pmtThreshold'])
+    event = event + list(b'FINI')
+    self.nEvents += 1
+    self.nKept += 1
+    self.tEventBuilt = time.time()
+    self._sendEvent(event)
+
+# Run a run through the emulator and measure how fast the host library reads and decodes the events
+def selftest(seconds):
+  emu = Emulator(rate=2000.)
+  emu.start()
+  PSOC_cmd.openCOM(emu.portName)
+  ser = PSOC_cmd.ser
+  ser.write(PSOC_cmd.mkCmdHdr(0, 0x07, PSOC_cmd.addrEvnt))
+  version = PSOC_cmd.ser.read(9)
+  ok = version[0:4] == bytes([FIX_HEAD, 0, 0xFF, VERSION])
+  cmd = PSOC_cmd.mkCmdHdr(2, 0x3C, PSOC_cmd.addrEvnt) + PSOC_cmd.mkDataByte(0, PSOC_cmd.addrEvnt, 1) + PSOC_cmd.mkDataByte(1, PSOC_cmd.addrEvnt, 2)
+  ser.write(cmd)
+  nEvents = 0
+  nBad = 0
+  tStart = time.time()
+  while time.time() - tStart < seconds:
+    data = PSOC_cmd.readVarReply("selftest")
+    if data[0:4] != b'ZERO' or data[-4:] != b'FINI':
+      nBad += 1
+      continue
+    iPtr = 52
+    for brd in range(data[51]):
+      nBytes = data[iPtr+1]
+      rc = PSOC_cmd.ParseASIChitList(PSOC_cmd.getBinaryString([data[i:i+1] for i in range(iPtr+2, iPtr+2+nBytes)]), False)
+      if rc[0] != 0: nBad += 1
+      iPtr = iPtr + 2 + nBytes
+    nEvents += 1
+  dt = time.time() - tStart
+  ser.write(PSOC_cmd.mkCmdHdr(0, 0x44, PSOC_cmd.addrEvnt))
+  time.sleep(0.1)
+  ser.reset_input_buffer()
+  # A version request sent while a Tracker image is being sent must be answered before the image is done
+  image = PSOC_cmd.tkrImageNew()
+  for chip in range(50): PSOC_cmd.tkrImageDAC(image, 0, chip % 12, "threshold", 25, "low")
+  imageBytes = image["bytes"]
+  for offset in range(0, len(imageBytes), 13):
+    block = [offset >> 8, offset & 0xFF] + list(imageBytes[offset:offset+13])
+    ser.write(PSOC_cmd.mkCmdHdr(len(block), 0x4A, PSOC_cmd.addrEvnt, 1) +
+              b''.join(PSOC_cmd.mkDataByte(block[i], PSOC_cmd.addrEvnt, i+1) for i in range(len(block))))
+    ser.read(9)
+  crc = PSOC_cmd.crc16(imageBytes)
+  ser.write(PSOC_cmd.mkCmdHdr(2, 0x4B, PSOC_cmd.addrEvnt) + PSOC_cmd.mkDataByte(crc >> 8, PSOC_cmd.addrEvnt, 1) +
+            PSOC_cmd.mkDataByte(crc & 0xFF, PSOC_cmd.addrEvnt, 2) + PSOC_cmd.mkCmdHdr(0, 0x07, PSOC_cmd.addrEvnt))
+  imageOK = ser.read(9)[0:4] == bytes([FIX_HEAD, 0, 0xFF, VERSION]) and PSOC_cmd.readVarReply("selftest")[0:2] == bytes([0, 50])
+  PSOC_cmd.closeCOM()
+  emu.stop()
+  print("selftest: version reply " + ("good" if ok else "BAD") + ", host decoded " + str(nEvents) + " events in " + str(round(dt, 2)) +
+        " s = " + str(round(nEvents/dt, 1)) + " events/s, " + str(nBad) + " bad; emulator sent " + str(emu.nEvents) + " events; " +
+        "version reply during a Tracker image " + ("good" if imageOK else "BAD"))
+  return ok and nBad == 0 and imageOK
+
+if __name__ == "__main__":
+  if len(sys.argv) > 1 and sys.argv[1] == "selftest":
+    passed = selftest(float(sys.argv[2]) if len(sys.argv) > 2 else 2.)
+    print("selftest: " + ("passed" if passed else "FAILED"))
+  else:
+    emu = Emulator(rate=float(sys.argv[1]) if len(sys.argv) > 1 else 100.)
+    emu.start()
+    print("Event PSOC emulator on " + emu.portName + ", event rate " + str(emu.rate) + " Hz. Ctrl-C to stop.")
+    try:
+      while True:
+        time.sleep(10.)
+        print("  commands= " + str(emu.nCommands) + ", events= " + str(emu.nEvents) + ", bytes out= " + str(emu.nBytesOut))
+    except KeyboardInterrupt:
+      emu.stop()
@@ -0,0 +1,165 @@
+# Online monitoring of a run while it is being taken. Feed every event record to OnlineMonitor.update();
+# each update takes a fixed amount of work, whatever the length of the run, and keeps
+#   - trigger rates per trgStatus bit over a sliding time window
+#   - the live-time fraction over the same window, from the accepted (event number) and generated (cntGO1) counts
+#   - pulse-height histograms of the six PMT channels, and a histogram of the TOF dtmin
+#   - the fraction of events with hits in each tracker layer
+#   - the number of events sent at each content level, which the event PSOC raises when its output backs up
+# snapshot() returns all of it as a dictionary, which can be written to a file periodically (writeSnapshots)
+# or served to anyone who connects to a local TCP port (serve).
+#
+# Usage:
+#   mon = OnlineMonitor(window=10.)
+#   mon.serve(5555)                      # then e.g. "nc localhost 5555" for the current snapshot
+#   limitedRun(123, 100000, monitor=mon)
+# or, to look at a run file after the fact: python3 PSOC_monitor.py run123.aeso
+import os
+import sys
+import json
+import time
+import threading
+import socketserver
+from collections import deque
+import numpy as np
+from PSOC_runfile import decodeEvent
+
+TRIGGER_BITS = ['PMT primary', 'PMT secondary', 'tracker-0', 'tracker-1', 'guard']
+PHA_CHANNELS = ['T1', 'T2', 'T3', 'T4', 'G', 'Ex']
+PHA_BINS = 128           # of 32 ADC counts each, for the 12-bit ADCs
+TOF_BINS = 100
+TOF_RANGE = 1000         # dtmin histogram from -TOF_RANGE to TOF_RANGE
+TOF_NONE = 32767         # dtmin when no TOF hits were matched to the event
+N_LAYERS = 8
+N_CONTENT_LEVELS = 4
+TICKS_PER_SECOND = 200   # the event time stamp counts 5 ms ticks
+
+class OnlineMonitor:
+  # window: length in seconds of the sliding window for the rates and the live time
+  def __init__(self, window=10.):
+    self.window = window
+    self.reset()
+    self.lock = threading.Lock()
+    self.snapshotFile = None
+    self.snapshotInterval = 5.
+    self.nextWrite = 0.
+    self.server = None
+
+  def reset(self):
+    self.nEvents = 0
+    self.nBad = 0
+    self.recent = deque()                          # (time, trgStatus, event number, cntGO1) inside the window
+    self.bitCount = [0]*len(TRIGGER_BITS)          # events inside the window with each trigger bit set
+    self.bitTotal = [0]*len(TRIGGER_BITS)
+    self.pha = np.zeros((len(PHA_CHANNELS), PHA_BINS), dtype=np.int64)
+    self.tof = np.zeros(TOF_BINS, dtype=np.int64)
+    self.nTof = 0
+    self.layerHits = np.zeros(N_LAYERS, dtype=np.int64)
+    self.levelCount = [0]*N_CONTENT_LEVELS
+    self.run = None
+    self.lastEvent = None
+
+  def update(self, data):
+    evt = decodeEvent(data)
+    with self.lock:
+      if evt is None:
+        self.nBad += 1
+        return
+      self.nEvents += 1
+      self.run = evt['run']
+      self.lastEvent = evt['event']
+      t = evt['timeStamp']/TICKS_PER_SECOND
+      status = evt['trgStatus']
+      self.recent.append((t, status, evt['event'], evt['cntGO1']))
+      for bit in range(len(TRIGGER_BITS)):
+        if status & (1 << bit):
+          self.bitCount[bit] += 1
+          self.bitTotal[bit] += 1
+      while self.recent[0][0] < t - self.window or self.recent[0][0] > t:   # old, or a time stamp reset
+        old = self.recent.popleft()
+        for bit in range(len(TRIGGER_BITS)):
+          if old[1] & (1 << bit): self.bitCount[bit] -= 1
+      for ch, name in enumerate(PHA_CHANNELS):
+        self.pha[ch, min(evt[name] >> 5, PHA_BINS-1)] += 1
+      if evt['dtmin'] != TOF_NONE:
+        self.nTof += 1
+        self.tof[min(max((evt['dtmin'] + TOF_RANGE)*TOF_BINS//(2*TOF_RANGE), 0), TOF_BINS-1)] += 1
+      for brd, hitList in evt['boards']:
+        if len(hitList) > 3 and (hitList[3] >> 4) > 0 and brd < N_LAYERS:    # number of chips with hits
+          self.layerHits[brd] += 1
+      for brd, nChips, nClust in evt.get('layerSummary', []):      # level-3 events only summarize each board
+        if nChips > 0 and brd < N_LAYERS:
+          self.layerHits[brd] += 1
+      self.levelCount[evt['level']] += 1
+    if self.snapshotFile is not None: self._maybeWrite()
+
+  def snapshot(self):
+    with self.lock:
+      first = self.recent[0] if len(self.recent) > 0 else None
+      last = self.recent[-1] if len(self.recent) > 0 else None
+      span = max(last[0] - first[0], 1./TICKS_PER_SECOND) if first is not None else 0.
+      live = None
+      if first is not None and last[3] != first[3]:
+        live = (last[2] - first[2])/float(last[3] - first[3])
+      return {
+        'time': time.time(),
+        'run': self.run,
+        'events': self.nEvents,
+        'badRecords': self.nBad,
+        'lastEvent': self.lastEvent,
+        'window': round(span, 3),
+        'rate': round(len(self.recent)/span, 2) if span > 0 else 0.,
+        'triggerRates': {name: round(self.bitCount[bit]/span, 2) if span > 0 else 0. for bit, name in enumerate(TRIGGER_BITS)},
+        'triggerTotals': dict(zip(TRIGGER_BITS, self.bitTotal)),
+        'liveFraction': round(live, 4) if live is not None else None,
+        'pha': {name: self.pha[ch].tolist() for ch, name in enumerate(PHA_CHANNELS)},
+        'phaBinWidth': 32,
+        'tof': self.tof.tolist(),
+        'tofRange': [-TOF_RANGE, TOF_RANGE],
+        'tofEntries': self.nTof,
+        'layerOccupancy': (self.layerHits/max(self.nEvents, 1)).round(4).tolist(),
+        'contentLevels': list(self.levelCount),
+      }
+
+  # Write the snapshot to a file every 'interval' seconds, replacing the previous one in a single step
+  def writeSnapshots(self, fileName, interval=5.):
+    self.snapshotFile = fileName
+    self.snapshotInterval = interval
+
+  def _maybeWrite(self):
+    if self.snapshotFile is None or time.time() < self.nextWrite: return
+    self.nextWrite = time.time() + self.snapshotInterval
+    with open(self.snapshotFile + '.tmp', 'w') as f:
+      json.dump(self.snapshot(), f)
+    os.replace(self.snapshotFile + '.tmp', self.snapshotFile)
+
+  # Send the current snapshot, as one line of JSON, to every client that connects to the given local port
+  def serve(self, port):
+    monitor = self
+    class Handler(socketserver.StreamRequestHandler):
+      def handle(self):
+        self.wfile.write((json.dumps(monitor.snapshot()) + "\n").encode())
+    self.server = socketserver.ThreadingTCPServer(('localhost', port), Handler)
+    self.server.daemon_threads = True
+    threading.Thread(target=self.server.serve_forever, daemon=True).start()
+
+  def close(self):
+    if self.server is not None:
+      self.server.shutdown()
+      self.server.server_close()
+      self.server = None
+
+if __name__ == "__main__":
+  if len(sys.argv) < 2:
+    print("usage: python3 PSOC_monitor.py <run file> [window in seconds]")
+    sys.exit(1)
+  from PSOC_runfile import RunReader
+  mon = OnlineMonitor(float(sys.argv[2]) if len(sys.argv) > 2 else 10.)
+  reader = RunReader(sys.argv[1])
+  tStart = time.time()
+  for data in reader.events(): mon.update(data)
+  dt = time.time() - tStart
+  snap = mon.snapshot()
+  print(sys.argv[1] + ": " + str(snap['events']) + " events monitored in " + str(round(dt, 2)) + " s (" +
+        str(round(1.e6*dt/max(snap['events'], 1), 1)) + " us per event)")
+  for key in ['rate', 'triggerRates', 'liveFraction', 'layerOccupancy', 'tofEntries', 'contentLevels']:
+    print("  " + key + ": " + str(snap[key]))
@@ -0,0 +1,152 @@
+# Tracker occupancy analysis of a whole run, from the columns made by PSOC_columns.py: strip occupancy maps
+# per layer, noisy strips, cluster width distributions, and the tkrSetDataMask/tkrSetTriggerMask commands
+# that would mask the noisy strips. Everything is done with numpy on the flat cluster arrays, not event by event.
+#
+# Channels are numbered as in the ASIC hit lists and the mask commands: chip 0-11, channel 0-63 of the chip.
+# Strips across a layer are numbered as in ParseASIChitList, strip = 64*(chip+1) - 1 - channel.
+#
+# Usage:
+#   col = loadRun("run123.aeso")                  # a run file, or columns exported by PSOC_columns.py
+#   occ = occupancyMap(col)                       # [layer, chip, channel], fraction of events with the channel hit
+#   noisy = noisyChannels(occ, factor=10., minOccupancy=0.01)
+#   for FPGA, chip, items in maskCommands(noisy): tkrSetDataMask(FPGA, chip, "mask", items)
+#   python3 PSOC_occupancy.py run123.aeso [masks.py]
+import sys
+import numpy as np
+import PSOC_columns
+
+N_LAYERS = 8
+N_CHIPS = 12
+N_CHANNELS = 64
+MAX_MASK_ITEMS = 5      # channel ranges per tkrSetDataMask/tkrSetTriggerMask command
+
+def loadRun(name):
+  if name.endswith('.aeso'):
+    reader = PSOC_columns.RunReader(name)
+    col = PSOC_columns.runColumns(reader)
+    reader.close()
+    return col
+  return PSOC_columns.loadColumns(name)
+
+# Index of the event that each cluster belongs to
+def clusterEvents(col):
+  return np.repeat(np.arange(len(col['event'])), np.diff(col['clusterOffset']))
+
+# Mask of the clusters to use: by default only those from events in which every hit list was intact
+def goodClusters(col, requireOK=True):
+  good = (col['clusterLayer'] < N_LAYERS) & (col['clusterChip'] < N_CHIPS)
+  if requireOK:
+    boardEvents = np.repeat(np.arange(len(col['event'])), np.diff(col['boardOffset']))
+    nBad = np.bincount(boardEvents, weights=~col['boardOK'], minlength=len(col['event']))
+    good &= nBad[clusterEvents(col)] == 0
+  return good
+
+# Number of events in which each channel was hit, as an array [layer, chip, channel]
+def hitCounts(col, requireOK=True):
+  good = goodClusters(col, requireOK)
+  layer = col['clusterLayer'][good].astype(np.int64)
+  chip = col['clusterChip'][good].astype(np.int64)
+  first = col['clusterFirst'][good].astype(np.int64)
+  width = col['clusterWidth'][good].astype(np.int64)
+  # Expand every cluster into its channels
+  cluster = np.repeat(np.arange(len(width)), width)
+  channel = first[cluster] + np.arange(len(cluster)) - np.repeat(np.cumsum(width) - width, width)
+  inChip = channel < N_CHANNELS
+  index = (layer[cluster]*N_CHIPS + chip[cluster])*N_CHANNELS + channel
+  counts = np.bincount(index[inChip], minlength=N_LAYERS*N_CHIPS*N_CHANNELS)
+  return counts.reshape(N_LAYERS, N_CHIPS, N_CHANNELS)
+
+# Only events with their hit lists count: those sent at content level 3 carry just a summary of each board
+def occupancyMap(col, requireOK=True):
+  nEvents = np.count_nonzero(col['level'] < 3) if 'level' in col else len(col['event'])
+  return hitCounts(col, requireOK)/max(nEvents, 1)
+
+# The same map as [layer, strip], with the strips in order across the layer
+def stripMap(channelMap):
+  return channelMap[:, :, ::-1].reshape(channelMap.shape[0], N_CHIPS*N_CHANNELS)
+
+# Channels whose occupancy is above both minOccupancy and factor times the median of the layer.
+# Returns a list of (layer, chip, channel, occupancy), noisiest first.
+def noisyChannels(occ, factor=10., minOccupancy=0.01):
+  median = np.median(occ.reshape(occ.shape[0], -1), axis=1)
+  limit = np.maximum(minOccupancy, factor*median)[:, None, None]
+  layer, chip, channel = np.nonzero(occ > limit)
+  order = np.argsort(-occ[layer, chip, channel], kind='stable')
+  return [(int(layer[i]), int(chip[i]), int(channel[i]), float(occ[layer[i], chip[i], channel[i]])) for i in order]
+
+# Histogram of the cluster widths in each layer: [layer, width], widths 0 to 64 (0 is never filled)
+def clusterWidths(col, requireOK=True):
+  good = goodClusters(col, requireOK)
+  index = col['clusterLayer'][good].astype(np.int64)*(N_CHANNELS+1) + np.minimum(col['clusterWidth'][good], N_CHANNELS)
+  return np.bincount(index, minlength=N_LAYERS*(N_CHANNELS+1)).reshape(N_LAYERS, N_CHANNELS+1)
+
+# Number of clusters per event in each layer: [event, layer]
+def clustersPerLayer(col, requireOK=True):
+  good = goodClusters(col, requireOK)
+  index = clusterEvents(col)[good]*N_LAYERS + col['clusterLayer'][good]
+  return np.bincount(index, minlength=len(col['event'])*N_LAYERS).reshape(len(col['event']), N_LAYERS)
+
+# Group noisy channels into the argument lists of tkrSetDataMask/tkrSetTriggerMask: a list of
+# (FPGA, chip, [[number of channels, first channel], ...]) with at most 5 ranges per command.
+# The FPGA address of a layer is the layer number, as in the commands sent by testMain.py.
+def maskCommands(noisy):
+  channels = {}
+  for layer, chip, channel, occupancy in noisy:
+    channels.setdefault((layer, chip), []).append(channel)
+  commands = []
+  for (layer, chip), chans in sorted(channels.items()):
+    items = []
+    for channel in sorted(chans):
+      if len(items) > 0 and items[-1][1] + items[-1][0] == channel: items[-1][0] += 1
+      else: items.append([1, channel])
+    for i in range(0, len(items), MAX_MASK_ITEMS):
+      commands.append((layer, chip, items[i:i+MAX_MASK_ITEMS]))
+  return commands
+
+# Write a script of suggested mask settings, to be reviewed and then run with PSOC_cmd imported.
+# Strips noisy enough to matter for the trigger are masked from the trigger only; the noisiest ones
+# are also masked from the data.
+def writeMaskScript(fileName, dataNoisy, triggerNoisy, comment=""):
+  with open(fileName, 'w') as f:
+    f.write("# Suggested Tracker masks" + (", " + comment if comment != "" else "") + "\n")
+    f.write("# Review before use; run it after openCOM, with the trigger disabled\n")
+    f.write("from PSOC_cmd import *\n\n")
+    for FPGA, chip, items in maskCommands(triggerNoisy):
+      f.write("tkrSetTriggerMask(" + str(FPGA) + ", " + str(chip) + ", \"mask\", " + str(items) + ")\n")
+    for FPGA, chip, items in maskCommands(dataNoisy):
+      f.write("tkrSetDataMask(" + str(FPGA) + ", " + str(chip) + ", \"mask\", " + str(items) + ")\n")
+
+# Print the clusters of one event, layer by layer, with the strip numbers across the layer
+def printEvent(col, i):
+  first, last = col['clusterOffset'][i], col['clusterOffset'][i+1]
+  print("Event " + str(col['event'][i]) + ", trigger status " + hex(col['trgStatus'][i]) + ", " + str(col['nBoards'][i]) + " boards")
+  for layer in range(N_LAYERS):
+    select = np.nonzero(col['clusterLayer'][first:last] == layer)[0] + first
+    if len(select) == 0: continue
+    print("  layer " + str(layer) + ": " + ", ".join("chip " + str(col['clusterChip'][c]) + " strip " +
+          str(round(float(col['clusterStrip'][c]), 1)) + " width " + str(col['clusterWidth'][c]) for c in select))
+
+if __name__ == "__main__":
+  if len(sys.argv) < 2:
+    print("usage: python3 PSOC_occupancy.py <run file or exported columns> [mask script to write]")
+    sys.exit(1)
+  col = loadRun(sys.argv[1])
+  nEvents = len(col['event'])
+  occ = occupancyMap(col)
+  dataNoisy = noisyChannels(occ, factor=20., minOccupancy=0.02)
+  triggerNoisy = noisyChannels(occ, factor=5., minOccupancy=0.005)
+  widths = clusterWidths(col)
+  print(sys.argv[1] + ": " + str(nEvents) + " events, " + str(len(col['clusterLayer'])) + " clusters")
+  for layer in range(N_LAYERS):
+    nClust = widths[layer].sum()
+    if nClust == 0: continue
+    meanWidth = (widths[layer]*np.arange(N_CHANNELS+1)).sum()/nClust
+    print("  layer " + str(layer) + ": mean occupancy " + "{:.2e}".format(occ[layer].mean()) + " per strip, " +
+          "{:.2f}".format(nClust/max(nEvents, 1)) + " clusters per event, mean width " + "{:.2f}".format(meanWidth) +
+          ", widths 1-4: " + str(list(widths[layer][1:5])))
+  print(str(len(triggerNoisy)) + " channels to mask from the trigger, " + str(len(dataNoisy)) + " from the data; noisiest:")
+  for layer, chip, channel, occupancy in triggerNoisy[0:10]:
+    print("  layer " + str(layer) + " chip " + str(chip) + " channel " + str(channel) + ": occupancy " + "{:.3f}".format(occupancy))
+  if len(sys.argv) > 2:
+    writeMaskScript(sys.argv[2], dataNoisy, triggerNoisy, "from " + sys.argv[1] + ", " + str(nEvents) + " events")
+    print("mask commands written to " + sys.argv[2])
@@ -0,0 +1,166 @@
+# Pipelined command interface for the event PSOC.
+# Commands are tagged with a sequence number (1 to 255) that the PSOC echoes in the second byte of
+# every reply packet header, so several commands can be in flight at once and each reply is matched
+# to its command as it arrives, instead of sleeping and reading a fixed-format reply after each command.
+#
+# Usage:
+#   openCOM("COM3")
+#   pipe = CommandPipeline()
+#   f1 = pipe.send(0x07)                # version number
+#   f2 = pipe.send(0x02, [0x01])        # threshold DAC 1
+#   print(f1.result(1.0), f2.result(1.0))
+#   pipe.close()
+import threading
+import queue
+from concurrent.futures import Future, TimeoutError as FutureTimeout
+import PSOC_cmd
+from PSOC_cmd import addrEvnt, mkCmdHdr, mkDataByte, mkBinCmd
+from PSOC_runfile import _psocdecode
+
+FIX_HEAD = 0xDB
+VAR_HEAD = 0xDC
+CMD_ACK = 0xAC
+CMD_NAK = 0xAE
+NO_REPLY = (0x50,)     # event PSOC commands that never reply, even when tagged: they complete once written
+
+class CommandError(Exception):
+  pass
+
+# Incremental decoder of the 9-byte FIX_HEAD/VAR_HEAD packets (output mode 0), also used by PSOC_service.py.
+# feed() returns a list of (header ID, sequence number, data) for every reply or event completed.
+class PacketDecoder:
+  def __init__(self):
+    self.buffer = b''
+    self.var = None         # [sequence number, number of data bytes, data] of a VAR_HEAD reply in progress
+    self.nSkipped = 0
+    self.useNative = _psocdecode is not None
+
+  def feed(self, data):
+    self.buffer += data
+    if self.useNative and self.var is None:
+      out, consumed, skipped = _psocdecode.unpackPackets(self.buffer)
+      self.buffer = self.buffer[consumed:]
+      self.nSkipped += skipped
+      return out
+    out = []
+    while len(self.buffer) >= 9:
+      buf = self.buffer
+      if not (buf[0] in (FIX_HEAD, VAR_HEAD) and buf[2] == 0xFF and buf[6:9] == b'\xFF\x00\xFF'):
+        self.buffer = buf[1:]
+        self.nSkipped += 1
+        continue
+      self.buffer = buf[9:]
+      if self.var is not None:
+        self.var[2] += buf[3:6]
+        if len(self.var[2]) >= self.var[1]:
+          out.append((VAR_HEAD, self.var[0], self.var[2][0:self.var[1]]))
+          self.var = None
+      elif buf[0] == VAR_HEAD:
+        nData = PSOC_cmd.varLength(buf[3:6])
+        if nData == 0: out.append((VAR_HEAD, buf[1], b''))
+        else: self.var = [buf[1], nData, b'']
+      else:
+        out.append((FIX_HEAD, buf[1], buf[3:6]))
+    return out
+
+class CommandPipeline:
+  # port: an open serial port, by default the one opened by PSOC_cmd.openCOM
+  # window: maximum number of commands in flight. The event PSOC buffers 256 command bytes,
+  #         and an ASCII command takes 29 bytes per data byte, so keep this small in ASCII mode.
+  def __init__(self, port=None, window=4):
+    self.ser = port if port is not None else PSOC_cmd.ser
+    self.window = threading.Semaphore(window)
+    self.lock = threading.Lock()
+    self.writeLock = threading.Lock()
+    self.pending = {}                   # sequence number -> [command code, Future]
+    self.nextSeq = 1
+    self.unsolicited = queue.Queue()    # (header ID, data) for untagged replies, events and housekeeping
+    self.running = True
+    self.reader = threading.Thread(target=self._readLoop, daemon=True)
+    self.reader.start()
+
+  # Send a command and return a Future that completes with the reply data (b'' for an acknowledgement)
+  def send(self, cmdCode, dataList=[], address=addrEvnt):
+    if address == addrEvnt and cmdCode in NO_REPLY:
+      with self.writeLock:
+        self.ser.write(self._mkCmd(cmdCode, dataList, address, 0))
+      future = Future()
+      future.seq = 0
+      future.set_result(b'')
+      return future
+    self.window.acquire()
+    future = Future()
+    with self.lock:
+      while self.nextSeq in self.pending:
+        self.nextSeq = self.nextSeq % 255 + 1
+      seq = self.nextSeq
+      self.nextSeq = self.nextSeq % 255 + 1
+      future.seq = seq
+      self.pending[seq] = [cmdCode, future]
+    with self.writeLock:
+      self.ser.write(self._mkCmd(cmdCode, dataList, address, seq))
+    return future
+
+  def _mkCmd(self, cmdCode, dataList, address, seq):
+    if PSOC_cmd.cmdFormat == "binary" and address == addrEvnt:
+      return mkBinCmd(cmdCode, address, dataList, seq)
+    cmd = mkCmdHdr(len(dataList), cmdCode, address, seq)
+    for i in range(len(dataList)):
+      cmd = cmd + mkDataByte(dataList[i], address, i+1)
+    return cmd
+
+  # Send a command and wait for its reply
+  def call(self, cmdCode, dataList=[], address=addrEvnt, timeout=2.0):
+    future = self.send(cmdCode, dataList, address)
+    try:
+      return future.result(timeout)
+    except FutureTimeout:
+      self._finish(future.seq)
+      raise
+
+  # Wait for all commands in flight to complete
+  def drain(self, timeout=5.0):
+    with self.lock:
+      futures = [p[1] for p in self.pending.values()]
+    for future in futures:
+      try:
+        future.result(timeout)
+      except CommandError:
+        pass
+
+  def close(self):
+    self.running = False
+    self.reader.join()
+    with self.lock:
+      for seq in list(self.pending):
+        self.pending[seq][1].cancel()
+      self.pending = {}
+
+  def _finish(self, seq):
+    with self.lock:
+      entry = self.pending.pop(seq, None)
+    if entry is not None:
+      self.window.release()
+    return entry
+
+  def _readLoop(self):
+    decoder = PacketDecoder()
+    while self.running:
+      data = self.ser.read(9)
+      if len(data) == 0: continue
+      for id, seq, payload in decoder.feed(data):
+        self._deliver(id, seq, payload)
+
+  def _deliver(self, id, seq, data):
+    entry = None
+    if seq != 0: entry = self._finish(seq)
+    if entry is None:
+      self.unsolicited.put((id, data))
+      return
+    cmdCode, future = entry
+    if id == FIX_HEAD and data[0] == cmdCode and data[1] == CMD_ACK and data[2] == 0:
+      future.set_result(b'')
+    elif id == FIX_HEAD and data[0] == cmdCode and data[1] == CMD_NAK:
+      future.set_exception(CommandError("command " + hex(cmdCode) + " rejected with error code " + str(data[2])))
+    else:
+      future.set_result(data)
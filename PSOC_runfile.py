@@ -0,0 +1,318 @@
+# Binary run files: every event record from a run stored verbatim, as the event PSOC sent it, so that
+# nothing is lost between data taking and analysis (limitedRun's text file keeps only a few fields).
+#
+# File layout, all integers little endian:
+#   header   "AESORUN1", version (2), run number (2), start time (8, float seconds since 1970),
+#            index interval (4), config length (4), config snapshot (JSON text)
+#   records  length (4), type (1), host receive time (8, float), data (length bytes)
+#   index    "AESOIDX1", number of records (8), file offset of every index-interval'th record (8 each)
+#   trailer  file offset of the index (8), "AESOEND1"
+# The index and trailer are written by close(). A file without them (a crashed run) is still readable:
+# the reader then builds the index by walking the records.
+#
+# Usage:
+#   with RunWriter("run123.aeso", 123, {"thresholds": [...]}) as w:
+#     w.write(eventBytes)
+#   r = RunReader("run123.aeso")
+#   print(len(r), r.config)
+#   data = r[100000]            # random access through a memory map
+#   for data in r.events(): evt = decodeEvent(data)
+import sys
+import json
+import mmap
+import struct
+import time
+try:
+  import _psocdecode      # compiled decoders, built with "python3 setup.py build_ext --inplace"
+except ImportError:
+  _psocdecode = None
+
+MAGIC = b'AESORUN1'
+INDEX_MAGIC = b'AESOIDX1'
+END_MAGIC = b'AESOEND1'
+VERSION = 1
+INDEX_INTERVAL = 64   # records between index entries
+
+REC_EVENT = 0       # event record, "ZERO" ... "FINI"
+REC_OTHER = 1       # any other reply kept with the run, for example the end-of-run summary
+
+EVT_FLAG_L2_FAIL = 0x01   # event flags: failed the level-2 filter, sent as part of the prescaled sample
+EVT_DEGRADE_SHIFT = 1     # event flags, bits 1-2: content level, raised by the firmware when its output backs up
+EVT_DEGRADE_MASK = 0x06
+N_PMT_CH = 6
+
+HEADER = struct.Struct('<8sHHdII')
+RECORD = struct.Struct('<IBd')
+TRAILER = struct.Struct('<Q8s')
+
+class RunWriter:
+  def __init__(self, fileName, runNumber, config={}, indexInterval=INDEX_INTERVAL):
+    self.f = open(fileName, 'wb')
+    self.runNumber = runNumber
+    self.indexInterval = indexInterval
+    self.nRecords = 0
+    self.index = []
+    configText = json.dumps(config).encode()
+    self.f.write(HEADER.pack(MAGIC, VERSION, runNumber, time.time(), indexInterval, len(configText)))
+    self.f.write(configText)
+    self.offset = HEADER.size + len(configText)
+
+  def write(self, data, type=REC_EVENT, hostTime=None):
+    if self.nRecords % self.indexInterval == 0: self.index.append(self.offset)
+    if hostTime is None: hostTime = time.time()
+    self.f.write(RECORD.pack(len(data), type, hostTime))
+    self.f.write(data)
+    self.offset += RECORD.size + len(data)
+    self.nRecords += 1
+
+  def close(self):
+    if self.f is None: return
+    self.f.write(INDEX_MAGIC + struct.pack('<Q', self.nRecords))
+    self.f.write(struct.pack('<' + str(len(self.index)) + 'Q', *self.index))
+    self.f.write(TRAILER.pack(self.offset, END_MAGIC))
+    self.f.close()
+    self.f = None
+
+  def __enter__(self):
+    return self
+
+  def __exit__(self, *args):
+    self.close()
+
+class RunReader:
+  def __init__(self, fileName):
+    self.f = open(fileName, 'rb')
+    self.map = mmap.mmap(self.f.fileno(), 0, access=mmap.ACCESS_READ)
+    magic, self.version, self.runNumber, self.startTime, self.indexInterval, nConfig = HEADER.unpack_from(self.map, 0)
+    if magic != MAGIC:
+      raise IOError("RunReader: " + fileName + " is not a run file")
+    self.config = json.loads(bytes(self.map[HEADER.size:HEADER.size+nConfig]))
+    self.firstRecord = HEADER.size + nConfig
+    if not self._readIndex(): self._buildIndex()
+
+  def _readIndex(self):
+    if len(self.map) < self.firstRecord + TRAILER.size: return False
+    indexOffset, magic = TRAILER.unpack_from(self.map, len(self.map) - TRAILER.size)
+    if magic != END_MAGIC or self.map[indexOffset:indexOffset+8] != INDEX_MAGIC: return False
+    self.nRecords = struct.unpack_from('<Q', self.map, indexOffset+8)[0]
+    nIndex = (self.nRecords + self.indexInterval - 1) // self.indexInterval
+    self.index = list(struct.unpack_from('<' + str(nIndex) + 'Q', self.map, indexOffset+16))
+    self.endOfRecords = indexOffset
+    return True
+
+  # No index at the end of the file: walk the records, stopping at the first incomplete one
+  def _buildIndex(self):
+    self.index = []
+    self.nRecords = 0
+    offset = self.firstRecord
+    while offset + RECORD.size <= len(self.map):
+      nData = RECORD.unpack_from(self.map, offset)[0]
+      if offset + RECORD.size + nData > len(self.map): break
+      if self.nRecords % self.indexInterval == 0: self.index.append(offset)
+      offset += RECORD.size + nData
+      self.nRecords += 1
+    self.endOfRecords = offset
+
+  def __len__(self):
+    return self.nRecords
+
+  # File offset of record i
+  def offset(self, i):
+    if i < 0: i += self.nRecords
+    if i < 0 or i >= self.nRecords: raise IndexError("RunReader: record " + str(i) + " out of range")
+    offset = self.index[i // self.indexInterval]
+    for j in range(i % self.indexInterval):
+      offset += RECORD.size + RECORD.unpack_from(self.map, offset)[0]
+    return offset
+
+  # Return (type, host receive time, data) of the record at the given file offset, and the offset of the next one
+  def recordAt(self, offset):
+    nData, type, hostTime = RECORD.unpack_from(self.map, offset)
+    start = offset + RECORD.size
+    return (type, hostTime, memoryview(self.map)[start:start+nData]), start + nData
+
+  def record(self, i):
+    return self.recordAt(self.offset(i))[0]
+
+  # Data of record i, without copying
+  def __getitem__(self, i):
+    return self.record(i)[2]
+
+  # Iterate over the records from record 'first' on, yielding (type, host time, data)
+  def records(self, first=0):
+    if first >= self.nRecords: return
+    offset = self.offset(first)
+    while offset < self.endOfRecords:
+      rec, offset = self.recordAt(offset)
+      yield rec
+
+  def events(self, first=0):
+    for type, hostTime, data in self.records(first):
+      if type == REC_EVENT: yield data
+
+  def close(self):
+    self.map.close()
+    self.f.close()
+
+# Decode an event record, following the event builder layout in DAQ.cydsn/main.c.
+# Returns a dictionary, with the tracker hit lists as a list of (board, hit list bytes), or None if the
+# record is not a complete event. Events sent at a reduced content level are decoded too, with the level in
+# 'level', None for the TOF debug fields left out, and at level 3 the boards in 'layerSummary' instead.
+def decodeEvent(data):
+  if len(data) < 41 or bytes(data[0:4]) != b'ZERO' or bytes(data[-4:]) != b'FINI': return None
+  level = eventLevel(data)
+  summary = layerSummary(data) if level == 3 else None
+  data = expandEvent(data)
+  if data is None or len(data) < 56: return None
+  evt = {}
+  evt['run'], evt['event'], evt['timeStamp'], evt['cntGO1'], evt['timeWord'], evt['trgStatus'] = struct.unpack_from('>HIIIIB', data, 4)
+  evt['T1'], evt['T2'], evt['T3'], evt['T4'], evt['G'], evt['Ex'], evt['dtmin'] = struct.unpack_from('>6Hh', data, 23)
+  evt['tkrTrgCount'], evt['tkrCmdCount'], evt['tkrTrgPattern'], evt['nTOFA'], evt['nTOFB'] = struct.unpack_from('>HBBBB', data, 37)
+  evt['tofA'], evt['tofB'], evt['clkA'], evt['clkB'] = struct.unpack_from('>4H', data, 43)
+  evt['flags'] = evt['tkrTrgPattern'] & 0x3F     # event flags share byte 40 with the tracker trigger pattern
+  evt['tkrTrgPattern'] &= 0xC0
+  nBoards = data[51]
+  boards = []
+  iPtr = 52
+  for brd in range(nBoards):
+    if iPtr + 2 > len(data) - 4: return None
+    nBytes = data[iPtr+1]
+    boards.append((data[iPtr], bytes(data[iPtr+2:iPtr+2+nBytes])))
+    iPtr += 2 + nBytes
+  if iPtr != len(data) - 4: return None
+  evt['boards'] = boards
+  evt['level'] = level
+  if level >= 1: evt['tofA'] = evt['tofB'] = evt['clkA'] = evt['clkB'] = None
+  if level == 3:      # the hit lists were replaced by (layer, chips hit, clusters)
+    evt['boards'] = []
+    evt['layerSummary'] = summary
+  return evt
+
+# Content level of an event record, set by the firmware when its output backs up (see degradeEvent in
+# DAQ.cydsn/main.c). Bytes 0-22 and 35-42 are always where they are at level 0; byte 40 carries the level.
+#   1: no TOF debug fields: the tracker data follow from byte 43
+#   2: also, the PMT pulse heights zero suppressed: a byte with a bit for each channel sent, then their pulse
+#      heights. This tail, and the tracker data after it, fills bytes 23-34 (padded with 0) and goes on from byte 43.
+#   3: also, each tracker board reduced to {layer, chips hit, clusters}
+def eventLevel(data):
+  return (data[40] & EVT_DEGRADE_MASK) >> EVT_DEGRADE_SHIFT if len(data) > 40 else 0
+
+# Split a record of level 2 or 3 into its pulse heights (0 for the channels not sent) and the tracker data that
+# follow them: nBoards, then the boards. Returns (None, None) if the record is too short.
+def _splitTail(data):
+  if len(data) < 47: return None, None
+  tail = bytes(data[23:35]) + bytes(data[43:-4])
+  adc = b''
+  iPtr = 1
+  for ch in range(N_PMT_CH):
+    if tail[0] & (1 << ch):
+      adc += tail[iPtr:iPtr+2]
+      iPtr += 2
+    else: adc += b'\x00\x00'
+  if iPtr >= len(tail): return None, None
+  return adc, tail[iPtr:]
+
+# The tracker data of a record of level 2 or 3 end either at the end of the record, or, in a record of the
+# shortest length, anywhere in bytes 23-34 with zeros after them
+def _tailEnds(data, tkr, iPtr):
+  return iPtr == len(tkr) or (iPtr < len(tkr) and len(data) == 47 and not any(tkr[iPtr:]))
+
+# The (layer, chips hit, clusters) of each board of a level-3 event record, or None if it is malformed
+def layerSummary(data):
+  adc, tkr = _splitTail(data)
+  if tkr is None or not _tailEnds(data, tkr, 1 + 3*tkr[0]): return None
+  return [tuple(tkr[1+3*brd:4+3*brd]) for brd in range(tkr[0])]
+
+# Rewrite an event record sent at a reduced content level in the full layout, so that code reading the fixed
+# offsets can take it: the TOF debug fields and the suppressed pulse heights become 0, and the boards of a
+# level-3 event get empty hit lists. Records at level 0, or that are not events, come back unchanged, and
+# malformed reduced records as None.
+def expandEvent(data):
+  level = eventLevel(data)
+  if level == 0 or bytes(data[0:4]) != b'ZERO': return data
+  if level == 1: return bytes(data[0:43]) + b'\x00'*8 + bytes(data[43:])
+  adc, tkr = _splitTail(data)
+  if tkr is None: return None
+  if level == 3:
+    summary = layerSummary(data)
+    if summary is None: return None
+    tkr = bytes([len(summary)]) + b''.join(bytes([layer, 0]) for layer, nChips, nClust in summary)
+  else:
+    iPtr = 1
+    for brd in range(tkr[0]):
+      if iPtr + 2 > len(tkr): return None
+      iPtr += 2 + tkr[iPtr+1]
+    if not _tailEnds(data, tkr, iPtr): return None
+    tkr = tkr[0:iPtr]
+  return bytes(data[0:23]) + adc + bytes(data[35:43]) + b'\x00'*8 + tkr + b'FINI'
+
+# CRC of the tracker hit lists, key 1100101, computed the same way as CRC6 in PSOC_cmd.py
+def crc6(value):
+  while value.bit_length() > 6:
+    value ^= 0x65 << (value.bit_length() - 7)
+  return value
+
+# Decode a tracker ASIC hit list (see ParseASIChitList in PSOC_cmd.py).
+# Returns (FPGA address, event tag, list of clusters as (chip, first strip, width), ok), where ok is False
+# if the identifier, the length, the CRC or the trailing bits are wrong.
+def pyDecodeHitList(hitList):
+  nBits = 8*len(hitList)
+  if nBits < 40: return (0, 0, [], False)
+  value = int.from_bytes(hitList, 'big')
+  def bits(pointer, n):
+    return (value >> (nBits - pointer - n)) & ((1 << n) - 1)
+  fpga = bits(9, 7)
+  tag = bits(16, 7)
+  nChips = bits(24, 4)
+  ok = bits(0, 8) == 0xE7
+  clusters = []
+  pointer = 28
+  for chip in range(nChips):
+    if pointer + 12 > nBits:
+      return (fpga, tag, clusters, False)
+    nClust = bits(pointer+2, 4)
+    address = bits(pointer+8, 4)
+    pointer += 12
+    if pointer + 12*nClust > nBits:
+      return (fpga, tag, clusters, False)
+    for clust in range(nClust):
+      clusters.append((address, bits(pointer+6, 6), bits(pointer, 6) + 1))
+      pointer += 12
+  if pointer + 8 > nBits: return (fpga, tag, clusters, False)
+  ok = ok and bits(pointer, 6) == crc6((1 << pointer) | bits(0, pointer)) and bits(pointer+6, 2) == 3
+  return (fpga, tag, clusters, ok)
+
+decodeHitList = _psocdecode.decodeHitList if _psocdecode is not None else pyDecodeHitList
+
+# Write a synthetic run, then check sequential and random access to it
+def selftest(fileName, nEvents):
+  import random
+  def mkEvent(n):
+    boards = b''
+    for brd in range(n % 9):
+      boards += bytes([brd, 4, 0xE7, brd, n & 0xFF, 0x03])
+    return (b'ZERO' + struct.pack('>HIIIIB6HhHBBBB4H', 7, n, 200*n, n+1, 0, 0x01, 1, 2, 3, 4, 5, 6, -5, n & 0xFFFF, 1, 0xC0, 1, 1, 0, 0, 0, 0)
+            + bytes([n % 9]) + boards + b'FINI')
+  tStart = time.time()
+  with RunWriter(fileName, 7, {"selftest": True}) as w:
+    for n in range(nEvents): w.write(mkEvent(n))
+  tWrite = time.time() - tStart
+  r = RunReader(fileName)
+  tStart = time.time()
+  nBad = sum(1 for n, data in enumerate(r.events()) if decodeEvent(data)['event'] != n)
+  tRead = time.time() - tStart
+  tStart = time.time()
+  picks = [random.randrange(nEvents) for i in range(1000)]
+  nBad += sum(1 for n in picks if decodeEvent(r[n])['event'] != n or len(decodeEvent(r[n])['boards']) != n % 9)
+  tSeek = (time.time() - tStart)/len(picks)
+  r.close()
+  print("selftest: " + str(nEvents) + " events written in " + str(round(tWrite, 2)) + " s, read and decoded in " +
+        str(round(tRead, 2)) + " s, " + str(round(tSeek*1.e6, 1)) + " us per random access: " + ("passed" if nBad == 0 else "FAILED"))
+
+if __name__ == "__main__":
+  if len(sys.argv) > 1 and sys.argv[1] == "selftest":
+    selftest(sys.argv[2] if len(sys.argv) > 2 else "selftest.aeso", int(sys.argv[3]) if len(sys.argv) > 3 else 100000)
+  elif len(sys.argv) > 1:
+    r = RunReader(sys.argv[1])
+    print(sys.argv[1] + ": run " + str(r.runNumber) + ", " + str(len(r)) + " records, started " + time.ctime(r.startTime))
+    print("config: " + json.dumps(r.config))
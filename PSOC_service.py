@@ -0,0 +1,233 @@
+# Asynchronous acquisition service for several DAQ boards at once.
+# Each serial port (for example the event PSOC USB-UART of two boards, or the main PSOC) gets its own reader
+# task that decodes the output framing and sorts what arrives into command replies, events and housekeeping,
+# so commands to one port, event streams from all of them and housekeeping can all be in flight together
+# from one process. Commands to the event PSOC are tagged with a sequence number and matched to their replies
+# by it (as in PSOC_pipeline.py); untagged replies, as from the main PSOC, go to the oldest untagged command.
+#
+# Usage:
+#   svc = AcquisitionService()
+#   svc.addPort("board1", serial.Serial("/dev/ttyACM0", 115200, timeout=.2))
+#   svc.addPort("board2", serial.Serial("/dev/ttyACM1", 115200, timeout=.2))
+#   async def main():
+#     await svc.start()
+#     version = await svc.call("board1", 0x07)
+#     async for data in svc.events("board2"): ...
+#     await svc.stop()
+#   asyncio.run(main())
+import sys
+import time
+import asyncio
+import PSOC_cmd
+from PSOC_cmd import addrEvnt, mkCmdHdr, mkDataByte, mkBinCmd
+from PSOC_pipeline import CMD_ACK, CMD_NAK, NO_REPLY, CommandError, PacketDecoder
+from PSOC_bulk import BULK_HEAD, BulkReader
+
+# Bulk records {0xDD, sequence number, length (2), data} (output mode 2), parsed by PSOC_bulk.BulkReader
+class BulkDecoder(BulkReader):
+  def __init__(self):
+    BulkReader.__init__(self, None)
+
+  def feed(self, data):
+    return [(BULK_HEAD, seq, record) for seq, record in BulkReader.feed(self, data)]
+
+class PortStats:
+  def __init__(self):
+    self.tStart = time.time()
+    self.bytesIn = 0
+    self.bytesOut = 0
+    self.nCommands = 0
+    self.nReplies = 0
+    self.nEvents = 0
+    self.nHousekeeping = 0
+    self.nUnmatched = 0       # replies that no command was waiting for
+    self.nDropped = 0         # events and housekeeping lost because nobody was reading them
+
+  def summary(self):
+    dt = max(time.time() - self.tStart, 1.e-6)
+    return {'seconds': round(dt, 1), 'kBin/s': round(self.bytesIn/dt/1000., 2), 'kBout/s': round(self.bytesOut/dt/1000., 2),
+            'events/s': round(self.nEvents/dt, 1), 'commands': self.nCommands, 'replies': self.nReplies,
+            'events': self.nEvents, 'housekeeping': self.nHousekeeping, 'unmatched': self.nUnmatched, 'dropped': self.nDropped}
+
+class Port:
+  def __init__(self, name, ser, address, mode, queueLength):
+    self.name = name
+    self.ser = ser
+    self.address = address
+    self.decoder = BulkDecoder() if mode == "bulk" else PacketDecoder()
+    self.queueLength = queueLength
+    self.stats = PortStats()
+    self.pending = {}         # sequence number -> [command code, Future]
+    self.untagged = []        # [command code, Future] of commands sent without a sequence number, oldest first
+    self.nextSeq = 1
+    self.task = None
+
+  def _queue(self, queue, data):
+    if queue.full():
+      queue.get_nowait()
+      self.stats.nDropped += 1
+    queue.put_nowait(data)
+
+  def _deliver(self, id, seq, data):
+    if data[0:4] == b'ZERO' and data[-4:] == b'FINI':
+      self.stats.nEvents += 1
+      self._queue(self.events, data)
+      return
+    if len(data) > 6 and data[1] == 0xC7:
+      self.stats.nHousekeeping += 1
+      self._queue(self.housekeeping, data)
+      return
+    entry = self.pending.pop(seq, None) if seq != 0 else (self.untagged.pop(0) if len(self.untagged) > 0 else None)
+    if entry is None or entry[1].done():
+      self.stats.nUnmatched += 1
+      self._queue(self.unsolicited, (id, data))
+      return
+    self.stats.nReplies += 1
+    cmdCode, future = entry
+    if len(data) == 3 and data[0] == cmdCode and data[1] == CMD_ACK and data[2] == 0:
+      future.set_result(b'')
+    elif len(data) == 3 and data[0] == cmdCode and data[1] == CMD_NAK:
+      future.set_exception(CommandError(self.name + ": command " + hex(cmdCode) + " rejected with error code " + str(data[2])))
+    else:
+      future.set_result(data)
+
+  async def _readLoop(self):
+    loop = asyncio.get_running_loop()
+    while True:
+      data = await loop.run_in_executor(None, lambda: self.ser.read(max(self.ser.in_waiting, 1)))
+      if len(data) == 0: continue
+      self.stats.bytesIn += len(data)
+      for id, seq, payload in self.decoder.feed(data):
+        self._deliver(id, seq, payload)
+
+  def start(self):
+    self.events = asyncio.Queue(self.queueLength)
+    self.housekeeping = asyncio.Queue(self.queueLength)
+    self.unsolicited = asyncio.Queue(self.queueLength)
+    self.task = asyncio.get_running_loop().create_task(self._readLoop())
+
+  async def stop(self):
+    if self.task is None: return
+    self.task.cancel()
+    try:
+      await self.task
+    except asyncio.CancelledError:
+      pass
+    self.task = None
+    for cmdCode, future in list(self.pending.values()) + self.untagged:
+      future.cancel()
+    self.pending = {}
+    self.untagged = []
+
+  async def _send(self, cmdCode, dataList, seq):
+    if PSOC_cmd.cmdFormat == "binary" and self.address == addrEvnt:
+      cmd = mkBinCmd(cmdCode, self.address, dataList, seq)
+    else:
+      cmd = mkCmdHdr(len(dataList), cmdCode, self.address, seq)
+      for i in range(len(dataList)):
+        cmd = cmd + mkDataByte(dataList[i], self.address, i+1)
+    self.stats.nCommands += 1
+    self.stats.bytesOut += len(cmd)
+    await asyncio.get_running_loop().run_in_executor(None, self.ser.write, cmd)
+
+  async def call(self, cmdCode, dataList, timeout):
+    if self.address == addrEvnt and cmdCode in NO_REPLY:
+      await self._send(cmdCode, dataList, 0)
+      return b''
+    future = asyncio.get_running_loop().create_future()
+    if self.address == addrEvnt:
+      while self.nextSeq in self.pending:
+        self.nextSeq = self.nextSeq % 255 + 1
+      seq = self.nextSeq
+      self.nextSeq = self.nextSeq % 255 + 1
+      self.pending[seq] = [cmdCode, future]
+    else:
+      seq = 0
+      self.untagged.append([cmdCode, future])
+    await self._send(cmdCode, dataList, seq)
+    try:
+      return await asyncio.wait_for(future, timeout)
+    except asyncio.TimeoutError:
+      if seq != 0: self.pending.pop(seq, None)
+      else: self.untagged = [entry for entry in self.untagged if entry[1] is not future]
+      raise
+
+class AcquisitionService:
+  def __init__(self):
+    self.ports = {}
+
+  # ser: an open serial port (or anything with read, write and in_waiting)
+  # address: the PSOC that commands on this port go to, addrEvnt or PSOC_cmd.addrMain
+  # mode: "packets" for output modes 0 and 1, "bulk" for output mode 2
+  # queueLength: events and housekeeping records kept for the reader; beyond that the oldest are dropped
+  def addPort(self, name, ser, address=addrEvnt, mode="packets", queueLength=10000):
+    self.ports[name] = Port(name, ser, address, mode, queueLength)
+    return self.ports[name]
+
+  async def start(self):
+    for port in self.ports.values(): port.start()
+
+  async def stop(self):
+    for port in self.ports.values(): await port.stop()
+
+  # Send a command and wait for its reply data (b'' for an acknowledgement)
+  async def call(self, name, cmdCode, dataList=[], timeout=2.0):
+    return await self.ports[name].call(cmdCode, dataList, timeout)
+
+  # Iterate over the events arriving on a port
+  async def events(self, name):
+    queue = self.ports[name].events
+    while True:
+      yield await queue.get()
+
+  async def nextHousekeeping(self, name, timeout=None):
+    return await asyncio.wait_for(self.ports[name].housekeeping.get(), timeout)
+
+  def stats(self):
+    return {name: port.stats.summary() for name, port in self.ports.items()}
+
+  # Print the throughput of every port at regular intervals, and optionally append it to a file
+  async def reportStats(self, interval=10., fileName=None):
+    while True:
+      await asyncio.sleep(interval)
+      line = time.strftime("%H:%M:%S") + " " + str(self.stats())
+      print(line)
+      if fileName is not None:
+        with open(fileName, 'a') as f: f.write(line + "\n")
+
+# Run two emulated boards through the service at once
+async def selftest(seconds):
+  import serial
+  import PSOC_emulator
+  emus = [PSOC_emulator.Emulator(rate=300.), PSOC_emulator.Emulator(rate=500.)]
+  svc = AcquisitionService()
+  for i, emu in enumerate(emus):
+    emu.start()
+    svc.addPort("board" + str(i+1), serial.Serial(emu.portName, 115200, timeout=.05))
+  await svc.start()
+  ok = True
+  for name in svc.ports:
+    version = await svc.call(name, 0x07)
+    ok = ok and version[0] == PSOC_emulator.VERSION
+    await svc.call(name, 0x3C, [0, 1])
+  nEvents = {name: 0 for name in svc.ports}
+  async def count(name):
+    async for data in svc.events(name): nEvents[name] += 1
+  counters = [asyncio.create_task(count(name)) for name in svc.ports]
+  tStart = time.time()
+  while time.time() - tStart < seconds:
+    for name in svc.ports:
+      ok = ok and (await svc.call(name, 0x07))[0] == PSOC_emulator.VERSION   # commands interleaved with events
+    await asyncio.sleep(0.2)
+  for name in svc.ports: await svc.call(name, 0x44)
+  await asyncio.sleep(0.2)
+  for task in counters: task.cancel()
+  await svc.stop()
+  for emu in emus: emu.stop()
+  for name, summary in svc.stats().items(): print(name + ": " + str(summary))
+  ok = ok and all(n > 0 for n in nEvents.values())
+  print("selftest: " + str(nEvents) + " events, " + ("passed" if ok else "FAILED"))
+
+if __name__ == "__main__":
+  if len(sys.argv) > 1 and sys.argv[1] == "selftest":
+    asyncio.run(selftest(float(sys.argv[2]) if len(sys.argv) > 2 else 3.))
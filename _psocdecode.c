@@ -0,0 +1,266 @@
+// Compiled decoders for the host library, used in place of the Python versions when the module has been built:
+//   python3 setup.py build_ext --inplace
+// The Python modules fall back to their own code when it is not there, and give the same results either way.
+//
+//   unpackPackets(buffer)  split a byte stream of 9-byte FIX_HEAD/VAR_HEAD packets into replies
+//                          -> (list of (header ID, sequence number, data), bytes consumed, bytes skipped)
+//   decodeHitList(hitList) decode a tracker ASIC hit list, as PSOC_runfile.decodeHitList
+//                          -> (FPGA, event tag, list of (chip, first strip, width), ok)
+//   decodeEvents(records)  decode a sequence of event records into columns, for PSOC_columns.runColumns
+//                          -> dictionary of bytes objects to be viewed as numpy arrays
+//                          Records of a reduced content level must first be expanded by PSOC_runfile.expandEvent;
+//                          the caller fills in the board summaries of level-3 records.
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <stdint.h>
+#include <string.h>
+
+#define FIX_HEAD 0xDB
+#define VAR_HEAD 0xDC
+#define EVENT_HEADER_LEN 52
+
+static int isPacket(const uint8_t* p) {
+    return (p[0] == FIX_HEAD || p[0] == VAR_HEAD) && p[2] == 0xFF && p[6] == 0xFF && p[7] == 0x00 && p[8] == 0xFF;
+}
+
+// Find the next packet at or after pos, counting the bytes passed over. Returns -1 if there is none yet.
+static Py_ssize_t nextPacket(const uint8_t* buf, Py_ssize_t len, Py_ssize_t pos, Py_ssize_t* nSkipped) {
+    while (pos + 9 <= len) {
+        if (isPacket(buf + pos)) return pos;
+        pos++;
+        (*nSkipped)++;
+    }
+    return -1;
+}
+
+static PyObject* unpackPackets(PyObject* self, PyObject* args) {
+    Py_buffer in;
+    if (!PyArg_ParseTuple(args, "y*", &in)) return NULL;
+    const uint8_t* buf = in.buf;
+    Py_ssize_t len = in.len;
+    PyObject* out = PyList_New(0);
+    Py_ssize_t consumed = 0;
+    Py_ssize_t skipped = 0;
+    uint8_t* data = NULL;
+    while (out != NULL) {
+        Py_ssize_t nSkipped = 0;
+        Py_ssize_t pos = nextPacket(buf, len, consumed, &nSkipped);
+        if (pos < 0) break;
+        PyObject* reply;
+        Py_ssize_t end;
+        if (buf[pos] == FIX_HEAD) {
+            reply = Py_BuildValue("(iiy#)", FIX_HEAD, buf[pos+1], buf + pos + 3, (Py_ssize_t)3);
+            end = pos + 9;
+        } else {
+            // The data follow in further packets; leave the reply in the buffer until all of them are in
+            Py_ssize_t nData = ((Py_ssize_t)buf[pos+4] << 8) | buf[pos+5];
+            if (nData == 0) nData = buf[pos+3];
+            data = PyMem_Realloc(data, nData + 3);
+            Py_ssize_t nGot = 0;
+            end = pos + 9;
+            while (nGot < nData) {
+                Py_ssize_t next = nextPacket(buf, len, end, &nSkipped);
+                if (next < 0) break;
+                memcpy(data + nGot, buf + next + 3, 3);
+                nGot += 3;
+                end = next + 9;
+            }
+            if (nGot < nData) break;
+            reply = Py_BuildValue("(iiy#)", VAR_HEAD, buf[pos+1], data, nData);
+        }
+        if (reply == NULL || PyList_Append(out, reply) < 0) {
+            Py_XDECREF(reply);
+            Py_CLEAR(out);
+            break;
+        }
+        Py_DECREF(reply);
+        consumed = end;
+        skipped += nSkipped;
+    }
+    PyMem_Free(data);
+    PyBuffer_Release(&in);
+    if (out == NULL) return NULL;
+    return Py_BuildValue("(Nnn)", out, consumed, skipped);
+}
+
+// Bits of a hit list, most significant bit of the first byte first
+static uint32_t getBits(const uint8_t* buf, Py_ssize_t pointer, int n) {
+    uint32_t value = 0;
+    for (int i=0; i<n; ++i, ++pointer) {
+        value = (value << 1) | ((buf[pointer >> 3] >> (7 - (pointer & 7))) & 1);
+    }
+    return value;
+}
+
+// CRC6 of a start bit followed by the first nBits of the hit list, key 1100101
+static uint32_t crc6(const uint8_t* buf, Py_ssize_t nBits) {
+    uint32_t rem = 1;
+    for (Py_ssize_t i=0; i<nBits; ++i) {
+        rem = (rem << 1) | ((buf[i >> 3] >> (7 - (i & 7))) & 1);
+        if (rem & 0x40) rem ^= 0x65;
+    }
+    return rem;
+}
+
+struct Cluster {
+    uint8_t chip;
+    uint8_t first;
+    uint8_t width;
+};
+
+#define MAX_HIT_CLUSTERS (15*15)   // 4-bit chip and cluster counts
+
+// Decode a hit list into at most MAX_HIT_CLUSTERS clusters. Returns ok.
+static int parseHitList(const uint8_t* buf, Py_ssize_t len, uint32_t* fpga, uint32_t* tag, struct Cluster* clusters, int* nClusters) {
+    Py_ssize_t nBits = 8*len;
+    *nClusters = 0;
+    *fpga = 0;
+    *tag = 0;
+    if (nBits < 40) return 0;
+    *fpga = getBits(buf, 9, 7);
+    *tag = getBits(buf, 16, 7);
+    int ok = getBits(buf, 0, 8) == 0xE7;
+    uint32_t nChips = getBits(buf, 24, 4);
+    Py_ssize_t pointer = 28;
+    for (uint32_t chip=0; chip<nChips; ++chip) {
+        if (pointer + 12 > nBits) return 0;
+        uint32_t nClust = getBits(buf, pointer+2, 4);
+        uint32_t address = getBits(buf, pointer+8, 4);
+        pointer += 12;
+        if (pointer + 12*(Py_ssize_t)nClust > nBits) return 0;
+        for (uint32_t clust=0; clust<nClust; ++clust) {
+            clusters[*nClusters].chip = address;
+            clusters[*nClusters].first = getBits(buf, pointer+6, 6);
+            clusters[*nClusters].width = getBits(buf, pointer, 6) + 1;
+            (*nClusters)++;
+            pointer += 12;
+        }
+    }
+    if (pointer + 8 > nBits) return 0;
+    return ok && getBits(buf, pointer, 6) == crc6(buf, pointer) && getBits(buf, pointer+6, 2) == 3;
+}
+
+static PyObject* decodeHitList(PyObject* self, PyObject* args) {
+    Py_buffer in;
+    if (!PyArg_ParseTuple(args, "y*", &in)) return NULL;
+    struct Cluster clusters[MAX_HIT_CLUSTERS];
+    int nClusters;
+    uint32_t fpga, tag;
+    int ok = parseHitList(in.buf, in.len, &fpga, &tag, clusters, &nClusters);
+    PyBuffer_Release(&in);
+    PyObject* list = PyList_New(nClusters);
+    if (list == NULL) return NULL;
+    for (int i=0; i<nClusters; ++i) {
+        PyList_SET_ITEM(list, i, Py_BuildValue("(iii)", clusters[i].chip, clusters[i].first, clusters[i].width));
+    }
+    return Py_BuildValue("(IINO)", fpga, tag, list, ok ? Py_True : Py_False);
+}
+
+// Growable array of bytes
+struct Column {
+    char* data;
+    Py_ssize_t len;
+    Py_ssize_t size;
+};
+
+static int append(struct Column* col, const void* data, Py_ssize_t n) {
+    if (col->len + n > col->size) {
+        Py_ssize_t size = col->size > 0 ? 2*col->size : 4096;
+        while (size < col->len + n) size *= 2;
+        char* grown = PyMem_Realloc(col->data, size);
+        if (grown == NULL) return -1;
+        col->data = grown;
+        col->size = size;
+    }
+    memcpy(col->data + col->len, data, n);
+    col->len += n;
+    return 0;
+}
+
+enum { HEADERS, VALID, BOARD_OFFSET, BOARD_LAYER, BOARD_CHIPS, BOARD_CLUSTERS, BOARD_OK, CLUSTER_OFFSET, CLUSTER_LAYER,
+       CLUSTER_CHIP, CLUSTER_FIRST, CLUSTER_WIDTH, N_COLUMNS };
+static const char* columnNames[N_COLUMNS] = { "headers", "valid", "boardOffset", "boardLayer", "boardChips", "boardClusters",
+       "boardOK", "clusterOffset", "clusterLayer", "clusterChip", "clusterFirst", "clusterWidth" };
+
+static PyObject* decodeEvents(PyObject* self, PyObject* args) {
+    PyObject* records;
+    if (!PyArg_ParseTuple(args, "O", &records)) return NULL;
+    PyObject* seq = PySequence_Fast(records, "decodeEvents: expected a sequence of event records");
+    if (seq == NULL) return NULL;
+    struct Column col[N_COLUMNS];
+    memset(col, 0, sizeof(col));
+    int64_t nBoards = 0;
+    int64_t nClustersTotal = 0;
+    int err = append(&col[BOARD_OFFSET], &nBoards, 8) || append(&col[CLUSTER_OFFSET], &nClustersTotal, 8);
+    struct Cluster clusters[MAX_HIT_CLUSTERS];
+    Py_ssize_t n = PySequence_Fast_GET_SIZE(seq);
+    for (Py_ssize_t i=0; i<n && !err; ++i) {
+        Py_buffer in;
+        if (PyObject_GetBuffer(PySequence_Fast_GET_ITEM(seq, i), &in, PyBUF_SIMPLE) < 0) {
+            err = 1;
+            break;
+        }
+        const uint8_t* data = in.buf;
+        Py_ssize_t len = in.len;
+        uint8_t valid = len >= EVENT_HEADER_LEN + 4 && memcmp(data, "ZERO", 4) == 0 && memcmp(data + len - 4, "FINI", 4) == 0;
+        err = append(&col[VALID], &valid, 1);
+        if (valid && !err) {
+            Py_ssize_t iPtr = EVENT_HEADER_LEN;
+            for (int brd=0; brd<data[51] && !err; ++brd) {
+                if (iPtr + 2 > len - 4) break;
+                uint8_t layer = data[iPtr];
+                Py_ssize_t nBytes = data[iPtr+1];
+                if (iPtr + 2 + nBytes > len) nBytes = len - iPtr - 2;
+                uint32_t fpga, tag;
+                int nClusters;
+                uint8_t ok = parseHitList(data + iPtr + 2, nBytes, &fpga, &tag, clusters, &nClusters);
+                uint16_t chips = 0;
+                for (int c=0; c<nClusters; ++c) chips |= 1 << clusters[c].chip;
+                uint8_t nChips = 0;
+                for (; chips; chips &= chips - 1) nChips++;
+                uint8_t nBoardClusters = nClusters;
+                err = append(&col[BOARD_LAYER], &layer, 1) || append(&col[BOARD_CHIPS], &nChips, 1) ||
+                      append(&col[BOARD_CLUSTERS], &nBoardClusters, 1) || append(&col[BOARD_OK], &ok, 1);
+                for (int c=0; c<nClusters && !err; ++c) {
+                    err = append(&col[CLUSTER_LAYER], &layer, 1) || append(&col[CLUSTER_CHIP], &clusters[c].chip, 1) ||
+                          append(&col[CLUSTER_FIRST], &clusters[c].first, 1) || append(&col[CLUSTER_WIDTH], &clusters[c].width, 1);
+                }
+                nBoards++;
+                nClustersTotal += nClusters;
+                iPtr += 2 + nBytes;
+            }
+            err = err || append(&col[HEADERS], data, EVENT_HEADER_LEN) || append(&col[BOARD_OFFSET], &nBoards, 8) ||
+                  append(&col[CLUSTER_OFFSET], &nClustersTotal, 8);
+        }
+        PyBuffer_Release(&in);
+    }
+    Py_DECREF(seq);
+    PyObject* result = NULL;
+    if (!err) {
+        result = PyDict_New();
+        for (int c=0; c<N_COLUMNS && result != NULL; ++c) {
+            PyObject* bytes = PyBytes_FromStringAndSize(col[c].data ? col[c].data : "", col[c].len);
+            if (bytes == NULL || PyDict_SetItemString(result, columnNames[c], bytes) < 0) Py_CLEAR(result);
+            Py_XDECREF(bytes);
+        }
+    } else if (!PyErr_Occurred()) {
+        PyErr_NoMemory();
+    }
+    for (int c=0; c<N_COLUMNS; ++c) PyMem_Free(col[c].data);
+    return result;
+}
+
+static PyMethodDef methods[] = {
+    {"unpackPackets", unpackPackets, METH_VARARGS, "Split a stream of FIX_HEAD/VAR_HEAD packets into replies"},
+    {"decodeHitList", decodeHitList, METH_VARARGS, "Decode a tracker ASIC hit list"},
+    {"decodeEvents", decodeEvents, METH_VARARGS, "Decode a sequence of event records into columns"},
+    {NULL, NULL, 0, NULL}
+};
+
+static struct PyModuleDef module = {
+    PyModuleDef_HEAD_INIT, "_psocdecode", "Compiled decoders for the event PSOC host library", -1, methods
+};
+
+PyMODINIT_FUNC PyInit__psocdecode(void) {
+    return PyModule_Create(&module);
+}
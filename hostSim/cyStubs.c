@@ -0,0 +1,174 @@
+// Stub definitions of the Cypress component API declared in project.h, for running the event PSOC firmware
+// on a PC. Everything is a no-op except the Tracker UART, which talks to the simulated Tracker in tkrSim.c,
+// the USB-UART and SPI output, which is counted, and the clock: polling an empty Tracker UART advances the
+// firmware clock by one 5 ms tick, so that the firmware time-outs run in simulated time instead of real time.
+#include "project.h"
+#include "tkrSim.h"
+
+extern uint32 clkCnt;    // firmware clock counter in main.c, in 5 ms ticks
+
+// Everything the firmware sends out by USB-UART or SPI is counted, and hashed (FNV-1a) when hostOutHashing
+// is set, so that benchmarks can check that the output did not change
+uint32 hostOutBytes = 0;
+uint32 hostOutHash = 2166136261u;
+bool hostOutHashing = false;
+static void hostOut(const uint8* data, uint16 n) {
+    hostOutBytes += n;
+    if (!hostOutHashing) return;
+    for (int i=0; i<n; ++i) hostOutHash = (hostOutHash ^ data[i])*16777619u;
+}
+
+volatile uint16 ADC_SAR_1_SAR_WRK0_PTR[1], ADC_SAR_2_SAR_WRK0_PTR[1];
+
+void CyDelay(uint32 ms) { clkCnt += ms/5; }
+void CyDelayUs(uint16 us) { }
+uint8 CyEnterCriticalSection(void) { return 0; }
+void CyExitCriticalSection(uint8 state) { }
+uint8 CyDmaTdAllocate(void) { return 0; }
+uint8 CyDmaTdSetConfiguration(uint8 td, uint16 count, uint8 next, uint8 config) { return 0; }
+#undef CyDmaTdSetAddress
+uint8 CyDmaTdSetAddress(uint8 td, uint16 src, uint16 dst) { return 0; }
+uint8 CyDmaChSetInitialTd(uint8 ch, uint8 td) { return 0; }
+uint8 CyDmaChEnable(uint8 ch, uint8 preserve) { return 0; }
+uint8 DMA_1_DmaInitialize(uint8 a, uint8 b, uint16 c, uint16 d) { return 0; }
+uint8 DMA_2_DmaInitialize(uint8 a, uint8 b, uint16 c, uint16 d) { return 0; }
+
+void ADC_SAR_1_Start(void) { }
+void ADC_SAR_2_Start(void) { }
+void ADC_DelSig_1_Start(void) { }
+int32 ADC_DelSig_1_Read32(void) { return 0; }
+int16 ADC_DelSig_1_CountsTo_mVolts(int32 counts) { return 0; }
+
+uint8 Cntr8_Timer_ReadCount(void) { return 0; }
+void Cntr8_Timer_WritePeriod(uint8 period) { }
+uint8 Cntr8_V1_1_ReadCount(void) { return 0; }
+uint8 Cntr8_V1_2_ReadCount(void) { return 0; }
+uint8 Cntr8_V1_3_ReadCount(void) { return 0; }
+uint8 Cntr8_V1_4_ReadCount(void) { return 0; }
+uint8 Cntr8_V1_5_ReadCount(void) { return 0; }
+void Cntr8_V1_PMT_WritePeriod(uint8 period) { }
+void Cntr8_V1_TKR_WritePeriod(uint8 period) { }
+
+void Comp_Ch1_Start(void) { }
+void Comp_Ch2_Start(void) { }
+void Comp_Ch3_Start(void) { }
+void Comp_Ch4_Start(void) { }
+
+uint8 controlSSN, controlTrg1, controlTrg2;
+uint8 Control_Reg_SSN_Read(void) { return controlSSN; }
+void Control_Reg_SSN_Write(uint8 value) { controlSSN = value; }
+void Control_Reg_Pls_Write(uint8 value) { }
+uint8 Control_Reg_Trg1_Read(void) { return controlTrg1; }
+void Control_Reg_Trg1_Write(uint8 value) { controlTrg1 = value; }
+uint8 Control_Reg_Trg2_Read(void) { return controlTrg2; }
+void Control_Reg_Trg2_Write(uint8 value) { controlTrg2 = value; }
+
+void Count7_1_Start(void) { }
+void Count7_2_Start(void) { }
+void Count7_3_Start(void) { }
+void Count7_3_WritePeriod(uint8 period) { }
+
+void I2C_2_Start(void) { }
+uint8 I2C_2_MasterSendStart(uint8 address, uint8 rw) { return I2C_2_MSTR_NO_ERROR; }
+uint8 I2C_2_MasterWriteByte(uint8 data) { return I2C_2_MSTR_NO_ERROR; }
+uint8 I2C_2_MasterReadByte(uint8 ack) { return 0; }
+uint8 I2C_2_MasterSendStop(void) { return I2C_2_MSTR_NO_ERROR; }
+uint8 I2C_2_MasterStatus(void) { return I2C_2_MSTAT_CLEAR; }
+
+RTC_1_TIME_DATE rtcTime;
+RTC_1_TIME_DATE* RTC_1_ReadTime(void) { return &rtcTime; }
+void RTC_1_WriteTime(const RTC_1_TIME_DATE* t) { rtcTime = *t; }
+void RTC_1_Start(void) { }
+
+void SPIM_Start(void) { }
+void SPIM_Init(void) { }
+void SPIM_Enable(void) { }
+void SPIM_ClearRxBuffer(void) { }
+void SPIM_ClearTxBuffer(void) { }
+uint8 SPIM_ReadTxStatus(void) { return SPIM_STS_SPI_IDLE; }
+uint8 SPIM_ReadRxData(void) { return 0; }
+uint8 SPIM_GetRxBufferSize(void) { return 0; }
+uint8 SPIM_GetTxBufferSize(void) { return 0; }
+void SPIM_WriteTxData(uint8 data) { hostOut(&data, 1); }
+void SPIM_PutArray(const uint8* data, uint8 n) { hostOut(data, n); }
+
+void ShiftReg_A_Start(void) { }
+void ShiftReg_B_Start(void) { }
+void ShiftReg_A_EnableInt(void) { }
+void ShiftReg_B_EnableInt(void) { }
+void ShiftReg_A_SetIntMode(uint8 mode) { }
+void ShiftReg_B_SetIntMode(uint8 mode) { }
+uint8 ShiftReg_A_GetIntStatus(void) { return 0; }
+uint8 ShiftReg_B_GetIntStatus(void) { return 0; }
+uint8 ShiftReg_A_GetFIFOStatus(uint8 fifo) { return ShiftReg_A_RET_FIFO_EMPTY; }
+uint8 ShiftReg_B_GetFIFOStatus(uint8 fifo) { return ShiftReg_B_RET_FIFO_EMPTY; }
+uint32 ShiftReg_A_ReadData(void) { return 0; }
+uint32 ShiftReg_B_ReadData(void) { return 0; }
+
+uint8 Status_Reg_M_Read(void) { return 0; }
+uint8 Status_Reg_Trg_Read(void) { return 0; }
+
+void Timer_1_Start(void) { }
+void Timer_1_Stop(void) { }
+
+void TrigWindow_V1_1_Count7_1_Start(void) { }
+void TrigWindow_V1_2_Count7_1_Start(void) { }
+void TrigWindow_V1_3_Count7_1_Start(void) { }
+void TrigWindow_V1_4_Count7_1_Start(void) { }
+void TrigWindow_V1_5_Count7_1_Start(void) { }
+void TrigWindow_V1_1_Count7_1_WritePeriod(uint8 period) { }
+void TrigWindow_V1_2_Count7_1_WritePeriod(uint8 period) { }
+void TrigWindow_V1_3_Count7_1_WritePeriod(uint8 period) { }
+void TrigWindow_V1_4_Count7_1_WritePeriod(uint8 period) { }
+void TrigWindow_V1_5_Count7_1_WritePeriod(uint8 period) { }
+
+void UART_CMD_Start(void) { }
+uint8 UART_CMD_GetRxBufferSize(void) { return 0; }
+uint8 UART_CMD_ReadRxData(void) { return 0; }
+uint8 UART_CMD_ReadRxStatus(void) { return 0; }
+
+// The Tracker UART
+void UART_TKR_Start(void) { }
+uint8 UART_TKR_ReadRxStatus(void) {
+    if (tkrSimRxReady()) return UART_TKR_RX_STS_FIFO_NOTEMPTY;
+    clkCnt++;
+    return 0;
+}
+uint8 UART_TKR_ReadRxData(void) { return tkrSimRxByte(); }
+uint8 UART_TKR_ReadTxStatus(void) { return UART_TKR_TX_STS_FIFO_EMPTY; }
+void UART_TKR_WriteTxData(uint8 data) { tkrSimTxByte(data); }
+void UART_TKR_PutChar(uint8 data) { tkrSimTxByte(data); }
+uint8 UART_TKR_GetTxBufferSize(void) { return 0; }
+
+void USBUART_Start(uint8 device, uint8 mode) { }
+uint8 USBUART_IsConfigurationChanged(void) { return 0; }
+uint8 USBUART_GetConfiguration(void) { return 0; }
+uint8 USBUART_CDC_Init(void) { return 0; }
+uint8 USBUART_CDCIsReady(void) { return 1; }
+uint8 USBUART_DataIsReady(void) { return 0; }
+uint16 USBUART_GetAll(uint8* data) { return 0; }
+uint16 USBUART_GetCount(void) { return 0; }
+void USBUART_PutData(const uint8* data, uint16 n) { hostOut(data, n); }
+
+void VDAC8_Ch1_Start(void) { }
+void VDAC8_Ch2_Start(void) { }
+void VDAC8_Ch3_Start(void) { }
+void VDAC8_Ch4_Start(void) { }
+void VDAC8_Ch1_SetValue(uint8 value) { }
+void VDAC8_Ch2_SetValue(uint8 value) { }
+void VDAC8_Ch3_SetValue(uint8 value) { }
+void VDAC8_Ch4_SetValue(uint8 value) { }
+
+#define ISR_STUBS(n) void n##_StartEx(void(*address)(void)) { } void n##_Enable(void) { } \
+    void n##_Disable(void) { } uint8 n##_GetState(void) { return 0; }
+ISR_STUBS(isr_timer) ISR_STUBS(isr_clk200) ISR_STUBS(isr_Store_A) ISR_STUBS(isr_Store_B) ISR_STUBS(isr_Ch1)
+ISR_STUBS(isr_Ch2) ISR_STUBS(isr_Ch3) ISR_STUBS(isr_Ch4) ISR_STUBS(isr_Ch5) ISR_STUBS(isr_GO1)
+
+void CySysTickStart(void) { }
+void CySysTickStop(void) { }
+void CySysTickEnableInterrupt(void) { }
+void CySysTickDisableInterrupt(void) { }
+void CySysTickSetReload(uint32 value) { }
+uint32 CySysTickGetValue(void) { return 0; }
+cySysTickCallback CySysTickSetCallback(uint32 number, cySysTickCallback function) { return 0; }
+void CySysTickClear(void) { }
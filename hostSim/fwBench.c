@@ -0,0 +1,641 @@
+// Regression benchmark of the event PSOC firmware logic, compiled on a PC from DAQ.cydsn/main.c as it is.
+// It times the parts of the event path that do not depend on the hardware:
+//   tof        matchTOF, the correlation of the two TOF channels with the event time stamp
+//   output     taskOutput, the framing of event records and replies (SPI packets, with and without the link
+//              trailer, USB packets, USB bulk)
+//   tracker    tkrRxByte, the parsing of Tracker event frames (from the simulated Tracker of tkrSim.c)
+//   command    cmdBufferPut and taskCommandInput, the decoding of ASCII and binary command frames
+//   schedule   a Tracker image load through the scheduler, which must still answer a command meanwhile
+// on synthetic inputs and, optionally, on the events of a run file (PSOC_runfile.py) and the commands of a
+// serial capture (PSOC_capture.py). For each it reports ns and bytes per event (or per command), and a check
+// value computed from what the firmware produced, so that a change of behavior shows up as well as a change
+// of speed. The results can be saved as a baseline and later runs compared against it.
+// The times are for the host CPU, not the PSoC, so by default only the check values and output sizes are
+// compared with the baseline and the times are just shown. Give -t to also fail on a slowdown larger than
+// the tolerance, with a baseline from the same machine, on a quiet one (on a shared virtual machine the speed
+// can drift by more than the tolerance).
+// The check values depend on the number of events, so compare runs made with the same -n.
+//
+// Usage: fwBench [-n events, default 10000] [-r run file] [-c capture file] [-b baseline to compare with] [-s baseline to write]
+//                [-t tolerance, for example 0.3; default 0, times not compared]
+// The exit status is 1 if a check value or output size changed, or, with -t, if a benchmark is slower than the
+// baseline by more than the tolerance.
+#define main firmwareMain
+#include "../DAQ.cydsn/main.c"
+#undef main
+#include "tkrSim.h"
+
+extern uint32 hostOutBytes;       // output counters of the USB-UART and SPI stubs in cyStubs.c
+extern uint32 hostOutHash;
+extern bool hostOutHashing;
+
+#define REPEATS 9                 // each benchmark is timed this many times and the fastest kept
+#define MAX_RESULTS 64
+#define MAX_REPLAY_EVENTS 20000
+#define FNV_START 2166136261u
+
+struct Result {
+    char name[32];
+    double ns;                    // per event or command
+    double bytes;                 // per event or command
+    uint32 check;
+};
+struct Result results[MAX_RESULTS];
+int nResults = 0;
+
+uint32 fnv(uint32 hash, const uint8* data, int n) {
+    for (int i=0; i<n; ++i) hash = (hash ^ data[i])*16777619u;
+    return hash;
+}
+
+void addResult(const char* name, double ns, double bytes, uint32 check) {
+    if (nResults >= MAX_RESULTS) return;
+    struct Result* r = &results[nResults++];
+    snprintf(r->name, sizeof(r->name), "%s", name);
+    r->ns = ns;
+    r->bytes = bytes;
+    r->check = check;
+}
+
+uint32 benchRandom = 1;
+uint32 benchRand(uint32 n) {      // xorshift, so that the inputs and check values are repeatable
+    benchRandom ^= benchRandom << 13;
+    benchRandom ^= benchRandom >> 17;
+    benchRandom ^= benchRandom << 5;
+    return benchRandom % n;
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// TOF correlation. The circular buffers are filled the way the Store_A and Store_B interrupts fill them,
+// with some readouts out of time with the event, and matchTOF is run on each filling.
+
+#define TOF_SETS 256
+struct TOF tofSetA[TOF_SETS], tofSetB[TOF_SETS];
+uint16 tofSetTime[TOF_SETS];
+
+void fillTOF(struct TOF* tof, uint16 timeStamp16, int nHits) {
+    memset(tof, 0, sizeof(*tof));
+    for (int i=0; i<nHits; ++i) {
+        tof->shiftReg[tof->ptr] = (benchRand(65536) << 16) | benchRand(8333);
+        tof->clkCnt[tof->ptr] = timeStamp16 - benchRand(4);     // a quarter of them too early to match
+        tof->filled[tof->ptr] = true;
+        tof->ptr = (tof->ptr + 1) % TOFMAX_EVT;
+    }
+}
+
+void benchTOF(int nEvents) {
+    static const int hits[] = { 1, 4, 16, TOFMAX_EVT };
+    for (size_t h=0; h<sizeof(hits)/sizeof(hits[0]); ++h) {
+        benchRandom = 777 + h;
+        for (int s=0; s<TOF_SETS; ++s) {
+            tofSetTime[s] = benchRand(65536);
+            fillTOF(&tofSetA[s], tofSetTime[s], hits[h]);
+            fillTOF(&tofSetB[s], tofSetTime[s], hits[h]);
+        }
+        int nCalls = nEvents/TOF_SETS > 0 ? nEvents/TOF_SETS : 1;
+        double best = 1.e30;
+        uint32 check = FNV_START;
+        for (int rep=0; rep<REPEATS; ++rep) {
+            double t = 0.;
+            for (int s=0; s<TOF_SETS; ++s) {
+                tofA = tofSetA[s];
+                tofB = tofSetB[s];
+                struct TOFmatch m;
+                double t0 = tkrSimSeconds();
+                for (int i=0; i<nCalls; ++i) matchTOF(tofSetTime[s], &m);
+                t += tkrSimSeconds() - t0;
+                if (rep == 0) {
+                    uint16 fields[7] = { m.nA, m.nB, (uint16)m.dtmin, m.aTOF, m.bTOF, m.aCLK, m.bCLK };
+                    check = fnv(check, (const uint8*)fields, sizeof(fields));
+                }
+            }
+            if (t < best) best = t;
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "tof.%dhits", hits[h]);
+        addResult(name, 1.e9*best/(nCalls*TOF_SETS), 0., check);
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Output framing
+
+void frameRecord(uint8 mode, const uint8* data, uint16 n) {
+    memcpy(dataOut, data, n);
+    nDataReady = n;
+    eventDataReady = n > 3;
+    outputMode = mode;
+    taskOutput();
+}
+
+// Frame every record in turn; the check value is the hash of all the bytes sent out
+void benchOutputRecords(const char* name, uint8 mode, uint8** records, uint16* lengths, int nRecords, int nEvents) {
+    hostOutHash = FNV_START;
+    hostOutHashing = true;
+    for (int i=0; i<nRecords; ++i) frameRecord(mode, records[i], lengths[i]);
+    usbFlush();
+    hostOutHashing = false;
+    uint32 check = hostOutHash;
+    double best = 1.e30;
+    uint32 nBytes = 0;
+    for (int rep=0; rep<REPEATS; ++rep) {
+        hostOutBytes = 0;
+        double t0 = tkrSimSeconds();
+        for (int i=0; i<nEvents; ++i) frameRecord(mode, records[i % nRecords], lengths[i % nRecords]);
+        usbFlush();
+        double t = tkrSimSeconds() - t0;
+        if (t < best) best = t;
+        nBytes = hostOutBytes;
+    }
+    addResult(name, 1.e9*best/nEvents, (double)nBytes/nEvents, check);
+}
+
+void benchOutput(int nEvents) {
+    static const uint16 sizes[] = { 3, 64, 300, 1200 };          // a short reply, then events of rising size
+    static const char* modeNames[] = { "spi", "usb", "bulk" };   // SPI_OUTPUT, USBUART_OUTPUT, USB_BULK_OUTPUT
+    static uint8 record[MAX_DATA_OUT];
+    for (int i=0; i<MAX_DATA_OUT; ++i) record[i] = (uint8)(i*37 + 11);
+    for (uint8 mode=SPI_OUTPUT; mode<=USB_BULK_OUTPUT; ++mode) {
+        for (size_t s=0; s<sizeof(sizes)/sizeof(sizes[0]); ++s) {
+            uint8* records[1] = { record };
+            uint16 lengths[1] = { sizes[s] };
+            char name[32];
+            snprintf(name, sizeof(name), "output.%s.%d", modeNames[mode], sizes[s]);
+            benchOutputRecords(name, mode, records, lengths, 1, nEvents);
+        }
+    }
+    linkMode = LINK_TRAILER;         // SPI events followed by the sequence number and CRC packet
+    for (size_t s=1; s<sizeof(sizes)/sizeof(sizes[0]); ++s) {
+        uint8* records[1] = { record };
+        uint16 lengths[1] = { sizes[s] };
+        char name[32];
+        snprintf(name, sizeof(name), "output.spilink.%d", sizes[s]);
+        benchOutputRecords(name, SPI_OUTPUT, records, lengths, 1, nEvents);
+    }
+    linkMode = 0;
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Tracker event frames
+
+void freeTkrHits() {
+    for (int brd=0; brd<MAX_TKR_BOARDS; ++brd) {
+        if (tkrData.boardHits[brd].nBytes > 0) {
+            tkrData.boardHits[brd].nBytes = 0;
+            free(tkrData.boardHits[brd].hitList);
+        }
+    }
+    tkrData.nTkrBoards = 0;
+}
+
+// Read one event as taskEventBuild does, returning the time spent in taskTracker parsing the event itself.
+// The check value is updated with what the firmware stored.
+double readTkrEvent(const struct TkrSimEvent* replay, uint32* check, long* nBytes) {
+    clkCnt += 2;
+    taskTracker();
+    tkrSend(0x00, 0x57, 0, NULL, TKR_FOR_NONE);
+    taskTracker();
+    nTkrHouseKeeping = 0;
+    if (replay != NULL) tkrSimReplay(replay);
+    tkrReadEvent();
+    *nBytes += tkrSimPending();
+    double t0 = tkrSimSeconds();
+    taskTracker();
+    double t = tkrSimSeconds() - t0;
+    evtTkrStep = EVT_TKR_IDLE;
+    *check = fnv(*check, &tkrData.nTkrBoards, 1);
+    for (int lyr=0; lyr<tkrData.nTkrBoards; ++lyr) {
+        *check = fnv(*check, tkrData.boardHits[lyr].hitList, tkrData.boardHits[lyr].nBytes);
+    }
+    freeTkrHits();
+    return t;
+}
+
+void resetTracker() {
+    tkrSimInit(12345);
+    freeTkrHits();
+    memset(tkrTrans, 0, sizeof(tkrTrans));
+    memset(&tkrRx, 0, sizeof(tkrRx));
+    tkrTxRead = tkrTxWrite = 0;
+    nErrors = 0;
+}
+
+void benchTrackerEvents(const char* name, const struct TkrSimEvent* replay, int nReplay, int nEvents) {
+    double best = 1.e30;
+    uint32 check = FNV_START;
+    long nBytes = 0;
+    for (int rep=0; rep<REPEATS; ++rep) {
+        resetTracker();
+        uint32 repCheck = FNV_START;
+        long repBytes = 0;
+        double t = 0.;
+        for (int i=0; i<nEvents; ++i) t += readTkrEvent(replay ? &replay[i % nReplay] : NULL, &repCheck, &repBytes);
+        if (t < best) best = t;
+        check = repCheck ^ nErrors;
+        nBytes = repBytes;
+    }
+    addResult(name, 1.e9*best/nEvents, (double)nBytes/nEvents, check);
+}
+
+void benchTracker(int nEvents) {
+    static const uint8 points[][2] = { {0,0}, {2,2}, {6,4}, {12,10} };  // hit chips per board, clusters per chip
+    for (size_t p=0; p<sizeof(points)/sizeof(points[0]); ++p) {
+        tkrSimConfigure(8, points[p][0], points[p][1]);
+        char name[32];
+        snprintf(name, sizeof(name), "tracker.%dchips.%dclusters", points[p][0], points[p][1]);
+        benchTrackerEvents(name, NULL, 0, nEvents);
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Command decoding
+
+uint32 cmdCheck;
+int nCmdDecoded;
+
+// Parse whatever is in the command buffer, acting on a complete command as taskCommandExec would
+// without executing it
+void parseCommands() {
+    while (true) {
+        uint16 before = bufferRead;
+        taskCommandInput();
+        if (cmdDone) {
+            uint8 code = command;
+            cmdCheck = fnv(cmdCheck, &code, 1);
+            cmdCheck = fnv(cmdCheck, cmdData, nDataBytes);
+            nCmdDecoded++;
+            cmdDone = false;
+            awaitingCommand = true;
+        }
+        if (bufferRead == before) break;
+    }
+}
+
+void resetCommands() {
+    bufferRead = bufferWrite = 0;
+    cmdDone = false;
+    awaitingCommand = true;
+    nErrors = 0;
+    cmdCheck = FNV_START;
+    nCmdDecoded = 0;
+}
+
+// One piece of a triplicated ASCII command, as mkCmdHdr and mkDataByte in PSOC_cmd.py make them
+int asciiPiece(uint8* out, uint8 dataByte, uint8 addressByte, uint8 seq) {
+    static const char hex[] = "0123456789abcdef";
+    uint8 piece[9] = { 'S', hex[dataByte >> 4], hex[dataByte & 0xF], hex[addressByte >> 4], hex[addressByte & 0xF],
+                       ' ', seq ? hex[seq >> 4] : 'x', seq ? hex[seq & 0xF] : 'y', 'W' };
+    for (int i=0; i<3; ++i) memcpy(out + 9*i, piece, 9);
+    out[27] = '\r';
+    out[28] = '\n';
+    return ASCII_CMD_LEN;
+}
+
+int mkAsciiCommand(uint8* out, uint8 cmdCode, uint8 nData, const uint8* data, uint8 seq) {
+    uint8 address = eventPSOCaddress;
+    int n = asciiPiece(out, cmdCode, ((nData & 0x0C) << 4) | (address << 2) | (nData & 0x03), seq);
+    for (uint8 id=1; id<=nData; ++id) {
+        n += asciiPiece(out + n, data[id-1], ((id & 0x0C) << 4) | (address << 2) | (id & 0x03), 0);
+    }
+    return n;
+}
+
+int mkBinCommand(uint8* out, uint8 cmdCode, uint8 nData, const uint8* data, uint8 seq) {
+    int n = 0;
+    out[n++] = BIN_SYNC;
+    out[n++] = eventPSOCaddress;
+    out[n++] = seq;
+    out[n++] = cmdCode;
+    out[n++] = nData;
+    for (int i=0; i<nData; ++i) out[n++] = data[i];
+    uint16 crc = 0xFFFF;
+    for (int i=1; i<n; ++i) crc = crc16(crc, out[i]);
+    out[n++] = byte16(crc, 0);
+    out[n++] = byte16(crc, 1);
+    return n;
+}
+
+void benchCommandStream(const char* name, const uint8* stream, int len, int nCommands, int chunk) {
+    double best = 1.e30;
+    for (int rep=0; rep<REPEATS; ++rep) {
+        resetCommands();
+        double t0 = tkrSimSeconds();
+        for (int i=0; i<len; i+=chunk) {
+            cmdBufferPut((uint8*)stream + i, len - i < chunk ? len - i : chunk);
+            parseCommands();
+        }
+        double t = tkrSimSeconds() - t0;
+        if (t < best) best = t;
+    }
+    if (nCmdDecoded != nCommands) printf("%s: %d commands decoded out of %d\n", name, nCmdDecoded, nCommands);
+    addResult(name, 1.e9*best/(nCommands > 0 ? nCommands : 1), (double)len/(nCommands > 0 ? nCommands : 1),
+              cmdCheck ^ nErrors);
+}
+
+void benchCommands(int nEvents) {
+    static const struct { const char* name; bool binary; uint8 nData; } kinds[] = {
+        { "command.ascii.0", false, 0 }, { "command.ascii.2", false, 2 }, { "command.ascii.5", false, 5 },
+        { "command.binary.0", true, 0 }, { "command.binary.2", true, 2 }, { "command.binary.5", true, 5 } };
+    int nCommands = nEvents/4 > 0 ? nEvents/4 : 1;
+    uint8* stream = malloc((size_t)nCommands*6*ASCII_CMD_LEN);
+    for (size_t k=0; k<sizeof(kinds)/sizeof(kinds[0]); ++k) {
+        benchRandom = 99 + k;
+        int len = 0;
+        for (int c=0; c<nCommands; ++c) {
+            uint8 data[5];
+            for (int i=0; i<kinds[k].nData; ++i) data[i] = benchRand(256);
+            uint8 code = 0x01 + benchRand(0x4A);
+            uint8 seq = 1 + c % 255;
+            if (kinds[k].binary) len += mkBinCommand(stream + len, code, kinds[k].nData, data, seq);
+            else len += mkAsciiCommand(stream + len, code, kinds[k].nData, data, seq);
+        }
+        benchCommandStream(kinds[k].name, stream, len, nCommands, 64);   // 64-byte pieces, as from the USB-UART
+    }
+    free(stream);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Scheduling. A Tracker configuration image is loaded with 0x4A and 0x4B and sent to the simulated Tracker by
+// the scheduler, and a version request (0x07) sent right after 0x4B must be answered before the image is done.
+
+#define SCHED_IMAGE_RECORDS 60
+#define SCHED_MAX_PASSES 100000
+
+// Run scheduler passes until the command just put in the buffer has been executed and its output sent
+void scheduleCommand(uint8* frame, int len) {
+    cmdBufferPut(frame, len);
+    for (int pass=0; pass<SCHED_MAX_PASSES && (bufferRead != bufferWrite || cmdDone || nDataReady > 0); ++pass) schedule();
+}
+
+// Returns false if the version request had to wait for the whole image
+bool checkImageSchedule() {
+    resetTracker();
+    resetCommands();
+    triggerEnable(false);      // not in a run, or the image commands are refused
+    triggered = false;
+    outputMode = USBUART_OUTPUT;
+    uint8 image[5*SCHED_IMAGE_RECORDS];
+    for (int i=0; i<SCHED_IMAGE_RECORDS; ++i) {   // threshold DACs, as tkrImageDAC makes them
+        uint8 record[5] = { 0, 0x11, 2, i % 12, 25 };
+        memcpy(image + 5*i, record, 5);
+    }
+    uint8 frame[32];
+    for (size_t offset=0; offset<sizeof(image); offset+=13) {
+        uint8 block[15] = { byte16(offset, 0), byte16(offset, 1) };
+        int n = sizeof(image) - offset < 13 ? sizeof(image) - offset : 13;
+        memcpy(block + 2, image + offset, n);
+        scheduleCommand(frame, mkBinCommand(frame, 0x4A, 2 + n, block, 1));
+    }
+    uint16 crc = 0xFFFF;
+    for (size_t i=0; i<sizeof(image); ++i) crc = crc16(crc, image[i]);
+    uint8 crcBytes[2] = { byte16(crc, 0), byte16(crc, 1) };
+    cmdBufferPut(frame, mkBinCommand(frame, 0x4B, 2, crcBytes, 2));
+    cmdBufferPut(frame, mkBinCommand(frame, 0x07, 0, NULL, 3));
+    int answeredAt = -1;
+    int nPasses = 0;
+    double t0 = tkrSimSeconds();
+    for (; nPasses<SCHED_MAX_PASSES && (tkrImageRunning || bufferRead != bufferWrite || cmdDone || nDataReady > 0); ++nPasses) {
+        uint32 nOut = hostOutBytes;
+        schedule();
+        if (answeredAt < 0 && hostOutBytes > nOut && tkrImageRunning) answeredAt = nTkrImageRecords;
+    }
+    double t = tkrSimSeconds() - t0;
+    bool ok = answeredAt >= 0 && nTkrImageRecords == SCHED_IMAGE_RECORDS && nTkrImageFailed == 0;
+    printf("schedule: version reply %s, %d of %d image records sent, %d failed, in %d passes\n",
+           answeredAt >= 0 ? "during the image load" : "NOT during the image load", nTkrImageRecords, SCHED_IMAGE_RECORDS,
+           nTkrImageFailed, nPasses);
+    uint32 check = FNV_START;
+    check = fnv(check, (uint8*)&answeredAt, sizeof(answeredAt));
+    check = fnv(check, (uint8*)&nTkrImageRecords, sizeof(nTkrImageRecords));
+    check = fnv(check, (uint8*)&nTkrImageFailed, sizeof(nTkrImageFailed));
+    addResult("schedule.imageload", 1.e9*t/SCHED_IMAGE_RECORDS, 0., check ^ nErrors);
+    return ok;
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Replayed inputs
+
+// Read the event records of a run file written by PSOC_runfile.RunWriter (the layout is described there)
+int readRunFile(const char* fileName, uint8*** records, uint16** lengths) {
+    FILE* f = fopen(fileName, "rb");
+    if (f == NULL) {
+        printf("fwBench: cannot open %s\n", fileName);
+        return 0;
+    }
+    uint8 head[28];
+    if (fread(head, 1, 28, f) != 28 || memcmp(head, "AESORUN1", 8) != 0) {
+        printf("fwBench: %s is not a run file\n", fileName);
+        fclose(f);
+        return 0;
+    }
+    uint32 nConfig = head[24] | head[25] << 8 | head[26] << 16 | (uint32)head[27] << 24;
+    fseek(f, nConfig, SEEK_CUR);
+    *records = malloc(MAX_REPLAY_EVENTS*sizeof(uint8*));
+    *lengths = malloc(MAX_REPLAY_EVENTS*sizeof(uint16));
+    int n = 0;
+    uint8 rec[13];
+    while (n < MAX_REPLAY_EVENTS && fread(rec, 1, 13, f) == 13 && memcmp(rec, "AESOIDX1", 8) != 0) {
+        uint32 len = rec[0] | rec[1] << 8 | rec[2] << 16 | (uint32)rec[3] << 24;
+        if (len > MAX_DATA_OUT) break;
+        uint8* data = malloc(len > 0 ? len : 1);
+        if (fread(data, 1, len, f) != len) {
+            free(data);
+            break;
+        }
+        if (rec[4] != 0 || len < 56 || memcmp(data, "ZERO", 4) != 0) {      // event records only
+            free(data);
+            continue;
+        }
+        (*records)[n] = data;
+        (*lengths)[n++] = len;
+    }
+    fclose(f);
+    return n;
+}
+
+// The Tracker hit lists of recorded events, to be sent again by the simulated Tracker
+int replayHitLists(uint8** records, uint16* lengths, int nRecords, struct TkrSimEvent* events) {
+    int n = 0;
+    for (int i=0; i<nRecords; ++i) {
+        const uint8* data = records[i];
+        struct TkrSimEvent* evt = &events[n];
+        memset(evt, 0, sizeof(*evt));
+        int iPtr = 52;
+        bool ok = data[51] <= TKR_SIM_MAX_BOARDS;
+        for (int brd=0; ok && brd<data[51]; ++brd) {
+            if (iPtr + 2 > lengths[i] - 4) {
+                ok = false;
+                break;
+            }
+            uint8 nBytes = data[iPtr+1];
+            if (nBytes > TKR_SIM_MAX_BOARD_BYTES || iPtr + 2 + nBytes > lengths[i] - 4) {
+                ok = false;
+                break;
+            }
+            evt->nBytes[brd] = nBytes;        // in the order of the record, which is the order of the Tracker frame
+            memcpy(evt->hitList[brd], data + iPtr + 2, nBytes);
+            iPtr += 2 + nBytes;
+        }
+        if (!ok) continue;
+        evt->nBoards = data[51];
+        n++;
+    }
+    return n;
+}
+
+void benchReplayRun(const char* fileName, int nEvents) {
+    uint8** records;
+    uint16* lengths;
+    int nRecords = readRunFile(fileName, &records, &lengths);
+    if (nRecords == 0) return;
+    printf("replaying %d events of %s\n", nRecords, fileName);
+    benchOutputRecords("replay.output.spi", SPI_OUTPUT, records, lengths, nRecords, nEvents);
+    benchOutputRecords("replay.output.bulk", USB_BULK_OUTPUT, records, lengths, nRecords, nEvents);
+    struct TkrSimEvent* events = malloc(nRecords*sizeof(struct TkrSimEvent));
+    int nReplay = replayHitLists(records, lengths, nRecords, events);
+    printf("replaying the Tracker hit lists of %d of them\n", nReplay);
+    if (nReplay > 0) benchTrackerEvents("replay.tracker", events, nReplay, nEvents);
+    free(events);
+    for (int i=0; i<nRecords; ++i) free(records[i]);
+    free(records);
+    free(lengths);
+}
+
+// Commands sent in a serial capture written by PSOC_capture.CaptureSerial, in the chunks they were sent in
+void benchReplayCapture(const char* fileName) {
+    FILE* f = fopen(fileName, "rb");
+    uint8 head[16];
+    if (f == NULL || fread(head, 1, 16, f) != 16 || memcmp(head, "AESOCAP1", 8) != 0) {
+        printf("fwBench: %s is not a capture file\n", fileName);
+        if (f != NULL) fclose(f);
+        return;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 16, SEEK_SET);
+    uint8* stream = malloc(size);
+    int len = 0;
+    int chunk = 1;
+    uint8 rec[13];
+    while (fread(rec, 1, 13, f) == 13) {
+        uint32 n = rec[9] | rec[10] << 8 | rec[11] << 16 | (uint32)rec[12] << 24;
+        if (n > size) break;
+        if (rec[8] == 1) {          // sent to the board
+            if (fread(stream + len, 1, n, f) != n) break;
+            len += n;
+            if (n > (uint32)chunk) chunk = n;
+        } else {
+            fseek(f, n, SEEK_CUR);
+        }
+    }
+    fclose(f);
+    if (chunk > 64) chunk = 64;
+    resetCommands();            // count the commands first, for the per-command figures
+    for (int i=0; i<len; i+=chunk) {
+        cmdBufferPut(stream + i, len - i < chunk ? len - i : chunk);
+        parseCommands();
+    }
+    printf("replaying %d command bytes (%d commands) of %s\n", len, nCmdDecoded, fileName);
+    if (nCmdDecoded > 0) benchCommandStream("replay.command", stream, len, nCmdDecoded, chunk);
+    free(stream);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Baselines
+
+void saveBaseline(const char* fileName) {
+    FILE* f = fopen(fileName, "w");
+    if (f == NULL) {
+        printf("fwBench: cannot write %s\n", fileName);
+        return;
+    }
+    fprintf(f, "# fwBench baseline: benchmark, ns per event, bytes per event, check value\n");
+    for (int i=0; i<nResults; ++i) {
+        fprintf(f, "%-28s %12.2f %10.1f 0x%08x\n", results[i].name, results[i].ns, results[i].bytes, results[i].check);
+    }
+    fclose(f);
+    printf("baseline written to %s\n", fileName);
+}
+
+// Print the results, compared with the baseline if there is one. Returns the number of regressions: changes of
+// output, and with a tolerance above 0, slowdowns beyond it.
+int report(const char* baselineName, double tolerance) {
+    struct Result base[MAX_RESULTS];
+    int nBase = 0;
+    if (baselineName != NULL) {
+        FILE* f = fopen(baselineName, "r");
+        if (f == NULL) {
+            printf("fwBench: cannot read baseline %s\n", baselineName);
+        } else {
+            char line[256];
+            while (nBase < MAX_RESULTS && fgets(line, sizeof(line), f) != NULL) {
+                if (line[0] == '#') continue;
+                struct Result* r = &base[nBase];
+                if (sscanf(line, "%31s %lf %lf %x", r->name, &r->ns, &r->bytes, &r->check) == 4) nBase++;
+            }
+            fclose(f);
+        }
+    }
+    int nBad = 0;
+    printf("  %-28s %10s %11s  %-10s", "benchmark", "ns/event", "bytes/event", "check");
+    if (nBase > 0) printf(" %12s %8s", "baseline ns", "change");
+    printf("\n");
+    for (int i=0; i<nResults; ++i) {
+        struct Result* r = &results[i];
+        printf("  %-28s %10.1f %11.1f  0x%08x", r->name, r->ns, r->bytes, r->check);
+        if (nBase > 0) {
+            struct Result* b = NULL;
+            for (int j=0; j<nBase; ++j) if (strcmp(base[j].name, r->name) == 0) b = &base[j];
+            if (b == NULL) {
+                printf(" %12s %8s  new", "-", "-");
+            } else {
+                double change = b->ns > 0. ? r->ns/b->ns - 1. : 0.;
+                printf(" %12.1f %+7.0f%%", b->ns, 100.*change);
+                if (b->check != r->check || b->bytes - r->bytes > 0.05 || r->bytes - b->bytes > 0.05) {
+                    printf("  OUTPUT CHANGED");
+                    nBad++;
+                } else if (tolerance > 0. && change > tolerance) {
+                    printf("  SLOWER");
+                    nBad++;
+                } else if (tolerance > 0. && change < -tolerance) {
+                    printf("  faster");
+                }
+            }
+        }
+        printf("\n");
+    }
+    return nBad;
+}
+
+int main(int argc, char* argv[]) {
+    int nEvents = 10000;
+    const char* runFile = NULL;
+    const char* captureFile = NULL;
+    const char* baselineIn = NULL;
+    const char* baselineOut = NULL;
+    double tolerance = 0.;
+    for (int i=1; i+1<argc; i+=2) {
+        if (strcmp(argv[i], "-n") == 0) nEvents = atoi(argv[i+1]);
+        else if (strcmp(argv[i], "-r") == 0) runFile = argv[i+1];
+        else if (strcmp(argv[i], "-c") == 0) captureFile = argv[i+1];
+        else if (strcmp(argv[i], "-b") == 0) baselineIn = argv[i+1];
+        else if (strcmp(argv[i], "-s") == 0) baselineOut = argv[i+1];
+        else if (strcmp(argv[i], "-t") == 0) tolerance = atof(argv[i+1]);
+    }
+    if (argc % 2 == 0 || nEvents <= 0) {
+        printf("usage: fwBench [-n events, default 10000] [-r run file] [-c capture file] [-b baseline] [-s new baseline] [-t tolerance]\n");
+        return 2;
+    }
+    benchTOF(nEvents);
+    benchOutput(nEvents);
+    benchTracker(nEvents);
+    benchCommands(nEvents);
+    if (runFile != NULL) benchReplayRun(runFile, nEvents);
+    if (captureFile != NULL) benchReplayCapture(captureFile);
+    bool scheduleOK = checkImageSchedule();
+    printf("fwBench, %d events per benchmark\n", nEvents);
+    int nBad = report(baselineIn, tolerance) + !scheduleOK;
+    if (baselineOut != NULL) saveBaseline(baselineOut);
+    if (baselineIn != NULL) printf("%d regressions against %s\n", nBad, baselineIn);
+    return nBad > 0 ? 1 : 0;
+}
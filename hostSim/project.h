@@ -0,0 +1,82 @@
+// Host stand-in for the project.h that PSoC Creator generates for DAQ.cydsn. It declares just the parts of the
+// Cypress component API that main.c uses, so that the firmware can be compiled and run on a PC. The functions
+// are defined in cyStubs.c, where the Tracker UART is connected to the simulated Tracker in tkrSim.c.
+#ifndef HOSTSIM_PROJECT_H
+#define HOSTSIM_PROJECT_H
+#include <stdint.h>
+typedef uint8_t uint8; typedef uint16_t uint16; typedef uint32_t uint32; typedef uint64_t uint64;
+typedef int8_t int8; typedef int16_t int16; typedef int32_t int32; typedef char char8;
+typedef unsigned int uint;
+typedef long time_t;      // main.c defines its own time(), so <time.h> cannot be included with it
+#define CY_ISR(n) void n(void)
+#define CY_ISR_PROTO(n) void n(void)
+#define CyGlobalIntEnable
+#define CyGlobalIntDisable
+#define HI16(x) ((uint16)((uint32)(x)>>16))
+#define LO16(x) ((uint16)(x))
+#define CYDEV_PERIPH_BASE 0x40000000u
+#define CYDEV_SRAM_BASE 0x1FFF8000u
+#define DMA_1__TD_TERMOUT_EN 1
+#define CY_DMA_TD_INC_DST_ADR 4
+typedef struct { uint8 Sec, Min, Hour, DayOfWeek, DayOfMonth; uint16 DayOfYear; uint8 Month; uint16 Year; } RTC_1_TIME_DATE;
+#define V(n) void n(void);
+#define U8(n) uint8 n(void);
+V(CyDelayDummy)
+void CyDelay(uint32); void CyDelayUs(uint16);
+uint8 CyEnterCriticalSection(void); void CyExitCriticalSection(uint8);
+uint8 CyDmaTdAllocate(void); uint8 CyDmaTdSetConfiguration(uint8,uint16,uint8,uint8); uint8 CyDmaTdSetAddress(uint8,uint16,uint16);
+// main.c gives the DMA addresses as (uint32) casts of pointers, which warn on a 64-bit host; the stub ignores
+// them, so they are dropped here without being compiled
+#define CyDmaTdSetAddress(td, src, dst) CyDmaTdSetAddress(td, 0, 0)
+uint8 CyDmaChSetInitialTd(uint8,uint8); uint8 CyDmaChEnable(uint8,uint8);
+uint8 DMA_1_DmaInitialize(uint8,uint8,uint16,uint16); uint8 DMA_2_DmaInitialize(uint8,uint8,uint16,uint16);
+extern volatile uint16 ADC_SAR_1_SAR_WRK0_PTR[1], ADC_SAR_2_SAR_WRK0_PTR[1];
+V(ADC_SAR_1_Start) V(ADC_SAR_2_Start) V(ADC_DelSig_1_Start) int32 ADC_DelSig_1_Read32(void); int16 ADC_DelSig_1_CountsTo_mVolts(int32);
+uint8 Cntr8_Timer_ReadCount(void); void Cntr8_Timer_WritePeriod(uint8);
+U8(Cntr8_V1_1_ReadCount) U8(Cntr8_V1_2_ReadCount) U8(Cntr8_V1_3_ReadCount) U8(Cntr8_V1_4_ReadCount) U8(Cntr8_V1_5_ReadCount)
+void Cntr8_V1_PMT_WritePeriod(uint8); void Cntr8_V1_TKR_WritePeriod(uint8);
+V(Comp_Ch1_Start) V(Comp_Ch2_Start) V(Comp_Ch3_Start) V(Comp_Ch4_Start)
+U8(Control_Reg_SSN_Read) void Control_Reg_SSN_Write(uint8); void Control_Reg_Pls_Write(uint8);
+U8(Control_Reg_Trg1_Read) void Control_Reg_Trg1_Write(uint8); U8(Control_Reg_Trg2_Read) void Control_Reg_Trg2_Write(uint8);
+V(Count7_1_Start) V(Count7_2_Start) V(Count7_3_Start) void Count7_3_WritePeriod(uint8);
+#define I2C_2_MSTR_NO_ERROR 0u
+#define I2C_2_MSTAT_CLEAR 0u
+#define I2C_2_MSTAT_XFER_INP 2u
+V(I2C_2_Start) uint8 I2C_2_MasterSendStart(uint8,uint8); uint8 I2C_2_MasterWriteByte(uint8); uint8 I2C_2_MasterReadByte(uint8);
+U8(I2C_2_MasterSendStop) U8(I2C_2_MasterStatus)
+RTC_1_TIME_DATE* RTC_1_ReadTime(void); void RTC_1_WriteTime(const RTC_1_TIME_DATE*); V(RTC_1_Start)
+#define SPIM_STS_SPI_IDLE 0x10u
+V(SPIM_Start) V(SPIM_Init) V(SPIM_Enable) V(SPIM_ClearRxBuffer) V(SPIM_ClearTxBuffer) U8(SPIM_ReadTxStatus) U8(SPIM_ReadRxData)
+U8(SPIM_GetRxBufferSize) U8(SPIM_GetTxBufferSize) void SPIM_WriteTxData(uint8); void SPIM_PutArray(const uint8*, uint8);
+#define ShiftReg_A_STORE 1u
+#define ShiftReg_B_STORE 1u
+#define ShiftReg_A_OUT_FIFO 2u
+#define ShiftReg_B_OUT_FIFO 2u
+#define ShiftReg_A_RET_FIFO_EMPTY 0u
+#define ShiftReg_B_RET_FIFO_EMPTY 0u
+#define ShiftReg_A_STORE_INT_EN 1u
+#define ShiftReg_B_STORE_INT_EN 1u
+V(ShiftReg_A_Start) V(ShiftReg_B_Start) V(ShiftReg_A_EnableInt) V(ShiftReg_B_EnableInt) void ShiftReg_A_SetIntMode(uint8); void ShiftReg_B_SetIntMode(uint8);
+U8(ShiftReg_A_GetIntStatus) U8(ShiftReg_B_GetIntStatus) uint8 ShiftReg_A_GetFIFOStatus(uint8); uint8 ShiftReg_B_GetFIFOStatus(uint8);
+uint32 ShiftReg_A_ReadData(void); uint32 ShiftReg_B_ReadData(void);
+U8(Status_Reg_M_Read) U8(Status_Reg_Trg_Read)
+V(Timer_1_Start) V(Timer_1_Stop)
+V(TrigWindow_V1_1_Count7_1_Start) V(TrigWindow_V1_2_Count7_1_Start) V(TrigWindow_V1_3_Count7_1_Start) V(TrigWindow_V1_4_Count7_1_Start) V(TrigWindow_V1_5_Count7_1_Start)
+void TrigWindow_V1_1_Count7_1_WritePeriod(uint8); void TrigWindow_V1_2_Count7_1_WritePeriod(uint8); void TrigWindow_V1_3_Count7_1_WritePeriod(uint8); void TrigWindow_V1_4_Count7_1_WritePeriod(uint8); void TrigWindow_V1_5_Count7_1_WritePeriod(uint8);
+V(UART_CMD_Start) U8(UART_CMD_GetRxBufferSize) U8(UART_CMD_ReadRxData) U8(UART_CMD_ReadRxStatus)
+#define UART_CMD_RX_STS_FIFO_NOTEMPTY 0x20u
+#define UART_TKR_RX_STS_FIFO_NOTEMPTY 0x20u
+#define UART_TKR_TX_STS_FIFO_FULL 0x04u
+#define UART_TKR_TX_STS_FIFO_EMPTY 0x02u
+V(UART_TKR_Start) U8(UART_TKR_ReadRxStatus) U8(UART_TKR_ReadRxData) U8(UART_TKR_ReadTxStatus) void UART_TKR_WriteTxData(uint8); void UART_TKR_PutChar(uint8); U8(UART_TKR_GetTxBufferSize)
+#define USBUART_3V_OPERATION 0
+void USBUART_Start(uint8,uint8); U8(USBUART_IsConfigurationChanged) U8(USBUART_GetConfiguration) U8(USBUART_CDC_Init) U8(USBUART_CDCIsReady) U8(USBUART_DataIsReady)
+uint16 USBUART_GetAll(uint8*); uint16 USBUART_GetCount(void); void USBUART_PutData(const uint8*, uint16);
+V(VDAC8_Ch1_Start) V(VDAC8_Ch2_Start) V(VDAC8_Ch3_Start) V(VDAC8_Ch4_Start) void VDAC8_Ch1_SetValue(uint8); void VDAC8_Ch2_SetValue(uint8); void VDAC8_Ch3_SetValue(uint8); void VDAC8_Ch4_SetValue(uint8);
+#define ISR(n) void n##_StartEx(void(*)(void)); V(n##_Enable) V(n##_Disable) U8(n##_GetState)
+ISR(isr_timer) ISR(isr_clk200) ISR(isr_Store_A) ISR(isr_Store_B) ISR(isr_Ch1) ISR(isr_Ch2) ISR(isr_Ch3) ISR(isr_Ch4) ISR(isr_Ch5) ISR(isr_GO1)
+typedef void (*cySysTickCallback)(void);
+V(CySysTickStart) V(CySysTickStop) V(CySysTickEnableInterrupt) V(CySysTickDisableInterrupt) void CySysTickSetReload(uint32); uint32 CySysTickGetValue(void);
+cySysTickCallback CySysTickSetCallback(uint32, cySysTickCallback); V(CySysTickClear)
+#define BCLK__BUS_CLK__MHZ 64u
+#endif
@@ -0,0 +1,141 @@
+// Host benchmark of the event PSOC Tracker readout. The firmware (DAQ.cydsn/main.c) is compiled in as is,
+// with its Tracker UART connected to the simulated Tracker stream of tkrSim.c, and the program
+//   - times the Tracker reply parser versus Tracker occupancy and checks every hit list it stores against what was sent;
+//   - injects faults into event frames and counts how many events it takes the readout to get back in step.
+// The timings measure the parsing code on the host CPU, not the PSoC, so use them to compare versions of
+// the firmware, not as absolute numbers.
+//
+// Usage: tkrBench [number of events per point, default 20000]
+#define main firmwareMain
+#include "../DAQ.cydsn/main.c"
+#undef main
+#include "tkrSim.h"
+
+#define EVENT_TICKS 2         // Time between events, in 5 ms ticks
+#define MAX_RECOVERY 20       // Give up waiting for the readout to recover after this many events
+
+void freeTkrHits() {
+    for (int brd=0; brd<MAX_TKR_BOARDS; ++brd) {
+        if (tkrData.boardHits[brd].nBytes > 0) {
+            tkrData.boardHits[brd].nBytes = 0;
+            free(tkrData.boardHits[brd].hitList);
+        }
+    }
+    tkrData.nTkrBoards = 0;
+}
+
+// Tracker part of the event builder: wait for the Tracker to be ready, then read the event.
+// Returns the time spent in taskTracker parsing the event itself.
+double readTkrEvent(int* rc) {
+    clkCnt += EVENT_TICKS;
+    taskTracker();                          // expires transactions that never got a reply
+    tkrSend(0x00, 0x57, 0, NULL, TKR_FOR_NONE);
+    taskTracker();
+    nTkrHouseKeeping = 0;
+    tkrReadEvent();
+    double t0 = tkrSimSeconds();
+    taskTracker();
+    double t = tkrSimSeconds() - t0;
+    for (uint32 i=0; i<=TKR_REPLY_TIMEOUT && evtTkrStep != EVT_TKR_DONE; ++i) {   // taskEventBuild waits for the data
+        clkCnt++;
+        taskTracker();
+    }
+    *rc = evtTkrStep == EVT_TKR_DONE && evtTkrOK ? 0 : 1;
+    evtTkrStep = EVT_TKR_IDLE;
+    return t;
+}
+
+// Compare what the firmware stored with what the simulator sent
+bool tkrEventMatches() {
+    const struct TkrSimEvent* evt = tkrSimLastEvent();
+    if (tkrData.nTkrBoards != evt->nBoards || tkrData.triggerCount != evt->triggerCount) return false;
+    for (int lyr=0; lyr<evt->nBoards; ++lyr) {
+        if (tkrData.boardHits[lyr].nBytes != evt->nBytes[lyr]) return false;
+        if (memcmp(tkrData.boardHits[lyr].hitList, evt->hitList[lyr], evt->nBytes[lyr]) != 0) return false;
+    }
+    return true;
+}
+
+void resetReadout() {
+    tkrSimFlush();
+    freeTkrHits();
+    memset(tkrTrans, 0, sizeof(tkrTrans));
+    memset(&tkrRx, 0, sizeof(tkrRx));
+    tkrTxRead = tkrTxWrite = 0;
+    nErrors = 0;
+}
+
+void benchOccupancy(int nEvents) {
+    static const uint8 points[][2] = { {0,0}, {1,1}, {2,2}, {4,2}, {6,4}, {12,4}, {12,10} };  // chips, clusters
+    printf("Tracker event parsing versus occupancy, 8 boards, %d events per point\n", nEvents);
+    printf("  chips clusters  bytes/event  us/event  ns/byte   bad events   errors\n");
+    for (size_t p=0; p<sizeof(points)/sizeof(points[0]); ++p) {
+        tkrSimConfigure(8, points[p][0], points[p][1]);
+        resetReadout();
+        double tSum = 0.;
+        long nBytes = 0;
+        int nBad = 0;
+        int nErr = 0;
+        for (int evt=0; evt<nEvents; ++evt) {
+            int rc;
+            tSum += readTkrEvent(&rc);
+            if (rc != 0 || !tkrEventMatches()) nBad++;
+            nErr += nErrors;
+            nErrors = 0;
+            nBytes += 6;
+            for (int lyr=0; lyr<tkrData.nTkrBoards; ++lyr) nBytes += 1 + tkrData.boardHits[lyr].nBytes;
+            freeTkrHits();
+        }
+        printf("  %5d %8d  %11.1f  %8.3f  %7.2f  %11d  %7d\n", points[p][0], points[p][1], (double)nBytes/nEvents,
+               1.e6*tSum/nEvents, 1.e9*tSum/nBytes, nBad, nErr);
+    }
+}
+
+// Inject each kind of fault into a moderately busy event, then read clean events until one comes through intact
+void benchResync(int nTrials) {
+    printf("Recovery after a damaged event frame, %d trials per fault\n", nTrials);
+    printf("  fault        recovered  mean events  max events  bytes left  errors/trial\n");
+    tkrSimConfigure(8, 4, 2);
+    for (int fault=TKR_FAULT_FLIP_BIT; fault<N_TKR_FAULTS; ++fault) {
+        int nRecovered = 0;
+        int nEventsSum = 0;
+        int nEventsMax = 0;
+        long nLeft = 0;
+        long nErr = 0;
+        for (int trial=0; trial<nTrials; ++trial) {
+            resetReadout();
+            tkrSimSetFault(fault);
+            int rc;
+            readTkrEvent(&rc);
+            nLeft += tkrSimPending();
+            nErr += nErrors;
+            nErrors = 0;
+            freeTkrHits();
+            for (int evt=1; evt<=MAX_RECOVERY; ++evt) {
+                readTkrEvent(&rc);
+                bool ok = rc == 0 && nErrors == 0 && tkrEventMatches();
+                nErr += nErrors;
+                nErrors = 0;
+                freeTkrHits();
+                if (ok) {
+                    nRecovered++;
+                    nEventsSum += evt;
+                    if (evt > nEventsMax) nEventsMax = evt;
+                    break;
+                }
+            }
+        }
+        printf("  %-11s  %5d/%-5d  %11.2f  %10d  %10.2f  %12.2f\n", tkrSimFaultName(fault), nRecovered, nTrials,
+               nRecovered > 0 ? (double)nEventsSum/nRecovered : 0., nEventsMax, (double)nLeft/nTrials,
+               (double)nErr/nTrials);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int nEvents = argc > 1 ? atoi(argv[1]) : 20000;
+    tkrSimInit(12345);
+    benchOccupancy(nEvents);
+    printf("\n");
+    benchResync(nEvents/20 > 0 ? nEvents/20 : 1);
+    return 0;
+}
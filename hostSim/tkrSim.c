@@ -0,0 +1,223 @@
+// Simulated Tracker FPGA stream. See tkrSim.h.
+#include "tkrSim.h"
+#include <string.h>
+#include <time.h>
+
+static uint8 simStream[TKR_SIM_STREAM_LEN];     // bytes on their way to the firmware
+static int simRead = 0;
+static int simWrite = 0;
+
+static uint8 simCmd[3+255];                     // command being received: FPGA, code, nData, data
+static int nSimCmd = 0;
+static uint16 simCmdCount = 0;
+static uint16 simTriggerCount = 0;
+
+static uint8 simBoards = 8;
+static uint8 simChips = 0;
+static uint8 simClusters = 0;
+static enum TkrSimFault simFault = TKR_FAULT_NONE;
+static struct TkrSimEvent simEvent;
+static struct TkrSimEvent simReplayEvent;
+static bool simReplaying = false;
+
+static uint32 simRandom = 1;
+static uint32 simRand(uint32 n) {               // xorshift, so that runs are repeatable
+    simRandom ^= simRandom << 13;
+    simRandom ^= simRandom >> 17;
+    simRandom ^= simRandom << 5;
+    return simRandom % n;
+}
+
+void tkrSimInit(uint32 seed) {
+    simRandom = seed ? seed : 1;
+    simRead = simWrite = 0;
+    nSimCmd = 0;
+    simCmdCount = 0;
+    simTriggerCount = 0;
+    simFault = TKR_FAULT_NONE;
+    simReplaying = false;
+    memset(&simEvent, 0, sizeof(simEvent));
+}
+
+void tkrSimConfigure(uint8 nBoards, uint8 nChips, uint8 nClusters) {
+    simBoards = nBoards > TKR_SIM_MAX_BOARDS ? TKR_SIM_MAX_BOARDS : nBoards;
+    simChips = nChips > TKR_SIM_MAX_CHIPS ? TKR_SIM_MAX_CHIPS : nChips;
+    simClusters = nClusters > TKR_SIM_MAX_CLUSTERS ? TKR_SIM_MAX_CLUSTERS : nClusters;
+}
+
+void tkrSimSetFault(enum TkrSimFault fault) {
+    simFault = fault;
+}
+
+void tkrSimReplay(const struct TkrSimEvent* evt) {
+    simReplayEvent = *evt;
+    if (simReplayEvent.nBoards > TKR_SIM_MAX_BOARDS) simReplayEvent.nBoards = TKR_SIM_MAX_BOARDS;
+    simReplaying = true;
+}
+
+const struct TkrSimEvent* tkrSimLastEvent(void) {
+    return &simEvent;
+}
+
+const char* tkrSimFaultName(enum TkrSimFault fault) {
+    static const char* names[N_TKR_FAULTS] = { "none", "flip bit", "drop byte", "extra byte", "truncate" };
+    return fault < N_TKR_FAULTS ? names[fault] : "?";
+}
+
+int tkrSimPending(void) {
+    return (simWrite - simRead + TKR_SIM_STREAM_LEN) % TKR_SIM_STREAM_LEN;
+}
+
+void tkrSimFlush(void) {
+    simRead = simWrite;
+    nSimCmd = 0;
+}
+
+bool tkrSimRxReady(void) {
+    return simRead != simWrite;
+}
+
+uint8 tkrSimRxByte(void) {
+    if (simRead == simWrite) return 0;
+    uint8 data = simStream[simRead];
+    simRead = (simRead + 1) % TKR_SIM_STREAM_LEN;
+    return data;
+}
+
+static void simPut(const uint8* data, int n) {
+    for (int i=0; i<n; ++i) {
+        simStream[simWrite] = data[i];
+        simWrite = (simWrite + 1) % TKR_SIM_STREAM_LEN;
+    }
+}
+
+uint8 tkrSimCRC6(const uint8* bits, int nBits) {
+    uint8 rem = 1;            // the FPGA includes the start bit, which is not in the hit list
+    for (int i=0; i<nBits; ++i) {
+        rem = (rem << 1) | ((bits[i >> 3] >> (7 - (i & 7))) & 1);
+        if (rem & 0x40) rem ^= 0x65;     // key 1100101
+    }
+    return rem;
+}
+
+static void putBits(uint8* buf, int* nBits, uint32 value, int n) {
+    for (int i=n-1; i>=0; --i) {
+        if ((value >> i) & 1) buf[*nBits >> 3] |= 0x80 >> (*nBits & 7);
+        (*nBits)++;
+    }
+}
+
+// Make the ASIC hit list of one board, with simChips chips of simClusters clusters each, and return its length
+static int mkHitList(uint8* buf, uint8 layer) {
+    memset(buf, 0, TKR_SIM_MAX_BOARD_BYTES);
+    int nBits = 0;
+    uint8 fpga = layer == 0 ? 8 : layer;     // the master board reports address 8
+    putBits(buf, &nBits, 0xE7, 8);
+    putBits(buf, &nBits, 0, 1);
+    putBits(buf, &nBits, fpga, 7);
+    putBits(buf, &nBits, simTriggerCount & 0x7F, 7);    // event tag
+    putBits(buf, &nBits, 0, 1);                         // error flag
+    putBits(buf, &nBits, simChips, 4);
+    uint16 used = 0;
+    for (int chip=0; chip<simChips; ++chip) {
+        uint8 address;
+        do {
+            address = simRand(TKR_SIM_MAX_CHIPS);
+        } while (used & (1 << address));
+        used |= 1 << address;
+        putBits(buf, &nBits, 0, 2);                     // overflow and spare bits
+        putBits(buf, &nBits, simClusters, 4);
+        putBits(buf, &nBits, 0, 2);                     // error and parity bits
+        putBits(buf, &nBits, address, 4);
+        for (int clust=0; clust<simClusters; ++clust) {
+            putBits(buf, &nBits, simRand(4), 6);        // width - 1
+            putBits(buf, &nBits, simRand(64), 6);       // first strip
+        }
+    }
+    putBits(buf, &nBits, tkrSimCRC6(buf, nBits), 6);
+    putBits(buf, &nBits, 3, 2);
+    return (nBits + 7)/8;
+}
+
+// Damage a frame according to the fault requested, and return its new length
+static int applyFault(uint8* frame, int n) {
+    int where = simRand(n);
+    switch (simFault) {
+        case TKR_FAULT_FLIP_BIT:
+            frame[where] ^= 1 << simRand(8);
+            break;
+        case TKR_FAULT_DROP_BYTE:
+            memmove(frame + where, frame + where + 1, n - where - 1);
+            n--;
+            break;
+        case TKR_FAULT_EXTRA_BYTE:
+            memmove(frame + where + 1, frame + where, n - where);
+            frame[where] = simRand(256);
+            n++;
+            break;
+        case TKR_FAULT_TRUNCATE:
+            n = where;
+            break;
+        default:
+            break;
+    }
+    simFault = TKR_FAULT_NONE;
+    return n;
+}
+
+static void sendEvent() {
+    uint8 frame[6 + TKR_SIM_MAX_BOARDS*(1 + TKR_SIM_MAX_BOARD_BYTES) + 1];
+    simTriggerCount++;
+    if (simReplaying) {
+        simEvent = simReplayEvent;
+        simReplaying = false;
+    } else {
+        simEvent.nBoards = simBoards;
+        for (int lyr=0; lyr<simBoards; ++lyr) simEvent.nBytes[lyr] = mkHitList(simEvent.hitList[lyr], lyr);
+    }
+    simEvent.triggerCount = simTriggerCount;
+    int n = 0;
+    frame[n++] = 5;
+    frame[n++] = 0xD3;
+    frame[n++] = simTriggerCount >> 8;
+    frame[n++] = simTriggerCount & 0xFF;
+    frame[n++] = simCmdCount & 0xFF;
+    frame[n++] = 0xC0 | simEvent.nBoards;     // both trigger bits set
+    for (int lyr=0; lyr<simEvent.nBoards; ++lyr) {
+        frame[n++] = simEvent.nBytes[lyr];
+        memcpy(frame + n, simEvent.hitList[lyr], simEvent.nBytes[lyr]);
+        n += simEvent.nBytes[lyr];
+    }
+    n = applyFault(frame, n);
+    simPut(frame, n);
+}
+
+// Respond to a complete command
+static void simExecute() {
+    uint8 fpga = simCmd[0];
+    uint8 code = simCmd[1];
+    simCmdCount++;
+    if (code == 0x01) {
+        sendEvent();
+    } else if (code == 0x57) {
+        uint8 frame[] = { 8, 0xC7, 2, simCmdCount >> 8, simCmdCount & 0xFF, fpga, code, 0x59, 0x0F };
+        simPut(frame, sizeof(frame));
+    } else if (code != 0x67 && code != 0x6C) {
+        uint8 frame[] = { 4, 0xF1, simCmdCount >> 8, simCmdCount & 0xFF, code };
+        simPut(frame, sizeof(frame));
+    }
+}
+
+void tkrSimTxByte(uint8 data) {
+    simCmd[nSimCmd++] = data;
+    if (nSimCmd >= 3 && nSimCmd == 3 + simCmd[2]) {
+        simExecute();
+        nSimCmd = 0;
+    }
+}
+
+double tkrSimSeconds(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + 1.e-9*t.tv_nsec;
+}
@@ -0,0 +1,56 @@
+// Simulated Tracker FPGA stream, for running the event PSOC Tracker readout (tkrRxByte in main.c) on a PC.
+// The simulator receives the command bytes that the firmware writes to the Tracker UART and answers the way
+// the master Tracker FPGA does:
+//   0x01 read event     event frame {5, 0xD3, trigger count (2), command count, nBoards}, then for each board
+//                       {nBytes, ASIC hit list}, the hit lists made up to the occupancy set by tkrSimConfigure
+//   0x57 status         housekeeping frame {8, 0xC7, 2, command count (2), FPGA, 0x57, 0x59, 0x0F}
+//   0x67, 0x6C          no reply
+//   anything else       command echo {4, 0xF1, command count (2), command code}
+// Recorded hit lists can be replayed instead, for example from a run file.
+// A fault can be injected into the next event frame, to see how the firmware gets back in step afterwards.
+#ifndef TKRSIM_H
+#define TKRSIM_H
+#include "project.h"
+#include <stdbool.h>
+
+#define TKR_SIM_MAX_BOARDS 8
+#define TKR_SIM_MAX_CHIPS 12
+#define TKR_SIM_MAX_CLUSTERS 10        // The ASICs report at most 10 clusters
+#define TKR_SIM_MAX_BOARD_BYTES 203    // Hit list length with 12 chips of 10 clusters each
+#define TKR_SIM_STREAM_LEN 4096
+
+enum TkrSimFault {
+    TKR_FAULT_NONE,
+    TKR_FAULT_FLIP_BIT,      // flip one bit somewhere in the frame
+    TKR_FAULT_DROP_BYTE,     // lose one byte
+    TKR_FAULT_EXTRA_BYTE,    // insert one garbage byte
+    TKR_FAULT_TRUNCATE,      // the frame stops part way through
+    N_TKR_FAULTS
+};
+
+// The event most recently sent, for checking what the firmware stored
+struct TkrSimEvent {
+    uint16 triggerCount;
+    uint8 nBoards;
+    uint8 nBytes[TKR_SIM_MAX_BOARDS];      // indexed by layer
+    uint8 hitList[TKR_SIM_MAX_BOARDS][TKR_SIM_MAX_BOARD_BYTES];
+};
+
+void tkrSimInit(uint32 seed);
+void tkrSimConfigure(uint8 nBoards, uint8 nChips, uint8 nClusters);    // hit chips per board, clusters per chip
+void tkrSimSetFault(enum TkrSimFault fault);                             // applied to the next event frame only
+void tkrSimReplay(const struct TkrSimEvent* evt);    // the next event frame carries these hit lists, not made-up ones
+const struct TkrSimEvent* tkrSimLastEvent(void);
+const char* tkrSimFaultName(enum TkrSimFault fault);
+int tkrSimPending(void);        // bytes waiting to be read by the firmware
+void tkrSimFlush(void);
+
+// Tracker UART side, called from the UART_TKR stubs in cyStubs.c
+bool tkrSimRxReady(void);
+uint8 tkrSimRxByte(void);
+void tkrSimTxByte(uint8 data);
+
+uint8 tkrSimCRC6(const uint8* bits, int nBits);     // same as CRC6('1' + bits) in PSOC_cmd.py
+double tkrSimSeconds(void);                         // wall clock, since main.c's time() hides <time.h>
+
+#endif
@@ -0,0 +1,7 @@
+# Build of the optional compiled decoders used by the host library (see _psocdecode.c):
+#   python3 setup.py build_ext --inplace
+from setuptools import setup, Extension
+
+setup(name="psocdecode",
+      version="1.0",
+      ext_modules=[Extension("_psocdecode", ["_psocdecode.c"], extra_compile_args=["-O2"])])